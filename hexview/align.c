@@ -0,0 +1,1023 @@
+#include "align.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "hash.h"
+#include "thread.h"
+
+#define SEGMENT_SIZE (16 << 20)  // bytes chunked by one thread at a time
+#define MIN_MATCH_JOB 4096       // fewest chunks worth giving their own thread
+#define NO_MATCH 0xffffffffu
+
+// A chunk of one of the files
+struct chunk_rec
+{
+	uint64 hash;
+	unsigned int off;
+	unsigned int len;
+};
+
+struct chunk_list
+{
+	struct chunk_rec *chunks;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+// A range of a file chunked and hashed by a single thread
+struct segment_job
+{
+	const chunk_params_t *params;
+	const byte *data;
+	unsigned int start;
+	unsigned int end;
+	struct chunk_list list;
+	int failed;
+};
+
+struct chunk_slot
+{
+	uint64 hash;
+	unsigned int first;  // where the chunks of the second file with the hash start in the order
+	unsigned int count;  // chunks with the hash, 0 if empty
+};
+
+// A range of the chunks of the first file looked up by a single thread
+struct match_job
+{
+	const byte *a;
+	const byte *b;
+	const struct chunk_list *achunks;
+	const struct chunk_list *bchunks;
+	const struct chunk_slot *table;
+	const unsigned int *order;  // chunks of the second file by hash, those with a hash by increasing offset
+	unsigned int mask;
+	unsigned int start;
+	unsigned int end;
+	unsigned int *match;  // chunk of the second file matching each of the first, or NO_MATCH
+};
+
+// Chunks in a row of the first file matching chunks in a row of the second
+struct run
+{
+	unsigned int aoff;
+	unsigned int aend;
+	unsigned int boff;
+	unsigned int bend;
+	unsigned int afirst;  // first and last chunks in each file
+	unsigned int alast;
+	unsigned int bfirst;
+	unsigned int blast;
+	uint64 weight;        // bytes of the heaviest series of runs in order ending with this one
+	unsigned int prev;    // index + 1 of the run before this one in that series, 0 if none
+	int aligned;          // in the series lining up the files, else moved
+	int dropped;          // moved over bytes of the second file another run is over, so deleted
+};
+
+// Where a moved run is in the second file
+struct span
+{
+	unsigned int start;
+	unsigned int end;
+	unsigned int run;
+};
+
+struct align_state
+{
+	const byte *a;
+	const byte *b;
+	unsigned int asize;
+	unsigned int bsize;
+	unsigned int gap;
+	struct chunk_list achunks;
+	struct chunk_list bchunks;
+
+	struct run *runs;
+	unsigned int nruns;
+	struct span *moved;  // by increasing start
+	unsigned int nmoved;
+
+	diff_range_t *ranges;
+	unsigned int count;
+	unsigned int capacity;
+	uint64 differ;
+	int failed;
+};
+
+static int chunk_file(const chunk_params_t *params, const byte *data, unsigned int size, struct segment_job *jobs, int njobs, struct chunk_list *const out);
+static void segment_proc(void *arg);
+static int add_chunks(struct chunk_list *list, const struct chunk_rec *chunks, unsigned int count);
+static unsigned int *match_chunks(struct align_state *st);
+static unsigned int find_slot(const struct chunk_slot *table, unsigned int mask, uint64 hash);
+static void match_proc(void *arg);
+static int out_of_line(const struct match_job *job, const struct chunk_rec *chunk, unsigned int other, int64 expected);
+static int in_line_copy(const struct match_job *job, const struct chunk_rec *chunk, unsigned int other, int64 shift);
+static int same_chunk(const byte *a, const struct chunk_rec *x, const byte *b, const struct chunk_rec *y);
+static int find_runs(struct align_state *st, const unsigned int *match);
+static int chain_runs(struct align_state *st);
+static void rebase_runs(struct align_state *st);
+static void extend_runs(struct align_state *st);
+static int collect_moved(struct align_state *st);
+static void emit_gap(struct align_state *st, unsigned int astart, unsigned int aend, unsigned int bstart, unsigned int bend, unsigned int first, unsigned int last);
+static unsigned int other_pieces(struct align_state *st, unsigned int bstart, unsigned int bend, int insert, unsigned int at, unsigned int *const off, unsigned int *const len);
+static void refine(struct align_state *st, unsigned int aoff, unsigned int alen, unsigned int boff, unsigned int blen);
+static void add_range(struct align_state *st, int kind, unsigned int offset, unsigned int size, unsigned int other, unsigned int other_size, unsigned int differ);
+static int compare_spans(const void *first, const void *second);
+
+
+diff_t *
+align_compare(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int gap)
+{
+	struct align_state st;
+	struct segment_job *jobs;
+	chunk_params_t params;
+	diff_t *diff;
+	const struct run *run;
+	unsigned int *match;
+	unsigned int avg, larger, apos, bpos, first, i;
+	int64 grown;
+	int njobs, failed;
+
+	// larger files are cut in larger chunks, so as many are kept
+	larger = asize > bsize ? asize : bsize;
+	for (avg = ALIGN_CHUNK; larger / avg > ALIGN_MAX_CHUNKS; avg <<= 1);
+	chunk_params_init(&params, avg);
+
+	memset(&st, 0, sizeof(st));
+	st.a = a;
+	st.b = b;
+	st.asize = asize;
+	st.bsize = bsize;
+	st.gap = gap;
+
+	njobs = cpu_count();
+	jobs = calloc(njobs, sizeof(struct segment_job));
+	failed = !jobs || !chunk_file(&params, a, asize, jobs, njobs, &st.achunks) ||
+		!chunk_file(&params, b, bsize, jobs, njobs, &st.bchunks);
+	if (jobs)
+	{
+		for (i = 0; i < (unsigned int)njobs; i++)
+			free(jobs[i].list.chunks);
+		free(jobs);
+	}
+
+	if (!failed)
+	{
+		match = match_chunks(&st);
+		failed = !match || !find_runs(&st, match) || !chain_runs(&st);
+		free(match);
+	}
+	free(st.achunks.chunks);
+	free(st.bchunks.chunks);
+
+	if (!failed)
+	{
+		rebase_runs(&st);
+		extend_runs(&st);
+		failed = !collect_moved(&st);
+	}
+
+	// the gaps before, between and after the aligned runs
+	if (!failed)
+	{
+		apos = 0;
+		bpos = 0;
+		first = 0;
+		for (i = 0; i < st.nruns; i++)
+		{
+			run = &st.runs[i];
+			if (!run->aligned)
+				continue;
+
+			emit_gap(&st, apos, run->aoff, bpos, run->boff, first, i);
+			apos = run->aend;
+			bpos = run->bend;
+			first = i + 1;
+		}
+		emit_gap(&st, apos, asize, bpos, bsize, first, st.nruns);
+		failed = st.failed;
+	}
+	free(st.runs);
+	free(st.moved);
+
+	diff = failed ? NULL : malloc(sizeof(diff_t));
+	if (!diff)
+	{
+		free(st.ranges);
+		return NULL;
+	}
+
+	// every byte of each file is in a single range, moved ones as many
+	// bytes in both, so the ranges change the size as much as it differs
+	grown = 0;
+	for (i = 0; i < st.count; i++)
+		grown += (int64)st.ranges[i].other_size - st.ranges[i].size;
+	assert(grown == (int64)bsize - asize);
+
+	diff->ranges = st.ranges;
+	diff->count = st.count;
+	diff->asize = asize;
+	diff->bsize = bsize;
+	diff->gap = gap;
+	diff->differ = st.differ;
+	diff->chunk = params.avg;
+	return diff;
+}
+
+// Chunk and hash a file, one window of segments at a time so the
+// chunks of a segment are only kept until they are added to out.
+// Returns 0 if memory could not be allocated.
+static int
+chunk_file(const chunk_params_t *params, const byte *data, unsigned int size, struct segment_job *jobs, int njobs, struct chunk_list *const out)
+{
+	unsigned int pos;
+	int n, i;
+
+	for (pos = 0; pos < size;)
+	{
+		for (n = 0; n < njobs && pos < size; n++)
+		{
+			jobs[n].params = params;
+			jobs[n].data = data;
+			jobs[n].start = pos;
+			jobs[n].end = size - pos > SEGMENT_SIZE ? pos + SEGMENT_SIZE : size;
+			jobs[n].list.count = 0;
+			pos = jobs[n].end;
+		}
+
+		run_parallel(&segment_proc, jobs, n, sizeof(struct segment_job));
+
+		for (i = 0; i < n; i++)
+		{
+			if (jobs[i].failed || !add_chunks(out, jobs[i].list.chunks, jobs[i].list.count))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void
+segment_proc(void *arg)
+{
+	struct segment_job *job;
+	struct chunk_rec chunk;
+	unsigned int pos;
+
+	job = arg;
+	for (pos = job->start; pos < job->end; pos += chunk.len)
+	{
+		chunk.len = chunk_next(job->params, job->data + pos, job->end - pos);
+		chunk.off = pos;
+		chunk.hash = xxh3_64(job->data + pos, chunk.len);
+		if (!add_chunks(&job->list, &chunk, 1))
+		{
+			job->failed = 1;
+			return;
+		}
+	}
+}
+
+// Add chunks after the others. Returns 0 if memory could not be
+// allocated.
+static int
+add_chunks(struct chunk_list *list, const struct chunk_rec *chunks, unsigned int count)
+{
+	struct chunk_rec *grown;
+	unsigned int capacity;
+
+	if (count > list->capacity - list->count)
+	{
+		for (capacity = list->capacity ? list->capacity : 1024; capacity - list->count < count; capacity *= 2);
+		grown = realloc(list->chunks, (size_t)capacity * sizeof(struct chunk_rec));
+		if (!grown)
+			return 0;
+		list->chunks = grown;
+		list->capacity = capacity;
+	}
+
+	memcpy(list->chunks + list->count, chunks, (size_t)count * sizeof(struct chunk_rec));
+	list->count += count;
+	return 1;
+}
+
+// Find the chunk of the second file matching each chunk of the first.
+// Returns NULL if memory could not be allocated.
+static unsigned int *
+match_chunks(struct align_state *st)
+{
+	struct chunk_slot *table;
+	struct match_job *jobs;
+	unsigned int *match, *order;
+	unsigned int capacity, slot, pos, per, i;
+	int njobs, n;
+
+	match = malloc(((size_t)st->achunks.count + 1) * sizeof(unsigned int));
+	order = malloc(((size_t)st->bchunks.count + 1) * sizeof(unsigned int));
+	for (capacity = 16; capacity < st->bchunks.count * 2; capacity *= 2);
+	table = calloc(capacity, sizeof(struct chunk_slot));
+	if (!match || !order || !table)
+	{
+		free(match);
+		free(order);
+		free(table);
+		return NULL;
+	}
+
+	// the chunks with each hash together by increasing offset, so the one
+	// nearest an offset is found by binary search however many repeat
+	for (i = 0; i < st->bchunks.count; i++)
+	{
+		slot = find_slot(table, capacity - 1, st->bchunks.chunks[i].hash);
+		table[slot].hash = st->bchunks.chunks[i].hash;
+		table[slot].count++;
+	}
+	for (slot = 0, pos = 0; slot < capacity; slot++)
+	{
+		pos += table[slot].count;
+		table[slot].first = pos;
+	}
+	for (i = st->bchunks.count; i > 0; i--)
+	{
+		slot = find_slot(table, capacity - 1, st->bchunks.chunks[i - 1].hash);
+		order[--table[slot].first] = i - 1;
+	}
+
+	njobs = cpu_count();
+	if ((uint64)njobs * MIN_MATCH_JOB > st->achunks.count)
+		njobs = (st->achunks.count + MIN_MATCH_JOB - 1) / MIN_MATCH_JOB;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = calloc(njobs, sizeof(struct match_job));
+	if (!jobs)
+	{
+		free(match);
+		free(order);
+		free(table);
+		return NULL;
+	}
+
+	per = (st->achunks.count + njobs - 1) / njobs;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].a = st->a;
+		jobs[n].b = st->b;
+		jobs[n].achunks = &st->achunks;
+		jobs[n].bchunks = &st->bchunks;
+		jobs[n].table = table;
+		jobs[n].order = order;
+		jobs[n].mask = capacity - 1;
+		jobs[n].start = (uint64)n * per < st->achunks.count ? n * per : st->achunks.count;
+		jobs[n].end = st->achunks.count - jobs[n].start > per ? jobs[n].start + per : st->achunks.count;
+		jobs[n].match = match;
+	}
+
+	run_parallel(&match_proc, jobs, njobs, sizeof(struct match_job));
+
+	free(jobs);
+	free(order);
+	free(table);
+	return match;
+}
+
+// Find the slot of a hash, or the empty slot where it goes
+static unsigned int
+find_slot(const struct chunk_slot *table, unsigned int mask, uint64 hash)
+{
+	unsigned int slot;
+
+	for (slot = (unsigned int)hash & mask; table[slot].count; slot = (slot + 1) & mask)
+	{
+		if (table[slot].hash == hash)
+			break;
+	}
+
+	return slot;
+}
+
+static void
+match_proc(void *arg)
+{
+	struct match_job *job;
+	const struct chunk_rec *chunk;
+	const unsigned int *order;
+	int64 shift, expected;
+	unsigned int i, j, best, slot, lo, hi, mid;
+
+	job = arg;
+	shift = 0;
+	for (i = job->start; i < job->end; i++)
+	{
+		chunk = &job->achunks->chunks[i];
+
+		// the chunk after the one the previous chunk matched keeps a run
+		// together where chunks repeat
+		j = i > job->start ? job->match[i - 1] : NO_MATCH;
+		if (j != NO_MATCH && j + 1 < job->bchunks->count && same_chunk(job->a, chunk, job->b, &job->bchunks->chunks[j + 1]))
+		{
+			job->match[i] = j + 1;
+			continue;
+		}
+
+		job->match[i] = NO_MATCH;
+		slot = find_slot(job->table, job->mask, chunk->hash);
+		if (!job->table[slot].count)
+			continue;
+
+		// of the chunks with the hash, the nearest to where the last match
+		// puts the chunk, so repeated content such as padding stays in line
+		expected = (int64)chunk->off + shift;
+		order = job->order + job->table[slot].first;
+		lo = 0;
+		hi = job->table[slot].count;
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			if ((int64)job->bchunks->chunks[order[mid]].off < expected)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == job->table[slot].count ||
+			(lo && expected - job->bchunks->chunks[order[lo - 1]].off <= (int64)job->bchunks->chunks[order[lo]].off - expected))
+			lo--;
+		best = order[lo];
+
+		// out of line, the first of copies of a chunk in a row, as in
+		// padding, goes to the first of the copies in a row it is nearest
+		// so the others follow it in line
+		if (out_of_line(job, chunk, best, expected) && (i == 0 || job->achunks->chunks[i - 1].hash != chunk->hash))
+		{
+			hi = lo;
+			lo = 0;
+			while (lo < hi)
+			{
+				mid = lo + (hi - lo) / 2;
+				if (order[mid] - mid < best - hi)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			best = order[lo];
+		}
+
+		// a copy out of line which a copy of the chunk lines up with is
+		// left to it, else a change among copies would line the wrong
+		// copies up
+		if (out_of_line(job, chunk, best, expected) && in_line_copy(job, chunk, best, expected - chunk->off))
+			continue;
+
+		// confirm the bytes so a hash collision is never matched
+		if (same_chunk(job->a, chunk, job->b, &job->bchunks->chunks[best]))
+		{
+			job->match[i] = best;
+			shift = (int64)job->bchunks->chunks[best].off - chunk->off;
+		}
+	}
+}
+
+// Returns nonzero if a chunk of the second file is a chunk or more away
+// from where a chunk of the first is expected
+static int
+out_of_line(const struct match_job *job, const struct chunk_rec *chunk, unsigned int other, int64 expected)
+{
+	int64 distance;
+
+	distance = (int64)job->bchunks->chunks[other].off - expected;
+	return distance >= chunk->len || -distance >= chunk->len;
+}
+
+// Returns nonzero if a chunk of the second file lines up at a shift with
+// a chunk of the first with the same hash as another
+static int
+in_line_copy(const struct match_job *job, const struct chunk_rec *chunk, unsigned int other, int64 shift)
+{
+	const struct chunk_list *achunks;
+	int64 pos;
+	unsigned int lo, hi, mid;
+
+	achunks = job->achunks;
+	pos = (int64)job->bchunks->chunks[other].off - shift;
+	if (pos < 0 || pos >= (int64)achunks->chunks[achunks->count - 1].off + achunks->chunks[achunks->count - 1].len)
+		return 0;
+
+	// the last chunk starting at or before the offset
+	lo = 0;
+	hi = achunks->count;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (achunks->chunks[mid].off <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &achunks->chunks[lo] != chunk && achunks->chunks[lo].hash == chunk->hash;
+}
+
+static int
+same_chunk(const byte *a, const struct chunk_rec *x, const byte *b, const struct chunk_rec *y)
+{
+	return x->hash == y->hash && x->len == y->len && !memcmp(a + x->off, b + y->off, x->len);
+}
+
+// Join matching chunks which follow each other in both files into runs.
+// Returns 0 if memory could not be allocated.
+static int
+find_runs(struct align_state *st, const unsigned int *match)
+{
+	struct run *runs, *run;
+	const struct chunk_rec *achunk, *bchunk;
+	unsigned int capacity, i;
+
+	capacity = 0;
+	for (i = 0; i < st->achunks.count; i++)
+	{
+		if (match[i] == NO_MATCH)
+			continue;
+
+		achunk = &st->achunks.chunks[i];
+		bchunk = &st->bchunks.chunks[match[i]];
+		run = st->nruns ? &st->runs[st->nruns - 1] : NULL;
+		if (run && run->alast + 1 == i && run->blast + 1 == match[i])
+		{
+			run->alast = i;
+			run->blast = match[i];
+			run->aend = achunk->off + achunk->len;
+			run->bend = bchunk->off + bchunk->len;
+			continue;
+		}
+
+		if (st->nruns == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 256;
+			runs = realloc(st->runs, (size_t)capacity * sizeof(struct run));
+			if (!runs)
+				return 0;
+			st->runs = runs;
+		}
+
+		run = &st->runs[st->nruns++];
+		run->aoff = achunk->off;
+		run->aend = achunk->off + achunk->len;
+		run->boff = bchunk->off;
+		run->bend = bchunk->off + bchunk->len;
+		run->afirst = run->alast = i;
+		run->bfirst = run->blast = match[i];
+		run->weight = 0;
+		run->prev = 0;
+		run->aligned = 0;
+		run->dropped = 0;
+	}
+
+	return 1;
+}
+
+// Mark the runs of the heaviest series in order in both files as
+// aligned, the heaviest increasing subsequence found with a Fenwick
+// tree of the best series ending by each chunk of the second file.
+// Returns 0 if memory could not be allocated.
+static int
+chain_runs(struct align_state *st)
+{
+	struct run *run;
+	uint64 *best;
+	unsigned int *best_run;
+	unsigned int count, i, k, from;
+	uint64 weight;
+
+	count = st->bchunks.count;
+	best = calloc((size_t)count + 1, sizeof(uint64));
+	best_run = calloc((size_t)count + 1, sizeof(unsigned int));
+	if (!best || !best_run)
+	{
+		free(best);
+		free(best_run);
+		return 0;
+	}
+
+	for (i = 0; i < st->nruns; i++)
+	{
+		run = &st->runs[i];
+
+		// the best series of runs ending before the run in both files
+		weight = 0;
+		from = 0;
+		for (k = run->bfirst; k > 0; k -= k & (0 - k))
+		{
+			if (best[k] > weight)
+			{
+				weight = best[k];
+				from = best_run[k];
+			}
+		}
+
+		run->weight = weight + (run->aend - run->aoff);
+		run->prev = from;
+		for (k = run->blast + 1; k <= count; k += k & (0 - k))
+		{
+			if (run->weight > best[k])
+			{
+				best[k] = run->weight;
+				best_run[k] = i + 1;
+			}
+		}
+	}
+
+	// the heaviest series ends with the heaviest run
+	weight = 0;
+	from = 0;
+	for (i = 0; i < st->nruns; i++)
+	{
+		if (st->runs[i].weight > weight)
+		{
+			weight = st->runs[i].weight;
+			from = i + 1;
+		}
+	}
+	for (; from; from = st->runs[from - 1].prev)
+		st->runs[from - 1].aligned = 1;
+
+	free(best);
+	free(best_run);
+	return 1;
+}
+
+// Keep the files lined up where content repeats. Chunks of repeated
+// content are cut at positions set by the cut before them, so a change
+// next to such content can line it up at another shift. A run is moved
+// to the shift of the aligned run before it when its bytes are also
+// equal there, which aligns moved runs too. Runs then out of order in
+// the second file are moved instead.
+static void
+rebase_runs(struct align_state *st)
+{
+	struct run *run;
+	int64 shift, other;
+	unsigned int bprev, len, i;
+
+	shift = 0;
+	for (i = 0; i < st->nruns; i++)
+	{
+		run = &st->runs[i];
+		other = (int64)run->aoff + shift;
+		len = run->aend - run->aoff;
+		if (other != run->boff && other >= 0 && other + len <= st->bsize &&
+			!memcmp(st->a + run->aoff, st->b + other, len))
+		{
+			run->boff = (unsigned int)other;
+			run->bend = (unsigned int)other + len;
+			run->aligned = 1;
+		}
+
+		if (run->aligned)
+			shift = (int64)run->boff - run->aoff;
+	}
+
+	bprev = 0;
+	for (i = 0; i < st->nruns; i++)
+	{
+		run = &st->runs[i];
+		if (!run->aligned)
+			continue;
+		if (run->boff < bprev)
+			run->aligned = 0;
+		else
+			bprev = run->bend;
+	}
+}
+
+// Grow the runs over equal bytes on either side, as the chunks next to
+// a change hold equal bytes up to it. Aligned runs grow first, up to
+// the runs next to them in the first file and the aligned runs next to
+// them in the second, then moved runs up to the runs next to them.
+static void
+extend_runs(struct align_state *st)
+{
+	struct run *run;
+	unsigned int alimit, blimit, bprev, i, k;
+
+	bprev = 0;
+	for (i = 0; i < st->nruns; i++)
+	{
+		run = &st->runs[i];
+		if (!run->aligned)
+			continue;
+
+		alimit = i ? st->runs[i - 1].aend : 0;
+		for (; run->aoff > alimit && run->boff > bprev && st->a[run->aoff - 1] == st->b[run->boff - 1]; run->aoff--, run->boff--);
+
+		for (k = i + 1; k < st->nruns && !st->runs[k].aligned; k++);
+		alimit = i + 1 < st->nruns ? st->runs[i + 1].aoff : st->asize;
+		blimit = k < st->nruns ? st->runs[k].boff : st->bsize;
+		for (; run->aend < alimit && run->bend < blimit && st->a[run->aend] == st->b[run->bend]; run->aend++, run->bend++);
+		bprev = run->bend;
+	}
+
+	for (i = 0; i < st->nruns; i++)
+	{
+		run = &st->runs[i];
+		if (run->aligned)
+			continue;
+
+		alimit = i ? st->runs[i - 1].aend : 0;
+		for (; run->aoff > alimit && run->boff > 0 && st->a[run->aoff - 1] == st->b[run->boff - 1]; run->aoff--, run->boff--);
+
+		alimit = i + 1 < st->nruns ? st->runs[i + 1].aoff : st->asize;
+		for (; run->aend < alimit && run->bend < st->bsize && st->a[run->aend] == st->b[run->bend]; run->aend++, run->bend++);
+	}
+}
+
+// Collect where the moved runs are in the second file, dropping those
+// over bytes an aligned run or a moved run before them is over, so
+// every byte of each file is in a single range and the bytes inserted
+// less those deleted are what the size changed by. The bytes of the
+// runs dropped are deleted. Returns 0 if memory could not be allocated.
+static int
+collect_moved(struct align_state *st)
+{
+	struct span *aligned;
+	unsigned int naligned, end, lo, hi, mid, i, k;
+
+	st->nmoved = 0;
+	if (!st->nruns)
+		return 1;
+
+	st->moved = malloc((size_t)st->nruns * sizeof(struct span));
+	aligned = malloc((size_t)st->nruns * sizeof(struct span));
+	if (!st->moved || !aligned)
+	{
+		free(aligned);
+		return 0;
+	}
+
+	// the aligned runs are in order in the second file too
+	naligned = 0;
+	for (i = 0; i < st->nruns; i++)
+	{
+		if (!st->runs[i].aligned)
+			continue;
+		aligned[naligned].start = st->runs[i].boff;
+		aligned[naligned].end = st->runs[i].bend;
+		naligned++;
+	}
+
+	for (i = 0; i < st->nruns; i++)
+	{
+		if (st->runs[i].aligned)
+			continue;
+
+		// the first aligned run ending after the moved run starts
+		lo = 0;
+		hi = naligned;
+		while (lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			if (aligned[mid].end <= st->runs[i].boff)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < naligned && aligned[lo].start < st->runs[i].bend)
+		{
+			st->runs[i].dropped = 1;
+			continue;
+		}
+
+		st->moved[st->nmoved].start = st->runs[i].boff;
+		st->moved[st->nmoved].end = st->runs[i].bend;
+		st->moved[st->nmoved].run = i;
+		st->nmoved++;
+	}
+	free(aligned);
+	qsort(st->moved, st->nmoved, sizeof(struct span), &compare_spans);
+
+	// of moved runs over the same bytes the first in the second file is kept
+	for (i = 0, k = 0, end = 0; i < st->nmoved; i++)
+	{
+		if (k && st->moved[i].start < end)
+		{
+			st->runs[st->moved[i].run].dropped = 1;
+			continue;
+		}
+		st->moved[k++] = st->moved[i];
+		end = st->moved[i].end;
+	}
+	st->nmoved = k;
+
+	// the runs are numbered again without those dropped
+	for (i = 0, k = 0; i < st->nruns; i++)
+	{
+		if (!st->runs[i].dropped)
+			st->runs[k++] = st->runs[i];
+	}
+	st->nruns = k;
+
+	return 1;
+}
+
+// Add the ranges of the bytes between two aligned runs, the moved runs
+// first to last between them in the first file. When what is left of
+// the gap is at most one piece in each file the two are refined,
+// otherwise the pieces are deleted and inserted.
+static void
+emit_gap(struct align_state *st, unsigned int astart, unsigned int aend, unsigned int bstart, unsigned int bend, unsigned int first, unsigned int last)
+{
+	const struct run *run;
+	unsigned int at, apieces, bpieces, boff, blen, k;
+	int pair;
+
+	apieces = 0;
+	at = astart;
+	for (k = first; k < last; k++)
+	{
+		if (st->runs[k].aoff > at)
+			apieces++;
+		at = st->runs[k].aend;
+	}
+	if (aend > at)
+		apieces++;
+
+	bpieces = other_pieces(st, bstart, bend, 0, 0, &boff, &blen);
+	pair = apieces <= 1 && bpieces <= 1;
+	if (!bpieces)
+	{
+		boff = bstart;
+		blen = 0;
+	}
+
+	// ranges go by offset in the first file, inserted ones at the end
+	at = astart;
+	for (k = first; k < last; k++)
+	{
+		run = &st->runs[k];
+		if (run->aoff > at)
+		{
+			if (pair)
+				refine(st, at, run->aoff - at, boff, blen);
+			else
+				add_range(st, DiffDeleted, at, run->aoff - at, bstart, 0, run->aoff - at);
+		}
+		add_range(st, DiffMoved, run->aoff, run->aend - run->aoff, run->boff, run->bend - run->boff, run->aend - run->aoff);
+		at = run->aend;
+	}
+
+	if (pair && (aend > at || !apieces))
+		refine(st, at, aend - at, boff, blen);
+	else if (aend > at)
+		add_range(st, DiffDeleted, at, aend - at, bstart, 0, aend - at);
+
+	if (!pair)
+		other_pieces(st, bstart, bend, 1, aend, &boff, &blen);
+}
+
+// Count the pieces of a range of the second file not where moved runs
+// are, and when insert is set add each as inserted at an offset of the
+// first file. Returns the number of pieces, the last of them in off
+// and len.
+static unsigned int
+other_pieces(struct align_state *st, unsigned int bstart, unsigned int bend, int insert, unsigned int at, unsigned int *const off, unsigned int *const len)
+{
+	unsigned int pos, count, lo, hi, mid, end;
+
+	// the first moved run starting in the range
+	lo = 0;
+	hi = st->nmoved;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (st->moved[mid].start < bstart)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	count = 0;
+	for (pos = bstart; pos < bend; lo++)
+	{
+		end = lo < st->nmoved && st->moved[lo].start < bend ? st->moved[lo].start : bend;
+		if (end > pos)
+		{
+			count++;
+			*off = pos;
+			*len = end - pos;
+			if (insert)
+				add_range(st, DiffInserted, at, 0, pos, end - pos, end - pos);
+		}
+
+		if (lo >= st->nmoved || st->moved[lo].start >= bend)
+			break;
+		if (st->moved[lo].end > pos)
+			pos = st->moved[lo].end;
+	}
+
+	return count;
+}
+
+// Add the ranges of a piece of the first file changed into a piece of
+// the second, without the bytes equal at both ends
+static void
+refine(struct align_state *st, unsigned int aoff, unsigned int alen, unsigned int boff, unsigned int blen)
+{
+	const byte *a, *b;
+	unsigned int n, pos, end;
+
+	a = st->a + aoff;
+	b = st->b + boff;
+	n = alen < blen ? alen : blen;
+	for (pos = 0; pos < n && a[pos] == b[pos]; pos++);
+	for (end = 0; end < n - pos && a[alen - 1 - end] == b[blen - 1 - end]; end++);
+	aoff += pos;
+	boff += pos;
+	alen -= pos + end;
+	blen -= pos + end;
+	a += pos;
+	b += pos;
+
+	if (!alen && !blen)
+		return;
+	if (!alen)
+	{
+		add_range(st, DiffInserted, aoff, 0, boff, blen, blen);
+		return;
+	}
+	if (!blen)
+	{
+		add_range(st, DiffDeleted, aoff, alen, boff, 0, alen);
+		return;
+	}
+	if (alen != blen)
+	{
+		add_range(st, DiffModified, aoff, alen, boff, blen, alen > blen ? alen : blen);
+		return;
+	}
+
+	// as many bytes on both sides are compared byte by byte
+	for (pos = 0; pos < alen; pos = end)
+	{
+		for (; pos < alen && a[pos] == b[pos]; pos++);
+		if (pos == alen)
+			break;
+		for (end = pos; end < alen && a[end] != b[end]; end++);
+		add_range(st, DiffModified, aoff + pos, end - pos, boff + pos, end - pos, end - pos);
+	}
+}
+
+// Add a range after the others, merging modified bytes into the last
+// range when it is modified at the same shift with at most gap equal
+// bytes between
+static void
+add_range(struct align_state *st, int kind, unsigned int offset, unsigned int size, unsigned int other, unsigned int other_size, unsigned int differ)
+{
+	diff_range_t *grown, *last;
+
+	if (st->failed)
+		return;
+	st->differ += differ;
+
+	if (st->count && kind == DiffModified && size == other_size)
+	{
+		last = &st->ranges[st->count - 1];
+		if (last->kind == DiffModified && last->size == last->other_size && last->other - last->offset == other - offset &&
+			offset - (last->offset + last->size) <= st->gap)
+		{
+			last->differ += differ;
+			last->size = offset + size - last->offset;
+			last->other_size = last->size;
+			return;
+		}
+	}
+
+	if (st->count == st->capacity)
+	{
+		st->capacity = st->capacity ? st->capacity * 2 : 256;
+		grown = realloc(st->ranges, (size_t)st->capacity * sizeof(diff_range_t));
+		if (!grown)
+		{
+			st->failed = 1;
+			return;
+		}
+		st->ranges = grown;
+	}
+
+	last = &st->ranges[st->count++];
+	last->offset = offset;
+	last->size = size;
+	last->differ = differ;
+	last->kind = kind;
+	last->other = other;
+	last->other_size = other_size;
+}
+
+static int
+compare_spans(const void *first, const void *second)
+{
+	const struct span *a = first, *b = second;
+
+	return a->start < b->start ? -1 : a->start > b->start;
+}
@@ -0,0 +1,32 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include "defs.h"
+#include "diff.h"
+
+#define ALIGN_CHUNK 1024          // average chunk size of files small enough
+#define ALIGN_MAX_CHUNKS 1048576  // about the most chunks of a file, larger files use larger chunks
+
+// Compare two files where bytes may have been inserted, deleted or
+// moved, so one change does not shift every byte after it. Both files
+// are split into content-defined chunks hashed on all avaliable cores,
+// and the chunks of the first are looked up among those of the second.
+// The series of matching chunks in the same order in both files with
+// the most bytes lines the files up, and the other matching chunks are
+// moved. The bytes between are trimmed of those equal at both ends,
+// then compared byte by byte when as many are left in both files.
+// Memory use grows with the number of chunks, which the chunk size
+// keeps to about ALIGN_MAX_CHUNKS per file however large the files.
+// Parameters:
+// - a: The data of the first file.
+// - asize: The size of the first file.
+// - b: The data of the second file.
+// - bsize: The size of the second file.
+// - gap: The most equal bytes to merge between modified bytes.
+//
+// Returns:
+// The differences by offset in the first file, or NULL if memory could
+// not be allocated. Inserted ranges have a size of 0.
+diff_t *align_compare(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int gap);
+
+#endif
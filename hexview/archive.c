@@ -0,0 +1,540 @@
+#include "archive.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARCHIVE_MAGIC "HVAR"
+#define ARCHIVE_VERSION 2
+#define TAR_BLOCK 512
+#define CPIO_NEWC_SIZE 110
+#define CPIO_ODC_SIZE 76
+#define ZIP_EOCD_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+#define MAX_NAME_SIZE 4096  // longest name kept, longer names are cut
+
+struct archive_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;        // size of the indexed file
+	uint32 format;
+	uint32 count;       // number of members
+	uint32 names_size;  // bytes of names after the members
+	uint64 mtime;       // modification time of the indexed file
+};
+
+// Members and names being indexed, grown as headers are read
+struct builder
+{
+	member_t *members;
+	unsigned int count;
+	unsigned int capacity;
+	char *names;
+	unsigned int names_size;
+	unsigned int names_capacity;
+	int failed;  // memory could not be allocated
+};
+
+static void add_member(struct builder *b, const char *prefix, unsigned int prefix_len, const char *name, unsigned int len, uint64 offset, uint64 size, unsigned int flags);
+static uint64 parse_octal(const byte *p, unsigned int len);
+static uint64 parse_hex(const byte *p, unsigned int len, int *const ok);
+static int tar_checksum(const byte *block);
+static void index_tar(struct builder *b, const byte *data, unsigned int size);
+static void index_cpio(struct builder *b, const byte *data, unsigned int size);
+static void index_zip(struct builder *b, const byte *data, unsigned int size);
+static unsigned int get16(const byte *p);
+static unsigned int get32(const byte *p);
+static const char *strip_name(const char *name);
+
+int
+archive_detect(const byte *data, unsigned int size)
+{
+	if (size >= 6 && (!memcmp(data, "070701", 6) || !memcmp(data, "070702", 6) || !memcmp(data, "070707", 6)))
+		return ArchiveCpio;
+	if (size >= 4 && (!memcmp(data, "PK\x03\x04", 4) || !memcmp(data, "PK\x05\x06", 4)))
+		return ArchiveZip;
+
+	// old tar headers have no magic, only the checksum tells them apart
+	if (size >= TAR_BLOCK && tar_checksum(data))
+		return ArchiveTar;
+
+	return ArchiveNone;
+}
+
+const char *
+archive_name(int format)
+{
+	switch (format)
+	{
+	case ArchiveTar: return "tar";
+	case ArchiveZip: return "zip";
+	case ArchiveCpio: return "cpio";
+	default: return "unknown";
+	}
+}
+
+archive_t *
+archive_index(const byte *data, unsigned int size, int format)
+{
+	archive_t *archive;
+	struct builder b;
+
+	memset(&b, 0, sizeof(b));
+	switch (format)
+	{
+	case ArchiveTar: index_tar(&b, data, size); break;
+	case ArchiveZip: index_zip(&b, data, size); break;
+	case ArchiveCpio: index_cpio(&b, data, size); break;
+	}
+
+	archive = calloc(1, sizeof(archive_t));
+	if (!archive || b.failed)
+	{
+		free(archive);
+		free(b.members);
+		free(b.names);
+		return NULL;
+	}
+
+	archive->format = format;
+	archive->members = b.members;
+	archive->count = b.count;
+	archive->names = b.names;
+	archive->names_size = b.names_size;
+	return archive;
+}
+
+int
+archive_save(const archive_t *archive, const char *path, unsigned int size, uint64 mtime)
+{
+	sidecar_t *sidecar;
+	struct archive_header *header;
+	size_t members_size;
+
+	members_size = (size_t)archive->count * sizeof(member_t);
+	sidecar = sidecar_create(path, sizeof(struct archive_header) + members_size + archive->names_size);
+	if (!sidecar)
+		return 0;
+
+	header = (struct archive_header *)sidecar->data;
+	memset(header, 0, sizeof(struct archive_header));
+	memcpy(header->magic, ARCHIVE_MAGIC, sizeof(header->magic));
+	header->version = ARCHIVE_VERSION;
+	header->size = size;
+	header->format = archive->format;
+	header->count = archive->count;
+	header->names_size = archive->names_size;
+	header->mtime = mtime;
+
+	if (members_size)
+		memcpy(sidecar->data + sizeof(struct archive_header), archive->members, members_size);
+	if (archive->names_size)
+		memcpy(sidecar->data + sizeof(struct archive_header) + members_size, archive->names, archive->names_size);
+
+	sidecar_close(sidecar);
+	return 1;
+}
+
+archive_t *
+archive_open(const char *path, unsigned int size, uint64 mtime)
+{
+	archive_t *archive;
+	sidecar_t *sidecar;
+	const struct archive_header *header;
+	const member_t *members;
+	unsigned int i;
+
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	header = (const struct archive_header *)sidecar->data;
+	if (sidecar->size < sizeof(struct archive_header) ||
+		memcmp(header->magic, ARCHIVE_MAGIC, sizeof(header->magic)) ||
+		header->version != ARCHIVE_VERSION || header->size != size || header->mtime != mtime ||
+		sidecar->size != sizeof(struct archive_header) + (size_t)header->count * sizeof(member_t) + header->names_size ||
+		(header->names_size && sidecar->data[sidecar->size - 1]))
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	// names must stay inside the sidecar
+	members = (const member_t *)(sidecar->data + sizeof(struct archive_header));
+	for (i = 0; i < header->count; i++)
+	{
+		if (members[i].name >= header->names_size)
+		{
+			sidecar_close(sidecar);
+			return NULL;
+		}
+	}
+
+	archive = malloc(sizeof(archive_t));
+	if (!archive)
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	archive->format = header->format;
+	archive->members = members;
+	archive->count = header->count;
+	archive->names = (const char *)(members + header->count);
+	archive->names_size = header->names_size;
+	archive->sidecar = sidecar;
+	return archive;
+}
+
+void
+archive_free(archive_t *archive)
+{
+	if (!archive) return;
+
+	if (archive->sidecar)
+		sidecar_close(archive->sidecar);
+	else
+	{
+		free((member_t *)archive->members);
+		free((char *)archive->names);
+	}
+	free(archive);
+}
+
+const member_t *
+archive_find(const archive_t *archive, const char *name)
+{
+	unsigned int i;
+
+	name = strip_name(name);
+	for (i = 0; i < archive->count; i++)
+	{
+		if (!strcmp(strip_name(archive->names + archive->members[i].name), name))
+			return &archive->members[i];
+	}
+
+	return NULL;
+}
+
+// Add a member named prefix/name. Members which are not entirely in the
+// file must be left out by the caller.
+static void
+add_member(struct builder *b, const char *prefix, unsigned int prefix_len, const char *name, unsigned int len, uint64 offset, uint64 size, unsigned int flags)
+{
+	member_t *members;
+	char *names;
+	unsigned int need, capacity;
+
+	if (b->failed)
+		return;
+
+	if (prefix_len > MAX_NAME_SIZE)
+		prefix_len = MAX_NAME_SIZE;
+	if (len > MAX_NAME_SIZE)
+		len = MAX_NAME_SIZE;
+
+	if (b->count == b->capacity)
+	{
+		capacity = b->capacity ? b->capacity * 2 : 256;
+		members = realloc(b->members, capacity * sizeof(member_t));
+		if (!members)
+		{
+			b->failed = 1;
+			return;
+		}
+		b->members = members;
+		b->capacity = capacity;
+	}
+
+	need = prefix_len + (prefix_len ? 1 : 0) + len + 1;
+	if (b->names_capacity - b->names_size < need)
+	{
+		capacity = b->names_capacity ? b->names_capacity * 2 : 4096;
+		while (capacity - b->names_size < need)
+			capacity *= 2;
+		names = realloc(b->names, capacity);
+		if (!names)
+		{
+			b->failed = 1;
+			return;
+		}
+		b->names = names;
+		b->names_capacity = capacity;
+	}
+
+	b->members[b->count].name = b->names_size;
+	b->members[b->count].offset = (uint32)offset;
+	b->members[b->count].size = (uint32)size;
+	b->members[b->count].flags = flags;
+	b->count++;
+
+	names = b->names + b->names_size;
+	if (prefix_len)
+	{
+		memcpy(names, prefix, prefix_len);
+		names[prefix_len] = '/';
+		names += prefix_len + 1;
+	}
+	memcpy(names, name, len);
+	names[len] = 0;
+	b->names_size += need;
+}
+
+// Parse an octal number padded with spaces or nulls, as tar and odc
+// cpio headers store them. Sizes of tar members past 8 GiB are stored
+// in base 256, marked by the high bit of the first byte.
+static uint64
+parse_octal(const byte *p, unsigned int len)
+{
+	uint64 value;
+	unsigned int i;
+
+	value = 0;
+	if (len && p[0] & 0x80)
+	{
+		value = p[0] & 0x7f;
+		for (i = 1; i < len; i++)
+			value = value << 8 | p[i];
+		return value;
+	}
+
+	for (i = 0; i < len && p[i] == ' '; i++);
+	for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+		value = value << 3 | (p[i] - '0');
+
+	return value;
+}
+
+static uint64
+parse_hex(const byte *p, unsigned int len, int *const ok)
+{
+	uint64 value;
+	unsigned int i, c;
+
+	value = 0;
+	for (i = 0; i < len; i++)
+	{
+		c = p[i];
+		if (c >= '0' && c <= '9')
+			c -= '0';
+		else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			c = (c | 0x20) - 'a' + 10;
+		else
+		{
+			*ok = 0;
+			return 0;
+		}
+		value = value << 4 | c;
+	}
+
+	return value;
+}
+
+// Returns nonzero if a block is a tar header, its bytes summed with the
+// checksum field as spaces match the checksum
+static int
+tar_checksum(const byte *block)
+{
+	unsigned int sum, i;
+
+	sum = 0;
+	for (i = 0; i < TAR_BLOCK; i++)
+		sum += i >= 148 && i < 156 ? ' ' : block[i];
+
+	// an empty block would sum to the spaces alone
+	return sum != 8 * ' ' && sum == parse_octal(block + 148, 8);
+}
+
+static void
+index_tar(struct builder *b, const byte *data, unsigned int size)
+{
+	const byte *h, *p, *end, *record;
+	const char *name, *prefix;
+	unsigned int name_len, prefix_len;
+	uint64 pos, member_size, len;
+	int type;
+
+	name = NULL;
+	name_len = 0;
+	for (pos = 0; pos + TAR_BLOCK <= size; pos += TAR_BLOCK + (member_size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK)
+	{
+		h = data + pos;
+		if (!tar_checksum(h))
+			break;
+
+		member_size = parse_octal(h + 124, 12);
+		type = h[156];
+		if (member_size > size - pos - TAR_BLOCK)
+			break;
+
+		// GNU long names and pax paths name the next member
+		if (type == 'L')
+		{
+			name = (const char *)h + TAR_BLOCK;
+			for (name_len = 0; name_len < member_size && name[name_len]; name_len++);
+			continue;
+		}
+		if (type == 'x')
+		{
+			// records are "<length> <key>=<value>\n", the length counting all of it
+			p = h + TAR_BLOCK;
+			end = p + member_size;
+			while (p < end)
+			{
+				record = p;
+				for (len = 0; p < end && *p >= '0' && *p <= '9' && len <= member_size; p++)
+					len = len * 10 + (*p - '0');
+				if (!len || len > (uint64)(end - record) || p >= end || *p++ != ' ')
+					break;
+
+				if (record + len - p > 5 && !memcmp(p, "path=", 5))
+				{
+					name = (const char *)p + 5;
+					name_len = (unsigned int)(record + len - 1 - p - 5);
+				}
+				p = record + len;
+			}
+			continue;
+		}
+		if (type == 'g' || type == 'K')
+			continue;
+
+		prefix = NULL;
+		prefix_len = 0;
+		if (!name)
+		{
+			name = (const char *)h;
+			for (name_len = 0; name_len < 100 && name[name_len]; name_len++);
+
+			// ustar splits long names at a slash into a prefix
+			if (!memcmp(h + 257, "ustar\0", 6))
+			{
+				prefix = (const char *)h + 345;
+				for (prefix_len = 0; prefix_len < 155 && prefix[prefix_len]; prefix_len++);
+			}
+		}
+
+		add_member(b, prefix, prefix_len, name, name_len, pos + TAR_BLOCK, member_size, 0);
+		name = NULL;
+	}
+}
+
+static void
+index_cpio(struct builder *b, const byte *data, unsigned int size)
+{
+	const byte *h;
+	uint64 pos, name_size, member_size, start;
+	int ok, newc;
+
+	for (pos = 0; pos + CPIO_ODC_SIZE <= size; pos = start + member_size)
+	{
+		h = data + pos;
+		ok = 1;
+		newc = !memcmp(h, "070701", 6) || !memcmp(h, "070702", 6);
+		if (newc)
+		{
+			if (pos + CPIO_NEWC_SIZE > size)
+				break;
+			member_size = parse_hex(h + 54, 8, &ok);
+			name_size = parse_hex(h + 94, 8, &ok);
+			start = (pos + CPIO_NEWC_SIZE + name_size + 3) & ~(uint64)3;
+		}
+		else if (!memcmp(h, "070707", 6))
+		{
+			name_size = parse_octal(h + 59, 6);
+			member_size = parse_octal(h + 65, 11);
+			start = pos + CPIO_ODC_SIZE + name_size;
+		}
+		else
+			break;
+
+		if (!ok || !name_size || start > size || member_size > size - start)
+			break;
+
+		// the name size counts its null
+		h += newc ? CPIO_NEWC_SIZE : CPIO_ODC_SIZE;
+		if (name_size == 11 && !memcmp(h, "TRAILER!!!", 10))
+			break;
+
+		add_member(b, NULL, 0, (const char *)h, (unsigned int)name_size - 1, start, member_size, 0);
+
+		// newc data is padded to 4 bytes too
+		if (newc)
+			member_size = (member_size + 3) & ~(uint64)3;
+	}
+}
+
+static void
+index_zip(struct builder *b, const byte *data, unsigned int size)
+{
+	const byte *h;
+	uint64 eocd, pos, end, local, start;
+	unsigned int entries, method, name_len, extra_len, comment_len, i;
+
+	if (size < ZIP_EOCD_SIZE)
+		return;
+
+	// the end of central directory record is followed only by a comment
+	for (eocd = size - ZIP_EOCD_SIZE; ; eocd--)
+	{
+		if (!memcmp(data + eocd, "PK\x05\x06", 4))
+			break;
+		if (!eocd || size - eocd >= ZIP_EOCD_SIZE + ZIP_MAX_COMMENT)
+			return;
+	}
+
+	entries = get16(data + eocd + 10);
+	pos = get32(data + eocd + 16);
+	end = pos + get32(data + eocd + 12);
+	if (end > eocd)
+		return;
+
+	for (i = 0; i < entries && pos + 46 <= end; i++)
+	{
+		h = data + pos;
+		if (memcmp(h, "PK\x01\x02", 4))
+			break;
+
+		method = get16(h + 10);
+		name_len = get16(h + 28);
+		local = get32(h + 42);
+		if (pos + 46 + name_len > end)
+			break;
+
+		// the local header has its own extra field, the data is after it
+		if (local + 30 <= size && !memcmp(data + local, "PK\x03\x04", 4))
+		{
+			start = local + 30 + get16(data + local + 26) + get16(data + local + 28);
+			if (start <= size && get32(h + 20) <= size - start)
+				add_member(b, NULL, 0, (const char *)h + 46, name_len, start, get32(h + 20), method ? MemberCompressed : 0);
+		}
+
+		extra_len = get16(h + 30);
+		comment_len = get16(h + 32);
+		pos += 46 + name_len + extra_len + comment_len;
+	}
+}
+
+static unsigned int
+get16(const byte *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static unsigned int
+get32(const byte *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+// Skip the "./" or "/" archivers put in front of names
+static const char *
+strip_name(const char *name)
+{
+	while (name[0] == '.' && name[1] == '/')
+		name += 2;
+	while (name[0] == '/')
+		name++;
+
+	return name;
+}
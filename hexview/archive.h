@@ -0,0 +1,106 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "defs.h"
+#include "sidecar.h"
+
+#define ARCHIVE_EXT ".hvar"
+
+enum
+{
+	ArchiveNone = 0,
+	ArchiveTar,
+	ArchiveZip,
+	ArchiveCpio
+};
+
+// Flags of a member
+enum
+{
+	MemberCompressed = 1 << 0  // the data of a zip member is not stored as is
+};
+
+typedef struct member_s member_t;
+struct member_s
+{
+	uint32 name;    // Offset of the name in archive_t.names.
+	uint32 offset;  // Offset of the data of the member in the archive.
+	uint32 size;    // Size of the data in the archive.
+	uint32 flags;
+};
+
+typedef struct archive_s archive_t;
+struct archive_s
+{
+	int format;
+	const member_t *members;  // Members in the order the archive lists them.
+	unsigned int count;
+	const char *names;        // Null terminated names of the members.
+	unsigned int names_size;
+
+	sidecar_t *sidecar;  // mapping holding the members and names, or NULL if built in memory
+};
+
+// Recognize a tar, zip or cpio archive from its first header.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+//
+// Returns:
+// The format, or ArchiveNone if it is not recognized.
+int archive_detect(const byte *data, unsigned int size);
+
+// Returns the name of an archive format, such as "tar".
+const char *archive_name(int format);
+
+// Index the members of an archive by walking its headers, or for zip
+// its central directory. Members whose headers are not entirely in the
+// file end the index.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+// - format: The format, as returned by archive_detect.
+//
+// Returns:
+// The index, or NULL if memory could not be allocated.
+archive_t *archive_index(const byte *data, unsigned int size, int format);
+
+// Store an index in a sidecar, so archive_open can skip the headers.
+// Parameters:
+// - archive: The index to store.
+// - path: The path of the sidecar to create.
+// - size: The size of the indexed file.
+// - mtime: The modification time of the file, see sidecar_file_time.
+//
+// Returns:
+// Nonzero if the sidecar was written.
+int archive_save(const archive_t *archive, const char *path, unsigned int size, uint64 mtime);
+
+// Open a sidecar created with archive_save. The members and names are
+// used where they are mapped.
+// Parameters:
+// - path: The path of the sidecar.
+// - size: The size of the file the sidecar should describe.
+// - mtime: The modification time of the file as it is now.
+//
+// Returns:
+// The index, or NULL if there is no sidecar or it describes a file of
+// another size or modification time.
+archive_t *archive_open(const char *path, unsigned int size, uint64 mtime);
+
+// Free an index.
+// Parameters:
+// - archive: The index to free, can be NULL.
+void archive_free(archive_t *archive);
+
+// Find a member by name. A leading "./" or "/" of the stored names is
+// ignored.
+// Parameters:
+// - archive: The index to search.
+// - name: The name of the member.
+//
+// Returns:
+// The first member with that name, or NULL if there is none.
+const member_t *archive_find(const archive_t *archive, const char *name);
+
+#endif
@@ -0,0 +1,475 @@
+#include "bloom.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+#include "util.h"
+
+#define BLOOM_MAGIC "HVBF"
+#define BLOOM_VERSION 4
+#define BLOOM_HASHES 3           // bits set for each gram
+#define MIN_FILTER_SIZE 64       // fewest bytes in a filter
+#define COUNT_BITS_LOG 20        // bits of the bitmap the distinct grams of a block are counted with
+#define MIN_JOB_BLOCKS 16  // fewest blocks worth giving their own thread
+
+struct bloom_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;        // size of the indexed file
+	uint32 block_size;  // BLOOM_BLOCK_SIZE when built
+	uint32 filter_size; // BLOOM_MAX_FILTER_SIZE when built
+	uint32 hashes;      // BLOOM_HASHES when built
+	uint64 mtime;       // modification time of the indexed file
+};
+
+// A range of blocks indexed by a single thread
+struct bloom_job
+{
+	const byte *data;
+	unsigned int size;
+	byte *filters;
+	bloom_block_t *table;
+	unsigned int *counts;        // when counting, the distinct grams of each block
+	const unsigned int *blocks;  // blocks to index, NULL for all from start to end
+	unsigned int start;  // first block, or index in blocks
+	unsigned int end;    // one past the last block
+};
+
+static void count_proc(void *arg);
+static void bloom_proc(void *arg);
+static int run_jobs(thread_fn proc, const byte *data, unsigned int size, byte *filters, bloom_block_t *table, unsigned int *counts,
+	const unsigned int *blocks, unsigned int count);
+static void block_grams(unsigned int block, unsigned int size, unsigned int *const pos, unsigned int *const end);
+static unsigned int count_bits(const byte *bits, unsigned int size);
+static int valid_header(const sidecar_t *sidecar, unsigned int size, uint64 mtime);
+static bloom_t *open_filters(sidecar_t *sidecar, unsigned int size);
+
+static inline uint32
+load_gram(const byte *p)
+{
+	uint32 gram;
+
+	memcpy(&gram, p, sizeof(gram));
+	return gram;
+}
+
+// Mix the bits of a gram, so any run of the result is a hash of it
+static inline uint64
+gram_hash(uint32 gram)
+{
+	uint64 h;
+
+	h = (uint64)gram * 0x9e3779b97f4a7c15ULL;
+	h ^= h >> 32;
+	return h * 0xd6e8feb86659fd93ULL;
+}
+
+// The bit of a gram for hash i in a filter of 2^bits_log bits, each
+// hash taking the next bits_log bits from the top of the mixed gram
+static inline uint32
+gram_bit(uint64 h, unsigned int i, unsigned int bits_log)
+{
+	return (uint32)(h >> (64 - bits_log * (i + 1))) & ((1u << bits_log) - 1);
+}
+
+// Returns log2 of a power of two
+static inline unsigned int
+log2_of(unsigned int n)
+{
+	unsigned int bits_log;
+
+	for (bits_log = 0; n > 1; n >>= 1)
+		bits_log++;
+	return bits_log;
+}
+
+// Returns nonzero if the filter of a block may hold a gram, as do
+// blocks searched always
+static inline int
+filter_contains(const bloom_t *bloom, const bloom_block_t *entry, uint32 gram)
+{
+	const byte *filter;
+	unsigned int bits_log, i;
+	uint64 h;
+	uint32 bit;
+
+	if (entry->flags & BLOOM_ALWAYS)
+		return 1;
+
+	filter = bloom->filters + entry->offset;
+	bits_log = log2_of(entry->size * 8);
+	h = gram_hash(gram);
+	for (i = 0; i < BLOOM_HASHES; i++)
+	{
+		bit = gram_bit(h, i, bits_log);
+		if (!((filter[bit >> 3] >> (bit & 7)) & 1))
+			return 0;
+	}
+
+	return 1;
+}
+
+bloom_t *
+bloom_build(const byte *data, unsigned int size, uint64 mtime, const char *path)
+{
+	sidecar_t *sidecar;
+	struct bloom_header *header;
+	bloom_block_t *table;
+	unsigned int *counts;
+	unsigned int nblocks, filter_size, block;
+	size_t offset, table_size;
+	bloom_t *bloom;
+
+	if (!size)
+		return NULL;
+
+	// each filter has the size its block needs, in most files far fewer
+	// than the bytes of a block, and up to the largest fewer bits for
+	// each gram. A block with more grams than half the bits of the
+	// largest would fill its filter past three quarters, it has none.
+	nblocks = (unsigned int)(((uint64)size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE);
+	counts = malloc((size_t)nblocks * sizeof(unsigned int));
+	table = malloc((size_t)nblocks * sizeof(bloom_block_t));
+	if (!counts || !table || !run_jobs(&count_proc, data, size, NULL, NULL, counts, NULL, nblocks))
+	{
+		free(counts);
+		free(table);
+		return NULL;
+	}
+
+	offset = 0;
+	for (block = 0; block < nblocks; block++)
+	{
+		for (filter_size = MIN_FILTER_SIZE; filter_size < BLOOM_MAX_FILTER_SIZE &&
+			(uint64)filter_size * 8 < (uint64)counts[block] * BLOOM_BITS_PER_GRAM; filter_size *= 2);
+		table[block].offset = (uint32)offset;
+		table[block].size = (uint64)counts[block] * 2 <= (uint64)filter_size * 8 ? filter_size : 0;
+		table[block].flags = table[block].size ? 0 : BLOOM_ALWAYS;
+		offset += table[block].size;
+	}
+	free(counts);
+
+	table_size = (size_t)nblocks * sizeof(bloom_block_t);
+	sidecar = sidecar_create(path, sizeof(struct bloom_header) + table_size + offset);
+	if (!sidecar)
+	{
+		free(table);
+		return NULL;
+	}
+
+	memcpy(sidecar->data + sizeof(struct bloom_header), table, table_size);
+	free(table);
+	table = (bloom_block_t *)(sidecar->data + sizeof(struct bloom_header));
+	if (!run_jobs(&bloom_proc, data, size, sidecar->data + sizeof(struct bloom_header) + table_size, table, NULL, NULL, nblocks))
+	{
+		sidecar_close(sidecar);
+		remove(path);
+		return NULL;
+	}
+
+	header = (struct bloom_header *)sidecar->data;
+	memcpy(header->magic, BLOOM_MAGIC, sizeof(header->magic));
+	header->version = BLOOM_VERSION;
+	header->size = size;
+	header->block_size = BLOOM_BLOCK_SIZE;
+	header->filter_size = BLOOM_MAX_FILTER_SIZE;
+	header->hashes = BLOOM_HASHES;
+	header->mtime = mtime;
+
+	bloom = open_filters(sidecar, size);
+	if (!bloom)
+		sidecar_close(sidecar);
+	return bloom;
+}
+
+bloom_t *
+bloom_open(const char *path, unsigned int size, uint64 mtime)
+{
+	bloom_t *bloom;
+	sidecar_t *sidecar;
+
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	bloom = valid_header(sidecar, size, mtime) ? open_filters(sidecar, size) : NULL;
+	if (!bloom)
+		sidecar_close(sidecar);
+	return bloom;
+}
+
+int
+bloom_update(const byte *data, unsigned int size, const char *path, const unsigned int *blocks, unsigned int count,
+	uint64 was, uint64 mtime)
+{
+	sidecar_t *sidecar;
+	unsigned int nblocks;
+	int result;
+
+	nblocks = (unsigned int)(((uint64)size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE);
+	sidecar = sidecar_edit(path);
+	if (!sidecar)
+		return 0;
+
+	if (!valid_header(sidecar, size, was))
+	{
+		sidecar_close(sidecar);
+		return 0;
+	}
+
+	result = run_jobs(&bloom_proc, data, size, sidecar->data + sizeof(struct bloom_header) + (size_t)nblocks * sizeof(bloom_block_t),
+		(bloom_block_t *)(sidecar->data + sizeof(struct bloom_header)), NULL, blocks, count);
+	if (result)
+		((struct bloom_header *)sidecar->data)->mtime = mtime;
+	sidecar_close(sidecar);
+	return result;
+}
+
+void
+bloom_free(bloom_t *bloom)
+{
+	if (!bloom) return;
+	sidecar_close(bloom->sidecar);
+	free(bloom);
+}
+
+unsigned int
+bloom_next_candidate(bloom_t *bloom, const uint32 *grams, unsigned int ngrams, unsigned int lead, unsigned int block)
+{
+	const bloom_block_t *entry, *next;
+	unsigned int first, rest;
+
+	for (; block < bloom->nblocks; block++)
+	{
+		entry = &bloom->blocks[block];
+		next = block + 1 < bloom->nblocks ? entry + 1 : NULL;
+		if (entry->flags & BLOOM_ALWAYS)
+			return block;
+
+		// the most grams from the first which can start in the block
+		for (first = 0; first < ngrams && filter_contains(bloom, entry, grams[first]); first++);
+		if (first == ngrams)
+			return block;
+		if (!next)
+			continue;
+
+		// the fewest grams from the last which can start in the next, a
+		// match starts in the block so its first gram does too unless
+		// the match does not start with it
+		for (rest = ngrams; rest > first && filter_contains(bloom, next, grams[rest - 1]); rest--);
+		if (rest == first && (first || lead))
+			return block;
+	}
+
+	return bloom->nblocks;
+}
+
+// Count the distinct grams of each block with a bitmap, one bit set for
+// each. At the load of a single block collisions lose a few percent at
+// most.
+static void
+count_proc(void *arg)
+{
+	struct bloom_job *job = arg;
+	byte *bits;
+	unsigned int block, pos, end;
+	uint32 bit;
+
+	bits = malloc((1u << COUNT_BITS_LOG) / 8);
+	if (!bits)
+	{
+		// without a count the blocks are searched always
+		for (block = job->start; block < job->end; block++)
+			job->counts[block] = BLOOM_BLOCK_SIZE;
+		return;
+	}
+
+	for (block = job->start; block < job->end; block++)
+	{
+		memset(bits, 0, (1u << COUNT_BITS_LOG) / 8);
+		block_grams(block, job->size, &pos, &end);
+		for (; pos < end; pos++)
+		{
+			bit = gram_bit(gram_hash(load_gram(job->data + pos)), 0, COUNT_BITS_LOG);
+			bits[bit >> 3] |= 1 << (bit & 7);
+		}
+
+		job->counts[block] = count_bits(bits, (1u << COUNT_BITS_LOG) / 8);
+	}
+
+	free(bits);
+}
+
+static void
+bloom_proc(void *arg)
+{
+	struct bloom_job *job = arg;
+	bloom_block_t *entry;
+	byte *filter;
+	unsigned int i, j, block, bits_log;
+	unsigned int pos, end;
+	uint64 h;
+	uint32 bit;
+
+	for (i = job->start; i < job->end; i++)
+	{
+		block = job->blocks ? job->blocks[i] : i;
+		entry = &job->table[block];
+		if (!entry->size)
+			continue;
+
+		filter = job->filters + entry->offset;
+		bits_log = log2_of(entry->size * 8);
+		memset(filter, 0, entry->size);
+		entry->flags &= ~BLOOM_ALWAYS;
+
+		block_grams(block, job->size, &pos, &end);
+		for (; pos < end; pos++)
+		{
+			h = gram_hash(load_gram(job->data + pos));
+			for (j = 0; j < BLOOM_HASHES; j++)
+			{
+				bit = gram_bit(h, j, bits_log);
+				filter[bit >> 3] |= 1 << (bit & 7);
+			}
+		}
+
+		// past three quarters of the bits set most absent grams pass
+		// anyway, the block is searched always rather than tested
+		if ((uint64)count_bits(filter, entry->size) * 4 > (uint64)entry->size * 8 * 3)
+			entry->flags |= BLOOM_ALWAYS;
+	}
+}
+
+// Run a job over blocks on all avaliable cores, all of the blocks from
+// the first when blocks is NULL. Returns 0 if memory could not be
+// allocated.
+static int
+run_jobs(thread_fn proc, const byte *data, unsigned int size, byte *filters, bloom_block_t *table, unsigned int *counts,
+	const unsigned int *blocks, unsigned int count)
+{
+	struct bloom_job *jobs;
+	unsigned int per;
+	int njobs, i;
+
+	njobs = cpu_count();
+	if (count / MIN_JOB_BLOCKS < (unsigned int)njobs)
+		njobs = count / MIN_JOB_BLOCKS;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = calloc(njobs, sizeof(struct bloom_job));
+	if (!jobs)
+		return 0;
+
+	per = count / njobs;
+	for (i = 0; i < njobs; i++)
+	{
+		jobs[i].data = data;
+		jobs[i].size = size;
+		jobs[i].filters = filters;
+		jobs[i].table = table;
+		jobs[i].counts = counts;
+		jobs[i].blocks = blocks;
+		jobs[i].start = i * per;
+		jobs[i].end = i == njobs - 1 ? count : (i + 1) * per;
+	}
+
+	run_parallel(proc, jobs, njobs, sizeof(struct bloom_job));
+
+	free(jobs);
+	return 1;
+}
+
+// The range of the grams starting in a block, the last ones read into
+// the next
+static void
+block_grams(unsigned int block, unsigned int size, unsigned int *const pos, unsigned int *const end)
+{
+	*pos = block * BLOOM_BLOCK_SIZE;
+	*end = size - *pos > BLOOM_BLOCK_SIZE ? *pos + BLOOM_BLOCK_SIZE : size;
+	if (*end > size - (BLOOM_GRAM_SIZE - 1))
+		*end = size >= BLOOM_GRAM_SIZE ? size - (BLOOM_GRAM_SIZE - 1) : 0;
+	if (*pos > *end)
+		*pos = *end;
+}
+
+// Returns the number of bits set in size bytes
+static unsigned int
+count_bits(const byte *bits, unsigned int size)
+{
+	unsigned int count, i;
+	uint64 word;
+
+	count = 0;
+	for (i = 0; i + sizeof(uint64) <= size; i += sizeof(uint64))
+	{
+		memcpy(&word, bits + i, sizeof(uint64));
+		count += popcount64(word);
+	}
+	for (; i < size; i++)
+		count += popcount64(bits[i]);
+
+	return count;
+}
+
+// Returns nonzero if a sidecar holds filters for a file of a size and
+// modification time, each within the sidecar
+static int
+valid_header(const sidecar_t *sidecar, unsigned int size, uint64 mtime)
+{
+	const struct bloom_header *header;
+	const bloom_block_t *table;
+	unsigned int nblocks, i;
+	size_t filters_size;
+
+	nblocks = (unsigned int)(((uint64)size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE);
+	header = (const struct bloom_header *)sidecar->data;
+	if (sidecar->size < sizeof(struct bloom_header) + (size_t)nblocks * sizeof(bloom_block_t) ||
+		memcmp(header->magic, BLOOM_MAGIC, sizeof(header->magic)) ||
+		header->version != BLOOM_VERSION || header->size != size || header->mtime != mtime ||
+		header->block_size != BLOOM_BLOCK_SIZE || header->hashes != BLOOM_HASHES ||
+		header->filter_size != BLOOM_MAX_FILTER_SIZE)
+		return 0;
+
+	table = (const bloom_block_t *)(sidecar->data + sizeof(struct bloom_header));
+	filters_size = sidecar->size - sizeof(struct bloom_header) - (size_t)nblocks * sizeof(bloom_block_t);
+	for (i = 0; i < nblocks; i++)
+	{
+		if ((table[i].size && (table[i].size < MIN_FILTER_SIZE || table[i].size > BLOOM_MAX_FILTER_SIZE ||
+			(table[i].size & (table[i].size - 1)))) || table[i].offset > filters_size || table[i].size > filters_size - table[i].offset ||
+			(!table[i].size && !(table[i].flags & BLOOM_ALWAYS)))
+			return 0;
+	}
+
+	return 1;
+}
+
+// Make an index of the filters in a valid sidecar, which it then holds.
+// Returns NULL if memory could not be allocated.
+static bloom_t *
+open_filters(sidecar_t *sidecar, unsigned int size)
+{
+	bloom_t *bloom;
+	unsigned int i;
+
+	bloom = malloc(sizeof(bloom_t));
+	if (!bloom)
+		return NULL;
+
+	bloom->sidecar = sidecar;
+	bloom->nblocks = (unsigned int)(((uint64)size + BLOOM_BLOCK_SIZE - 1) / BLOOM_BLOCK_SIZE);
+	bloom->blocks = (const bloom_block_t *)(sidecar->data + sizeof(struct bloom_header));
+	bloom->filters = sidecar->data + sizeof(struct bloom_header) + (size_t)bloom->nblocks * sizeof(bloom_block_t);
+	bloom->size = size;
+	bloom->always = 0;
+	for (i = 0; i < bloom->nblocks; i++)
+	{
+		if (bloom->blocks[i].flags & BLOOM_ALWAYS)
+			bloom->always++;
+	}
+
+	return bloom;
+}
@@ -0,0 +1,112 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "defs.h"
+#include "sidecar.h"
+
+#define BLOOM_EXT ".hvbf"
+#define BLOOM_BLOCK_SIZE 65536  // bytes of the file covered by each filter
+#define BLOOM_BITS_PER_GRAM 4       // bits of a filter for each distinct gram of its block
+#define BLOOM_MAX_FILTER_SIZE 4096  // most bytes in a filter, a sixteenth of a block
+#define BLOOM_GRAM_SIZE 4
+
+#define BLOOM_ALWAYS 1  // the block is searched always, its filter would let most grams through
+
+typedef struct bloom_block_s bloom_block_t;
+struct bloom_block_s
+{
+	uint32 offset;  // Where the filter of the block starts after the table.
+	uint32 size;    // Bytes in the filter, a power of two, 0 if none is stored.
+	uint32 flags;   // BLOOM_ALWAYS or 0.
+};
+
+typedef struct bloom_s bloom_t;
+struct bloom_s
+{
+	const bloom_block_t *blocks;  // The filter of each block.
+	const byte *filters;          // The filters, after the table of blocks.
+	unsigned int nblocks;         // Number of blocks in the file.
+	unsigned int always;          // Number of blocks searched always.
+	unsigned int size;            // Size of the indexed file.
+
+	sidecar_t *sidecar;  // mapping holding the filters
+};
+
+// Build a Bloom filter of the 4-grams starting in each block of a block
+// of memory and store them in a sidecar. The distinct grams of every
+// block are counted first and each filter is sized from those of its
+// block, up to BLOOM_MAX_FILTER_SIZE. A block with so many that the
+// largest filter would fill up, as compressed data has, is flagged to
+// be searched always and no filter is stored for it, so the sidecar is
+// at most a sixteenth of the file and far less for repetitive data.
+// Blocks are indexed on all avaliable cores.
+// Parameters:
+// - data: The data to index.
+// - size: The number of bytes data points to.
+// - mtime: The modification time of the file, see sidecar_file_time.
+// - path: The path of the sidecar to create.
+//
+// Returns:
+// The index, or NULL if the sidecar could not be created.
+bloom_t *bloom_build(const byte *data, unsigned int size, uint64 mtime, const char *path);
+
+// Open a sidecar created with bloom_build.
+// Parameters:
+// - path: The path of the sidecar.
+// - size: The size of the file the sidecar should describe.
+// - mtime: The modification time of the file as it is now.
+//
+// Returns:
+// The index, or NULL if there is no sidecar or it describes a file of
+// a different size or modification time.
+bloom_t *bloom_open(const char *path, unsigned int size, uint64 mtime);
+
+// Index some blocks again in a sidecar created with bloom_build, after
+// the bytes they cover changed, on all avaliable cores. The filters keep
+// the size they were built with, a block whose filter fills up with the
+// grams it has now is flagged to be searched always, as are those which
+// were when built. The sidecar then describes the file as modified at
+// mtime.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file, which must not have changed.
+// - path: The path of the sidecar.
+// - blocks: The blocks to index again.
+// - count: The number of elements in blocks.
+// - was: The modification time of the file before the blocks changed.
+// - mtime: The modification time of the file as it is now.
+//
+// Returns:
+// Nonzero if the blocks were indexed, 0 if there is no sidecar for a
+// file of the size modified at was or memory could not be allocated.
+int bloom_update(const byte *data, unsigned int size, const char *path, const unsigned int *blocks, unsigned int count,
+	uint64 was, uint64 mtime);
+
+// Close an index.
+// Parameters:
+// - bloom: The index to close, can be NULL.
+void bloom_free(bloom_t *bloom);
+
+// Find the next block which may contain the start of a match. A match
+// starting in a block can run into the next one, so its grams up to
+// some point start in the block and the rest in the next. A block is
+// only skipped if there is no such point where the first grams are in
+// its filter and the others in the filter of the next. Blocks flagged
+// to be searched always hold any gram.
+// Parameters:
+// - bloom: The index to search.
+// - grams: The grams every match must contain, in the order they appear
+//          in it, each read from 4 bytes in native byte order. Grams
+//          must start within the first BLOOM_BLOCK_SIZE bytes of the
+//          match.
+// - ngrams: The number of elements in grams.
+// - lead: The offset of the first gram in a match. When it is 0 the
+//         first gram starts in the same block as the match.
+// - block: The first block to consider.
+//
+// Returns:
+// The first candidate block at or after block, or bloom->nblocks if
+// there are none.
+unsigned int bloom_next_candidate(bloom_t *bloom, const uint32 *grams, unsigned int ngrams, unsigned int lead, unsigned int block);
+
+#endif
@@ -0,0 +1,84 @@
+#include "chunk.h"
+
+#define MIN_AVG_SIZE 64
+
+static uint64 gear[256];
+static int gear_ready = 0;
+
+static void init_gear();
+
+void
+chunk_params_init(chunk_params_t *params, unsigned int avg)
+{
+	unsigned int bits;
+
+	init_gear();
+
+	if (avg < MIN_AVG_SIZE)
+		avg = MIN_AVG_SIZE;
+
+	for (bits = 0; (2U << bits) <= avg && bits < 30; bits++);
+
+	params->avg = 1U << bits;
+	params->min = params->avg / 4;
+	params->max = params->avg * 8;
+
+	// use the high bits, they depend on the most bytes
+	params->mask_small = ((1ULL << (bits + 1)) - 1) << (64 - (bits + 1));
+	params->mask_large = ((1ULL << (bits - 1)) - 1) << (64 - (bits - 1));
+}
+
+unsigned int
+chunk_next(const chunk_params_t *params, const byte *data, unsigned int size)
+{
+	unsigned int i, normal;
+	uint64 fp;
+
+	if (size <= params->min)
+		return size;
+	if (size > params->max)
+		size = params->max;
+
+	normal = params->avg < size ? params->avg : size;
+
+	fp = 0;
+	for (i = params->min; i < normal; i++)
+	{
+		fp = (fp << 1) + gear[data[i]];
+		if (!(fp & params->mask_small))
+			return i + 1;
+	}
+
+	for (; i < size; i++)
+	{
+		fp = (fp << 1) + gear[data[i]];
+		if (!(fp & params->mask_large))
+			return i + 1;
+	}
+
+	return size;
+}
+
+// Fill the gear table with fixed pseudo-random values (splitmix64), so
+// chunk boundaries are stable between runs
+static void
+init_gear()
+{
+	uint64 x, z;
+	int i;
+
+	if (gear_ready)
+		return;
+
+	x = 0x6865787669657721ULL;
+	for (i = 0; i < 256; i++)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+
+	gear_ready = 1;
+}
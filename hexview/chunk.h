@@ -0,0 +1,37 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include "defs.h"
+
+typedef struct chunk_params_s chunk_params_t;
+struct chunk_params_s
+{
+	unsigned int min;  // Minimum chunk size, no cut is made before this.
+	unsigned int avg;  // Target average chunk size, a power of 2.
+	unsigned int max;  // Maximum chunk size, a cut is always made here.
+
+	uint64 mask_small;  // Harder mask used before avg bytes.
+	uint64 mask_large;  // Easier mask used after avg bytes.
+};
+
+// Initialize content-defined chunking parameters.
+// Parameters:
+// - params: The parameters to initialize.
+// - avg: The target average chunk size. Rounded to a power of 2, the
+//        minimum and maximum sizes are derived from it.
+void chunk_params_init(chunk_params_t *params, unsigned int avg);
+
+// Find the next content-defined cut point using a Gear rolling hash
+// with normalized chunking (FastCDC). Cut points only depend on the
+// bytes since the previous cut, so identical content produces
+// identical chunks wherever it appears.
+// Parameters:
+// - params: The chunking parameters.
+// - data: Pointer to the start of the chunk.
+// - size: Number of bytes avaliable at data.
+//
+// Returns:
+// The length of the chunk starting at data, at most size.
+unsigned int chunk_next(const chunk_params_t *params, const byte *data, unsigned int size);
+
+#endif
@@ -0,0 +1,310 @@
+#include "compress.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPRESS_MAGIC "HVGZ"
+#define COMPRESS_VERSION 2
+#define MAX_OUTPUT 0xffffffffu  // most decompressed bytes unsigned offsets address
+
+struct compress_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;      // size of the compressed data
+	uint32 format;
+	uint32 count;     // number of checkpoints
+	uint32 out_size;  // size of the decompressed data
+	uint32 span;      // COMPRESS_SPAN when built
+	uint32 complete;
+	uint64 mtime;     // modification time of the file
+};
+
+static compressed_t *new_compressed(const byte *in, unsigned int size);
+static int add_point(compressed_t *compressed, unsigned int *const capacity, const inflate_t *st);
+
+int
+compress_detect(const byte *data, unsigned int size)
+{
+	if (inflate_is_gzip(data, size))
+		return CompressGzip;
+	if (size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd)
+		return CompressZstd;
+	return CompressNone;
+}
+
+const char *
+compress_name(int format)
+{
+	switch (format)
+	{
+	case CompressGzip: return "gzip";
+	case CompressZstd: return "zstd";
+	default: return "none";
+	}
+}
+
+compressed_t *
+compress_index(const byte *in, unsigned int size)
+{
+	compressed_t *compressed;
+	inflate_t *st;
+	unsigned int capacity;
+	int state;
+
+	compressed = new_compressed(in, size);
+	if (!compressed)
+		return NULL;
+
+	// the first checkpoint is the start, where decoding begins at the header
+	capacity = 0;
+	st = compressed->decoder;
+	st->out = 0;
+	st->pos = 0;
+	if (!add_point(compressed, &capacity, st))
+	{
+		compress_free(compressed);
+		return NULL;
+	}
+
+	inflate_begin(st, in, size);
+	state = st->state;
+	while (state != InflateEnd && state != InflateError && st->out < MAX_OUTPUT)
+	{
+		state = inflate_step(st);
+		if (state == InflateHeader && st->out - compressed->points[compressed->count - 1].out >= COMPRESS_SPAN &&
+			st->out < MAX_OUTPUT && !add_point(compressed, &capacity, st))
+		{
+			compress_free(compressed);
+			return NULL;
+		}
+	}
+
+	compressed->size = st->out < MAX_OUTPUT ? (unsigned int)st->out : MAX_OUTPUT;
+	compressed->complete = state == InflateEnd;
+
+	// reads start over from a checkpoint
+	st->state = InflateError;
+	return compressed;
+}
+
+int
+compress_save(const compressed_t *compressed, const char *path, uint64 mtime)
+{
+	sidecar_t *sidecar;
+	struct compress_header *header;
+	size_t points_size;
+
+	points_size = (size_t)compressed->count * sizeof(checkpoint_t);
+	sidecar = sidecar_create(path, sizeof(struct compress_header) + points_size + (size_t)compressed->count * INFLATE_WINDOW);
+	if (!sidecar)
+		return 0;
+
+	header = (struct compress_header *)sidecar->data;
+	memset(header, 0, sizeof(struct compress_header));
+	memcpy(header->magic, COMPRESS_MAGIC, sizeof(header->magic));
+	header->version = COMPRESS_VERSION;
+	header->size = compressed->in_size;
+	header->format = compressed->format;
+	header->count = compressed->count;
+	header->out_size = compressed->size;
+	header->span = COMPRESS_SPAN;
+	header->complete = compressed->complete;
+	header->mtime = mtime;
+
+	memcpy(sidecar->data + sizeof(struct compress_header), compressed->points, points_size);
+	memcpy(sidecar->data + sizeof(struct compress_header) + points_size, compressed->windows, (size_t)compressed->count * INFLATE_WINDOW);
+
+	sidecar_close(sidecar);
+	return 1;
+}
+
+compressed_t *
+compress_open(const byte *in, unsigned int size, const char *path, uint64 mtime)
+{
+	compressed_t *compressed;
+	sidecar_t *sidecar;
+	const struct compress_header *header;
+	const checkpoint_t *points;
+	unsigned int i;
+
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	header = (const struct compress_header *)sidecar->data;
+	if (sidecar->size < sizeof(struct compress_header) ||
+		memcmp(header->magic, COMPRESS_MAGIC, sizeof(header->magic)) ||
+		header->version != COMPRESS_VERSION || header->size != size || header->mtime != mtime ||
+		header->format != CompressGzip || header->span != COMPRESS_SPAN || !header->count ||
+		sidecar->size != sizeof(struct compress_header) + (size_t)header->count * (sizeof(checkpoint_t) + INFLATE_WINDOW))
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	// checkpoints outside the data would send reads astray
+	points = (const checkpoint_t *)(sidecar->data + sizeof(struct compress_header));
+	for (i = 0; i < header->count; i++)
+	{
+		if (points[i].bit > (uint64)size * 8 || points[i].out > header->out_size || (i && points[i].out <= points[i - 1].out))
+		{
+			sidecar_close(sidecar);
+			return NULL;
+		}
+	}
+
+	compressed = new_compressed(in, size);
+	if (!compressed)
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	compressed->size = header->out_size;
+	compressed->complete = header->complete;
+	compressed->points = points;
+	compressed->count = header->count;
+	compressed->windows = (const byte *)(points + header->count);
+	compressed->sidecar = sidecar;
+	return compressed;
+}
+
+void
+compress_free(compressed_t *compressed)
+{
+	if (!compressed) return;
+
+	if (compressed->sidecar)
+		sidecar_close(compressed->sidecar);
+	else
+	{
+		free((checkpoint_t *)compressed->points);
+		free((byte *)compressed->windows);
+	}
+	free(compressed->decoder);
+	free(compressed);
+}
+
+unsigned int
+compress_read(void *arg, unsigned int off, byte *out, unsigned int len)
+{
+	compressed_t *compressed;
+	inflate_t *st;
+	uint64 at, start;
+	unsigned int done, n, lo, hi, mid;
+
+	compressed = arg;
+	st = compressed->decoder;
+	if (off >= compressed->size)
+		return 0;
+	if (len > compressed->size - off)
+		len = compressed->size - off;
+
+	// going on is cheaper than starting over while the decoder is less
+	// than a span behind, as when reading chunk after chunk
+	if (st->state == InflateError || st->out - st->pos > off || st->out + COMPRESS_SPAN < off)
+	{
+		lo = 0;
+		hi = compressed->count;
+		while (hi - lo > 1)
+		{
+			mid = lo + (hi - lo) / 2;
+			if (compressed->points[mid].out <= off)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if (!lo)
+			inflate_begin(st, compressed->in, compressed->in_size);
+		else
+			inflate_resume(st, compressed->in, compressed->in_size, compressed->points[lo].bit, compressed->points[lo].out,
+				compressed->windows + (size_t)lo * INFLATE_WINDOW);
+	}
+
+	// the buffer holds the output from start to st->out
+	done = 0;
+	for (;;)
+	{
+		at = (uint64)off + done;
+		start = st->out - st->pos;
+		if (at >= start && at < st->out)
+		{
+			n = st->out - at < len - done ? (unsigned int)(st->out - at) : len - done;
+			memcpy(out + done, st->buffer + (at - start), n);
+			done += n;
+		}
+
+		if (done == len || st->state == InflateEnd || st->state == InflateError)
+			return done;
+		inflate_step(st);
+	}
+}
+
+// Allocate an empty index and the decoder used with it
+static compressed_t *
+new_compressed(const byte *in, unsigned int size)
+{
+	compressed_t *compressed;
+
+	compressed = malloc(sizeof(compressed_t));
+	if (!compressed)
+		return NULL;
+
+	compressed->decoder = malloc(sizeof(inflate_t));
+	if (!compressed->decoder)
+	{
+		free(compressed);
+		return NULL;
+	}
+
+	compressed->format = CompressGzip;
+	compressed->in = in;
+	compressed->in_size = size;
+	compressed->size = 0;
+	compressed->complete = 0;
+	compressed->points = NULL;
+	compressed->count = 0;
+	compressed->windows = NULL;
+	compressed->sidecar = NULL;
+	compressed->decoder->state = InflateError;
+	return compressed;
+}
+
+// Add a checkpoint where the decoder is, at the start of a block.
+// Returns 0 if memory could not be allocated.
+static int
+add_point(compressed_t *compressed, unsigned int *const capacity, const inflate_t *st)
+{
+	checkpoint_t *points;
+	byte *windows;
+	unsigned int window;
+
+	if (compressed->count == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 64;
+		points = realloc((checkpoint_t *)compressed->points, *capacity * sizeof(checkpoint_t));
+		if (!points)
+			return 0;
+		compressed->points = points;
+
+		windows = realloc((byte *)compressed->windows, (size_t)*capacity * INFLATE_WINDOW);
+		if (!windows)
+			return 0;
+		compressed->windows = windows;
+	}
+
+	points = (checkpoint_t *)compressed->points;
+	windows = (byte *)compressed->windows + (size_t)compressed->count * INFLATE_WINDOW;
+	points[compressed->count].bit = st->out ? inflate_bit(st) : 0;
+	points[compressed->count].out = st->out;
+
+	// the window is kept from its start, zero past the output there is
+	window = st->out < INFLATE_WINDOW ? (unsigned int)st->out : INFLATE_WINDOW;
+	memcpy(windows, st->buffer + st->pos - window, window);
+	memset(windows + window, 0, INFLATE_WINDOW - window);
+
+	compressed->count++;
+	return 1;
+}
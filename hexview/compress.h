@@ -0,0 +1,109 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "defs.h"
+#include "inflate.h"
+#include "sidecar.h"
+
+#define COMPRESS_EXT ".hvgz"
+#define COMPRESS_SPAN 4194304  // least output between checkpoints
+
+enum
+{
+	CompressNone = 0,
+	CompressGzip,
+	CompressZstd   // recognized, but there is no decoder
+};
+
+// A place decoding can start from without what comes before it
+typedef struct checkpoint_s checkpoint_t;
+struct checkpoint_s
+{
+	uint64 bit;  // Position of a block in bits from the start of the compressed data.
+	uint64 out;  // Bytes of output before the block.
+};
+
+typedef struct compressed_s compressed_t;
+struct compressed_s
+{
+	int format;
+	const byte *in;          // The compressed data.
+	unsigned int in_size;
+	unsigned int size;       // Size of the decompressed data, clipped to what offsets can address.
+	int complete;            // all of the data decoded without error and fit
+
+	const checkpoint_t *points;  // Checkpoints by increasing out, the first at the start.
+	unsigned int count;
+	const byte *windows;     // The INFLATE_WINDOW bytes of output before each checkpoint.
+
+	sidecar_t *sidecar;      // mapping holding the checkpoints and windows, or NULL if built in memory
+	inflate_t *decoder;      // decoder used to read, left where the last read stopped
+};
+
+// Recognize compressed data from its magic.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+//
+// Returns:
+// The format, or CompressNone if it is not recognized.
+int compress_detect(const byte *data, unsigned int size);
+
+// Returns the name of a compression format, such as "gzip".
+const char *compress_name(int format);
+
+// Index gzip data by decoding all of it once, keeping a checkpoint at
+// the first block boundary after every COMPRESS_SPAN bytes of output.
+// Data which ends early or is malformed is indexed up to where it
+// stops.
+// Parameters:
+// - in: The compressed data, which must stay valid until the index is
+//       freed.
+// - size: The size of the compressed data.
+//
+// Returns:
+// The index, or NULL if memory could not be allocated.
+compressed_t *compress_index(const byte *in, unsigned int size);
+
+// Store an index in a sidecar, so compress_open can skip decoding.
+// Parameters:
+// - compressed: The index to store.
+// - path: The path of the sidecar to create.
+// - mtime: The modification time of the file, see sidecar_file_time.
+//
+// Returns:
+// Nonzero if the sidecar was written.
+int compress_save(const compressed_t *compressed, const char *path, uint64 mtime);
+
+// Open a sidecar created with compress_save.
+// Parameters:
+// - in: The compressed data, which must stay valid until the index is
+//       freed.
+// - size: The size of the compressed data.
+// - path: The path of the sidecar.
+// - mtime: The modification time of the file as it is now.
+//
+// Returns:
+// The index, or NULL if there is no sidecar, it describes data of
+// another size or modification time, or memory could not be allocated.
+compressed_t *compress_open(const byte *in, unsigned int size, const char *path, uint64 mtime);
+
+// Free an index.
+// Parameters:
+// - compressed: The index to free, can be NULL.
+void compress_free(compressed_t *compressed);
+
+// Decompress part of the data, starting from the last checkpoint before
+// it, or going on from the previous read when that is closer. Nothing
+// is allocated, so it can fill a file made with file_lazy.
+// Parameters:
+// - arg: The index.
+// - off: The offset in the decompressed data of the first byte to read.
+// - out: Destination of the bytes.
+// - len: The number of bytes to read.
+//
+// Returns:
+// The number of bytes read, fewer if the data ends or is malformed.
+unsigned int compress_read(void *arg, unsigned int off, byte *out, unsigned int len);
+
+#endif
@@ -7,9 +7,64 @@
 #include "file.h"
 #include "util.h"
 #include "pattern.h"
+#include "strscan.h"
+#include "hash.h"
+#include "dupes.h"
+#include "simhash.h"
+#include "suffix.h"
+#include "bloom.h"
+#include "render.h"
+#include "tui.h"
+#include "minimap.h"
+#include "numeric.h"
+#include "template.h"
+#include "query.h"
+#include "formats.h"
+#include "symbols.h"
+#include "archive.h"
+#include "compress.h"
+#include "process.h"
+#include "diff.h"
+#include "align.h"
+#include "merkle.h"
+#include "piece.h"
+#include "journal.h"
 
 #define BYTES_TO_DISPLAY 128
+#define PEEK_WIDTH 16
+#define MAX_PEEK_WIDTH 256
 #define MAX_FIND_ITERATIONS 8
+#define MAX_STRINGS_LISTED 32
+#define DEFAULT_MIN_STRLEN 4
+#define DEFAULT_CHUNK_SIZE 8192
+#define DEFAULT_DUPES_LISTED 16
+#define MAX_DUPE_OFFSETS_LISTED 6
+#define MAX_SIMHASH_MATCHES 5
+#define DEFAULT_MIN_REPEAT 8
+#define DEFAULT_REPEATS_LISTED 16
+#define MAX_REPEAT_PREVIEW 48
+#define MAX_PATH_SIZE 4096
+#define MAX_FIND_GRAMS 64
+#define MAP_COLUMNS 64
+#define DEFAULT_MAP_ROWS 16
+#define MAX_MAP_ROWS 256
+#define MAX_DARR_LISTED 256
+#define DARR_BLOCK 4096
+#define MAX_HISTOGRAM_BAR 40
+#define HISTOGRAM_BAR "########################################"
+#define PLOT_LABEL_COLUMNS 13
+#define MIN_PLOT_HEIGHT 4
+#define MAX_PLOT_HEIGHT 64
+#define MAX_DECODE_LISTED 256
+#define DECODE_BLOCK 1024
+#define MAX_DECODE_LINE 4096
+#define DEFAULT_WHERE_LISTED 16
+#define MAX_SECTIONS_LISTED 64
+#define MAX_SYMBOL_LABEL 64    // longer names are cut, C++ names can be very long
+#define MAX_MEMBERS_LISTED 64
+#define DEFAULT_DIFFS_LISTED 16
+#define MAX_EDIT_BYTES 16  // most bytes of an edit echoed back
+#define DEFAULT_REPLACE_CONFIRM 1000  // most matches replaced without asking first
 #define sayhelp printf("Invalid usage, try \033[95mhelp\033[m.\n")
 
 typedef int(*cmd_exec_fn)(state_t *, token_list_t *);
@@ -22,13 +77,65 @@ struct cmd
 	struct cmd *next;
 };
 
+// A file or member left by enter, restored by leave
+struct view
+{
+	file_t *file;
+	unsigned int off;
+	char *member;  // name of the member entered from this view
+	int format;
+	sections_t *sections;
+	symbols_t *symbols;
+	suffix_t *suffix;
+	bloom_t *bloom;
+	strindex_t *strings;
+	archive_t *archive;
+	compressed_t *compressed;
+	file_t *other;
+	diff_t *diff;
+	unsigned int record_base;
+	unsigned int record_stride;
+	unsigned int record_count;
+	plan_t *record_plan;
+
+	struct view *next;
+};
+
 struct state_s
 {
 	file_t *file;
+	char *filename;
 	alist_t *bindings;
 	unsigned int off;
 	int current_endianess;
 	int max_strlen;
+	strindex_t *strings;  // index built by the strings command
+	alist_t *digests;     // digests bound by the hash command, as hex strings
+	simdb_t *simdb;       // database used by the simhash command
+	suffix_t *suffix;     // suffix array sidecar, used by find when present
+	bloom_t *bloom;       // block Bloom filter sidecar, used by find when present
+	template_t *templates;  // structs loaded by the struct command
+	unsigned int record_base;    // offset of the first record used by where
+	unsigned int record_stride;  // size of a record, 0 until set by the records command
+	unsigned int record_count;   // number of records
+	plan_t *record_plan;         // struct the records were set from, or NULL
+	int format;                  // container format recognized when the file was opened
+	sections_t *sections;        // sections of the format, indexed on first use
+	symbols_t *symbols;          // symbols of an ELF file, loaded on first use
+	archive_t *archive;          // members of an archive, indexed by enter
+	compressed_t *compressed;    // checkpoints of the compressed data the file is decompressed from
+	process_t *process;          // process whose memory is viewed instead of a file, or NULL
+	file_t *other;               // file compared with by cmp
+	diff_t *diff;                // differences from the other file
+	merkle_t *tree;              // block hashes of the file, when its sidecar is present
+	merkle_range_t *changes;     // blocks changed since the tree was saved
+	unsigned int nchanges;
+	pieces_t *pieces;            // edits not saved yet, the file is viewed through them, or NULL
+	file_t *base;                // the file as opened while it is edited
+	journal_t *journal;          // the edits made, for undo and redo, logged next to the file
+	int interrupted;             // the edits were replayed over a file a save was interrupted writing
+	int dropping;                // exit was asked for once with edits not saved
+	struct view *views;          // views left by enter, the innermost first
 
 	struct cmd *first;  // linked list of avaliable commands
 };
@@ -47,6 +154,74 @@ static int help_cmd(state_t *state, token_list_t *tokens);
 static int bind_cmd(state_t *state, token_list_t *tokens);
 static int jump_cmd(state_t *state, token_list_t *tokens);
 static int find_cmd(state_t *state, token_list_t *tokens);
+static int strings_cmd(state_t *state, token_list_t *tokens);
+static int hash_cmd(state_t *state, token_list_t *tokens);
+static int dupes_cmd(state_t *state, token_list_t *tokens);
+static int simhash_cmd(state_t *state, token_list_t *tokens);
+static int index_cmd(state_t *state, token_list_t *tokens);
+static int repeats_cmd(state_t *state, token_list_t *tokens);
+static int dump_cmd(state_t *state, token_list_t *tokens);
+static int view_cmd(state_t *state, token_list_t *tokens);
+static int map_cmd(state_t *state, token_list_t *tokens);
+static int plot_cmd(state_t *state, token_list_t *tokens);
+static int struct_cmd(state_t *state, token_list_t *tokens);
+static int decode_cmd(state_t *state, token_list_t *tokens);
+static int records_cmd(state_t *state, token_list_t *tokens);
+static int where_cmd(state_t *state, token_list_t *tokens);
+static int format_cmd(state_t *state, token_list_t *tokens);
+static int enter_cmd(state_t *state, token_list_t *tokens);
+static int leave_cmd(state_t *state, token_list_t *tokens);
+static int cmp_cmd(state_t *state, token_list_t *tokens);
+static int changes_cmd(state_t *state, token_list_t *tokens);
+static int poke_cmd(state_t *state, token_list_t *tokens);
+static int write_cmd(state_t *state, token_list_t *tokens);
+static int fill_cmd(state_t *state, token_list_t *tokens);
+static int insert_cmd(state_t *state, token_list_t *tokens);
+static int delete_cmd(state_t *state, token_list_t *tokens);
+static int save_cmd(state_t *state, token_list_t *tokens);
+static int undo_cmd(state_t *state, token_list_t *tokens);
+static int redo_cmd(state_t *state, token_list_t *tokens);
+static int journal_cmd(state_t *state, token_list_t *tokens);
+static int replace_cmd(state_t *state, token_list_t *tokens);
+
+static void print_map(minimap_t *map, unsigned int mark, char *line);
+static void print_stats(numeric_stats_t *stats, int type, double elapsed);
+static int put_char(char *const out, unsigned int c, unsigned int limit);
+static int parse_field(state_t *state, const char *s, query_field_t *const out);
+static sections_t *get_sections(state_t *state);
+static unsigned int symbol_label(state_t *state, unsigned int off, char *const out);
+static void print_match(state_t *state, unsigned int count, unsigned int off);
+static archive_t *get_archive(state_t *state);
+static void free_indexes(state_t *state);
+static int enter_view(state_t *state, file_t *file, const char *name);
+static void enter_compressed(state_t *state, int format);
+static void print_compressed(state_t *state);
+static void close_on_state(state_t *state);
+static void bind_regions(state_t *state);
+static int find_process(state_t *state, pattern_t *pattern, unsigned int count);
+static void print_diff(state_t *state, const diff_range_t *range);
+static void check_tree(state_t *state, const char *filename);
+static void leave_view(state_t *state);
+static byte *parse_bytes(token_list_t *it, unsigned int *const len);
+static unsigned int overwritten(state_t *state, unsigned int off, unsigned int len);
+static int edit_file(state_t *state, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size);
+static int begin_edit(state_t *state);
+static int splice_file(state_t *state, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size);
+static int end_edit(state_t *state);
+static int show_edits(state_t *state);
+static int apply_ops(state_t *state, unsigned int first, unsigned int last, int undo);
+static int step_journal(state_t *state, int undo);
+static int replace_matches(state_t *state, const unsigned int *matches, unsigned int count, unsigned int old_size, pattern_t *value, unsigned int new_size);
+static void check_journal(state_t *state, const char *filename);
+static int reopen_file(state_t *state, char *filename, unsigned int off);
+static void print_edit(state_t *state, const char *verb, unsigned int off, const byte *bytes, unsigned int len);
+static int add_field(query_t *query, const query_field_t *field);
+static void print_field(state_t *state, const query_field_t *field, unsigned int record);
+static int find_indexed(state_t *state, pattern_t *pattern, unsigned int count);
+static int find_blocks(state_t *state, pattern_t *pattern, unsigned int count);
+
+static int parse_uint(const char *s, unsigned int *const out);
+static int parse_range(state_t *state, token_list_t **it, unsigned int *const start, unsigned int *const len);
 
 state_t *
 create_state()
@@ -56,6 +231,7 @@ create_state()
 		return NULL;
 
 	state->file = NULL;
+	state->filename = NULL;
 	state->bindings = alist_create(STRCMP, STRCPY, STRFREE, NULL, NULL);
 	if (!state->bindings)
 	{
@@ -63,9 +239,43 @@ create_state()
 		return NULL;
 	}
 
+	state->digests = alist_create(STRCMP, STRCPY, STRFREE, STRCPY, STRFREE);
+	if (!state->digests)
+	{
+		alist_free(state->bindings);
+		free(state);
+		return NULL;
+	}
+
 	state->off = 0;
 	state->current_endianess = NATIVE_ENDIANESS;
 	state->max_strlen = 32;
+	state->strings = NULL;
+	state->simdb = NULL;
+	state->suffix = NULL;
+	state->bloom = NULL;
+	state->templates = NULL;
+	state->record_base = 0;
+	state->record_stride = 0;
+	state->record_count = 0;
+	state->record_plan = NULL;
+	state->format = FormatNone;
+	state->sections = NULL;
+	state->symbols = NULL;
+	state->archive = NULL;
+	state->compressed = NULL;
+	state->process = NULL;
+	state->other = NULL;
+	state->diff = NULL;
+	state->tree = NULL;
+	state->changes = NULL;
+	state->nchanges = 0;
+	state->pieces = NULL;
+	state->base = NULL;
+	state->journal = NULL;
+	state->interrupted = 0;
+	state->dropping = 0;
+	state->views = NULL;
 	state->first = NULL;
 
 	create_cmd(state, &exit_cmd, "exit");
@@ -80,6 +290,35 @@ create_state()
 	create_cmd(state, &bind_cmd, "bind");
 	create_cmd(state, &jump_cmd, "jump");
 	create_cmd(state, &find_cmd, "find");
+	create_cmd(state, &strings_cmd, "strings");
+	create_cmd(state, &hash_cmd, "hash");
+	create_cmd(state, &dupes_cmd, "dupes");
+	create_cmd(state, &simhash_cmd, "simhash");
+	create_cmd(state, &index_cmd, "index");
+	create_cmd(state, &repeats_cmd, "repeats");
+	create_cmd(state, &dump_cmd, "dump");
+	create_cmd(state, &view_cmd, "view");
+	create_cmd(state, &map_cmd, "map");
+	create_cmd(state, &plot_cmd, "plot");
+	create_cmd(state, &struct_cmd, "struct");
+	create_cmd(state, &decode_cmd, "decode");
+	create_cmd(state, &records_cmd, "records");
+	create_cmd(state, &where_cmd, "where");
+	create_cmd(state, &format_cmd, "format");
+	create_cmd(state, &enter_cmd, "enter");
+	create_cmd(state, &leave_cmd, "leave");
+	create_cmd(state, &cmp_cmd, "cmp");
+	create_cmd(state, &changes_cmd, "changes");
+	create_cmd(state, &poke_cmd, "poke");
+	create_cmd(state, &write_cmd, "write");
+	create_cmd(state, &fill_cmd, "fill");
+	create_cmd(state, &insert_cmd, "insert");
+	create_cmd(state, &delete_cmd, "delete");
+	create_cmd(state, &save_cmd, "save");
+	create_cmd(state, &undo_cmd, "undo");
+	create_cmd(state, &redo_cmd, "redo");
+	create_cmd(state, &journal_cmd, "journal");
+	create_cmd(state, &replace_cmd, "replace");
 
 	return state;
 }
@@ -89,8 +328,10 @@ destroy_state(state_t *state)
 {
 	struct cmd *cmd;
 
-	if (state->file)
-		close_file(state->file);
+	close_on_state(state);
+	alist_free(state->digests);
+	simdb_free(state->simdb);
+	template_free(state->templates);
 
 	while (state->first)
 	{
@@ -106,13 +347,10 @@ int
 open_file_on_state(state_t *state, const char *filename)
 {
 	char sizestr[16];
+	char path[MAX_PATH_SIZE];
+	uint64 mtime;
 
-	if (state->file)
-	{
-		close_file(state->file);
-		state->file = NULL;
-	}
-
+	close_on_state(state);
 	if (!filename)
 		return 1;
 
@@ -120,6 +358,15 @@ open_file_on_state(state_t *state, const char *filename)
 	if (!state->file)
 		return 0;
 
+	state->filename = malloc(strlen(filename) + 1);
+	if (!state->filename)
+	{
+		close_file(state->file);
+		state->file = NULL;
+		return 0;
+	}
+	strcpy(state->filename, filename);
+
 	/* make file size string */
 	if (state->file->size < 1024)
 		snprintf(sizestr, sizeof(sizestr), "%d B", state->file->size);
@@ -132,6 +379,82 @@ open_file_on_state(state_t *state, const char *filename)
 	printf("Size: \033[94m%s\033[m [\033[92m0x00000000\033[m, \033[92m0x%08x\033[m)\n", sizestr, state->file->size);
 	printf("Mode is %s endian.\n", state->current_endianess == LittleEndian ? "little" : "big");
 
+	// only the signature is checked now, headers are parsed on first use
+	state->format = format_detect(state->file->data, state->file->size);
+	if (state->format != FormatNone)
+		printf("Format: \033[94m%s\033[m, use \033[95mformat\033[m to list its sections.\n", format_name(state->format));
+	print_compressed(state);
+	check_tree(state, filename);
+	check_journal(state, filename);
+
+	// pick up indexes left by a previous session, of the file as saved
+	if (state->pieces || !sidecar_file_time(filename, &mtime))
+		return 1;
+
+	if (sidecar_path(filename, SUFFIX_EXT, path, sizeof(path)))
+	{
+		state->suffix = suffix_open(path, state->file->size, mtime);
+		if (state->suffix)
+			printf("Using suffix array index \033[33m'%s'\033[m\n", path);
+	}
+
+	if (sidecar_path(filename, BLOOM_EXT, path, sizeof(path)))
+	{
+		state->bloom = bloom_open(path, state->file->size, mtime);
+		if (state->bloom)
+			printf("Using block index \033[33m'%s'\033[m\n", path);
+	}
+
+	return 1;
+}
+
+int
+open_process_on_state(state_t *state, int pid)
+{
+	char path[32];
+	process_t *process;
+
+	close_on_state(state);
+
+	process = process_open(pid);
+	if (!process)
+		return 0;
+
+	if (!process->size)
+	{
+		printf("The process has no readable mappings.\n");
+		process_free(process);
+		return 0;
+	}
+
+	state->file = file_lazy(process->size, &process_read, process);
+	if (!state->file)
+	{
+		process_free(process);
+		return 0;
+	}
+
+	// sidecars of the process would go in /proc, where they cannot be made
+	snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+	state->filename = malloc(strlen(path) + 1);
+	if (!state->filename)
+	{
+		close_file(state->file);
+		state->file = NULL;
+		process_free(process);
+		return 0;
+	}
+	strcpy(state->filename, path);
+	state->process = process;
+
+	printf("Process: \033[94m%d\033[m\n", pid);
+	printf("Size: \033[94m%u MiB\033[m in \033[94m%u\033[m readable mappings [\033[92m0x00000000\033[m, \033[92m0x%08x\033[m)\n",
+		process->size / 1024 / 1024, process->count, process->size);
+	if (process->clipped)
+		printf("Mappings past the first 4 GiB are not shown.\n");
+	printf("Mode is %s endian.\n", state->current_endianess == LittleEndian ? "little" : "big");
+	bind_regions(state);
+
 	return 1;
 }
 
@@ -176,13 +499,30 @@ create_cmd(state_t *state, cmd_exec_fn proc, const char *name)
 static int
 exit_cmd(state_t *state, token_list_t *tokens)
 {
+	if (state->pieces && !state->dropping)
+	{
+		if (state->journal->log)
+			printf("There are edits not saved, \033[95msave\033[m them or \033[95mexit\033[m again to replay them from the edit log when the file is opened next.\n");
+		else
+			printf("There are edits not saved, \033[95msave\033[m them or \033[95mexit\033[m again to drop them.\n");
+		state->dropping = 1;
+		return Continue;
+	}
+
 	return Exit;
 }
 
 static int
 tell_cmd(state_t *state, token_list_t *tokens)
 {
+	char label[MAX_SYMBOL_LABEL + 16];
+
 	printf("Offset: \033[92m0x%08x\033[m\nSize:   \033[92m0x%08x\033[m\n", state->off, state->file->size);
+	if (symbol_label(state, state->off, label))
+		printf("%s \033[33m%s\033[m\n", state->process && !state->views ? "Address:" : "Symbol:", label);
+	if (state->views)
+		printf("Member: \033[33m'%s'\033[m, \033[95mleave\033[m returns to the %s\n", state->views->member,
+			state->compressed ? "compressed file" : "archive");
 	return Continue;
 }
 
@@ -261,71 +601,72 @@ seek_cmd(state_t *state, token_list_t *tokens)
 static int
 peek_cmd(state_t *state, token_list_t *tokens)
 {
-	unsigned int i, at;
-	unsigned int m;
-	unsigned int j;
-	unsigned char c;
+	token_list_t *it;
+	unsigned int rows, width, row, at;
+	char label[MAX_SYMBOL_LABEL + 16];
+	char *buf, *p;
+	size_t len;
+	int color;
 
-	printf("           ");
-	printf("\033[4m");
-	for (i = 0; i < 16; i++)
-		printf(" %02x", i);
-	printf("\033[m\n");
+	width = PEEK_WIDTH;
+	rows = 0;
 
-	for (i = 0; i < BYTES_TO_DISPLAY; i++)
+	for (it = offset_token(tokens, 1); it; it = it->next)
 	{
-		at = state->off + i;
-		m = i % 16;
-		if (at >= state->file->size)
+		if (!strcmp(it->token.string, "--rows") && it->next && parse_uint(it->next->token.string, &rows))
+			it = it->next;
+		else if (!strcmp(it->token.string, "--width") && it->next && parse_uint(it->next->token.string, &width))
+			it = it->next;
+		else
 		{
-			for (j = m; j < 16; j++)
-				printf(" \033[41m??\033[m");
-
-			printf("   ");
-			for (j = 0; j < m; j++)
-			{
-				c = state->file->data[state->off + i + j - m];
-				if (c < 0x20 || c == 0x7f)
-					putchar('.');
-				else
-					putchar(c);
-			}
-			break;
+			sayhelp;
+			return Continue;
 		}
+	}
 
-		if (m == 0)
-		{
-			if (i > 0)
-			{
-				printf("   ");
-				for (j = 0; j < 16; j++)
-				{
-					c = state->file->data[state->off + i + j - 16];
-					if (c < 0x20 || c == 0x7f)
-						putchar('.');
-					else
-						putchar(c);
-				}
-				putchar('\n');
-			}
-			printf("\033[90m0x%08x \033[m", at);
-		}
-		printf(" %02hhx", state->file->data[at]);
+	if (!width || width > MAX_PEEK_WIDTH)
+	{
+		printf("Width must be between 1 and %d.\n", MAX_PEEK_WIDTH);
+		return Continue;
+	}
+
+	if (!rows)
+		rows = (BYTES_TO_DISPLAY + width - 1) / width;
+
+	// rows past the end of the file are never rendered
+	if (rows > state->file->size / width + 1)
+		rows = state->file->size / width + 1;
+
+	// rows of an ELF file end with the symbol they are in
+	buf = malloc(render_peek_size(rows, width) + (size_t)rows * (sizeof(label) + 16));
+	if (!buf)
+	{
+		printf("Out of memory.\n");
+		return Continue;
 	}
 
-	if (at < state->file->size)
+	color = render_is_tty();
+	if (state->format != FormatElf)
+		len = render_peek(state->file->data, state->file->size, state->off, rows, width, color, buf);
+	else
 	{
-		printf("   ");
-		for (j = 0; j < 16; j++)
+		p = buf + render_peek_header(width, color, buf);
+		*p++ = '\n';
+		for (row = 0; row < rows || row == 0; row++)
 		{
-			c = state->file->data[state->off + i + j - 16];
-			if (c < 0x20 || c == 0x7f)
-				putchar('.');
-			else
-				putchar(c);
+			at = state->off + row * width;
+			p += render_peek_row(state->file->data, state->file->size, at, width, color, p);
+			if (at < state->file->size && symbol_label(state, at, label))
+				p += sprintf(p, color ? "   \033[33m%s\033[m" : "   %s", label);
+			*p++ = '\n';
+
+			if (at >= state->file->size || state->file->size - at <= width)
+				break;
 		}
+		len = p - buf;
 	}
-	putchar('\n');
+	render_write(buf, len);
+	free(buf);
 
 	return Continue;
 }
@@ -482,142 +823,138 @@ static int
 darr_cmd(state_t *state, token_list_t *tokens)
 {
 	token_list_t *it;
-	int elemtype, elemsize;
-	int arrlen;
-	int i;
-	byte *loc;
-	value_u *inval;
-	outvalues_t outval;
+	numeric_stats_t stats;
+	const char *path;
+	FILE *fp;
+	value_u *native;
+	char *out, *p;
+	unsigned int arrlen, avail, listed, pos, len, i;
+	int type, size, all, summary, format, result;
+	double begin, elapsed;
 
 	it = offset_token(tokens, 1);
-	if (!it)
+	if (!it || (type = numeric_type(it->token.string)) < 0)
 	{
 		sayhelp;
 		return Continue;
 	}
 
-	if (!strcmp(it->token.string, "int8"))
-		elemtype = Int8;
-	else if (!strcmp(it->token.string, "uint8"))
-		elemtype = Uint8;
-	else if (!strcmp(it->token.string, "int16"))
-		elemtype = Int16;
-	else if (!strcmp(it->token.string, "uint16"))
-		elemtype = Uint16;
-	else if (!strcmp(it->token.string, "int32"))
-		elemtype = Int32;
-	else if (!strcmp(it->token.string, "uint32"))
-		elemtype = Uint32;
-	else if (!strcmp(it->token.string, "int64"))
-		elemtype = Int64;
-	else if (!strcmp(it->token.string, "uint64"))
-		elemtype = Uint64;
-	else if (!strcmp(it->token.string, "float32") || !strcmp(it->token.string, "float"))
-		elemtype = Float32;
-	else if (!strcmp(it->token.string, "float64") || !strcmp(it->token.string, "double"))
-		elemtype = Float64;
-	else if (!strcmp(it->token.string, "char8"))
-		elemtype = Char8;
-	else if (!strcmp(it->token.string, "char16"))
-		elemtype = Char16;
-	else
+	it = it->next;
+	if (!it || !parse_uint(it->token.string, &arrlen))
 	{
 		sayhelp;
 		return Continue;
 	}
 
-	switch (elemtype)
+	all = 0;
+	summary = 0;
+	format = -1;
+	path = NULL;
+	for (it = it->next; it; it = it->next)
 	{
-	case Int8:
-	case Uint8:
-	case Char8:
-		elemsize = 1;
-		break;
-	case Int16:
-	case Uint16:
-	case Char16:
-		elemsize = 2;
-		break;
-	case Int32:
-	case Uint32:
-	case Float32:
-		elemsize = 4;
-		break;
-	case Int64:
-	case Uint64:
-	case Float64:
-		elemsize = 8;
-		break;
+		if (!strcmp(it->token.string, "--all"))
+			all = 1;
+		else if (!strcmp(it->token.string, "--stats"))
+			summary = 1;
+		else if (!strcmp(it->token.string, "--csv") && it->next)
+			format = ExportCsv;
+		else if (!strcmp(it->token.string, "--ndjson") && it->next)
+			format = ExportNdjson;
+		else if (!strcmp(it->token.string, "--raw") && it->next)
+			format = ExportRaw;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		if (format >= 0 && !path)
+		{
+			it = it->next;
+			path = it->token.string;
+		}
 	}
 
-	it = offset_token(it, 1);
-	if (!it)
+	size = numeric_size(type);
+	avail = (state->file->size - state->off) / size;
+	if (arrlen > avail)
 	{
-		sayhelp;
-		return Continue;
+		printf("Only %u elements fit before the end of the file.\n", avail);
+		arrlen = avail;
 	}
 
-	arrlen = it->token.integer;
-	if (arrlen < 0)
+	if (path)
 	{
-		printf("Invalid array length.\n");
-		return Continue;
+		fp = fopen(path, "wb");
+		if (!fp)
+		{
+			printf("Failed to open \033[33m'%s'\033[m\n", path);
+			return Continue;
+		}
+
+		begin = time_now();
+		result = numeric_export(state->file->data + state->off, arrlen, type, state->current_endianess, format, fp);
+		elapsed = time_now() - begin;
+		fclose(fp);
+
+		if (result)
+			printf("Wrote \033[92m%u\033[m elements to \033[33m'%s'\033[m in %.1f ms\n", arrlen, path, elapsed * 1000.0);
+		else
+			printf("Failed to write \033[33m'%s'\033[m\n", path);
+	}
+
+	if (summary)
+	{
+		begin = time_now();
+		result = numeric_stats(state->file->data + state->off, arrlen, type, state->current_endianess, &stats);
+		elapsed = time_now() - begin;
+
+		if (result)
+			print_stats(&stats, type, elapsed);
+		else
+			printf("Failed to allocate memory.\n");
 	}
 
-	printf("[");
+	if (path || summary)
+		return Continue;
 
-	for (i = 0; i < arrlen; i++)
+	// values are decoded and formatted a block at a time
+	listed = all || arrlen <= MAX_DARR_LISTED ? arrlen : MAX_DARR_LISTED;
+	native = malloc(DARR_BLOCK * sizeof(value_u));
+	out = malloc(DARR_BLOCK * (NUMERIC_MAX_CHARS + 1) + 2);
+	if (!native || !out)
 	{
-		loc = state->file->data + state->off + (i * elemsize);
-		if (loc + elemtype > state->file->data + state->off + state->file->size)
-			break;
-		inval = (value_u *)loc;
+		printf("Failed to allocate memory.\n");
+		free(native);
+		free(out);
+		return Continue;
+	}
 
-		to_native_endianess(inval, 8, state->current_endianess, &outval);
+	fputc('[', stdout);
+	for (pos = 0; pos < listed; pos += len)
+	{
+		len = listed - pos < DARR_BLOCK ? listed - pos : DARR_BLOCK;
+		numeric_decode(state->file->data + state->off + (size_t)pos * size, len, type, state->current_endianess, native);
 
-		switch (elemtype)
+		p = out;
+		for (i = 0; i < len; i++)
 		{
-		case Int8:
-			printf(" %hhd", outval.i8);
-			break;
-		case Uint8:
-			printf(" %hhd", outval.ui8);
-			break;
-		case Int16:
-			printf(" %hd", outval.i16);
-			break;
-		case Uint16:
-			printf(" %hu", outval.ui16);
-			break;
-		case Int32:
-			printf(" %d", outval.i32);
-			break;
-		case Uint32:
-			printf(" %u", outval.ui32);
-			break;
-		case Int64:
-			printf(" %lld", outval.i64);
-			break;
-		case Uint64:
-			printf(" %llu", outval.ui64);
-			break;
-		case Float32:
-			printf(" %g", (double)outval.f32);
-			break;
-		case Float64:
-			printf(" %g", (double)outval.f64);
-			break;
-		case Char8:
-			printf(" %c", *outval.char8);
-			break;
-		case Char16:
-			wprintf(L" %lc", *outval.char16);
-			break;
+			*p++ = ' ';
+			if (type == Char8 || type == Char16)
+				p += put_char(p, type == Char8 ? ((uint8 *)native)[i] : ((uint16 *)native)[i], type == Char8 ? 0x80 : 0x10000);
+			else
+				p += numeric_format((byte *)native + (size_t)i * size, type, p);
 		}
+		fwrite(out, 1, p - out, stdout);
 	}
-
 	printf(" ]\n");
 
+	if (listed < arrlen)
+		printf("%u more, use \033[33m--all\033[m to list them or \033[33m--stats\033[m to summarize.\n", arrlen - listed);
+
+	free(native);
+	free(out);
+
 	return Continue;
 }
 
@@ -628,7 +965,8 @@ help_cmd(state_t *state, token_list_t *tokens)
 	printf(" Exit the program\n\n");
 
 	printf("\033[95mtell\033[m\n");
-	printf(" Display current offset and file size\n\n");
+	printf(" Display current offset and file size, and for ELF files the symbol the\n");
+	printf(" offset is in as symbol+0xNN.\n\n");
 
 	printf("\033[95mseek\033[m [\033[92m<offset>\033[m|\033[33mend\033[m]\n");
 	printf(" Seeks to a new location in the file. Supports decimal, hexadecimal, and\n");
@@ -637,8 +975,10 @@ help_cmd(state_t *state, token_list_t *tokens)
 	printf(" '+' or '-' to do a relative seek. Use 'end' to seek to the end of the\n");
 	printf(" file while still displaying as many bytes as possible.\n\n");
 
-	printf("\033[95mpeek\033[m\n");
-	printf(" Displays bytes at the current seek location.\n\n");
+	printf("\033[95mpeek\033[m [\033[33m--rows\033[m \033[36m<n>\033[m] [\033[33m--width\033[m \033[36m<n>\033[m]\n");
+	printf(" Displays bytes at the current seek location, <n> rows of --width bytes,\n");
+	printf(" 128 bytes 16 to a row by default. Colors are left out when the output\n");
+	printf(" is not a terminal. Rows of ELF files end with the symbol they are in.\n\n");
 
 	printf("\033[95mvals\033[m\n");
 	printf(" Displays a list of common byte and multi-byte interpretations in the\n");
@@ -653,10 +993,46 @@ help_cmd(state_t *state, token_list_t *tokens)
 	printf(" Sets the maximum string length to display when using vals, for both utf8\n");
 	printf(" and utf16 strings.\n\n");
 
-	printf("\033[95mdarr\033[m \033[36m<type>\033[m \033[92m<length>\033[m\n");
+	printf("\033[95mdarr\033[m \033[36m<type>\033[m \033[92m<length>\033[m [\033[33m--all\033[m] [\033[33m--stats\033[m] [\033[33m--csv\033[m|\033[33m--ndjson\033[m|\033[33m--raw\033[m \033[36m<file>\033[m]\n");
 	printf(" Interprets the current offset as an array with the give type and length.\n");
 	printf(" type can be one of: int8, uint8, int16, uint16, int32, uint32, int64,\n");
-	printf(" uint64, float32, float64, char8, or char16.\n\n");
+	printf(" uint64, float32, float64, char8, or char16. Only the first 256 values are\n");
+	printf(" listed unless --all is given. --stats displays the count, extremes, mean,\n");
+	printf(" standard deviation and a histogram instead, computed on all avaliable\n");
+	printf(" cores. --csv and --ndjson write the values to <file> as text, --raw as\n");
+	printf(" binary in the native endianess.\n\n");
+
+	printf("\033[95mplot\033[m \033[36m<type>\033[m \033[92m<length>\033[m [\033[33m--height\033[m \033[36m<rows>\033[m]\n");
+	printf(" Plots an array as darr reads it with braille characters, as wide as the\n");
+	printf(" terminal. Each column of dots covers the smallest to largest value of an\n");
+	printf(" equal share of the array, found on all avaliable cores.\n\n");
+
+	printf("\033[95mstruct\033[m [\033[33mload\033[m \033[36m<file>\033[m|\033[36m<name>\033[m]\n");
+	printf(" Loads struct definitions from <file>, lists the loaded structs, or shows\n");
+	printf(" the fields <name> is compiled to. A definition looks like:\n");
+	printf("   struct point big { int32 x; int32 y; }\n");
+	printf("   struct shape { uint16 n; point pts[n]; char8 name[uint8]; float64 area le; }\n");
+	printf(" Fields are darr types or earlier structs, optionally with an endianess.\n");
+	printf(" An array count is a number, an earlier field, or the integer type of a\n");
+	printf(" count stored just before the elements. Nested structs are flattened.\n\n");
+
+	printf("\033[95mdecode\033[m \033[36m<struct>\033[m \033[92m<count, optional>\033[m [\033[33m--all\033[m]\n");
+	printf(" Decodes <count> records of a loaded struct at the current offset, one per\n");
+	printf(" line. Records of fixed size are decoded a field at a time across a block\n");
+	printf(" of records. Only the first 256 records are listed unless --all is given.\n\n");
+
+	printf("\033[95mrecords\033[m \033[36m<size>\033[m|\033[36m<struct>\033[m \033[92m<offset, optional>\033[m [\033[33m--count\033[m \033[36m<n>\033[m]\n");
+	printf(" Treats the file from <offset>, the current offset by default, as records of\n");
+	printf(" <size> bytes or of a loaded struct of fixed size, for where to query.\n\n");
+
+	printf("\033[95mwhere\033[m [\033[36m<field>\033[m \033[36m<op>\033[m \033[36m<value>\033[m [\033[33mand\033[m ...]] [\033[33mcount\033[m|\033[33mtop\033[m \033[36m<k>\033[m \033[33mby\033[m \033[36m<field>\033[m|\033[33mgroup by\033[m \033[36m<field>\033[m [\033[36m<k>\033[m]]\n");
+	printf(" Finds the records matching every predicate. A field is <offset>:<type>,\n");
+	printf(" optionally followed by :big or :little, or the name of a field of the\n");
+	printf(" struct. op is one of ==, !=, <, <=, > or >=. Lists the first 16 matches,\n");
+	printf(" only counts them, lists the <k> with the largest values of a field, or\n");
+	printf(" counts the matches with each value of a field. Fields are extracted a\n");
+	printf(" block of records at a time and compared a vector at a time, on all\n");
+	printf(" avaliable cores.\n\n");
 
 	printf("\033[95mbind\033[m \033[36m<name>\033[m \033[36m<value, optional>\033[m\n");
 	printf(" Binds a name to an integer value. The binding can then be subsequently\n");
@@ -665,8 +1041,77 @@ help_cmd(state_t *state, token_list_t *tokens)
 	printf(" the old binding will be overwritten.\n\n");
 
 	printf("\033[95mjump\033[m \033[36m<name>\033[m\n");
-	printf(" Jumps to a file offset previously saved using bind. If the binding does not\n");
-	printf(" exist, nothing will change.\n");
+	printf(" Jumps to a file offset previously saved using bind, or to a section of a\n");
+	printf(" recognized format such as .text or chunk:IDAT:3, see format. If neither\n");
+	printf(" exists, nothing will change.\n\n");
+
+	printf("\033[95menter\033[m [\033[36m<member>\033[m|\033[33m--all\033[m]\n");
+	printf(" Views a member of a tar, zip or cpio archive as if it were the whole\n");
+	printf(" file, so seek, peek, find, darr and the other commands work inside it.\n");
+	printf(" The member is a window into the archive, nothing is extracted. The\n");
+	printf(" headers are indexed the first time, and the index is saved next to the\n");
+	printf(" file as .hvar so later sessions skip them. Members of zip archives must\n");
+	printf(" be stored, not compressed. Without a member, lists the first 64 members\n");
+	printf(" or with --all every member. Archives inside members can be entered too.\n");
+	printf(" On a gzip file, views the decompressed data instead. It is decoded once\n");
+	printf(" to keep a checkpoint every 4 MiB, saved next to the file as .hvgz, and\n");
+	printf(" parts are then decompressed from the nearest checkpoint when touched,\n");
+	printf(" keeping the last 64 MiB in memory. zstd files are recognized only.\n\n");
+
+	printf("\033[95mleave\033[m\n");
+	printf(" Returns from a member to the archive it was entered from, or from the\n");
+	printf(" decompressed data to the compressed file, at the offset it was at.\n\n");
+
+	printf("\033[95mcmp\033[m \033[36m<file>\033[m [\033[33m--gap\033[m \033[36m<n>\033[m] [\033[33m--aligned\033[m]|\033[33mnext\033[m|\033[33mprev\033[m|\033[33mlist\033[m [\033[33m--all\033[m]|\033[33mpeek\033[m [\033[33m--rows\033[m \033[36m<n>\033[m]\n");
+	printf(" Compares the file with another byte by byte at the same offsets, on all\n");
+	printf(" cores, and lists the ranges which differ. Differences with at most <n>\n");
+	printf(" equal bytes between them, 8 by default, are merged into one range.\n");
+	printf(" With --aligned both files are cut into content-defined chunks matched by\n");
+	printf(" hash, so bytes inserted or deleted do not shift the rest, and the ranges\n");
+	printf(" are listed as inserted, deleted, moved or modified with their offset in\n");
+	printf(" the other file.\n");
+	printf(" next and prev seek to the next or previous range, list lists them from\n");
+	printf(" the current offset, and peek shows both files side by side with the\n");
+	printf(" differing bytes colored.\n\n");
+
+	printf("\033[95mpoke\033[m \033[96mvalue...\033[m | \033[95mwrite\033[m \033[36m<file>\033[m | \033[95mfill\033[m \033[92m<length>\033[m \033[96mvalue...\033[m\n");
+	printf(" Overwrites the bytes at the current offset with values written as the\n");
+	printf(" pattern of find without wildcards, with the contents of <file>, or with\n");
+	printf(" the values repeated over <length> bytes. Bytes past the end grow the file.\n");
+	printf("\033[95minsert\033[m \033[96mvalue...\033[m | \033[95mdelete\033[m \033[92m<length>\033[m\n");
+	printf(" Inserts values before the current offset, or deletes <length> bytes from\n");
+	printf(" it. Edits are kept in a piece table over the file, which is not written\n");
+	printf(" until it is saved, and every command sees the edited bytes. Indexes are\n");
+	printf(" dropped by an edit, and only whole files can be edited.\n");
+	printf("\033[95msave\033[m\n");
+	printf(" Writes the edits to the file. Bytes which were only overwritten are\n");
+	printf(" written in place, otherwise a new file is written next to it, copying\n");
+	printf(" the bytes not edited from the file, and renamed over it.\n");
+	printf("\033[95mundo\033[m | \033[95mredo\033[m\n");
+	printf(" Undoes the last command which edited the file, every edit it made at\n");
+	printf(" once, or redoes the last one undone.\n");
+	printf("\033[95mjournal\033[m [\033[33m--all\033[m|\033[33mrollback\033[m]\n");
+	printf(" Lists the edits from the latest, only the last 16 unless --all is given.\n");
+	printf(" Every edit is appended to <file>.hvwl with the bytes it replaced before\n");
+	printf(" it is shown, and when a session ends without saving them, or in the\n");
+	printf(" middle of saving them, they are replayed when the file is opened again.\n");
+	printf(" rollback drops the edits, or after an interrupted save undoes them so\n");
+	printf(" saving restores the file as it was.\n\n");
+
+	printf("\033[95mreplace\033[m \033[96mpattern...\033[m -> [\033[96mvalue...\033[m] [\033[33m--dry\033[m] [\033[33m--confirm\033[m \033[36m<n>\033[m]\n");
+	printf(" Replaces every match of the pattern in the file with the values, both\n");
+	printf(" written as the pattern of find, as a single edit which undo takes back.\n");
+	printf(" Matches do not overlap, and the values may be longer or shorter, or left\n");
+	printf(" out to delete the matches. A wildcard in the values keeps the byte matched\n");
+	printf(" at its position. The file is searched on every core. --dry only counts\n");
+	printf(" the matches, and more than <n> matches, 1000 by default, are replaced only\n");
+	printf(" once confirmed.\n\n");
+
+	printf("\033[95mformat\033[m [\033[33m--all\033[m]\n");
+	printf(" Lists the sections, segments, chunks, members or partitions of an ELF, PE,\n");
+	printf(" PNG, ZIP or GPT file, recognized from its signature when it is opened.\n");
+	printf(" Headers are only parsed the first time a section is needed. Only the\n");
+	printf(" first 64 are listed unless --all is given.\n\n");
 
 	printf("\033[95mfind\033[m \033[96mpattern...\033[m\n");
 	printf(" Searches for a pattern in the file at the current offset. pattern...\n");
@@ -694,6 +1139,78 @@ help_cmd(state_t *state, token_list_t *tokens)
 	printf("  sn<string>   - match a null-terminated char8 string.\n");
 	printf("  ws<string>   - match a sequence of char16 characters.\n");
 	printf("  wsn<string>  - match a null-terminated char16 string.\n");
+	printf(" Matches in ELF files are followed by the symbol they are in. The symbol\n");
+	printf(" and section tables are loaded the first time a symbol is needed.\n");
+
+	printf("\n\033[95mhash\033[m \033[36m<algo>\033[m [\033[92m<start>\033[m] [\033[92m<length>\033[m] [\033[36m--bind <name>\033[m]\n");
+	printf(" Hashes <length> bytes at <start>, defaulting to the current offset and\n");
+	printf(" the rest of the file. algo can be one of: crc32, crc32c, xxh3, sha1, or\n");
+	printf(" sha256. With --bind, the digest is saved as <name>, if <name> was\n");
+	printf(" already bound the two digests are compared. Use hash list to display all\n");
+	printf(" bound digests.\n");
+
+	printf("\n\033[95mdupes\033[m [\033[36m--avg <bytes>\033[m] [\033[36m--top <n>\033[m]\n");
+	printf(" Splits the file into content-defined chunks averaging <bytes> bytes\n");
+	printf(" (default 8192) and reports the <n> duplicated chunks (default 16) which\n");
+	printf(" waste the most space, along with the total deduplicable bytes.\n");
+
+	printf("\n\033[95msimhash\033[m [\033[92m<start>\033[m] [\033[92m<length>\033[m]\n");
+	printf(" Computes a similarity digest of <length> bytes at <start>, defaulting to\n");
+	printf(" the current offset and the rest of the file. If a database is loaded,\n");
+	printf(" the nearest digests in it are listed, a distance of 0 is identical.\n");
+	printf("\033[95msimhash\033[m \033[33mdb\033[m \033[36m<path>\033[m\n");
+	printf(" Loads the digest database at <path>, it is created if needed.\n");
+	printf("\033[95msimhash\033[m \033[33madd\033[m \033[36m<name>\033[m [\033[92m<start>\033[m] [\033[92m<length>\033[m]\n");
+	printf(" Adds the digest of a range to the database as <name>.\n");
+
+	printf("\n\033[95mindex\033[m [\033[33mbuild\033[m|\033[33mdrop\033[m] [\033[33msa\033[m|\033[33mbloom\033[m|\033[33mtree\033[m]\n");
+	printf(" Builds an index of the file into a sidecar next to it, which is loaded\n");
+	printf(" again whenever the file is opened. sa, the default, builds the suffix\n");
+	printf(" and LCP arrays into <file>.hvsa. While it is present, find answers\n");
+	printf(" patterns without wildcards by binary search and reports the total number\n");
+	printf(" of occurrences. bloom builds a Bloom filter of the 4-grams of every\n");
+	printf(" 64 KiB block into <file>.hvbf, each sized from the distinct grams of\n");
+	printf(" its block up to 4 KiB. Blocks with more are searched always. find then\n");
+	printf(" skips the blocks which cannot contain the literal parts of a pattern.\n");
+	printf(" tree saves a Merkle tree of the xxh3 hashes of every 1 MiB block into\n");
+	printf(" <file>.hvmt. When the file is opened again after it was modified, it is\n");
+	printf(" hashed on all cores and the trees compared to find the blocks which\n");
+	printf(" changed, only those of the Bloom filter are indexed again, and the tree\n");
+	printf(" is saved for the file as it is now. drop deletes a sidecar, or all of\n");
+	printf(" them if none is given, and with no argument the state of the indexes is\n");
+	printf(" displayed.\n");
+	printf("\033[95mchanges\033[m [\033[33m--all\033[m]\n");
+	printf(" Lists the ranges of the file which changed since its block tree was\n");
+	printf(" saved, as found when it was opened.\n");
+	printf("\033[95mrepeats\033[m [\033[33m--min\033[m \033[36m<n>\033[m] [\033[33m--top\033[m \033[36m<n>\033[m]\n");
+	printf(" Lists the longest repeated byte strings of at least --min bytes, default\n");
+	printf(" 8, using the suffix array index.\n");
+
+	printf("\n\033[95mdump\033[m [\033[92m<start>\033[m] [\033[92m<length>\033[m] [\033[33m>\033[m \033[36m<file>\033[m]\n");
+	printf(" Writes <length> bytes at <start> in the format of xxd, defaulting to the\n");
+	printf(" current offset and the rest of the file. Chunks of the range are rendered\n");
+	printf(" on all avaliable cores. With > the output replaces the contents of <file>.\n");
+	printf("\033[95mview\033[m\n");
+	printf(" Browses the file full screen from the current offset. Scroll with the\n");
+	printf(" arrow keys or j and k, page with PgUp and PgDn or b and space, jump to\n");
+	printf(" the start or end with Home and End or g and G, and quit with q. The\n");
+	printf(" current offset is left at the top of the last screen. On a wide enough\n");
+	printf(" terminal a minimap of the whole file is shown beside the bytes, clicking\n");
+	printf(" a cell or pressing [ and ] jumps between cells of different classes.\n");
+	printf("\033[95mmap\033[m [\033[33m--rows\033[m \033[36m<n>\033[m]\n");
+	printf(" Draws the whole file as rows of 64 cells colored by the class of most of\n");
+	printf(" their bytes: zeros, text, random (compressed or encrypted) or other. The\n");
+	printf(" map is first drawn from a sample of each cell, then refined from every\n");
+	printf(" byte on all avaliable cores. The cell of the current offset is marked.\n");
+
+	printf("\n\033[95mstrings\033[m [\033[36m--min <n>\033[m] [\033[33m--utf16le\033[m|\033[33m--utf16be\033[m]\n");
+	printf(" Indexes every printable string of at least <n> characters (default 4)\n");
+	printf(" in the file. Without an encoding switch, ASCII strings are indexed.\n");
+	printf("\033[95mstrings\033[m [\033[33mnext\033[m|\033[33mprev\033[m|\033[33mlist\033[m|\033[33mfind\033[m \033[36m<substring>\033[m]\n");
+	printf(" Navigates the string index, building it with defaults if needed. next\n");
+	printf(" and prev seek to the next or previous string, list displays strings\n");
+	printf(" from the current offset, and find lists strings from the current\n");
+	printf(" offset containing <substring>.\n");
 
 	return Continue;
 }
@@ -730,6 +1247,7 @@ jump_cmd(state_t *state, token_list_t *tokens)
 	token_list_t *it;
 	const char *name;
 	avalue_t *value;
+	const section_t *section;
 
 	it = offset_token(tokens, 1);
 	if (!it)
@@ -740,14 +1258,16 @@ jump_cmd(state_t *state, token_list_t *tokens)
 
 	name = it->token.string;
 
+	// bindings come first, then the sections of the format
 	value = alist_find(state->bindings, AKEY(name));
-	if (!value)
+	section = value || !get_sections(state) ? NULL : sections_find(state->sections, name);
+	if (!value && !section)
 	{
 		printf("\033[33m%s\033[m is not bound.\n", name);
 		return Continue;
 	}
 
-	state->off = *(unsigned int *)value;
+	state->off = value ? *(unsigned int *)value : section->offset;
 
 	if (state->off < 0)
 		state->off = 0;
@@ -788,12 +1308,18 @@ find_cmd(state_t *state, token_list_t *tokens)
 		return Continue;
 	}
 
+	if (find_process(state, pattern, count) || find_indexed(state, pattern, count) || find_blocks(state, pattern, count))
+	{
+		pattern_free(pattern);
+		return Continue;
+	}
+
 	stateoff = 0;
 	for (itcount = 0; itcount < MAX_FIND_ITERATIONS; itcount++)
 	{
 		result = pattern_find_next(pattern, state->file->data + state->off + stateoff, state->file->size - (state->off + stateoff), &off);
 		if (result)
-			printf("Matched \033[92m%u\033[m bytes at \033[92m0x%08x\033[m\n", count, state->off + off + stateoff);
+			print_match(state, count, state->off + off + stateoff);
 		else
 			break;
 
@@ -808,4 +1334,3523 @@ find_cmd(state_t *state, token_list_t *tokens)
 	pattern_free(pattern);
 
 	return Continue;
-}
\ No newline at end of file
+}
+
+// Print a single string from the strings index
+static void
+print_string_entry(state_t *state, const strent_t *ent)
+{
+	const byte *s;
+	unsigned int unit;
+	unsigned int nchars;
+	unsigned int i;
+
+	unit = state->strings->enc == EncAscii ? 1 : 2;
+	s = state->file->data + ent->off + (state->strings->enc == EncUtf16be ? 1 : 0);
+	nchars = ent->len / unit;
+
+	printf("\033[92m0x%08x\033[m \033[90m%6u\033[m ", ent->off, nchars);
+	for (i = 0; i < nchars && i < (unsigned int)state->max_strlen; i++)
+		putchar(s[i * unit]);
+	if (nchars > (unsigned int)state->max_strlen)
+		printf("\033[90m...\033[m");
+	putchar('\n');
+}
+
+static int
+strings_cmd(state_t *state, token_list_t *tokens)
+{
+	static const char *encnames[] = { "ascii", "utf16le", "utf16be" };
+
+	token_list_t *it;
+	strindex_t *index;
+	const char *needle;
+	unsigned int minlen;
+	unsigned int i, listed;
+	int enc;
+
+	it = offset_token(tokens, 1);
+
+	if (it && (!strcmp(it->token.string, "next") || !strcmp(it->token.string, "prev") ||
+		!strcmp(it->token.string, "list") || !strcmp(it->token.string, "find")))
+	{
+		if (!state->strings)
+		{
+			state->strings = strindex_build(state->file->data, state->file->size, DEFAULT_MIN_STRLEN, EncAscii);
+			if (!state->strings)
+			{
+				printf("Failed to build string index.\n");
+				return Continue;
+			}
+		}
+		index = state->strings;
+
+		if (!strcmp(it->token.string, "next"))
+		{
+			i = strindex_lower_bound(index, state->off + 1);
+			if (i == index->count)
+			{
+				printf("No more strings.\n");
+				return Continue;
+			}
+			state->off = index->ents[i].off;
+			print_string_entry(state, &index->ents[i]);
+		}
+		else if (!strcmp(it->token.string, "prev"))
+		{
+			i = strindex_lower_bound(index, state->off);
+			if (i == 0)
+			{
+				printf("No previous strings.\n");
+				return Continue;
+			}
+			state->off = index->ents[i - 1].off;
+			print_string_entry(state, &index->ents[i - 1]);
+		}
+		else if (!strcmp(it->token.string, "list"))
+		{
+			listed = 0;
+			for (i = strindex_lower_bound(index, state->off); i < index->count && listed < MAX_STRINGS_LISTED; i++, listed++)
+				print_string_entry(state, &index->ents[i]);
+
+			if (listed == 0)
+				printf("No strings at or after \033[92m0x%08x\033[m\n", state->off);
+		}
+		else
+		{
+			it = offset_token(it, 1);
+			if (!it)
+			{
+				sayhelp;
+				return Continue;
+			}
+			needle = it->token.string;
+
+			listed = 0;
+			for (i = strindex_lower_bound(index, state->off); i < index->count; i++)
+			{
+				if (!strindex_contains(index, state->file->data, &index->ents[i], needle))
+					continue;
+
+				if (listed == MAX_STRINGS_LISTED)
+				{
+					printf("Reached max listed strings, more matches may exist...\n");
+					break;
+				}
+
+				print_string_entry(state, &index->ents[i]);
+				listed++;
+			}
+
+			if (listed == 0)
+				printf("No match.\n");
+		}
+
+		return Continue;
+	}
+
+	minlen = DEFAULT_MIN_STRLEN;
+	enc = EncAscii;
+	for (; it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--min"))
+		{
+			it = it->next;
+			if (!it || it->token.integer <= 0)
+			{
+				sayhelp;
+				return Continue;
+			}
+			minlen = it->token.integer;
+		}
+		else if (!strcmp(it->token.string, "--utf16le"))
+			enc = EncUtf16le;
+		else if (!strcmp(it->token.string, "--utf16be"))
+			enc = EncUtf16be;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	index = strindex_build(state->file->data, state->file->size, minlen, enc);
+	if (!index)
+	{
+		printf("Failed to build string index.\n");
+		return Continue;
+	}
+
+	strindex_free(state->strings);
+	state->strings = index;
+
+	printf("Indexed \033[92m%u\033[m %s strings of at least %u characters.\n", index->count, encnames[enc], index->minlen);
+
+	return Continue;
+}
+
+// Print a digest bound by the hash command
+static void
+print_digest(akey_t key, avalue_t value, void *user)
+{
+	printf("\033[33m%s\033[m = %s\n", (char *)key, (char *)value);
+	(*(unsigned int *)user)++;
+}
+
+static int
+hash_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	int algo;
+	unsigned int start, len;
+	unsigned int i, size;
+	const char *name;
+	byte digest[MAX_DIGEST_SIZE];
+	char hex[MAX_DIGEST_SIZE * 2 + 1];
+	avalue_t *bound;
+	double begin, elapsed;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!strcmp(it->token.string, "list"))
+	{
+		i = 0;
+		alist_foreach(state->digests, &print_digest, &i);
+		if (!i)
+			printf("No digests are bound.\n");
+		return Continue;
+	}
+
+	algo = hash_find(it->token.string);
+	if (algo == -1)
+	{
+		printf("Algorithm must be: crc32, crc32c, xxh3, sha1, or sha256\n");
+		return Continue;
+	}
+
+	it = it->next;
+	if (!parse_range(state, &it, &start, &len))
+		return Continue;
+
+	name = NULL;
+	if (it && !strcmp(it->token.string, "--bind") && it->next)
+	{
+		name = it->next->token.string;
+		it = it->next->next;
+	}
+
+	if (it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	begin = time_now();
+	hash_data(algo, state->file->data + start, len, digest);
+	elapsed = time_now() - begin;
+
+	size = hash_digest_size(algo);
+	for (i = 0; i < size; i++)
+		snprintf(hex + i * 2, 3, "%02x", digest[i]);
+
+	printf("%s [\033[92m0x%08x\033[m, \033[92m0x%08x\033[m): %s\n", hash_name(algo), start, start + len, hex);
+	printf("Hashed %.1f MiB in %.1f ms", len / (1024.0 * 1024.0), elapsed * 1000.0);
+	if (elapsed > 0)
+		printf(" (%.0f MiB/s)", len / (1024.0 * 1024.0) / elapsed);
+	putchar('\n');
+
+	if (name)
+	{
+		bound = alist_find(state->digests, AKEY(name));
+		if (bound)
+		{
+			if (!strcmp((char *)*bound, hex))
+				printf("Matches \033[33m%s\033[m.\n", name);
+			else
+				printf("\033[41mDiffers\033[m from \033[33m%s\033[m = %s\n", name, (char *)*bound);
+		}
+		else
+		{
+			alist_insert(state->digests, AKEY(name), AVALUE(hex));
+			printf("Bound \033[33m%s\033[m -> %s\n", name, hex);
+		}
+	}
+
+	return Continue;
+}
+
+static int
+dupes_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	dupes_t *dupes;
+	dupe_group_t *group;
+	unsigned int avg, top;
+	unsigned int i, j;
+	double begin, elapsed;
+
+	avg = DEFAULT_CHUNK_SIZE;
+	top = DEFAULT_DUPES_LISTED;
+
+	for (it = offset_token(tokens, 1); it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--avg") && it->next && parse_uint(it->next->token.string, &avg))
+			it = it->next;
+		else if (!strcmp(it->token.string, "--top") && it->next && parse_uint(it->next->token.string, &top))
+			it = it->next;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	begin = time_now();
+	dupes = dupes_find(state->file->data, state->file->size, avg);
+	elapsed = time_now() - begin;
+	if (!dupes)
+	{
+		printf("Out of memory.\n");
+		return Continue;
+	}
+
+	printf("Split into \033[92m%u\033[m chunks, \033[92m%u\033[m distinct, in %.1f ms.\n", dupes->nchunks, dupes->nunique, elapsed * 1000.0);
+	printf("Found \033[92m%u\033[m duplicated chunks, \033[92m%llu\033[m deduplicable bytes (%.1f%%).\n",
+		dupes->ngroups, dupes->dupbytes, state->file->size ? 100.0 * dupes->dupbytes / state->file->size : 0.0);
+
+	for (i = 0; i < dupes->ngroups && i < top; i++)
+	{
+		group = &dupes->groups[i];
+		printf("%u bytes x %u:", group->len, group->count);
+		for (j = 0; j < group->count && j < MAX_DUPE_OFFSETS_LISTED; j++)
+			printf(" \033[92m0x%08x\033[m", group->offsets[j]);
+		if (group->count > MAX_DUPE_OFFSETS_LISTED)
+			printf(" \033[90m(+%u more)\033[m", group->count - MAX_DUPE_OFFSETS_LISTED);
+		putchar('\n');
+	}
+
+	if (dupes->ngroups > top)
+		printf("%u more groups not shown, use --top to show more.\n", dupes->ngroups - top);
+
+	dupes_free(dupes);
+
+	return Continue;
+}
+
+static int
+simhash_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	simdb_t *db;
+	simhash_t hash;
+	simdb_match_t matches[MAX_SIMHASH_MATCHES];
+	char digest[SIMHASH_STRING_SIZE];
+	const char *name;
+	unsigned int start, len;
+	unsigned int i, count;
+
+	it = offset_token(tokens, 1);
+
+	if (it && !strcmp(it->token.string, "db"))
+	{
+		it = it->next;
+		if (!it)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		db = simdb_load(it->token.string);
+		if (!db)
+		{
+			printf("Failed to load database.\n");
+			return Continue;
+		}
+
+		simdb_free(state->simdb);
+		state->simdb = db;
+		printf("Loaded \033[92m%u\033[m digests from \033[33m'%s'\033[m\n", simdb_count(db), it->token.string);
+		return Continue;
+	}
+
+	name = NULL;
+	if (it && !strcmp(it->token.string, "add"))
+	{
+		it = it->next;
+		if (!it)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		if (!state->simdb)
+		{
+			printf("No database loaded, use simhash db <path>.\n");
+			return Continue;
+		}
+
+		name = it->token.string;
+		it = it->next;
+	}
+
+	if (!parse_range(state, &it, &start, &len))
+		return Continue;
+
+	if (it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!simhash_compute(state->file->data + start, len, &hash))
+	{
+		printf("Range is too small or too uniform to digest.\n");
+		return Continue;
+	}
+
+	simhash_format(&hash, digest);
+	printf("simhash [\033[92m0x%08x\033[m, \033[92m0x%08x\033[m): %s\n", start, start + len, digest);
+
+	if (!state->simdb)
+		return Continue;
+
+	if (name)
+	{
+		if (simdb_add(state->simdb, name, &hash))
+			printf("Added \033[33m%s\033[m to the database.\n", name);
+		else
+			printf("Failed to write database.\n");
+		return Continue;
+	}
+
+	count = simdb_rank(state->simdb, &hash, matches, MAX_SIMHASH_MATCHES);
+	for (i = 0; i < count; i++)
+		printf("\033[94m%6d\033[m \033[33m%s\033[m\n", matches[i].distance, matches[i].name);
+
+	return Continue;
+}
+
+static int
+index_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	char sapath[MAX_PATH_SIZE];
+	char bfpath[MAX_PATH_SIZE];
+	char mtpath[MAX_PATH_SIZE];
+	const char *kind, *path;
+	merkle_t *tree;
+	uint64 mtime;
+	double begin, elapsed;
+	int build;
+
+	// sidecars are named after the file, a member has no file of its own
+	if (state->views || state->process)
+	{
+		printf("Indexes can only be built for whole files, \033[95mleave\033[m the member first.\n");
+		return Continue;
+	}
+
+	if (state->pieces)
+	{
+		printf("Indexes are of the file as saved, \033[95msave\033[m the edits first.\n");
+		return Continue;
+	}
+
+	if (!sidecar_path(state->filename, SUFFIX_EXT, sapath, sizeof(sapath)) ||
+		!sidecar_path(state->filename, BLOOM_EXT, bfpath, sizeof(bfpath)) ||
+		!sidecar_path(state->filename, MERKLE_EXT, mtpath, sizeof(mtpath)))
+	{
+		printf("Path too long.\n");
+		return Continue;
+	}
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		if (state->suffix)
+			printf("Suffix array: \033[33m'%s'\033[m, %u suffixes\n", sapath, state->suffix->size);
+		else
+			printf("Suffix array: not built\n");
+
+		if (state->bloom)
+			printf("Block index: \033[33m'%s'\033[m, %u blocks, %u searched always\n", bfpath, state->bloom->nblocks, state->bloom->always);
+		else
+			printf("Block index: not built\n");
+
+		if (state->tree)
+			printf("Block tree: \033[33m'%s'\033[m, %u blocks, root %016llx\n", mtpath, state->tree->nleaves, (unsigned long long)merkle_root(state->tree));
+		else
+			printf("Block tree: not built\n");
+		return Continue;
+	}
+
+	if (!strcmp(it->token.string, "build"))
+		build = 1;
+	else if (!strcmp(it->token.string, "drop"))
+		build = 0;
+	else
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	kind = NULL;
+	if (it->next)
+	{
+		kind = it->next->token.string;
+		if ((strcmp(kind, "sa") && strcmp(kind, "bloom") && strcmp(kind, "tree")) || it->next->next)
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	if (!build)
+	{
+		if (!kind || !strcmp(kind, "sa"))
+		{
+			suffix_free(state->suffix);
+			state->suffix = NULL;
+			if (!remove(sapath))
+				printf("Removed \033[33m'%s'\033[m\n", sapath);
+		}
+
+		if (!kind || !strcmp(kind, "bloom"))
+		{
+			bloom_free(state->bloom);
+			state->bloom = NULL;
+			if (!remove(bfpath))
+				printf("Removed \033[33m'%s'\033[m\n", bfpath);
+		}
+
+		if (!kind || !strcmp(kind, "tree"))
+		{
+			merkle_free(state->tree);
+			state->tree = NULL;
+			if (!remove(mtpath))
+				printf("Removed \033[33m'%s'\033[m\n", mtpath);
+		}
+
+		return Continue;
+	}
+
+	if (!sidecar_file_time(state->filename, &mtime))
+	{
+		printf("Failed to read the time \033[33m'%s'\033[m was modified.\n", state->filename);
+		return Continue;
+	}
+
+	if (kind && !strcmp(kind, "tree"))
+	{
+		begin = time_now();
+		tree = merkle_build(state->file->data, state->file->size, mtime);
+		elapsed = time_now() - begin;
+		if (!tree)
+		{
+			printf("Failed to allocate memory.\n");
+			return Continue;
+		}
+		if (!merkle_save(tree, mtpath))
+		{
+			merkle_free(tree);
+			printf("Failed to build index.\n");
+			return Continue;
+		}
+
+		merkle_free(state->tree);
+		state->tree = tree;
+		printf("Hashed \033[92m%u\033[m blocks in %.1f ms, wrote \033[33m'%s'\033[m\n", tree->nleaves, elapsed * 1000.0, mtpath);
+		return Continue;
+	}
+
+	if (kind && !strcmp(kind, "bloom"))
+	{
+		path = bfpath;
+		bloom_free(state->bloom);
+
+		begin = time_now();
+		state->bloom = bloom_build(state->file->data, state->file->size, mtime, path);
+		elapsed = time_now() - begin;
+		if (!state->bloom)
+		{
+			printf("Failed to build index.\n");
+			return Continue;
+		}
+
+		printf("Indexed \033[92m%u\033[m blocks in %.1f ms, \033[94m%u\033[m searched always, wrote \033[33m'%s'\033[m\n", state->bloom->nblocks, elapsed * 1000.0,
+			state->bloom->always, path);
+	}
+	else
+	{
+		path = sapath;
+		suffix_free(state->suffix);
+
+		begin = time_now();
+		state->suffix = suffix_build(state->file->data, state->file->size, mtime, path);
+		elapsed = time_now() - begin;
+		if (!state->suffix)
+		{
+			printf("Failed to build index.\n");
+			return Continue;
+		}
+
+		printf("Indexed \033[92m%u\033[m suffixes in %.1f ms, wrote \033[33m'%s'\033[m\n", state->suffix->size, elapsed * 1000.0, path);
+	}
+
+	return Continue;
+}
+
+static int
+repeats_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	suffix_repeat_t *repeats;
+	unsigned int minlen, top;
+	unsigned int i, j, count;
+	byte b;
+
+	minlen = DEFAULT_MIN_REPEAT;
+	top = DEFAULT_REPEATS_LISTED;
+
+	for (it = offset_token(tokens, 1); it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--min") && it->next && parse_uint(it->next->token.string, &minlen))
+			it = it->next;
+		else if (!strcmp(it->token.string, "--top") && it->next && parse_uint(it->next->token.string, &top))
+			it = it->next;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	if (!state->suffix)
+	{
+		printf("No index, use \033[95mindex\033[m build.\n");
+		return Continue;
+	}
+
+	if (!top)
+		return Continue;
+
+	repeats = malloc(top * sizeof(suffix_repeat_t));
+	if (!repeats)
+	{
+		printf("Out of memory.\n");
+		return Continue;
+	}
+
+	count = suffix_repeats(state->suffix, state->file->data, minlen, repeats, top);
+	if (!count)
+		printf("No repeats of at least %u bytes.\n", minlen);
+
+	for (i = 0; i < count; i++)
+	{
+		printf("\033[92m0x%08x\033[m %u bytes x %u: \033[33m\"", repeats[i].off, repeats[i].len, repeats[i].count);
+		for (j = 0; j < repeats[i].len && j < MAX_REPEAT_PREVIEW; j++)
+		{
+			b = state->file->data[repeats[i].off + j];
+			putchar(b >= 0x20 && b < 0x7f ? b : '.');
+		}
+		printf("\"\033[m%s\n", repeats[i].len > MAX_REPEAT_PREVIEW ? "..." : "");
+	}
+
+	free(repeats);
+
+	return Continue;
+}
+
+static int
+dump_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	const char *path;
+	FILE *fp;
+	unsigned int start, len;
+	double begin, elapsed;
+	int result;
+
+	it = offset_token(tokens, 1);
+	if (!parse_range(state, &it, &start, &len))
+		return Continue;
+
+	// "> file" or ">file"
+	path = NULL;
+	if (it && it->token.string[0] == '>')
+	{
+		path = it->token.string + 1;
+		if (!*path && it->next)
+		{
+			it = it->next;
+			path = it->token.string;
+		}
+		it = it->next;
+	}
+
+	if (it || (path && !*path))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!path)
+	{
+		if (!render_dump(state->file->data + start, start, len, stdout))
+			printf("Failed to write output.\n");
+		return Continue;
+	}
+
+	fp = fopen(path, "wb");
+	if (!fp)
+	{
+		printf("Failed to open \033[33m'%s'\033[m\n", path);
+		return Continue;
+	}
+
+	begin = time_now();
+	result = render_dump(state->file->data + start, start, len, fp);
+	elapsed = time_now() - begin;
+	fclose(fp);
+
+	if (result)
+		printf("Wrote %u bytes as \033[92m%zu\033[m characters to \033[33m'%s'\033[m in %.1f ms\n", len, render_xxd_size(len), path, elapsed * 1000.0);
+	else
+		printf("Failed to write \033[33m'%s'\033[m\n", path);
+
+	return Continue;
+}
+
+static int
+view_cmd(state_t *state, token_list_t *tokens)
+{
+	if (tokens->next)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!tui_run(state->file, &state->off))
+		printf("view needs a terminal.\n");
+
+	return Continue;
+}
+
+static int
+map_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	minimap_t *map;
+	char *line;
+	unsigned int rows, mark;
+	double begin, sampled, refined;
+	int tty;
+
+	rows = DEFAULT_MAP_ROWS;
+
+	for (it = offset_token(tokens, 1); it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--rows") && it->next && parse_uint(it->next->token.string, &rows))
+			it = it->next;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	if (!rows || rows > MAX_MAP_ROWS)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	map = minimap_create(state->file->size, rows * MAP_COLUMNS);
+	line = malloc(render_map_size(MAP_COLUMNS));
+	if (!map || !line)
+	{
+		printf("Failed to allocate memory.\n");
+		minimap_free(map);
+		free(line);
+		return Continue;
+	}
+
+	tty = render_is_tty();
+	mark = minimap_cell(map, state->off);
+	rows = (map->count + MAP_COLUMNS - 1) / MAP_COLUMNS;
+
+	begin = time_now();
+	minimap_sample(map, state->file->data, state->file->size);
+	sampled = time_now() - begin;
+
+	// refine a row at a time, drawing over the sampled map on a terminal
+	if (tty)
+		print_map(map, mark, line);
+
+	begin = time_now();
+	while (!minimap_refine(map, state->file->data, state->file->size, MAP_COLUMNS))
+	{
+		if (tty)
+		{
+			printf("\033[%uF", rows + 1);
+			print_map(map, mark, line);
+		}
+	}
+	refined = time_now() - begin;
+
+	if (tty)
+		printf("\033[%uF", rows + 1);
+	print_map(map, mark, line);
+
+	printf("Each cell is %u bytes. Sampled in %.1f ms, refined in %.1f ms.\n", map->cell_size, sampled * 1000.0, refined * 1000.0);
+
+	minimap_free(map);
+	free(line);
+
+	return Continue;
+}
+
+static int
+plot_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	double *mins, *maxs;
+	char *out;
+	unsigned int arrlen, avail, rows, cols, height, buckets;
+	size_t len;
+	int type;
+	double begin, elapsed;
+
+	it = offset_token(tokens, 1);
+	if (!it || (type = numeric_type(it->token.string)) < 0)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	it = it->next;
+	if (!it || !parse_uint(it->token.string, &arrlen))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	// sized to the terminal unless told otherwise
+	render_term_size(&rows, &cols);
+	height = rows > MIN_PLOT_HEIGHT + 6 ? rows - 6 : MIN_PLOT_HEIGHT;
+	if (height > MAX_PLOT_HEIGHT)
+		height = MAX_PLOT_HEIGHT;
+
+	for (it = it->next; it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--height") && it->next && parse_uint(it->next->token.string, &height) && height && height <= MAX_PLOT_HEIGHT)
+			it = it->next;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	avail = (state->file->size - state->off) / numeric_size(type);
+	if (arrlen > avail)
+	{
+		printf("Only %u elements fit before the end of the file.\n", avail);
+		arrlen = avail;
+	}
+
+	if (!arrlen)
+		return Continue;
+
+	// a bucket for each column of dots, two to a character
+	buckets = cols > PLOT_LABEL_COLUMNS + 1 ? (cols - PLOT_LABEL_COLUMNS - 1) * 2 : 2;
+	if (buckets > arrlen)
+		buckets = arrlen;
+
+	mins = malloc(buckets * sizeof(double));
+	maxs = malloc(buckets * sizeof(double));
+	out = malloc(render_plot_size(buckets, height));
+	if (!mins || !maxs || !out)
+	{
+		printf("Failed to allocate memory.\n");
+		free(mins);
+		free(maxs);
+		free(out);
+		return Continue;
+	}
+
+	begin = time_now();
+	if (!numeric_downsample(state->file->data + state->off, arrlen, type, state->current_endianess, buckets, mins, maxs))
+		len = 0;
+	else
+		len = render_plot(mins, maxs, buckets, height, out);
+	elapsed = time_now() - begin;
+
+	if (len)
+	{
+		fwrite(out, 1, len, stdout);
+		printf("%u values, %.1f to a column of dots, in %.1f ms\n", arrlen, (double)arrlen / buckets, elapsed * 1000.0);
+	}
+	else
+		printf("Nothing to plot.\n");
+
+	free(mins);
+	free(maxs);
+	free(out);
+
+	return Continue;
+}
+
+static int
+struct_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	plan_t *plan;
+	const plan_op_t *op;
+	const char *after;
+	char error[TEMPLATE_ERROR_SIZE];
+	char type[MAX_PATH_SIZE];
+	unsigned int i;
+	int count;
+
+	if (!state->templates)
+	{
+		state->templates = template_create();
+		if (!state->templates)
+		{
+			printf("Failed to allocate memory.\n");
+			return Continue;
+		}
+	}
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		for (i = 0; (plan = template_at(state->templates, i)); i++)
+		{
+			if (plan->size)
+				printf("\033[33m'%s'\033[m %u bytes, %u fields\n", plan->name, plan->size, plan->nops);
+			else
+				printf("\033[33m'%s'\033[m variable size, %u fields\n", plan->name, plan->nops);
+		}
+		if (!i)
+			printf("No structs loaded, use struct load <file>.\n");
+		return Continue;
+	}
+
+	if (!strcmp(it->token.string, "load"))
+	{
+		it = it->next;
+		if (!it || it->next)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		count = template_load(state->templates, it->token.string, error, sizeof(error));
+		if (count < 0)
+			printf("Failed to load \033[33m'%s'\033[m: %s\n", it->token.string, error);
+		else
+			printf("Loaded \033[92m%d\033[m structs from \033[33m'%s'\033[m\n", count, it->token.string);
+		return Continue;
+	}
+
+	plan = template_find(state->templates, it->token.string);
+	if (!plan || it->next)
+	{
+		if (!plan)
+			printf("No struct named \033[33m'%s'\033[m.\n", it->token.string);
+		else
+			sayhelp;
+		return Continue;
+	}
+
+	// offsets after a field of variable size are from the end of that field
+	after = NULL;
+	for (i = 0; i < plan->nops; i++)
+	{
+		op = &plan->ops[i];
+
+		strcpy(type, op->type >= 0 ? numeric_name(op->type) : op->sub->name);
+		if (op->kind == OpArray)
+			sprintf(type + strlen(type), "[%u]", op->count);
+		else if (op->kind == OpCounted)
+			sprintf(type + strlen(type), "[%s]", plan->ops[op->count].name);
+		else if (op->kind == OpPrefixed)
+			sprintf(type + strlen(type), "[%s]", numeric_name(op->count));
+		if (op->type >= 0 && op->type != Int8 && op->type != Uint8 && op->type != Char8)
+			strcat(type, op->endianess == BigEndian ? " big" : " little");
+
+		if (after)
+			printf("  \033[92m+0x%04x\033[m  %-24s %s\n", op->offset, type, op->name);
+		else
+			printf("  \033[92m0x%04x\033[m   %-24s %s\n", op->offset, type, op->name);
+
+		if (op->kind == OpCounted || op->kind == OpPrefixed || (op->type < 0 && !op->sub->size))
+			after = op->name;
+	}
+
+	if (plan->size)
+		printf("%u bytes\n", plan->size);
+	else
+		printf("Variable size, offsets with + are from the end of the last variable field.\n");
+
+	return Continue;
+}
+
+static int
+decode_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	plan_t *plan;
+	value_u *columns;
+	const byte *data;
+	char *line;
+	size_t len;
+	unsigned int count, listed, record, block, i, pos, size, fit;
+	int all;
+	double begin, elapsed;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	plan = state->templates ? template_find(state->templates, it->token.string) : NULL;
+	if (!plan)
+	{
+		printf("No struct named \033[33m'%s'\033[m, use struct load <file>.\n", it->token.string);
+		return Continue;
+	}
+
+	count = 1;
+	all = 0;
+	for (it = it->next; it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--all"))
+			all = 1;
+		else if (!parse_uint(it->token.string, &count) || !count)
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	line = malloc(MAX_DECODE_LINE);
+	columns = plan->size ? malloc((size_t)DECODE_BLOCK * plan->nops * sizeof(value_u)) : NULL;
+	if (!line || (plan->size && !columns))
+	{
+		printf("Failed to allocate memory.\n");
+		free(line);
+		free(columns);
+		return Continue;
+	}
+
+	data = state->file->data;
+	pos = state->off;
+	listed = all || count <= MAX_DECODE_LISTED ? count : MAX_DECODE_LISTED;
+	begin = time_now();
+
+	if (plan->size)
+	{
+		fit = (state->file->size - pos) / plan->size;
+		if (count > fit)
+		{
+			printf("Only %u records fit before the end of the file.\n", fit);
+			count = fit;
+			listed = listed < fit ? listed : fit;
+		}
+
+		// a block of records is decoded one field at a time, then printed
+		for (record = 0; record < listed; record += block)
+		{
+			block = listed - record < DECODE_BLOCK ? listed - record : DECODE_BLOCK;
+			template_columns(plan, data + pos + (size_t)record * plan->size, block, columns);
+
+			for (i = 0; i < block; i++)
+			{
+				template_format(plan, data + pos + (size_t)(record + i) * plan->size, plan->size, columns, block, i,
+					count == 1 ? "\n  " : " ", line, MAX_DECODE_LINE, &len);
+				if (count == 1)
+					printf("\033[92m0x%08x\033[m\n  ", pos);
+				else
+					printf("\033[92m0x%08x\033[m ", pos + (record + i) * plan->size);
+				fwrite(line, 1, len, stdout);
+				fputc('\n', stdout);
+			}
+		}
+		pos += count * plan->size;
+	}
+	else
+	{
+		// each record has to be walked to find where the next one starts
+		for (record = 0; record < count; record++)
+		{
+			if (record < listed)
+				size = template_format(plan, data + pos, state->file->size - pos, NULL, 0, 0,
+					count == 1 ? "\n  " : " ", line, MAX_DECODE_LINE, &len);
+			else
+				size = template_measure(plan, data + pos, state->file->size - pos);
+
+			if (!size)
+			{
+				printf("Record %u at \033[92m0x%08x\033[m does not fit before the end of the file.\n", record, pos);
+				break;
+			}
+
+			if (record < listed)
+			{
+				if (count == 1)
+					printf("\033[92m0x%08x\033[m\n  ", pos);
+				else
+					printf("\033[92m0x%08x\033[m ", pos);
+				fwrite(line, 1, len, stdout);
+				fputc('\n', stdout);
+			}
+			pos += size;
+		}
+		count = record;
+	}
+	elapsed = time_now() - begin;
+
+	if (listed < count)
+		printf("%u more, use \033[33m--all\033[m to list them.\n", count - listed);
+	if (count > 1)
+		printf("%u records in %.1f ms, next at \033[92m0x%08x\033[m\n", count, elapsed * 1000.0, pos);
+
+	free(line);
+	free(columns);
+
+	return Continue;
+}
+
+static int
+records_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	plan_t *plan;
+	unsigned int stride, base, count, fit;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		if (!state->record_stride)
+			printf("No records set, use records <size> [offset].\n");
+		else
+			printf("Records of %u bytes from \033[92m0x%08x\033[m, %u of them\n", state->record_stride,
+				state->record_base, state->record_count);
+		return Continue;
+	}
+
+	plan = state->templates ? template_find(state->templates, it->token.string) : NULL;
+	if (plan && !plan->size)
+	{
+		printf("Struct \033[33m'%s'\033[m does not have a fixed size.\n", plan->name);
+		return Continue;
+	}
+	if (plan)
+		stride = plan->size;
+	else if (!parse_uint(it->token.string, &stride) || !stride)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	base = state->off;
+	count = 0;
+	for (it = it->next; it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--count") && it->next && parse_uint(it->next->token.string, &count))
+			it = it->next;
+		else if (!parse_uint(it->token.string, &base) || base >= state->file->size)
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	fit = (state->file->size - base) / stride;
+	if (!count || count > fit)
+		count = fit;
+	if (!count)
+	{
+		printf("No record fits before the end of the file.\n");
+		return Continue;
+	}
+
+	state->record_base = base;
+	state->record_stride = stride;
+	state->record_count = count;
+	state->record_plan = plan;
+
+	printf("Records of %u bytes from \033[92m0x%08x\033[m, %u of them\n", stride, base, count);
+	return Continue;
+}
+
+static int
+where_cmd(state_t *state, token_list_t *tokens)
+{
+	static const char *ops[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+	token_list_t *it;
+	query_t query;
+	query_result_t result;
+	query_field_t field;
+	query_predicate_t *predicate;
+	const char *labels[QUERY_MAX_FIELDS];
+	char *line;
+	size_t len;
+	unsigned int i, j, record, op;
+	int index;
+	double begin, elapsed;
+
+	if (!state->record_stride)
+	{
+		printf("No records set, use records <size> [offset].\n");
+		return Continue;
+	}
+
+	memset(&query, 0, sizeof(query));
+	query.data = state->file->data + state->record_base;
+	query.stride = state->record_stride;
+	query.count = state->record_count;
+	query.action = QueryList;
+	query.limit = DEFAULT_WHERE_LISTED;
+
+	// predicates, joined by and
+	for (it = offset_token(tokens, 1); it; it = it->next->next->next)
+	{
+		if (!strcmp(it->token.string, "count") || !strcmp(it->token.string, "top") || !strcmp(it->token.string, "group"))
+			break;
+		if (query.npredicates && !strcmp(it->token.string, "and"))
+			it = it->next;
+		if (!it || !it->next || !it->next->next)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		if (!parse_field(state, it->token.string, &field))
+		{
+			printf("Invalid field \033[33m'%s'\033[m.\n", it->token.string);
+			return Continue;
+		}
+
+		for (op = QueryEq; op <= QueryGe && strcmp(ops[op], it->next->token.string); op++);
+		index = add_field(&query, &field);
+		if (op > QueryGe || index < 0 || query.npredicates == QUERY_MAX_PREDICATES)
+		{
+			sayhelp;
+			return Continue;
+		}
+		labels[index] = it->token.string;
+
+		predicate = &query.predicates[query.npredicates++];
+		predicate->field = index;
+		predicate->op = op;
+		if (!query_parse_value(it->next->next->token.string, field.type, &predicate->value))
+		{
+			printf("Invalid %s value \033[33m'%s'\033[m.\n", numeric_name(field.type), it->next->next->token.string);
+			return Continue;
+		}
+	}
+
+	// what to do with the matches
+	if (it && !strcmp(it->token.string, "count"))
+	{
+		query.action = QueryCount;
+		it = it->next;
+	}
+	else if (it && (!strcmp(it->token.string, "top") || !strcmp(it->token.string, "group")))
+	{
+		query.action = it->token.string[0] == 't' ? QueryTop : QueryGroup;
+		if (query.action == QueryTop)
+		{
+			it = it->next;
+			if (!it || !parse_uint(it->token.string, &query.limit) || !query.limit)
+			{
+				sayhelp;
+				return Continue;
+			}
+		}
+
+		it = it->next;
+		if (!it || strcmp(it->token.string, "by") || !it->next)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		it = it->next;
+		if (!parse_field(state, it->token.string, &field))
+		{
+			printf("Invalid field \033[33m'%s'\033[m.\n", it->token.string);
+			return Continue;
+		}
+		index = add_field(&query, &field);
+		if (index < 0)
+		{
+			sayhelp;
+			return Continue;
+		}
+		labels[index] = it->token.string;
+		query.field = index;
+
+		it = it->next;
+		if (it && query.action == QueryGroup && parse_uint(it->token.string, &query.limit) && query.limit)
+			it = it->next;
+	}
+
+	if (it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	begin = time_now();
+	if (!query_run(&query, &result))
+	{
+		printf("Failed to allocate memory.\n");
+		return Continue;
+	}
+	elapsed = time_now() - begin;
+
+	line = state->record_plan ? malloc(MAX_DECODE_LINE) : NULL;
+	for (i = 0; i < result.nrows; i++)
+	{
+		record = result.rows[i].record;
+
+		if (query.action == QueryGroup)
+		{
+			print_field(state, &query.fields[query.field], record);
+			printf(" \033[92m%llu\033[m\n", (unsigned long long)result.rows[i].count);
+			continue;
+		}
+
+		printf("\033[92m0x%08x\033[m #%u", state->record_base + record * state->record_stride, record);
+		if (line)
+		{
+			// records of a struct are shown whole
+			template_format(state->record_plan, query.data + (size_t)record * query.stride, query.stride,
+				NULL, 0, 0, " ", line, MAX_DECODE_LINE, &len);
+			fputc(' ', stdout);
+			fwrite(line, 1, len, stdout);
+		}
+		else
+		{
+			for (j = 0; j < query.nfields; j++)
+			{
+				printf(" %s=", labels[j]);
+				print_field(state, &query.fields[j], record);
+			}
+		}
+		fputc('\n', stdout);
+	}
+
+	printf("%llu of %u records match", (unsigned long long)result.matches, query.count);
+	if (query.action == QueryGroup)
+		printf(", %llu distinct values", (unsigned long long)result.groups);
+	printf(", in %.1f ms\n", elapsed * 1000.0);
+
+	free(line);
+	query_result_free(&result);
+
+	return Continue;
+}
+
+static int
+format_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	const section_t *section;
+	unsigned int i, listed;
+	int all;
+
+	all = 0;
+	for (it = offset_token(tokens, 1); it; it = it->next)
+	{
+		if (!strcmp(it->token.string, "--all"))
+			all = 1;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	if (state->format == FormatNone)
+	{
+		printf("The format of the file is not recognized.\n");
+		return Continue;
+	}
+
+	if (!get_sections(state))
+	{
+		printf("Failed to allocate memory.\n");
+		return Continue;
+	}
+
+	listed = all || state->sections->count <= MAX_SECTIONS_LISTED ? state->sections->count : MAX_SECTIONS_LISTED;
+	for (i = 0; i < listed; i++)
+	{
+		section = &state->sections->items[i];
+		printf("\033[92m0x%08x\033[m %10u \033[33m%s\033[m\n", section->offset, section->size, section->name);
+	}
+
+	if (listed < state->sections->count)
+		printf("%u more, use \033[33m--all\033[m to list them.\n", state->sections->count - listed);
+	printf("%s, %u sections\n", format_name(state->format), state->sections->count);
+
+	return Continue;
+}
+
+static int
+enter_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	archive_t *archive;
+	const member_t *member;
+	file_t *slice;
+	unsigned int i, listed;
+	int all, format;
+
+	it = offset_token(tokens, 1);
+	if (it && it->next)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	format = compress_detect(state->file->data, state->file->size);
+	if (!it && format != CompressNone)
+	{
+		enter_compressed(state, format);
+		return Continue;
+	}
+
+	all = it && !strcmp(it->token.string, "--all");
+	archive = get_archive(state);
+	if (!archive)
+		return Continue;
+
+	if (!it || all)
+	{
+		listed = all || archive->count <= MAX_MEMBERS_LISTED ? archive->count : MAX_MEMBERS_LISTED;
+		for (i = 0; i < listed; i++)
+		{
+			member = &archive->members[i];
+			printf("\033[92m0x%08x\033[m %10u \033[33m%s\033[m%s\n", member->offset, member->size, archive->names + member->name,
+				member->flags & MemberCompressed ? " (compressed)" : "");
+		}
+
+		if (listed < archive->count)
+			printf("%u more, use \033[33m--all\033[m to list them.\n", archive->count - listed);
+		printf("%s, %u members\n", archive_name(archive->format), archive->count);
+		return Continue;
+	}
+
+	member = archive_find(archive, it->token.string);
+	if (!member)
+	{
+		printf("\033[33m'%s'\033[m is not a member.\n", it->token.string);
+		return Continue;
+	}
+
+	if (member->flags & MemberCompressed)
+	{
+		printf("\033[33m'%s'\033[m is compressed, only stored members can be entered.\n", it->token.string);
+		return Continue;
+	}
+
+	if (!member->size)
+	{
+		printf("\033[33m'%s'\033[m is empty.\n", it->token.string);
+		return Continue;
+	}
+
+	slice = file_slice(state->file, member->offset, member->size);
+	if (!slice || !enter_view(state, slice, archive->names + member->name))
+	{
+		if (slice)
+			close_file(slice);
+		printf("Failed to allocate memory.\n");
+		return Continue;
+	}
+
+	printf("Entered \033[33m'%s'\033[m, \033[94m%u\033[m bytes at \033[92m0x%08x\033[m of the archive\n", state->views->member, member->size, member->offset);
+
+	state->format = format_detect(state->file->data, state->file->size);
+	if (state->format != FormatNone)
+		printf("Format: \033[94m%s\033[m, use \033[95mformat\033[m to list its sections.\n", format_name(state->format));
+	print_compressed(state);
+
+	return Continue;
+}
+
+// Make a file the one being viewed, keeping the current one and its
+// indexes for leave. Returns 0 if memory could not be allocated.
+static int
+enter_view(state_t *state, file_t *file, const char *name)
+{
+	struct view *view;
+
+	view = malloc(sizeof(struct view));
+	if (!view)
+		return 0;
+	view->member = malloc(strlen(name) + 1);
+	if (!view->member)
+	{
+		free(view);
+		return 0;
+	}
+	strcpy(view->member, name);
+
+	// the indexes of the file are kept for when the view is left
+	view->file = state->file;
+	view->off = state->off;
+	view->format = state->format;
+	view->sections = state->sections;
+	view->symbols = state->symbols;
+	view->suffix = state->suffix;
+	view->bloom = state->bloom;
+	view->strings = state->strings;
+	view->archive = state->archive;
+	view->compressed = state->compressed;
+	view->other = state->other;
+	view->diff = state->diff;
+	view->record_base = state->record_base;
+	view->record_stride = state->record_stride;
+	view->record_count = state->record_count;
+	view->record_plan = state->record_plan;
+	view->next = state->views;
+	state->views = view;
+
+	state->file = file;
+	state->off = 0;
+	state->format = FormatNone;
+	state->sections = NULL;
+	state->symbols = NULL;
+	state->suffix = NULL;
+	state->bloom = NULL;
+	state->strings = NULL;
+	state->archive = NULL;
+	state->compressed = NULL;
+	state->other = NULL;
+	state->diff = NULL;
+	state->record_base = 0;
+	state->record_stride = 0;
+	state->record_count = 0;
+	state->record_plan = NULL;
+	return 1;
+}
+
+// View the decompressed data of the file, indexing its checkpoints the
+// first time
+static void
+enter_compressed(state_t *state, int format)
+{
+	char path[MAX_PATH_SIZE];
+	compressed_t *compressed;
+	file_t *file;
+	uint64 mtime;
+	double begin;
+	int cached;
+
+	if (format != CompressGzip)
+	{
+		printf("\033[94m%s\033[m is recognized, but cannot be decompressed.\n", compress_name(format));
+		return;
+	}
+
+	// only a whole file has a sidecar, members are indexed every time
+	compressed = NULL;
+	cached = !state->views && !state->pieces && sidecar_path(state->filename, COMPRESS_EXT, path, sizeof(path)) &&
+		sidecar_file_time(state->filename, &mtime);
+	if (cached)
+	{
+		compressed = compress_open(state->file->data, state->file->size, path, mtime);
+		if (compressed)
+			printf("Using checkpoint index \033[33m'%s'\033[m\n", path);
+	}
+
+	if (!compressed)
+	{
+		begin = time_now();
+		compressed = compress_index(state->file->data, state->file->size);
+		if (!compressed)
+		{
+			printf("Failed to allocate memory.\n");
+			return;
+		}
+		printf("Indexed \033[94m%u\033[m checkpoints in %.3f seconds\n", compressed->count, time_now() - begin);
+
+		if (cached && compressed->size && compress_save(compressed, path, mtime))
+			printf("Saved checkpoint index \033[33m'%s'\033[m\n", path);
+	}
+
+	if (!compressed->complete)
+		printf("The data is truncated, malformed or too large after \033[92m0x%08x\033[m, the rest is not shown.\n", compressed->size);
+
+	if (!compressed->size)
+	{
+		printf("There is no data to view.\n");
+		compress_free(compressed);
+		return;
+	}
+
+	file = file_lazy(compressed->size, &compress_read, compressed);
+	if (!file)
+	{
+		printf("Failed to reserve memory for the data.\n");
+		compress_free(compressed);
+		return;
+	}
+
+	if (!enter_view(state, file, compress_name(format)))
+	{
+		close_file(file);
+		compress_free(compressed);
+		printf("Failed to allocate memory.\n");
+		return;
+	}
+	state->compressed = compressed;
+
+	printf("Entered the \033[94m%s\033[m data, \033[94m%u\033[m bytes from \033[94m%u\033[m\n", compress_name(format), compressed->size, compressed->in_size);
+
+	state->format = format_detect(state->file->data, state->file->size);
+	if (state->format != FormatNone)
+		printf("Format: \033[94m%s\033[m, use \033[95mformat\033[m to list its sections.\n", format_name(state->format));
+}
+
+// Tell how to view the file if it is compressed
+static void
+print_compressed(state_t *state)
+{
+	int format;
+
+	format = compress_detect(state->file->data, state->file->size);
+	if (format == CompressGzip)
+		printf("Compressed: \033[94m%s\033[m, use \033[95menter\033[m to view it decompressed.\n", compress_name(format));
+	else if (format == CompressZstd)
+		printf("Compressed: \033[94m%s\033[m, which cannot be decompressed.\n", compress_name(format));
+}
+
+static int
+leave_cmd(state_t *state, token_list_t *tokens)
+{
+	if (offset_token(tokens, 1))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!state->views)
+	{
+		printf("Not in a member, use \033[95menter\033[m first.\n");
+		return Continue;
+	}
+
+	printf("Left \033[33m'%s'\033[m\n", state->views->member);
+	leave_view(state);
+	printf("Now looking at offset \033[92m0x%08x\033[m\n", state->off);
+
+	return Continue;
+}
+
+static int
+cmp_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it, *opt;
+	const diff_range_t *range;
+	char *buf, *p;
+	unsigned int i, rows, row, gap, listed, limit, at;
+	int all, color, aligned;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (strcmp(it->token.string, "next") && strcmp(it->token.string, "prev") &&
+		strcmp(it->token.string, "list") && strcmp(it->token.string, "peek"))
+	{
+		gap = DIFF_GAP;
+		aligned = 0;
+		for (opt = it->next; opt; opt = opt->next)
+		{
+			if (!strcmp(opt->token.string, "--aligned"))
+				aligned = 1;
+			else if (!strcmp(opt->token.string, "--gap") && opt->next && parse_uint(opt->next->token.string, &gap))
+				opt = opt->next;
+			else
+			{
+				sayhelp;
+				return Continue;
+			}
+		}
+
+		compare_on_state(state, it->token.string, gap, aligned);
+		return Continue;
+	}
+
+	if (!state->diff)
+	{
+		printf("Nothing to compare with, use \033[95mcmp\033[m \033[36m<file>\033[m first.\n");
+		return Continue;
+	}
+
+	if (!strcmp(it->token.string, "next") || !strcmp(it->token.string, "prev"))
+	{
+		if (it->next)
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		i = diff_search(state->diff, state->off);
+		if (!strcmp(it->token.string, "next"))
+		{
+			// the range at the offset is the current one
+			if (i < state->diff->count && state->diff->ranges[i].offset == state->off)
+				i++;
+			if (i == state->diff->count)
+			{
+				printf("No more differences.\n");
+				return Continue;
+			}
+		}
+		else if (i-- == 0)
+		{
+			printf("No previous differences.\n");
+			return Continue;
+		}
+
+		range = &state->diff->ranges[i];
+		state->off = range->offset < state->file->size ? range->offset : state->file->size - 1;
+		printf("Difference \033[94m%u\033[m of \033[94m%u\033[m\n", i + 1, state->diff->count);
+		print_diff(state, range);
+		return Continue;
+	}
+
+	if (!strcmp(it->token.string, "list"))
+	{
+		all = it->next && !strcmp(it->next->token.string, "--all");
+		if (it->next && (!all || it->next->next))
+		{
+			sayhelp;
+			return Continue;
+		}
+
+		limit = all ? state->diff->count : DEFAULT_DIFFS_LISTED;
+		listed = 0;
+		for (i = diff_search(state->diff, state->off); i < state->diff->count && listed < limit; i++, listed++)
+			print_diff(state, &state->diff->ranges[i]);
+
+		if (!listed)
+			printf("No differences at or after \033[92m0x%08x\033[m\n", state->off);
+		else if (i < state->diff->count)
+			printf("%u more, use \033[33m--all\033[m to list them.\n", state->diff->count - i);
+		return Continue;
+	}
+
+	// peek, the two files side by side
+	rows = 0;
+	if (it->next && (strcmp(it->next->token.string, "--rows") || !it->next->next || it->next->next->next ||
+		!parse_uint(it->next->next->token.string, &rows)))
+	{
+		sayhelp;
+		return Continue;
+	}
+	if (!rows)
+		rows = BYTES_TO_DISPLAY / PEEK_WIDTH;
+
+	buf = malloc((size_t)rows * (render_compare_size(PEEK_WIDTH) + 1));
+	if (!buf)
+	{
+		printf("Failed to allocate memory.\n");
+		return Continue;
+	}
+
+	color = render_is_tty();
+	p = buf;
+	for (row = 0; row < rows; row++)
+	{
+		at = state->off + row * PEEK_WIDTH;
+		if (row && (at >= state->file->size && at >= state->other->size))
+			break;
+		p += render_compare_row(state->file->data, state->file->size, state->other->data, state->other->size, at, diff_other(state->diff, at), PEEK_WIDTH, color, p);
+		*p++ = '\n';
+
+		if (at > 0xffffffffu - PEEK_WIDTH)
+			break;
+	}
+	render_write(buf, p - buf);
+	free(buf);
+
+	return Continue;
+}
+
+static int
+changes_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	char label[MAX_SYMBOL_LABEL + 16];
+	const merkle_range_t *range;
+	unsigned int i, limit;
+	int all;
+
+	it = offset_token(tokens, 1);
+	all = it && !strcmp(it->token.string, "--all");
+	if (it && (!all || it->next))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (state->views || state->process || !state->tree)
+	{
+		printf("No block tree, use \033[95mindex\033[m \033[33mbuild tree\033[m and open the file again after it changes.\n");
+		return Continue;
+	}
+
+	if (!state->nchanges)
+	{
+		printf("No blocks changed since the tree was saved.\n");
+		return Continue;
+	}
+
+	limit = all ? state->nchanges : DEFAULT_DIFFS_LISTED;
+	for (i = 0; i < state->nchanges && i < limit; i++)
+	{
+		range = &state->changes[i];
+		if (symbol_label(state, range->offset, label))
+			printf("\033[92m0x%08x\033[m %10u bytes \033[33m%s\033[m\n", range->offset, range->size, label);
+		else
+			printf("\033[92m0x%08x\033[m %10u bytes\n", range->offset, range->size);
+	}
+	if (i < state->nchanges)
+		printf("%u more, use \033[33m--all\033[m to list them.\n", state->nchanges - i);
+
+	return Continue;
+}
+
+static int
+poke_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	byte *bytes;
+	unsigned int off, len;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	bytes = parse_bytes(it, &len);
+	if (!bytes)
+		return Continue;
+
+	off = state->off;
+	if (edit_file(state, off, overwritten(state, off, len), bytes, len))
+		print_edit(state, "Wrote", off, bytes, len);
+	free(bytes);
+
+	return Continue;
+}
+
+static int
+write_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	file_t *file;
+	unsigned int off;
+
+	it = offset_token(tokens, 1);
+	if (!it || it->next)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	file = open_file(it->token.string);
+	if (!file)
+	{
+		printf("Failed to open \033[33m'%s'\033[m\n", it->token.string);
+		return Continue;
+	}
+
+	// the bytes are copied into the edits, the file is not needed after
+	off = state->off;
+	if (edit_file(state, off, overwritten(state, off, file->size), file->data, file->size))
+		print_edit(state, "Wrote", off, NULL, file->size);
+	close_file(file);
+
+	return Continue;
+}
+
+static int
+fill_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	byte *bytes, *data;
+	unsigned int off, len, count, i;
+
+	it = offset_token(tokens, 1);
+	if (!it || !it->next || !parse_uint(it->token.string, &len) || !len)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	bytes = parse_bytes(it->next, &count);
+	if (!bytes)
+		return Continue;
+
+	data = malloc(len);
+	if (!data)
+	{
+		printf("Failed to allocate memory.\n");
+		free(bytes);
+		return Continue;
+	}
+
+	// the values repeated, the last time cut short if they do not divide
+	// the length
+	for (i = 0; i < len; i += count)
+		memcpy(data + i, bytes, len - i < count ? len - i : count);
+
+	off = state->off;
+	if (edit_file(state, off, overwritten(state, off, len), data, len))
+		print_edit(state, "Filled", off, NULL, len);
+	free(data);
+	free(bytes);
+
+	return Continue;
+}
+
+static int
+insert_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	byte *bytes;
+	unsigned int off, len;
+
+	it = offset_token(tokens, 1);
+	if (!it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	bytes = parse_bytes(it, &len);
+	if (!bytes)
+		return Continue;
+
+	off = state->off;
+	if (edit_file(state, off, 0, bytes, len))
+		print_edit(state, "Inserted", off, bytes, len);
+	free(bytes);
+
+	return Continue;
+}
+
+static int
+delete_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	unsigned int off, len;
+
+	it = offset_token(tokens, 1);
+	if (!it || it->next || !parse_uint(it->token.string, &len) || !len)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	off = state->off;
+	if (len > state->file->size - off)
+		len = state->file->size - off;
+
+	if (edit_file(state, off, len, NULL, 0))
+		print_edit(state, "Deleted", off, NULL, len);
+
+	return Continue;
+}
+
+static int
+save_cmd(state_t *state, token_list_t *tokens)
+{
+	char path[MAX_PATH_SIZE];
+	char log[MAX_PATH_SIZE];
+	char target[MAX_PATH_SIZE];
+	char *filename;
+	unsigned int off;
+	double begin;
+	int in_place, replaced;
+
+	if (offset_token(tokens, 1))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!state->pieces)
+	{
+		printf("There are no edits to save.\n");
+		return Continue;
+	}
+
+	// through a symbolic link the file it leads to is replaced, not the link
+	if (!pieces_target(state->filename, target, sizeof(target)))
+	{
+		printf("Failed to find the file \033[33m'%s'\033[m leads to.\n", state->filename);
+		return Continue;
+	}
+
+	if (!sidecar_path(target, PIECE_TEMP_EXT, path, sizeof(path)))
+	{
+		printf("Path too long.\n");
+		return Continue;
+	}
+
+	if (!sidecar_path(state->filename, JOURNAL_EXT, log, sizeof(log)))
+	{
+		printf("Path too long.\n");
+		return Continue;
+	}
+
+	// bytes only overwritten go straight into the file, otherwise a new
+	// file is written beside it and renamed over it, so a failure leaves
+	// the file as it was. Either is marked in the edit log first, so
+	// the next session knows what a crash in the middle left, and nothing
+	// is written without the mark.
+	begin = time_now();
+	in_place = pieces_in_place(state->pieces);
+	if (!journal_mark(state->journal, in_place ? JournalPatch : JournalRename))
+	{
+		printf("Failed to write the edit log, nothing was saved and the edits are kept.\n");
+		return Continue;
+	}
+
+	in_place = in_place && pieces_patch(state->pieces, state->filename);
+	if (!in_place && !journal_mark(state->journal, JournalRename))
+	{
+		printf("Failed to write the edit log, the edits are kept.\n");
+		return Continue;
+	}
+
+	if (!in_place && !pieces_save(state->pieces, state->filename, path))
+	{
+		printf("Failed to write \033[33m'%s'\033[m, the edits are kept.\n", path);
+		return Continue;
+	}
+
+	// on Windows the file cannot be replaced while it is open, and the
+	// data shown must be read again in any case
+	off = state->off;
+	filename = state->filename;
+	state->filename = NULL;
+	close_on_state(state);
+
+	// a file not replaced is as it was, its edits stay in the log
+	replaced = in_place || pieces_replace(path, target);
+	if (replaced)
+		remove(log);
+
+	if (!replaced)
+		printf("Failed to replace the file, the edits were saved to \033[33m'%s'\033[m\n", path);
+	else if (in_place)
+		printf("Wrote the edits over \033[33m'%s'\033[m in %.3f seconds\n", filename, time_now() - begin);
+	else
+		printf("Saved \033[33m'%s'\033[m in %.3f seconds\n", filename, time_now() - begin);
+
+	return reopen_file(state, filename, off) ? Continue : Exit;
+}
+
+static int
+undo_cmd(state_t *state, token_list_t *tokens)
+{
+	if (offset_token(tokens, 1))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	step_journal(state, 1);
+	return Continue;
+}
+
+static int
+redo_cmd(state_t *state, token_list_t *tokens)
+{
+	if (offset_token(tokens, 1))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	step_journal(state, 0);
+	return Continue;
+}
+
+static int
+journal_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it;
+	char path[MAX_PATH_SIZE];
+	const journal_op_t *op;
+	char *filename;
+	unsigned int first, last, i, limit, groups;
+	int all, rollback;
+
+	it = offset_token(tokens, 1);
+	all = it && !strcmp(it->token.string, "--all");
+	rollback = it && !strcmp(it->token.string, "rollback");
+	if (it && (!(all || rollback) || it->next))
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	if (!state->journal)
+	{
+		printf("No edits, the edit log starts with the first.\n");
+		return Continue;
+	}
+
+	if (rollback)
+	{
+		// after an interrupted save the file on disk is not the original,
+		// undoing everything and saving writes the original back
+		if (state->interrupted)
+		{
+			while (state->journal->done)
+			{
+				if (!step_journal(state, 1))
+					return Continue;
+			}
+			printf("Undid every edit, \033[95msave\033[m to restore the file as it was before them.\n");
+			return Continue;
+		}
+
+		if (!sidecar_path(state->filename, JOURNAL_EXT, path, sizeof(path)))
+		{
+			printf("Path too long.\n");
+			return Continue;
+		}
+
+		first = state->off;
+		filename = state->filename;
+		state->filename = NULL;
+		close_on_state(state);
+		remove(path);
+		printf("Dropped the edits.\n");
+		return reopen_file(state, filename, first) ? Continue : Exit;
+	}
+
+	groups = 0;
+	for (i = 0; i < state->journal->done; i++)
+		groups += !i || state->journal->ops[i].group != state->journal->ops[i - 1].group;
+	printf("\033[94m%u\033[m edits in \033[94m%u\033[m groups, \033[94m%u\033[m undone which can be redone, holding \033[94m%zu\033[m bytes.\n",
+		state->journal->done, groups, state->journal->count - state->journal->done, state->journal->used);
+	if (!state->journal->log)
+		printf("The edit log could not be written, the edits are lost if the session ends.\n");
+
+	// the latest first, as undo takes them
+	limit = all ? state->journal->done : DEFAULT_DIFFS_LISTED;
+	first = state->journal->done;
+	last = first > limit ? first - limit : 0;
+	for (i = first; i > last; i--)
+	{
+		op = &state->journal->ops[i - 1];
+		printf("\033[92m0x%08x\033[m %10u bytes replaced by %10u, group \033[94m%u\033[m\n", op->offset, op->old_size, op->new_size, op->group);
+	}
+	if (last)
+		printf("%u more, use \033[33m--all\033[m to list them.\n", last);
+
+	return Continue;
+}
+
+static int
+replace_cmd(state_t *state, token_list_t *tokens)
+{
+	token_list_t *it, *arrow, *opt;
+	pattern_t *pattern, *value;
+	unsigned int *matches;
+	unsigned int old_size, new_size, confirm, i;
+	char answer[16];
+	uint64 size;
+	double begin;
+	int count, dry, replace;
+
+	it = offset_token(tokens, 1);
+	for (arrow = it; arrow && strcmp(arrow->token.string, "->"); arrow = arrow->next);
+	for (opt = arrow ? arrow->next : NULL; opt && strncmp(opt->token.string, "--", 2); opt = opt->next);
+	if (!arrow || arrow == it)
+	{
+		sayhelp;
+		return Continue;
+	}
+
+	dry = 0;
+	confirm = DEFAULT_REPLACE_CONFIRM;
+	for (; opt; opt = opt->next)
+	{
+		if (!strcmp(opt->token.string, "--dry"))
+			dry = 1;
+		else if (!strcmp(opt->token.string, "--confirm") && opt->next && parse_uint(opt->next->token.string, &confirm))
+			opt = opt->next;
+		else
+		{
+			sayhelp;
+			return Continue;
+		}
+	}
+
+	if (state->process)
+	{
+		printf("Only whole files can be edited.\n");
+		return Continue;
+	}
+
+	// both sides are patterns of their own, the list is cut at the arrow
+	// and the options for as long as they are generated
+	arrow->prev->next = NULL;
+	pattern = pattern_generate(it, &old_size);
+	arrow->prev->next = arrow;
+
+	value = NULL;
+	new_size = 0;
+	for (opt = arrow->next; opt && strncmp(opt->token.string, "--", 2); opt = opt->next);
+	if (arrow->next != opt)
+	{
+		if (opt)
+			opt->prev->next = NULL;
+		value = pattern_generate(arrow->next, &new_size);
+		if (opt)
+			opt->prev->next = opt;
+	}
+
+	if (!pattern || !old_size || (arrow->next != opt && !value))
+	{
+		pattern_free(pattern);
+		pattern_free(value);
+		printf("Malformed pattern.\n");
+		return Continue;
+	}
+
+	// a wildcard keeps the byte matched at its position
+	for (i = old_size; i < new_size; i++)
+	{
+		if (pattern_get(value, i) < 0)
+		{
+			pattern_free(pattern);
+			pattern_free(value);
+			printf("Wildcards past the length of the pattern cannot be written.\n");
+			return Continue;
+		}
+	}
+
+	begin = time_now();
+	count = pattern_find_all(pattern, state->file->data, state->file->size, &matches);
+	pattern_free(pattern);
+	if (count < 0)
+	{
+		pattern_free(value);
+		printf("Failed to allocate memory.\n");
+		return Continue;
+	}
+
+	printf("Found \033[94m%d\033[m matches in %.3f seconds\n", count, time_now() - begin);
+	if (dry || !count)
+	{
+		free(matches);
+		pattern_free(value);
+		return Continue;
+	}
+
+	// the matches do not overlap, so no byte is replaced twice
+	size = (uint64)state->file->size - (uint64)count * old_size + (uint64)count * new_size;
+	replace = 0;
+	if (!size)
+		printf("The file cannot be left empty.\n");
+	else if (size > 0xffffffff)
+		printf("The file would be 4 GiB or more.\n");
+	else if ((unsigned int)count > confirm)
+	{
+		printf("Replace \033[94m%d\033[m matches? [y/N] ", count);
+		fflush(stdout);
+		replace = readline(answer, sizeof(answer)) > 0 && (answer[0] == 'y' || answer[0] == 'Y');
+		if (!replace)
+			printf("Nothing replaced.\n");
+	}
+	else
+		replace = 1;
+
+	begin = time_now();
+	if (replace && replace_matches(state, matches, count, old_size, value, new_size))
+	{
+		printf("Replaced \033[94m%d\033[m matches in %.3f seconds\n", count, time_now() - begin);
+		printf("Size: \033[92m0x%08x\033[m, \033[94m%u\033[m edits not saved.\n", state->file->size, state->journal->done);
+	}
+
+	free(matches);
+	pattern_free(value);
+	return Continue;
+}
+
+int
+compare_on_state(state_t *state, const char *filename, unsigned int gap, int aligned)
+{
+	file_t *other;
+	diff_t *diff;
+	unsigned int i;
+	double begin, elapsed;
+
+	other = open_file(filename);
+	if (!other)
+	{
+		printf("Failed to open \033[33m'%s'\033[m\n", filename);
+		return 0;
+	}
+
+	begin = time_now();
+	if (aligned)
+		diff = align_compare(state->file->data, state->file->size, other->data, other->size, gap);
+	else
+		diff = diff_compare(state->file->data, state->file->size, other->data, other->size, gap);
+	if (!diff)
+	{
+		close_file(other);
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+	elapsed = time_now() - begin;
+
+	diff_free(state->diff);
+	if (state->other)
+		close_file(state->other);
+	state->other = other;
+	state->diff = diff;
+
+	if (aligned)
+		printf("Aligned with \033[33m'%s'\033[m in chunks of \033[94m%u\033[m bytes in %.3f seconds (%.0f MiB/s)\n", filename, diff->chunk, elapsed,
+			elapsed > 0 ? ((double)state->file->size + other->size) / 1048576.0 / elapsed : 0.0);
+	else
+		printf("Compared with \033[33m'%s'\033[m in %.3f seconds (%.0f MiB/s)\n", filename, elapsed,
+			elapsed > 0 ? (state->file->size < other->size ? state->file->size : other->size) / 1048576.0 / elapsed : 0.0);
+	if (!diff->count)
+	{
+		printf("The files are the same.\n");
+		return 1;
+	}
+
+	printf("\033[94m%llu\033[m bytes differ in \033[94m%u\033[m ranges\n", (unsigned long long)diff->differ, diff->count);
+	for (i = 0; i < diff->count && i < DEFAULT_DIFFS_LISTED; i++)
+		print_diff(state, &diff->ranges[i]);
+	if (i < diff->count)
+		printf("%u more, use \033[95mcmp\033[m \033[33mnext\033[m or \033[33mlist\033[m to see them.\n", diff->count - i);
+
+	return 1;
+}
+
+// Returns the members of the archive being viewed, indexing it the
+// first time, or NULL after printing why there are none
+static archive_t *
+get_archive(state_t *state)
+{
+	char path[MAX_PATH_SIZE];
+	uint64 mtime;
+	double begin;
+	int format, cached;
+
+	if (state->archive)
+		return state->archive;
+
+	format = archive_detect(state->file->data, state->file->size);
+	if (format == ArchiveNone)
+	{
+		printf("Not a tar, zip or cpio archive.\n");
+		return NULL;
+	}
+
+	// only a whole file has a sidecar, members are indexed every time
+	cached = !state->views && !state->pieces && sidecar_path(state->filename, ARCHIVE_EXT, path, sizeof(path)) &&
+		sidecar_file_time(state->filename, &mtime);
+	if (cached)
+	{
+		state->archive = archive_open(path, state->file->size, mtime);
+		if (state->archive)
+		{
+			printf("Using member index \033[33m'%s'\033[m\n", path);
+			return state->archive;
+		}
+	}
+
+	begin = time_now();
+	state->archive = archive_index(state->file->data, state->file->size, format);
+	if (!state->archive)
+	{
+		printf("Failed to allocate memory.\n");
+		return NULL;
+	}
+	printf("Indexed \033[94m%u\033[m members in %.3f seconds\n", state->archive->count, time_now() - begin);
+
+	if (cached && state->archive->count && archive_save(state->archive, path, state->file->size, mtime))
+		printf("Saved member index \033[33m'%s'\033[m\n", path);
+
+	return state->archive;
+}
+
+// Free the indexes of the file or member being viewed
+static void
+free_indexes(state_t *state)
+{
+	strindex_free(state->strings);
+	state->strings = NULL;
+	suffix_free(state->suffix);
+	state->suffix = NULL;
+	bloom_free(state->bloom);
+	state->bloom = NULL;
+	sections_free(state->sections);
+	state->sections = NULL;
+	symbols_free(state->symbols);
+	state->symbols = NULL;
+	archive_free(state->archive);
+	state->archive = NULL;
+	diff_free(state->diff);
+	state->diff = NULL;
+	if (state->other)
+		close_file(state->other);
+	state->other = NULL;
+	state->format = FormatNone;
+}
+
+// Close the member being viewed and return to the view it was entered
+// from
+static void
+leave_view(state_t *state)
+{
+	struct view *view;
+
+	view = state->views;
+	free_indexes(state);
+	close_file(state->file);
+	compress_free(state->compressed);
+
+	state->file = view->file;
+	state->off = view->off;
+	state->format = view->format;
+	state->sections = view->sections;
+	state->symbols = view->symbols;
+	state->suffix = view->suffix;
+	state->bloom = view->bloom;
+	state->strings = view->strings;
+	state->archive = view->archive;
+	state->compressed = view->compressed;
+	state->other = view->other;
+	state->diff = view->diff;
+	state->record_base = view->record_base;
+	state->record_stride = view->record_stride;
+	state->record_count = view->record_count;
+	state->record_plan = view->record_plan;
+	state->views = view->next;
+
+	free(view->member);
+	free(view);
+}
+
+// Returns the sections of the format of the file, parsing its headers
+// the first time, or NULL if there are none
+static sections_t *
+get_sections(state_t *state)
+{
+	if (!state->sections && state->format != FormatNone)
+		state->sections = format_index(state->file->data, state->file->size, state->format);
+
+	return state->sections;
+}
+
+// Write the symbol an offset is in as name+0xNN, loading the symbols of
+// an ELF file the first time. Returns the length, 0 if there is no symbol.
+static unsigned int
+symbol_label(state_t *state, unsigned int off, char *const out)
+{
+	const symbol_t *symbol;
+	const region_t *region;
+	double begin;
+
+	// offsets of a process stand for the address they were read from
+	if (state->process && !state->views)
+	{
+		region = process_region(state->process, off);
+		if (!region->name[0])
+			return sprintf(out, "0x%012llx", (unsigned long long)(region->address + (off - region->offset)));
+		return sprintf(out, "0x%012llx %.*s", (unsigned long long)(region->address + (off - region->offset)), MAX_SYMBOL_LABEL, region->name);
+	}
+
+	if (state->format != FormatElf)
+		return 0;
+
+	if (!state->symbols)
+	{
+		begin = time_now();
+		state->symbols = symbols_load(state->file->data, state->file->size);
+		if (!state->symbols)
+			return 0;
+
+		if (state->symbols->count)
+			printf("\033[90mLoaded %u symbols in %.3f seconds\033[m\n", state->symbols->count, time_now() - begin);
+	}
+
+	symbol = symbols_lookup(state->symbols, off);
+	if (!symbol)
+		return 0;
+
+	if (off == symbol->offset)
+		return sprintf(out, "%.*s", MAX_SYMBOL_LABEL, symbol->name);
+	return sprintf(out, "%.*s+0x%x", MAX_SYMBOL_LABEL, symbol->name, off - symbol->offset);
+}
+
+// Print a match of find, with the symbol it is in
+static void
+print_match(state_t *state, unsigned int count, unsigned int off)
+{
+	char label[MAX_SYMBOL_LABEL + 16];
+
+	if (symbol_label(state, off, label))
+		printf("Matched \033[92m%u\033[m bytes at \033[92m0x%08x\033[m \033[33m%s\033[m\n", count, off, label);
+	else
+		printf("Matched \033[92m%u\033[m bytes at \033[92m0x%08x\033[m\n", count, off);
+}
+
+// Parse a field of the records, <offset>:<type>[:big|:little] or the name
+// of a field of the struct the records were set from
+static int
+parse_field(state_t *state, const char *s, query_field_t *const out)
+{
+	const plan_op_t *op;
+	char spec[64];
+	char *type, *endianess;
+	unsigned int i;
+
+	for (i = 0; state->record_plan && i < state->record_plan->nops; i++)
+	{
+		op = &state->record_plan->ops[i];
+		if (strcmp(op->name, s))
+			continue;
+		if (op->kind != OpValue || op->type < 0)
+			return 0;
+
+		out->offset = op->offset;
+		out->type = op->type;
+		out->endianess = op->endianess;
+		return 1;
+	}
+
+	if (*s == '@')
+		s++;
+	if (strlen(s) >= sizeof(spec))
+		return 0;
+	strcpy(spec, s);
+
+	type = strchr(spec, ':');
+	if (!type)
+		return 0;
+	*type++ = 0;
+	endianess = strchr(type, ':');
+	if (endianess)
+		*endianess++ = 0;
+
+	if (!parse_uint(spec, &out->offset) || (out->type = numeric_type(type)) < 0)
+		return 0;
+
+	out->endianess = state->current_endianess;
+	if (endianess && (!strcmp(endianess, "big") || !strcmp(endianess, "be")))
+		out->endianess = BigEndian;
+	else if (endianess && (!strcmp(endianess, "little") || !strcmp(endianess, "le")))
+		out->endianess = LittleEndian;
+	else if (endianess)
+		return 0;
+
+	return (uint64)out->offset + numeric_size(out->type) <= state->record_stride;
+}
+
+// Returns the index of a field in a query, adding it if it is new, or -1
+// if the query has too many
+static int
+add_field(query_t *query, const query_field_t *field)
+{
+	unsigned int i;
+
+	for (i = 0; i < query->nfields; i++)
+	{
+		if (query->fields[i].offset == field->offset && query->fields[i].type == field->type &&
+			query->fields[i].endianess == field->endianess)
+			return i;
+	}
+
+	if (query->nfields == QUERY_MAX_FIELDS)
+		return -1;
+
+	query->fields[query->nfields] = *field;
+	return query->nfields++;
+}
+
+// Print the value of a field of a record
+static void
+print_field(state_t *state, const query_field_t *field, unsigned int record)
+{
+	value_u value;
+	char out[NUMERIC_MAX_CHARS];
+
+	numeric_decode(state->file->data + state->record_base + (size_t)record * state->record_stride + field->offset,
+		1, field->type, field->endianess, &value);
+	fwrite(out, 1, numeric_format(&value, field->type, out), stdout);
+}
+
+// Print a minimap as rows of MAP_COLUMNS cells labelled by their offset,
+// followed by the legend
+static void
+print_map(minimap_t *map, unsigned int mark, char *line)
+{
+	unsigned int cell, count;
+	size_t len;
+
+	for (cell = 0; cell < map->count; cell += MAP_COLUMNS)
+	{
+		count = map->count - cell < MAP_COLUMNS ? map->count - cell : MAP_COLUMNS;
+		len = render_map_row(map->cells + cell, count, mark >= cell ? mark - cell : count, mark >= cell ? mark - cell + 1 : count, line);
+		printf("\033[92m0x%08x\033[m %.*s\n", cell * map->cell_size, (int)len, line);
+	}
+
+	len = render_map_legend(line);
+	printf("%.*s\n", (int)len, line);
+}
+
+// Print the statistics of an array with a bar for each histogram bin
+static void
+print_stats(numeric_stats_t *stats, int type, double elapsed)
+{
+	char first[NUMERIC_MAX_CHARS + 1], second[NUMERIC_MAX_CHARS + 1];
+	double lo, hi, edge;
+	uint64 most;
+	int i, bar;
+
+	printf("Count:  \033[92m%llu\033[m", (unsigned long long)stats->count);
+	if (stats->nans)
+		printf(" and %llu NaN", (unsigned long long)stats->nans);
+	printf(", in %.1f ms\n", elapsed * 1000.0);
+
+	if (!stats->count)
+		return;
+
+	first[numeric_format(&stats->min, type, first)] = 0;
+	second[numeric_format(&stats->max, type, second)] = 0;
+	printf("Min:    \033[92m%s\033[m\n", first);
+	printf("Max:    \033[92m%s\033[m\n", second);
+
+	first[numeric_format(&stats->mean, Float64, first)] = 0;
+	second[numeric_format(&stats->stddev, Float64, second)] = 0;
+	printf("Mean:   \033[92m%s\033[m\n", first);
+	printf("Stddev: \033[92m%s\033[m\n", second);
+
+	most = 0;
+	for (i = 0; i < NUMERIC_BINS; i++)
+	{
+		if (stats->histogram[i] > most)
+			most = stats->histogram[i];
+	}
+
+	if (!most)
+		return;
+
+	lo = numeric_to_double(&stats->min, type);
+	hi = numeric_to_double(&stats->max, type);
+	for (i = 0; i < NUMERIC_BINS; i++)
+	{
+		edge = lo + (hi - lo) * i / NUMERIC_BINS;
+		first[numeric_format(&edge, Float64, first)] = 0;
+		bar = (int)((stats->histogram[i] * MAX_HISTOGRAM_BAR + most - 1) / most);
+		printf(" %22s %10llu %.*s\n", first, (unsigned long long)stats->histogram[i], bar, HISTOGRAM_BAR);
+
+		// everything is in the first bin when all values are equal
+		if (hi == lo)
+			break;
+	}
+}
+
+// Write a character of a char8 or char16 array as UTF-8, or a dot if it
+// is not printable or not below limit. Returns the number of bytes
+// written.
+static int
+put_char(char *const out, unsigned int c, unsigned int limit)
+{
+	if (c < 0x20 || c == 0x7f || c >= limit || (c >= 0xd800 && c < 0xe000))
+	{
+		*out = '.';
+		return 1;
+	}
+
+	if (c < 0x80)
+	{
+		*out = (char)c;
+		return 1;
+	}
+
+	if (c < 0x800)
+	{
+		out[0] = (char)(0xc0 | (c >> 6));
+		out[1] = (char)(0x80 | (c & 0x3f));
+		return 2;
+	}
+
+	out[0] = (char)(0xe0 | (c >> 12));
+	out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+	out[2] = (char)(0x80 | (c & 0x3f));
+	return 3;
+}
+
+// Find a pattern without wildcards by binary search on the suffix
+// array. Returns 0 if there is no index or the pattern has wildcards.
+static int
+find_indexed(state_t *state, pattern_t *pattern, unsigned int count)
+{
+	byte *literal;
+	unsigned int offs[MAX_FIND_ITERATIONS];
+	unsigned int first, total, after, nfound;
+	unsigned int i, j, off;
+	int value;
+
+	if (!state->suffix || !count)
+		return 0;
+
+	literal = malloc(count);
+	if (!literal)
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		value = pattern_get(pattern, i);
+		if (value < 0)
+		{
+			free(literal);
+			return 0;
+		}
+		literal[i] = (byte)value;
+	}
+
+	total = suffix_find(state->suffix, state->file->data, literal, count, &first);
+	free(literal);
+
+	// matches are in suffix order, keep the first few at or after the offset
+	after = 0;
+	nfound = 0;
+	for (i = first; i < first + total; i++)
+	{
+		off = state->suffix->sa[i];
+		if (off < state->off)
+			continue;
+
+		after++;
+		if (nfound == MAX_FIND_ITERATIONS && off > offs[nfound - 1])
+			continue;
+
+		if (nfound < MAX_FIND_ITERATIONS)
+			nfound++;
+		for (j = nfound - 1; j > 0 && offs[j - 1] > off; j--)
+			offs[j] = offs[j - 1];
+		offs[j] = off;
+	}
+
+	for (i = 0; i < nfound; i++)
+		print_match(state, count, offs[i]);
+
+	if (!nfound)
+		printf("No match.\n");
+	else if (after > nfound)
+		printf("Reached max find iterations, %u more matches exist...\n", after - nfound);
+	printf("\033[90m%u occurrences in the file (indexed)\033[m\n", total);
+
+	return 1;
+}
+
+// Find a pattern, only searching the blocks which the Bloom filter
+// index cannot rule out. Returns 0 if there is no index or the pattern
+// has no run of 4 bytes without wildcards.
+static int
+find_blocks(state_t *state, pattern_t *pattern, unsigned int count)
+{
+	bloom_t *bloom;
+	uint32 grams[MAX_FIND_GRAMS];
+	byte gram[BLOOM_GRAM_SIZE];
+	unsigned int ngrams, lead, nsearched;
+	unsigned int block, next;
+	unsigned int pos, end, limit, off;
+	unsigned int itcount;
+	unsigned int i, j;
+	int value;
+
+	bloom = state->bloom;
+	if (!bloom || count < BLOOM_GRAM_SIZE)
+		return 0;
+
+	// every gram in the literal parts of the pattern must be in the block
+	// or the next, in order
+	ngrams = 0;
+	lead = 0;
+	for (i = 0; i + BLOOM_GRAM_SIZE <= count && i < BLOOM_BLOCK_SIZE && ngrams < MAX_FIND_GRAMS; i++)
+	{
+		for (j = 0; j < BLOOM_GRAM_SIZE; j++)
+		{
+			value = pattern_get(pattern, i + j);
+			if (value < 0)
+				break;
+			gram[j] = (byte)value;
+		}
+
+		if (j == BLOOM_GRAM_SIZE)
+		{
+			if (!ngrams)
+				lead = i;
+			memcpy(&grams[ngrams++], gram, sizeof(uint32));
+		}
+	}
+
+	if (!ngrams)
+		return 0;
+
+	itcount = 0;
+	nsearched = 0;
+	block = state->off / BLOOM_BLOCK_SIZE;
+	while (block < bloom->nblocks && itcount < MAX_FIND_ITERATIONS)
+	{
+		next = bloom_next_candidate(bloom, grams, ngrams, lead, block);
+		if (next == bloom->nblocks)
+		{
+			block = next;
+			break;
+		}
+
+		// matches starting in the block, which may end in the next
+		pos = next * BLOOM_BLOCK_SIZE;
+		if (pos < state->off)
+			pos = state->off;
+		end = state->file->size - next * BLOOM_BLOCK_SIZE > BLOOM_BLOCK_SIZE ? (next + 1) * BLOOM_BLOCK_SIZE : state->file->size;
+		limit = state->file->size - end > count - 1 ? end + count - 1 : state->file->size;
+
+		for (; pos < end && itcount < MAX_FIND_ITERATIONS; itcount++)
+		{
+			if (!pattern_find_next(pattern, state->file->data + pos, limit - pos, &off))
+				break;
+
+			print_match(state, count, pos + off);
+			pos += off + 1;
+		}
+
+		nsearched++;
+		block = next + 1;
+	}
+
+	if (itcount == 0)
+		printf("No match.\n");
+	else if (itcount == MAX_FIND_ITERATIONS)
+		printf("Reached max find iterations, more matches may exist...\n");
+	printf("\033[90mSearched %u of %u blocks (indexed)\033[m\n", nsearched, block - state->off / BLOOM_BLOCK_SIZE);
+
+	return 1;
+}
+
+// Parse an unsigned decimal, hexadecimal or octal integer. Returns
+// nonzero on success.
+static int
+parse_uint(const char *s, unsigned int *const out)
+{
+	char *end;
+	unsigned long long value;
+
+	if (!*s || *s == '-')
+		return 0;
+
+	value = strtoull(s, &end, 0);
+	if (*end || value > 0xffffffffULL)
+		return 0;
+
+	*out = (unsigned int)value;
+	return 1;
+}
+
+// Parse an optional [<start>] [<length>] range, advancing *it past it.
+// The range defaults to the current offset and the rest of the file.
+// Returns nonzero if the range lies within the file.
+static int
+parse_range(state_t *state, token_list_t **it, unsigned int *const start, unsigned int *const len)
+{
+	*start = state->off;
+	*len = state->file->size - state->off;
+
+	if (*it && parse_uint((*it)->token.string, start))
+	{
+		*it = (*it)->next;
+		*len = *start < state->file->size ? state->file->size - *start : 0;
+
+		if (*it && parse_uint((*it)->token.string, len))
+			*it = (*it)->next;
+	}
+
+	if (*start > state->file->size || *len > state->file->size - *start)
+	{
+		printf("Range exceeds the end of the file.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+// Close the file or process being viewed, with all the views entered
+// from it and their indexes
+static void
+close_on_state(state_t *state)
+{
+	while (state->views)
+		leave_view(state);
+
+	if (state->file)
+	{
+		close_file(state->file);
+		state->file = NULL;
+	}
+
+	// the edited view was closed above, the file it shows last
+	if (state->base)
+	{
+		close_file(state->base);
+		state->base = NULL;
+	}
+	pieces_free(state->pieces);
+	state->pieces = NULL;
+	journal_close(state->journal);
+	state->journal = NULL;
+	state->interrupted = 0;
+	state->dropping = 0;
+
+	process_free(state->process);
+	state->process = NULL;
+	merkle_free(state->tree);
+	state->tree = NULL;
+	free(state->changes);
+	state->changes = NULL;
+	state->nchanges = 0;
+	free_indexes(state);
+	free(state->filename);
+	state->filename = NULL;
+}
+
+// Bind the name of each named mapping of the process to where it is in
+// the view. Files mapped more than once get a suffix from the second
+// mapping on, as in libc.so.6:1.
+static void
+bind_regions(state_t *state)
+{
+	char name[REGION_NAME_SIZE + 16];
+	const region_t *region;
+	unsigned int i, n, bound;
+
+	bound = 0;
+	for (i = 0; i < state->process->count; i++)
+	{
+		region = &state->process->regions[i];
+		if (!region->name[0])
+			continue;
+
+		strcpy(name, region->name);
+		for (n = 1; alist_find(state->bindings, AKEY(name)); n++)
+			snprintf(name, sizeof(name), "%s:%u", region->name, n);
+
+		alist_insert(state->bindings, AKEY(name), AVALUE(region->offset));
+		bound++;
+	}
+
+	if (bound)
+		printf("Bound \033[94m%u\033[m named mappings, use \033[95mjump\033[m \033[36m<name>\033[m such as \033[33m[heap]\033[m.\n", bound);
+}
+
+// Search the memory of a process from the current offset, all regions
+// at once. Returns 0 if not viewing a process.
+static int
+find_process(state_t *state, pattern_t *pattern, unsigned int count)
+{
+	unsigned int matches[MAX_FIND_ITERATIONS];
+	int n, i;
+
+	if (!state->process || state->views)
+		return 0;
+
+	n = process_find(state->process, pattern, count, state->off, matches, MAX_FIND_ITERATIONS);
+	if (n < 0)
+	{
+		printf("Failed to allocate memory.\n");
+		return 1;
+	}
+
+	for (i = 0; i < n; i++)
+		print_match(state, count, matches[i]);
+
+	if (n == 0)
+		printf("No match.\n");
+	else if (n == MAX_FIND_ITERATIONS)
+		printf("Reached max find iterations, more matches may exist...\n");
+
+	return 1;
+}
+
+// Print a range of differences, with the symbol it is in
+static void
+print_diff(state_t *state, const diff_range_t *range)
+{
+	char label[MAX_SYMBOL_LABEL + 16];
+	char change[96];
+	const char *only;
+
+	if (!(range->offset < state->file->size && symbol_label(state, range->offset, label)))
+		label[0] = 0;
+
+	// aligned, the range says how the bytes changed and where they are in the other file
+	if (state->diff->chunk)
+	{
+		switch (range->kind)
+		{
+		case DiffInserted:
+			snprintf(change, sizeof(change), "inserted %10u bytes from \033[92m0x%08x\033[m", range->other_size, range->other);
+			break;
+		case DiffDeleted:
+			snprintf(change, sizeof(change), "deleted  %10u bytes", range->size);
+			break;
+		case DiffMoved:
+			snprintf(change, sizeof(change), "moved    %10u bytes to \033[92m0x%08x\033[m", range->size, range->other);
+			break;
+		default:
+			snprintf(change, sizeof(change), "modified %10u bytes, %u differ, as %u at \033[92m0x%08x\033[m", range->size, range->differ, range->other_size, range->other);
+			break;
+		}
+
+		if (label[0])
+			printf("\033[92m0x%08x\033[m %s \033[33m%s\033[m\n", range->offset, change, label);
+		else
+			printf("\033[92m0x%08x\033[m %s\n", range->offset, change);
+		return;
+	}
+
+	// past the end of one file the range is only in the other
+	only = "";
+	if (range->offset >= state->file->size)
+		only = " only in the other file";
+	else if (range->offset >= state->other->size)
+		only = " only in this file";
+
+	if (label[0])
+		printf("\033[92m0x%08x\033[m %10u bytes, %u differ%s \033[33m%s\033[m\n", range->offset, range->size, range->differ, only, label);
+	else
+		printf("\033[92m0x%08x\033[m %10u bytes, %u differ%s\n", range->offset, range->size, range->differ, only);
+}
+
+// Compare the file with the block tree saved when it was last opened,
+// if there is one. When it changed, only the blocks of the Bloom filter
+// which changed are indexed again, provided the filter was of the file
+// as the tree saw it, and the tree is saved for the file as it is
+// now.
+static void
+check_tree(state_t *state, const char *filename)
+{
+	char path[MAX_PATH_SIZE];
+	char bfpath[MAX_PATH_SIZE];
+	char sapath[MAX_PATH_SIZE];
+	merkle_t *old, *now;
+	merkle_range_t *changes;
+	suffix_t *suffix;
+	unsigned int *blocks;
+	unsigned int nblocks, block, last, i;
+	uint64 mtime, index_time;
+	double begin, elapsed;
+	int count;
+
+	if (!sidecar_path(filename, MERKLE_EXT, path, sizeof(path)))
+		return;
+	old = merkle_open(path);
+	if (!old)
+		return;
+
+	// the same time and size need no hashing
+	if (!sidecar_file_time(filename, &mtime) || (old->mtime == mtime && old->size == state->file->size))
+	{
+		state->tree = old;
+		printf("Using block tree \033[33m'%s'\033[m\n", path);
+		return;
+	}
+
+	begin = time_now();
+	now = merkle_build(state->file->data, state->file->size, mtime);
+	count = now ? merkle_changes(old, now, &changes) : -1;
+	elapsed = time_now() - begin;
+	if (count < 0)
+	{
+		merkle_free(old);
+		merkle_free(now);
+		printf("Failed to allocate memory.\n");
+		return;
+	}
+
+	if (old->size != now->size)
+		printf("Size changed from \033[94m%u\033[m to \033[94m%u\033[m bytes since the block tree was saved.\n", old->size, now->size);
+	if (count)
+		printf("Hashed \033[94m%u\033[m blocks in %.1f ms, \033[94m%d\033[m ranges changed, use \033[95mchanges\033[m to list them.\n",
+			now->nleaves, elapsed * 1000.0, count);
+	else
+		printf("Hashed \033[94m%u\033[m blocks in %.1f ms, none changed.\n", now->nleaves, elapsed * 1000.0);
+
+	// filters reading into a changed byte are built again, those of
+	// grams starting up to 3 bytes before it too
+	if (old->size == now->size && sidecar_path(filename, BLOOM_EXT, bfpath, sizeof(bfpath)))
+	{
+		blocks = malloc(((size_t)now->size / BLOOM_BLOCK_SIZE + 1) * sizeof(unsigned int));
+		nblocks = 0;
+		for (i = 0; i < (unsigned int)count && blocks; i++)
+		{
+			block = (changes[i].offset >= BLOOM_GRAM_SIZE - 1 ? changes[i].offset - (BLOOM_GRAM_SIZE - 1) : 0) / BLOOM_BLOCK_SIZE;
+			if (nblocks && block <= blocks[nblocks - 1])
+				block = blocks[nblocks - 1] + 1;
+			last = (changes[i].offset + (changes[i].size - 1)) / BLOOM_BLOCK_SIZE;
+			for (; block <= last; block++)
+				blocks[nblocks++] = block;
+		}
+
+		if (blocks && bloom_update(state->file->data, state->file->size, bfpath, blocks, nblocks, old->mtime, mtime) && nblocks)
+			printf("Indexed \033[94m%u\033[m blocks of \033[33m'%s'\033[m again.\n", nblocks, bfpath);
+		free(blocks);
+	}
+
+	// the suffix array is of the whole file, it can only be built again
+	suffix = NULL;
+	if (sidecar_path(filename, SUFFIX_EXT, sapath, sizeof(sapath)) && sidecar_file_time(sapath, &index_time) &&
+		!(suffix = suffix_open(sapath, state->file->size, mtime)))
+		printf("The suffix array is out of date, use \033[95mindex\033[m \033[33mbuild sa\033[m.\n");
+	suffix_free(suffix);
+
+	if (!merkle_save(now, path))
+		printf("Failed to write \033[33m'%s'\033[m\n", path);
+
+	merkle_free(old);
+	state->tree = now;
+	state->changes = changes;
+	state->nchanges = (unsigned int)count;
+}
+
+// Read the bytes of values written as the pattern of find, which must
+// not have wildcards. Returns the bytes, which are freed with free, or
+// NULL after telling why there are none.
+static byte *
+parse_bytes(token_list_t *it, unsigned int *const len)
+{
+	pattern_t *pattern;
+	byte *bytes;
+	unsigned int i;
+	int value;
+
+	pattern = pattern_generate(it, len);
+	if (!pattern || !*len)
+	{
+		pattern_free(pattern);
+		printf("Malformed pattern.\n");
+		return NULL;
+	}
+
+	bytes = malloc(*len);
+	if (!bytes)
+	{
+		pattern_free(pattern);
+		printf("Failed to allocate memory.\n");
+		return NULL;
+	}
+
+	for (i = 0; i < *len; i++)
+	{
+		value = pattern_get(pattern, i);
+		if (value < 0)
+		{
+			pattern_free(pattern);
+			free(bytes);
+			printf("Wildcards cannot be written.\n");
+			return NULL;
+		}
+		bytes[i] = (byte)value;
+	}
+
+	pattern_free(pattern);
+	return bytes;
+}
+
+// Returns the number of bytes at an offset which writing len bytes
+// overwrites, the rest grow the file
+static unsigned int
+overwritten(state_t *state, unsigned int off, unsigned int len)
+{
+	return state->file->size - off < len ? state->file->size - off : len;
+}
+
+// Make a single edit as a group of its own. Returns 0 after telling why
+// the file could not be edited.
+static int
+edit_file(state_t *state, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size)
+{
+	uint64 size;
+
+	size = (uint64)state->file->size - old_size + new_size;
+	if (!size)
+	{
+		printf("The file cannot be left empty.\n");
+		return 0;
+	}
+	if (size > 0xffffffff)
+	{
+		printf("The file would be 4 GiB or more.\n");
+		return 0;
+	}
+
+	if (!begin_edit(state))
+		return 0;
+	if (!splice_file(state, off, old_size, bytes, new_size))
+	{
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+
+	return end_edit(state);
+}
+
+// Start a group of edits, made to the file through its piece table from
+// the first edit on. The edits are journaled and logged next to the
+// file. Returns 0 after telling why the file cannot be edited.
+static int
+begin_edit(state_t *state)
+{
+	char path[MAX_PATH_SIZE];
+	uint64 mtime;
+
+	// the edits are saved over the file, a member has no file of its own
+	if (state->process)
+	{
+		printf("The memory of a process cannot be edited, only files can.\n");
+		return 0;
+	}
+
+	if (state->views)
+	{
+		printf("Only whole files can be edited, \033[95mleave\033[m the member first.\n");
+		return 0;
+	}
+
+	if (!state->pieces)
+	{
+		state->pieces = pieces_create(state->file->data, state->file->size);
+		state->journal = journal_create();
+		if (!state->pieces || !state->journal)
+		{
+			pieces_free(state->pieces);
+			state->pieces = NULL;
+			journal_close(state->journal);
+			state->journal = NULL;
+			printf("Failed to allocate memory.\n");
+			return 0;
+		}
+
+		// the edits can still be made without a log, only not recovered
+		if (!sidecar_path(state->filename, JOURNAL_EXT, path, sizeof(path)) || !sidecar_file_time(state->filename, &mtime) ||
+			!journal_log(state->journal, path, state->file->size, mtime))
+			printf("Failed to create the edit log, the edits are lost if the session ends before they are saved.\n");
+	}
+
+	journal_group(state->journal);
+	return 1;
+}
+
+// Make an edit of the group begun, journaling the bytes it replaces.
+// Returns 0 if memory could not be allocated, leaving the file as it
+// was before it.
+static int
+splice_file(state_t *state, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size)
+{
+	if (!journal_add(state->journal, off, old_size, &pieces_read, state->pieces, bytes, new_size))
+		return 0;
+
+	if (!pieces_splice(state->pieces, off, old_size, bytes, new_size))
+	{
+		journal_cancel(state->journal);
+		return 0;
+	}
+
+	return 1;
+}
+
+// End a group of edits, writing it to the edit log and showing the file
+// as it is now. Returns 0 after telling why the group was undone.
+static int
+end_edit(state_t *state)
+{
+	unsigned int first, last;
+
+	if (!journal_flush(state->journal))
+		printf("Failed to write the edit log.\n");
+
+	if (show_edits(state))
+		return 1;
+
+	// the view before the edits is left, so are the edits
+	if (journal_undo(state->journal, &first, &last))
+		apply_ops(state, first, last, 1);
+	printf("Failed to reserve memory for the data.\n");
+	return 0;
+}
+
+// View the file through its piece table. The view is a lazy file made
+// again for each change, so no chunk of the data before it is left in
+// its cache, and indexes of the data before are dropped. Returns 0 if
+// the view could not be made, leaving the one before.
+static int
+show_edits(state_t *state)
+{
+	file_t *file;
+
+	// a file is never edited to nothing
+	file = file_lazy(state->pieces->size, &pieces_read, state->pieces);
+	if (!file)
+		return 0;
+
+	if (state->base)
+		close_file(state->file);
+	else
+		state->base = state->file;
+	state->file = file;
+	state->dropping = 0;
+
+	free_indexes(state);
+	state->format = format_detect(state->file->data, state->file->size);
+	if (state->off >= state->file->size)
+		state->off = state->file->size - 1;
+
+	return 1;
+}
+
+// Make the journaled edits [first, last) to the piece table again, or
+// undo them from the last. Room is made first, so either all of them
+// are made or none. Returns 0 if memory could not be allocated.
+static int
+apply_ops(state_t *state, unsigned int first, unsigned int last, int undo)
+{
+	const journal_op_t *op;
+	const byte *bytes;
+	uint64 added;
+	unsigned int i;
+
+	added = 0;
+	for (i = first; i < last; i++)
+		added += undo ? state->journal->ops[i].old_size : state->journal->ops[i].new_size;
+	if (!pieces_reserve(state->pieces, last - first, added))
+		return 0;
+
+	for (i = 0; i < last - first; i++)
+	{
+		op = &state->journal->ops[undo ? last - 1 - i : first + i];
+		bytes = journal_bytes(state->journal, op);
+		if (undo)
+			pieces_splice(state->pieces, op->offset, op->new_size, bytes, op->old_size);
+		else
+			pieces_splice(state->pieces, op->offset, op->old_size, bytes + op->old_size, op->new_size);
+	}
+
+	return 1;
+}
+
+// Undo the last group of edits or redo the first undone, and seek to
+// where it was. Returns 0 after telling why nothing changed.
+static int
+step_journal(state_t *state, int undo)
+{
+	unsigned int first, last;
+
+	if (!state->journal || state->views || state->process ||
+		!(undo ? journal_undo(state->journal, &first, &last) : journal_redo(state->journal, &first, &last)))
+	{
+		printf("Nothing to %s.\n", undo ? "undo" : "redo");
+		return 0;
+	}
+
+	// the journal is put back as it was when the edits cannot be changed
+	if (!apply_ops(state, first, last, undo))
+	{
+		if (undo)
+			journal_redo(state->journal, &first, &last);
+		else
+			journal_undo(state->journal, &first, &last);
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+
+	if (!show_edits(state))
+	{
+		apply_ops(state, first, last, !undo);
+		if (undo)
+			journal_redo(state->journal, &first, &last);
+		else
+			journal_undo(state->journal, &first, &last);
+		printf("Failed to reserve memory for the data.\n");
+		return 0;
+	}
+
+	state->off = state->journal->ops[undo ? last - 1 : first].offset;
+	if (state->off >= state->file->size)
+		state->off = state->file->size - 1;
+	printf("%s \033[94m%u\033[m edits, now looking at offset \033[92m0x%08x\033[m\n", undo ? "Undid" : "Redid", last - first, state->off);
+	return 1;
+}
+
+// Replace each match of old_size bytes with the bytes of a pattern as
+// one group of edits, from the last so the offsets of those before do
+// not move. Room for the edits, and for undoing them, is made first, so
+// either all of them are made or none. Returns 0 after telling why
+// nothing was replaced.
+static int
+replace_matches(state_t *state, const unsigned int *matches, unsigned int count, unsigned int old_size, pattern_t *value, unsigned int new_size)
+{
+	byte *bytes;
+	unsigned int made, i;
+	int b;
+
+	// a single buffer for every match, only the wildcards change
+	bytes = new_size ? malloc(new_size) : NULL;
+	if (new_size && !bytes)
+	{
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+
+	if (!begin_edit(state))
+	{
+		free(bytes);
+		return 0;
+	}
+
+	if (!pieces_reserve(state->pieces, 2 * count, (uint64)count * (old_size + new_size)))
+	{
+		free(bytes);
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+
+	for (made = 0; made < count; made++)
+	{
+		for (i = 0; i < new_size; i++)
+		{
+			b = pattern_get(value, i);
+			bytes[i] = b < 0 ? state->file->data[matches[count - 1 - made] + i] : (byte)b;
+		}
+		if (!splice_file(state, matches[count - 1 - made], old_size, bytes, new_size))
+			break;
+	}
+	free(bytes);
+
+	if (made < count)
+	{
+		apply_ops(state, state->journal->count - made, state->journal->count, 1);
+		for (; made; made--)
+			journal_cancel(state->journal);
+		printf("Failed to allocate memory.\n");
+		return 0;
+	}
+
+	return end_edit(state);
+}
+
+// Replay the edits left in the edit log by a session which ended
+// without saving them, or while saving them
+static void
+check_journal(state_t *state, const char *filename)
+{
+	char path[MAX_PATH_SIZE];
+	char target[MAX_PATH_SIZE];
+	journal_t *journal;
+	uint64 mtime;
+	int status;
+
+	if (!sidecar_path(filename, JOURNAL_EXT, path, sizeof(path)) || !sidecar_file_time(filename, &mtime))
+		return;
+
+	journal = journal_open(path, state->file->size, mtime, &status);
+	if (status == JournalStale)
+		printf("Dropped the edit log \033[33m'%s'\033[m, the file was changed since.\n", path);
+
+	// a new file written by a save which did not finish is not needed,
+	// the edits are replayed or were saved
+	if (status != JournalNone && pieces_target(filename, target, sizeof(target)) && sidecar_path(target, PIECE_TEMP_EXT, path, sizeof(path)))
+		remove(path);
+
+	if (!journal)
+		return;
+
+	state->pieces = pieces_create(state->file->data, state->file->size);
+	state->journal = journal;
+	if (!state->pieces || !apply_ops(state, 0, journal->done, 0) || !show_edits(state))
+	{
+		printf("Failed to allocate memory to replay the edit log.\n");
+		pieces_free(state->pieces);
+		state->pieces = NULL;
+		journal_close(state->journal);
+		state->journal = NULL;
+		return;
+	}
+
+	state->interrupted = status == JournalInterrupted;
+	if (state->interrupted)
+		printf("A save was interrupted, replayed \033[94m%u\033[m edits from the edit log over the file. \033[95msave\033[m to finish it, or \033[95mjournal\033[m \033[33mrollback\033[m to restore the file as it was.\n", journal->done);
+	else
+		printf("Replayed \033[94m%u\033[m edits not saved from the edit log. \033[95msave\033[m them, \033[95mundo\033[m them, or \033[95mjournal\033[m \033[33mrollback\033[m to drop them.\n", journal->done);
+}
+
+// Open a file again after closing it, at the offset it was at. Returns
+// 0 after telling it could not be opened.
+static int
+reopen_file(state_t *state, char *filename, unsigned int off)
+{
+	if (!open_file_on_state(state, filename))
+	{
+		printf("Failed to open the file again.\n");
+		free(filename);
+		return 0;
+	}
+	free(filename);
+
+	state->off = off < state->file->size ? off : state->file->size - 1;
+	return 1;
+}
+
+// Tell what an edit did, with the first bytes written when given
+static void
+print_edit(state_t *state, const char *verb, unsigned int off, const byte *bytes, unsigned int len)
+{
+	unsigned int i;
+
+	printf("%s \033[94m%u\033[m bytes at \033[92m0x%08x\033[m", verb, len, off);
+	for (i = 0; bytes && i < len && i < MAX_EDIT_BYTES; i++)
+		printf("%s%02x", i ? " " : ": ", bytes[i]);
+	printf("%s\nSize: \033[92m0x%08x\033[m, \033[94m%u\033[m edits not saved.\n", bytes && len > MAX_EDIT_BYTES ? " ..." : "", state->file->size, state->journal->done);
+}
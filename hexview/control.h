@@ -13,6 +13,8 @@ state_t *create_state();
 void destroy_state(state_t *state);
 
 int open_file_on_state(state_t *state, const char *filename);
+int open_process_on_state(state_t *state, int pid);
+int compare_on_state(state_t *state, const char *filename, unsigned int gap, int aligned);
 int run_string(state_t *state, const char *string);
 
 #endif
\ No newline at end of file
@@ -12,6 +12,21 @@ enum
 
 #define NATIVE_ENDIANESS 0
 
+// SSE2 is part of the x86-64 baseline, enable the vectorized paths there
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#else
+#define HAVE_SSE2 0
+#endif
+
+// Allows a function to use instructions beyond the compiler's baseline,
+// callers must check cpu_features first
+#if _MSC_VER
+#define TARGET(features)
+#else
+#define TARGET(features) __attribute__((target(features)))
+#endif
+
 #ifdef _WIN32
 typedef unsigned __int8 byte;
 
@@ -0,0 +1,340 @@
+#include "diff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread.h"
+#include "util.h"
+
+#if HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+#define MIN_JOB_SIZE 4194304  // fewest bytes worth giving their own thread
+
+typedef unsigned int(*scan_fn)(const byte *a, const byte *b, unsigned int pos, unsigned int end);
+
+// A chunk of the files compared by a single thread
+struct diff_job
+{
+	const byte *a;
+	const byte *b;
+	unsigned int start;
+	unsigned int end;
+	unsigned int gap;
+	scan_fn differ;  // first differing byte from a position
+	scan_fn equal;   // first equal byte from a position
+
+	diff_range_t *ranges;
+	unsigned int count;
+	unsigned int capacity;
+	int failed;
+};
+
+static void diff_proc(void *arg);
+static int add_range(diff_range_t **const ranges, unsigned int *const count, unsigned int *const capacity, unsigned int gap, unsigned int start, unsigned int end);
+static unsigned int scan_differ(const byte *a, const byte *b, unsigned int pos, unsigned int end);
+static unsigned int scan_equal(const byte *a, const byte *b, unsigned int pos, unsigned int end);
+#if HAVE_SSE2
+TARGET("avx2") static unsigned int scan_differ_avx2(const byte *a, const byte *b, unsigned int pos, unsigned int end);
+TARGET("avx2") static unsigned int scan_equal_avx2(const byte *a, const byte *b, unsigned int pos, unsigned int end);
+#endif
+
+diff_t *
+diff_compare(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int gap)
+{
+	diff_t *diff;
+	struct diff_job *jobs;
+	diff_range_t *range;
+	unsigned int common, per, capacity, i;
+	int njobs, n, failed;
+
+	diff = malloc(sizeof(diff_t));
+	if (!diff)
+		return NULL;
+
+	common = asize < bsize ? asize : bsize;
+	njobs = cpu_count();
+	if ((uint64)njobs * MIN_JOB_SIZE > common)
+		njobs = (common + MIN_JOB_SIZE - 1) / MIN_JOB_SIZE;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = calloc(njobs, sizeof(struct diff_job));
+	if (!jobs)
+	{
+		free(diff);
+		return NULL;
+	}
+
+	// contiguous shares keep each thread reading both files in order
+	per = (common + njobs - 1) / njobs;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].a = a;
+		jobs[n].b = b;
+		jobs[n].start = (uint64)n * per < common ? n * per : common;
+		jobs[n].end = common - jobs[n].start > per ? jobs[n].start + per : common;
+		jobs[n].gap = gap;
+		jobs[n].differ = &scan_differ;
+		jobs[n].equal = &scan_equal;
+#if HAVE_SSE2
+		if (cpu_features() & CpuAvx2)
+		{
+			jobs[n].differ = &scan_differ_avx2;
+			jobs[n].equal = &scan_equal_avx2;
+		}
+#endif
+	}
+
+	run_parallel(&diff_proc, jobs, njobs, sizeof(struct diff_job));
+
+	// join the ranges of the jobs, merging across the ends of their chunks
+	diff->ranges = NULL;
+	diff->count = 0;
+	diff->asize = asize;
+	diff->bsize = bsize;
+	diff->gap = gap;
+	diff->differ = 0;
+	diff->chunk = 0;
+	capacity = 0;
+	failed = 0;
+	for (n = 0; n < njobs; n++)
+	{
+		failed |= jobs[n].failed;
+		for (i = 0; i < jobs[n].count && !failed; i++)
+		{
+			range = &jobs[n].ranges[i];
+			if (!add_range(&diff->ranges, &diff->count, &capacity, gap, range->offset, range->offset + range->size))
+				failed = 1;
+			else
+			{
+				diff->ranges[diff->count - 1].differ += range->differ - range->size;
+				diff->differ += range->differ;
+			}
+		}
+		free(jobs[n].ranges);
+	}
+	free(jobs);
+
+	// the tail of the longer file has nothing to compare with
+	if (!failed && asize != bsize)
+	{
+		if (!add_range(&diff->ranges, &diff->count, &capacity, gap, common, asize > bsize ? asize : bsize))
+			failed = 1;
+		diff->differ += (asize > bsize ? asize : bsize) - common;
+	}
+
+	if (failed)
+	{
+		diff_free(diff);
+		return NULL;
+	}
+
+	// byte by byte each range is at the same offset in both files
+	for (i = 0; i < diff->count; i++)
+	{
+		diff->ranges[i].kind = DiffModified;
+		diff->ranges[i].other = diff->ranges[i].offset;
+		diff->ranges[i].other_size = diff->ranges[i].size;
+	}
+
+	return diff;
+}
+
+void
+diff_free(diff_t *diff)
+{
+	if (!diff) return;
+	free(diff->ranges);
+	free(diff);
+}
+
+unsigned int
+diff_other(const diff_t *diff, unsigned int off)
+{
+	const diff_range_t *range;
+	unsigned int i;
+
+	// the last range ending by the offset which is not moved sets the shift
+	for (i = diff_search(diff, off); i > 0; i--)
+	{
+		range = &diff->ranges[i - 1];
+		if (range->kind == DiffMoved || range->offset + range->size > off)
+			continue;
+		return range->other + range->other_size + (off - range->offset - range->size);
+	}
+
+	return off;
+}
+
+unsigned int
+diff_search(const diff_t *diff, unsigned int off)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = diff->count;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (diff->ranges[mid].offset < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void
+diff_proc(void *arg)
+{
+	struct diff_job *job;
+	unsigned int pos, end;
+
+	job = arg;
+	pos = job->start;
+	while (pos < job->end)
+	{
+		// a run of differing bytes, then the equal bytes after it
+		pos = job->differ(job->a, job->b, pos, job->end);
+		if (pos == job->end)
+			break;
+		end = job->equal(job->a, job->b, pos, job->end);
+
+		if (!add_range(&job->ranges, &job->count, &job->capacity, job->gap, pos, end))
+		{
+			job->failed = 1;
+			return;
+		}
+		pos = end;
+	}
+}
+
+// Add the differing bytes [start, end) after the last range, merging
+// them into it when at most gap equal bytes are between. Returns 0 if
+// memory could not be allocated.
+static int
+add_range(diff_range_t **const ranges, unsigned int *const count, unsigned int *const capacity, unsigned int gap, unsigned int start, unsigned int end)
+{
+	diff_range_t *grown, *last;
+
+	if (*count)
+	{
+		last = &(*ranges)[*count - 1];
+		if (start - (last->offset + last->size) <= gap)
+		{
+			last->differ += end - start;
+			last->size = end - last->offset;
+			return 1;
+		}
+	}
+
+	if (*count == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 256;
+		grown = realloc(*ranges, *capacity * sizeof(diff_range_t));
+		if (!grown)
+			return 0;
+		*ranges = grown;
+	}
+
+	last = &(*ranges)[(*count)++];
+	last->offset = start;
+	last->size = end - start;
+	last->differ = end - start;
+	return 1;
+}
+
+// Returns the first position in [pos, end) where the files differ, or
+// end if there is none
+static unsigned int
+scan_differ(const byte *a, const byte *b, unsigned int pos, unsigned int end)
+{
+	uint64 x, y;
+#if HAVE_SSE2
+	unsigned int mask;
+
+	for (; end - pos >= 16; pos += 16)
+	{
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + pos)), _mm_loadu_si128((const __m128i *)(b + pos)))) & 0xffff;
+		if (mask)
+			return pos + lowest_bit64(mask);
+	}
+#endif
+
+	for (; end - pos >= 8; pos += 8)
+	{
+		memcpy(&x, a + pos, 8);
+		memcpy(&y, b + pos, 8);
+		if (x != y)
+			break;
+	}
+
+	for (; pos < end && a[pos] == b[pos]; pos++);
+	return pos;
+}
+
+// Returns the first position in [pos, end) where the files are equal,
+// or end if there is none
+static unsigned int
+scan_equal(const byte *a, const byte *b, unsigned int pos, unsigned int end)
+{
+#if HAVE_SSE2
+	unsigned int mask;
+
+	for (; end - pos >= 16; pos += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + pos)), _mm_loadu_si128((const __m128i *)(b + pos))));
+		if (mask)
+			return pos + lowest_bit64(mask);
+	}
+#endif
+
+	for (; pos < end && a[pos] != b[pos]; pos++);
+	return pos;
+}
+
+#if HAVE_SSE2
+
+// Two vectors of 32 bytes at a time while 64 bytes remain
+TARGET("avx2")
+static unsigned int
+scan_differ_avx2(const byte *a, const byte *b, unsigned int pos, unsigned int end)
+{
+	__m256i lo, hi;
+	uint64 mask;
+
+	for (; end - pos >= 64; pos += 64)
+	{
+		lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + pos)), _mm256_loadu_si256((const __m256i *)(b + pos)));
+		hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + pos + 32)), _mm256_loadu_si256((const __m256i *)(b + pos + 32)));
+		mask = ~((uint64)(uint32)_mm256_movemask_epi8(lo) | (uint64)(uint32)_mm256_movemask_epi8(hi) << 32);
+		if (mask)
+			return pos + lowest_bit64(mask);
+	}
+
+	return scan_differ(a, b, pos, end);
+}
+
+TARGET("avx2")
+static unsigned int
+scan_equal_avx2(const byte *a, const byte *b, unsigned int pos, unsigned int end)
+{
+	__m256i lo, hi;
+	uint64 mask;
+
+	for (; end - pos >= 64; pos += 64)
+	{
+		lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + pos)), _mm256_loadu_si256((const __m256i *)(b + pos)));
+		hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + pos + 32)), _mm256_loadu_si256((const __m256i *)(b + pos + 32)));
+		mask = (uint64)(uint32)_mm256_movemask_epi8(lo) | (uint64)(uint32)_mm256_movemask_epi8(hi) << 32;
+		if (mask)
+			return pos + lowest_bit64(mask);
+	}
+
+	return scan_equal(a, b, pos, end);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include "defs.h"
+
+#define DIFF_GAP 8  // equal bytes between differences merged into one range by default
+
+enum
+{
+	DiffModified,  // bytes of the first file replaced in the second
+	DiffInserted,  // bytes only in the second file, inserted at the offset
+	DiffDeleted,   // bytes only in the first file
+	DiffMoved,     // bytes of the first file found elsewhere in the second
+};
+
+typedef struct diff_range_s diff_range_t;
+struct diff_range_s
+{
+	unsigned int offset;  // Offset of the first differing byte.
+	unsigned int size;    // Bytes from the first to the last differing byte.
+	unsigned int differ;  // Bytes of the range which differ, fewer than size where gaps were merged.
+	int kind;             // DiffModified when byte by byte, how the bytes changed when aligned.
+	unsigned int other;       // Offset of the range in the second file.
+	unsigned int other_size;  // Bytes of the range in the second file, 0 if deleted.
+};
+
+typedef struct diff_s diff_t;
+struct diff_s
+{
+	diff_range_t *ranges;  // Ranges by increasing offset.
+	unsigned int count;
+	unsigned int asize;    // Size of the first file.
+	unsigned int bsize;    // Size of the second file.
+	unsigned int gap;      // Most equal bytes merged between two differences.
+	uint64 differ;         // Bytes which differ, including those past the end of the shorter file.
+	unsigned int chunk;    // Average chunk size the files were aligned with, 0 if byte by byte.
+};
+
+// Compare two files byte by byte at the same offsets, 32 or 64 bytes
+// at a time with SIMD and in parallel chunks on all avaliable cores.
+// Runs of differing bytes separated by at most gap equal bytes are
+// merged into one range. When the files differ in size, the bytes past
+// the end of the shorter one make up the last range.
+// Parameters:
+// - a: The data of the first file.
+// - asize: The size of the first file.
+// - b: The data of the second file.
+// - bsize: The size of the second file.
+// - gap: The most equal bytes to merge between differences.
+//
+// Returns:
+// The differences, or NULL if memory could not be allocated.
+diff_t *diff_compare(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int gap);
+
+// Free the differences of two files.
+// Parameters:
+// - diff: The differences to free, can be NULL.
+void diff_free(diff_t *diff);
+
+// Find the offset in the second file lined up with an offset of the
+// first, past the ranges before it. Byte by byte the offsets are the
+// same, aligned they are shifted by the bytes inserted and deleted.
+// Parameters:
+// - diff: The differences of the files.
+// - off: The offset in the first file.
+//
+// Returns:
+// The offset in the second file.
+unsigned int diff_other(const diff_t *diff, unsigned int off);
+
+// Find the first range starting at or after an offset.
+// Parameters:
+// - diff: The differences to search.
+// - off: The offset.
+//
+// Returns:
+// The index of the range, or diff->count if there is none.
+unsigned int diff_search(const diff_t *diff, unsigned int off);
+
+#endif
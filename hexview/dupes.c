@@ -0,0 +1,330 @@
+#include "dupes.h"
+
+#include <string.h>
+
+#include "chunk.h"
+#include "hash.h"
+#include "thread.h"
+
+#define SEGMENT_SIZE (16 << 20)  // bytes chunked by one thread at a time
+#define INITIAL_TABLE_CAP 4096
+#define INITIAL_SEGMENT_CAP 1024
+
+// A chunk found while scanning a segment
+struct chunk_rec
+{
+	uint64 hash;
+	unsigned int off;
+	unsigned int len;
+};
+
+// A range of the data chunked and hashed by a single thread
+struct segment_job
+{
+	const chunk_params_t *params;
+	const byte *data;
+	unsigned int start;
+	unsigned int end;
+
+	struct chunk_rec *chunks;
+	unsigned int count;
+	unsigned int capacity;
+	int failed;
+};
+
+// A distinct chunk in the hash table
+struct table_entry
+{
+	uint64 hash;
+	unsigned int off;    // first occurrence
+	unsigned int len;    // 0 if the slot is empty
+	unsigned int count;  // number of occurrences
+	unsigned int dup_head;  // index + 1 of the first repeat in the dup list, 0 if none
+	unsigned int dup_tail;
+};
+
+// A repeated occurrence of a chunk
+struct dup_link
+{
+	unsigned int off;
+	unsigned int next;  // index + 1 of the next repeat, 0 if none
+};
+
+struct dupe_table
+{
+	struct table_entry *entries;
+	unsigned int capacity;  // power of 2
+	unsigned int count;
+
+	struct dup_link *links;
+	unsigned int nlinks;
+	unsigned int links_cap;
+};
+
+static void segment_proc(void *arg);
+static int table_insert(struct dupe_table *table, const byte *data, const struct chunk_rec *rec);
+static int table_grow(struct dupe_table *table);
+static int compare_groups(const void *first, const void *second);
+
+dupes_t *
+dupes_find(const byte *data, unsigned int size, unsigned int avg)
+{
+	dupes_t *dupes;
+	chunk_params_t params;
+	struct dupe_table table;
+	struct segment_job *jobs;
+	struct table_entry *entry;
+	dupe_group_t *group;
+	unsigned int pos, link;
+	unsigned int i, j;
+	int njobs, n;
+	int failed;
+
+	chunk_params_init(&params, avg);
+
+	njobs = cpu_count();
+	jobs = calloc(njobs, sizeof(struct segment_job));
+	dupes = calloc(1, sizeof(dupes_t));
+
+	memset(&table, 0, sizeof(table));
+	table.capacity = INITIAL_TABLE_CAP;
+	table.entries = calloc(table.capacity, sizeof(struct table_entry));
+
+	failed = !jobs || !dupes || !table.entries;
+
+	// one window of segments at a time, so memory does not grow with the file
+	for (pos = 0; pos < size && !failed;)
+	{
+		for (n = 0; n < njobs && pos < size; n++)
+		{
+			jobs[n].params = &params;
+			jobs[n].data = data;
+			jobs[n].start = pos;
+			jobs[n].end = size - pos > SEGMENT_SIZE ? pos + SEGMENT_SIZE : size;
+			jobs[n].count = 0;
+			pos = jobs[n].end;
+		}
+
+		run_parallel(&segment_proc, jobs, n, sizeof(struct segment_job));
+
+		for (i = 0; i < (unsigned int)n && !failed; i++)
+		{
+			failed |= jobs[i].failed;
+			for (j = 0; j < jobs[i].count && !failed; j++)
+				failed = !table_insert(&table, data, &jobs[i].chunks[j]);
+			dupes->nchunks += jobs[i].count;
+		}
+	}
+
+	if (jobs)
+	{
+		for (i = 0; i < (unsigned int)njobs; i++)
+			free(jobs[i].chunks);
+		free(jobs);
+	}
+
+	if (!failed)
+	{
+		dupes->nunique = table.count;
+		for (i = 0; i < table.capacity; i++)
+		{
+			if (table.entries[i].count > 1)
+				dupes->ngroups++;
+		}
+
+		if (dupes->ngroups)
+		{
+			dupes->groups = calloc(dupes->ngroups, sizeof(dupe_group_t));
+			failed = !dupes->groups;
+		}
+	}
+
+	if (!failed)
+	{
+		group = dupes->groups;
+		for (i = 0; i < table.capacity && !failed; i++)
+		{
+			entry = &table.entries[i];
+			if (entry->count < 2)
+				continue;
+
+			group->hash = entry->hash;
+			group->len = entry->len;
+			group->count = entry->count;
+			group->offsets = malloc(entry->count * sizeof(unsigned int));
+			if (!group->offsets)
+			{
+				failed = 1;
+				break;
+			}
+
+			group->offsets[0] = entry->off;
+			for (j = 1, link = entry->dup_head; link; j++, link = table.links[link - 1].next)
+				group->offsets[j] = table.links[link - 1].off;
+
+			dupes->dupbytes += (uint64)entry->len * (entry->count - 1);
+			group++;
+		}
+
+		if (!failed && dupes->ngroups)
+			qsort(dupes->groups, dupes->ngroups, sizeof(dupe_group_t), &compare_groups);
+	}
+
+	free(table.entries);
+	free(table.links);
+
+	if (failed)
+	{
+		dupes_free(dupes);
+		return NULL;
+	}
+
+	return dupes;
+}
+
+void
+dupes_free(dupes_t *dupes)
+{
+	unsigned int i;
+
+	if (!dupes) return;
+
+	if (dupes->groups)
+	{
+		for (i = 0; i < dupes->ngroups; i++)
+			free(dupes->groups[i].offsets);
+		free(dupes->groups);
+	}
+
+	free(dupes);
+}
+
+static void
+segment_proc(void *arg)
+{
+	struct segment_job *job = arg;
+	struct chunk_rec *nbuf;
+	unsigned int pos, len;
+	unsigned int ncap;
+
+	for (pos = job->start; pos < job->end; pos += len)
+	{
+		len = chunk_next(job->params, job->data + pos, job->end - pos);
+
+		if (job->count == job->capacity)
+		{
+			ncap = job->capacity ? job->capacity << 1 : INITIAL_SEGMENT_CAP;
+			nbuf = realloc(job->chunks, ncap * sizeof(struct chunk_rec));
+			if (!nbuf)
+			{
+				job->failed = 1;
+				return;
+			}
+			job->chunks = nbuf;
+			job->capacity = ncap;
+		}
+
+		job->chunks[job->count].hash = xxh3_64(job->data + pos, len);
+		job->chunks[job->count].off = pos;
+		job->chunks[job->count].len = len;
+		job->count++;
+	}
+}
+
+static int
+table_insert(struct dupe_table *table, const byte *data, const struct chunk_rec *rec)
+{
+	struct table_entry *entry;
+	struct dup_link *nlinks;
+	unsigned int slot, ncap;
+
+	if ((table->count + 1) * 2 > table->capacity && !table_grow(table))
+		return 0;
+
+	for (slot = (unsigned int)rec->hash & (table->capacity - 1);; slot = (slot + 1) & (table->capacity - 1))
+	{
+		entry = &table->entries[slot];
+		if (!entry->len)
+			break;
+
+		// confirm the bytes so a hash collision is never reported
+		if (entry->hash == rec->hash && entry->len == rec->len &&
+			!memcmp(data + entry->off, data + rec->off, rec->len))
+		{
+			if (table->nlinks == table->links_cap)
+			{
+				ncap = table->links_cap ? table->links_cap << 1 : INITIAL_TABLE_CAP;
+				nlinks = realloc(table->links, ncap * sizeof(struct dup_link));
+				if (!nlinks)
+					return 0;
+				table->links = nlinks;
+				table->links_cap = ncap;
+			}
+
+			table->links[table->nlinks].off = rec->off;
+			table->links[table->nlinks].next = 0;
+			table->nlinks++;
+
+			if (entry->dup_tail)
+				table->links[entry->dup_tail - 1].next = table->nlinks;
+			else
+				entry->dup_head = table->nlinks;
+			entry->dup_tail = table->nlinks;
+			entry->count++;
+			return 1;
+		}
+	}
+
+	entry->hash = rec->hash;
+	entry->off = rec->off;
+	entry->len = rec->len;
+	entry->count = 1;
+	entry->dup_head = 0;
+	entry->dup_tail = 0;
+	table->count++;
+
+	return 1;
+}
+
+static int
+table_grow(struct dupe_table *table)
+{
+	struct table_entry *nentries, *entry;
+	unsigned int ncap, slot;
+	unsigned int i;
+
+	ncap = table->capacity << 1;
+	nentries = calloc(ncap, sizeof(struct table_entry));
+	if (!nentries)
+		return 0;
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		entry = &table->entries[i];
+		if (!entry->len)
+			continue;
+
+		for (slot = (unsigned int)entry->hash & (ncap - 1); nentries[slot].len; slot = (slot + 1) & (ncap - 1));
+		nentries[slot] = *entry;
+	}
+
+	free(table->entries);
+	table->entries = nentries;
+	table->capacity = ncap;
+
+	return 1;
+}
+
+static int
+compare_groups(const void *first, const void *second)
+{
+	const dupe_group_t *a = first, *b = second;
+	uint64 wa, wb;
+
+	wa = (uint64)a->len * (a->count - 1);
+	wb = (uint64)b->len * (b->count - 1);
+	if (wa != wb)
+		return wa < wb ? 1 : -1;
+
+	return a->offsets[0] < b->offsets[0] ? -1 : a->offsets[0] > b->offsets[0];
+}
@@ -0,0 +1,44 @@
+#ifndef DUPES_H
+#define DUPES_H
+
+#include "defs.h"
+
+typedef struct dupe_group_s dupe_group_t;
+struct dupe_group_s
+{
+	uint64 hash;            // Hash of the chunk contents.
+	unsigned int len;       // Length of every chunk in the group.
+	unsigned int count;     // Number of occurrences, always at least 2.
+	unsigned int *offsets;  // Offset of each occurrence, ascending.
+};
+
+typedef struct dupes_s dupes_t;
+struct dupes_s
+{
+	dupe_group_t *groups;  // Duplicate groups, most wasted bytes first.
+	unsigned int ngroups;  // Number of elements in groups.
+
+	unsigned int nchunks;  // Total number of chunks.
+	unsigned int nunique;  // Number of distinct chunks.
+	uint64 dupbytes;       // Bytes that could be removed by deduplication.
+};
+
+// Find duplicated content in a block of memory. The data is split
+// into content-defined chunks which are hashed on all avaliable cores
+// and grouped by their contents. Memory use is proportional to the
+// number of distinct chunks plus the number of duplicates.
+// Parameters:
+// - data: The data to search.
+// - size: The number of bytes data points to.
+// - avg: Target average chunk size in bytes.
+//
+// Returns:
+// The duplicates found, or NULL if memory could not be allocated.
+dupes_t *dupes_find(const byte *data, unsigned int size, unsigned int avg);
+
+// Free the result of dupes_find.
+// Parameters:
+// - dupes: The result to free, can be NULL.
+void dupes_free(dupes_t *dupes);
+
+#endif
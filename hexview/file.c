@@ -1,7 +1,14 @@
+#if __linux__
+#define _GNU_SOURCE  // for mremap
+#endif
+
 #include "file.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#define MAX_LAZY_FILES 16  // lazy files open at once, views of views of compressed files
 
 #if _WIN32
 #include <Windows.h>
@@ -20,6 +27,7 @@ struct win32_file
 #include <fcntl.h>
 #include <unistd.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 
 struct linux_file
@@ -27,8 +35,52 @@ struct linux_file
 	int file;  // file descriptor
 };
 
+#include <sched.h>
+#include <signal.h>
+
 #endif
 
+// States of a chunk of a lazy file
+enum
+{
+	LazyEmpty,     // not in memory
+	LazyActive,    // in memory and readable
+	LazyInactive   // in memory but protected, so its next use faults
+};
+
+// A chunk of a lazy file in memory
+struct lazy_chunk
+{
+	unsigned int chunk;
+	uint64 last;  // tick of the last fault on it, when it was last seen used
+};
+
+struct lazy_file
+{
+	file_fill_fn fill;
+	void *arg;
+	volatile long lock;   // held while a chunk is filled, protected or dropped
+	unsigned int nchunks;
+	byte *filled;         // state of each chunk, one of the Lazy values
+	struct lazy_chunk resident[FILE_LAZY_CACHE];  // chunks in memory, in no order
+	unsigned int used;
+	unsigned int active;  // chunks in memory which are readable
+	uint64 tick;          // counts faults
+};
+
+// Lazy files are found from the address of a fault. Entries only
+// change while no fault can be raised, between commands.
+static file_t *lazy_files[MAX_LAZY_FILES];
+static int lazy_installed;
+
+static int lazy_fault(const byte *addr);
+static void lazy_fill(file_t *file, unsigned int chunk);
+static unsigned int lazy_oldest(struct lazy_file *lazy, int state);
+static void lazy_protect(byte *addr, int readable);
+static void lazy_lock(volatile long *lock);
+static void lazy_unlock(volatile long *lock);
+static int lazy_install();
+
 file_t *
 open_file(const char *filename)
 {
@@ -43,9 +95,11 @@ open_file(const char *filename)
 	BOOL bResult;
 	DWORD dwError;
 
-	result = malloc(offsetof(file_t, reserved) + sizeof(struct win32_file));
+	result = malloc(sizeof(file_t) + sizeof(struct win32_file));
 	if (!result)
 		return NULL;
+	result->parent = NULL;
+	result->lazy = 0;
 	file32 = (struct win32_file *)&result->reserved;
 
 	file32->hFile = CreateFileA(
@@ -150,7 +204,11 @@ open_file(const char *filename)
 	ssize_t remaining;
 	ssize_t bytes_read;
 
-	result = malloc(offsetof(file_t, reserved) + sizeof(struct linux_file));
+	result = malloc(sizeof(file_t) + sizeof(struct linux_file));
+	if (!result)
+		return NULL;
+	result->parent = NULL;
+	result->lazy = 0;
 	linux_file = (struct linux_file *)&result->reserved;
 
 	linux_file->file = open(filename, O_RDONLY);
@@ -217,9 +275,166 @@ open_file(const char *filename)
 	return result;
 }
 
+file_t *
+file_slice(file_t *file, unsigned int off, unsigned int size)
+{
+	file_t *result;
+
+	result = malloc(sizeof(file_t));
+	if (!result)
+		return NULL;
+
+	result->data = file->data + off;
+	result->size = size;
+	result->parent = file;
+	result->lazy = 0;
+	return result;
+}
+
+file_t *
+file_lazy(unsigned int size, file_fill_fn fill, void *arg)
+{
+	file_t *result;
+	struct lazy_file *lazy;
+	size_t mapsize;
+	int slot;
+
+	if (!size || !lazy_install())
+		return NULL;
+
+	for (slot = 0; slot < MAX_LAZY_FILES && lazy_files[slot]; slot++);
+	if (slot == MAX_LAZY_FILES)
+		return NULL;
+
+	result = malloc(sizeof(file_t) + sizeof(struct lazy_file));
+	if (!result)
+		return NULL;
+	result->size = size;
+	result->parent = NULL;
+	result->lazy = 1;
+
+	lazy = (struct lazy_file *)&result->reserved;
+	lazy->fill = fill;
+	lazy->arg = arg;
+	lazy->lock = 0;
+	lazy->nchunks = (unsigned int)(((uint64)size + FILE_LAZY_CHUNK - 1) / FILE_LAZY_CHUNK);
+	lazy->used = 0;
+	lazy->active = 0;
+	lazy->tick = 0;
+	lazy->filled = calloc(lazy->nchunks, 1);
+	if (!lazy->filled)
+	{
+		free(result);
+		return NULL;
+	}
+
+	// whole chunks are reserved, so the tail of the last is filled like the rest
+	mapsize = (size_t)lazy->nchunks * FILE_LAZY_CHUNK;
+#if _WIN32
+	result->data = VirtualAlloc(NULL, mapsize, MEM_RESERVE, PAGE_NOACCESS);
+	if (!result->data)
+#elif __linux__ || __APPLE__
+	result->data = mmap(NULL, mapsize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (result->data == MAP_FAILED)
+#endif
+	{
+		free(lazy->filled);
+		free(result);
+		return NULL;
+	}
+
+	lazy_files[slot] = result;
+	return result;
+}
+
+void
+file_prefetch(file_t *file, unsigned int off, unsigned int len)
+{
+#if _WIN32
+	struct win32_file *file32;
+	WIN32_MEMORY_RANGE_ENTRY range;
+
+	if (file->parent)
+	{
+		if (off < file->size)
+			file_prefetch(file->parent, (unsigned int)(file->data - file->parent->data) + off, len < file->size - off ? len : file->size - off);
+		return;
+	}
+
+	if (file->lazy)
+		return;
+
+	file32 = (struct win32_file *)&file->reserved;
+	if (!file32->hMap || off >= file->size)
+		return;
+
+	if (len > file->size - off)
+		len = file->size - off;
+
+	range.VirtualAddress = file->data + off;
+	range.NumberOfBytes = len;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#elif __linux__ || __APPLE__
+	struct linux_file *linux_file;
+	uintptr_t start, end;
+	uintptr_t pagesize;
+
+	if (file->parent)
+	{
+		if (off < file->size)
+			file_prefetch(file->parent, (unsigned int)(file->data - file->parent->data) + off, len < file->size - off ? len : file->size - off);
+		return;
+	}
+
+	if (file->lazy)
+		return;
+
+	linux_file = (struct linux_file *)&file->reserved;
+	if (!linux_file->file || off >= file->size)
+		return;
+
+	if (len > file->size - off)
+		len = file->size - off;
+
+	// madvise wants whole pages
+	pagesize = getpagesize();
+	start = (uintptr_t)(file->data + off) & ~(pagesize - 1);
+	end = (uintptr_t)(file->data + off + len);
+	madvise((void *)start, end - start, MADV_WILLNEED);
+#endif
+}
+
 void
 close_file(file_t *file)
 {
+	struct lazy_file *lazy;
+	int slot;
+
+	if (file->parent)
+	{
+		free(file);
+		return;
+	}
+
+	if (file->lazy)
+	{
+		lazy = (struct lazy_file *)&file->reserved;
+		for (slot = 0; slot < MAX_LAZY_FILES; slot++)
+		{
+			if (lazy_files[slot] == file)
+				lazy_files[slot] = NULL;
+		}
+
+#if _WIN32
+		VirtualFree(file->data, 0, MEM_RELEASE);
+#elif __linux__ || __APPLE__
+		munmap(file->data, (size_t)lazy->nchunks * FILE_LAZY_CHUNK);
+#endif
+		free(lazy->filled);
+		free(file);
+		return;
+	}
+
 #if _WIN32
 	struct win32_file *file32;
 
@@ -252,4 +467,260 @@ close_file(file_t *file)
 
 	free(file);
 #endif
-}
\ No newline at end of file
+}
+// Fill the chunk of a lazy file holding an address. Returns 0 if the
+// address is not in a lazy file.
+static int
+lazy_fault(const byte *addr)
+{
+	file_t *file;
+	struct lazy_file *lazy;
+	int slot;
+
+	for (slot = 0; slot < MAX_LAZY_FILES; slot++)
+	{
+		file = lazy_files[slot];
+		if (!file)
+			continue;
+
+		lazy = (struct lazy_file *)&file->reserved;
+		if (addr >= file->data && addr < file->data + (size_t)lazy->nchunks * FILE_LAZY_CHUNK)
+		{
+			lazy_fill(file, (unsigned int)((addr - file->data) / FILE_LAZY_CHUNK));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Make a chunk of a lazy file readable after a fault on it, filling it
+// when it is not in memory and dropping the chunk least recently used
+// first when the cache is full. The chunk is then the latest used, and
+// the readable chunk used longest ago is protected when there are too
+// many. Threads faulting on the same chunk wait for the first.
+static void
+lazy_fill(file_t *file, unsigned int chunk)
+{
+	struct lazy_file *lazy;
+	struct lazy_chunk *entry;
+	byte *dest, *old;
+	unsigned int off, len, i;
+#if _WIN32
+	DWORD protect;
+#elif __linux__
+	byte *stage;
+#endif
+
+	lazy = (struct lazy_file *)&file->reserved;
+	lazy_lock(&lazy->lock);
+	dest = file->data + (size_t)chunk * FILE_LAZY_CHUNK;
+	if (lazy->filled[chunk] == LazyActive)
+	{
+		lazy_unlock(&lazy->lock);
+		return;
+	}
+
+	// used again while protected, the bytes are still there
+	if (lazy->filled[chunk] == LazyInactive)
+	{
+		for (i = 0; lazy->resident[i].chunk != chunk; i++);
+		lazy->resident[i].last = ++lazy->tick;
+		lazy_protect(dest, 1);
+		lazy->filled[chunk] = LazyActive;
+		lazy->active++;
+		goto demote;
+	}
+
+	// there are always fewer readable chunks than the cache holds, so an
+	// inactive one is there to drop
+	if (lazy->used == FILE_LAZY_CACHE)
+	{
+		entry = &lazy->resident[lazy_oldest(lazy, LazyInactive)];
+		old = file->data + (size_t)entry->chunk * FILE_LAZY_CHUNK;
+		lazy->filled[entry->chunk] = LazyEmpty;
+		*entry = lazy->resident[--lazy->used];
+#if _WIN32
+		VirtualFree(old, FILE_LAZY_CHUNK, MEM_DECOMMIT);
+#elif __linux__ || __APPLE__
+		mmap(old, FILE_LAZY_CHUNK, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+	}
+
+	off = chunk * FILE_LAZY_CHUNK;
+	len = file->size - off < FILE_LAZY_CHUNK ? file->size - off : FILE_LAZY_CHUNK;
+
+#if _WIN32
+	VirtualAlloc(dest, FILE_LAZY_CHUNK, MEM_COMMIT, PAGE_READWRITE);
+	lazy->fill(lazy->arg, off, dest, len);
+	VirtualProtect(dest, FILE_LAZY_CHUNK, PAGE_READONLY, &protect);
+#elif __linux__
+	// filled out of sight and moved in whole, so other threads reading
+	// the chunk fault until all of it is there
+	stage = mmap(NULL, FILE_LAZY_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (stage != MAP_FAILED)
+	{
+		lazy->fill(lazy->arg, off, stage, len);
+		mprotect(stage, FILE_LAZY_CHUNK, PROT_READ);
+		if (mremap(stage, FILE_LAZY_CHUNK, FILE_LAZY_CHUNK, MREMAP_MAYMOVE | MREMAP_FIXED, dest) == MAP_FAILED)
+			munmap(stage, FILE_LAZY_CHUNK);
+	}
+	else
+	{
+		mprotect(dest, FILE_LAZY_CHUNK, PROT_READ | PROT_WRITE);
+		lazy->fill(lazy->arg, off, dest, len);
+		mprotect(dest, FILE_LAZY_CHUNK, PROT_READ);
+	}
+#elif __APPLE__
+	mprotect(dest, FILE_LAZY_CHUNK, PROT_READ | PROT_WRITE);
+	lazy->fill(lazy->arg, off, dest, len);
+	mprotect(dest, FILE_LAZY_CHUNK, PROT_READ);
+#endif
+
+	lazy->filled[chunk] = LazyActive;
+	lazy->resident[lazy->used].chunk = chunk;
+	lazy->resident[lazy->used].last = ++lazy->tick;
+	lazy->used++;
+	lazy->active++;
+
+demote:
+	// a thread reading a chunk as it is protected faults and takes it back
+	while (lazy->active > FILE_LAZY_ACTIVE)
+	{
+		entry = &lazy->resident[lazy_oldest(lazy, LazyActive)];
+		lazy_protect(file->data + (size_t)entry->chunk * FILE_LAZY_CHUNK, 0);
+		lazy->filled[entry->chunk] = LazyInactive;
+		lazy->active--;
+	}
+
+	lazy_unlock(&lazy->lock);
+}
+
+// Returns the index in the cache of the chunk in a state which was used
+// longest ago, there must be one.
+static unsigned int
+lazy_oldest(struct lazy_file *lazy, int state)
+{
+	unsigned int i, oldest;
+
+	oldest = lazy->used;
+	for (i = 0; i < lazy->used; i++)
+	{
+		if (lazy->filled[lazy->resident[i].chunk] == state && (oldest == lazy->used || lazy->resident[i].last < lazy->resident[oldest].last))
+			oldest = i;
+	}
+
+	return oldest;
+}
+
+// Make a chunk of a lazy file in memory readable, or fault on any access
+// while keeping its bytes
+static void
+lazy_protect(byte *addr, int readable)
+{
+#if _WIN32
+	DWORD protect;
+
+	VirtualProtect(addr, FILE_LAZY_CHUNK, readable ? PAGE_READONLY : PAGE_NOACCESS, &protect);
+#elif __linux__ || __APPLE__
+	mprotect(addr, FILE_LAZY_CHUNK, readable ? PROT_READ : PROT_NONE);
+#endif
+}
+
+// The holder may be filling a chunk, which takes a while, so waiting
+// threads give up the processor rather than spin
+static void
+lazy_lock(volatile long *lock)
+{
+#if _MSC_VER
+	while (InterlockedExchange(lock, 1))
+		SwitchToThread();
+#else
+	while (__sync_lock_test_and_set(lock, 1))
+	{
+		while (*lock)
+			sched_yield();
+	}
+#endif
+}
+
+static void
+lazy_unlock(volatile long *lock)
+{
+#if _MSC_VER
+	InterlockedExchange(lock, 0);
+#else
+	__sync_lock_release(lock);
+#endif
+}
+
+#if _WIN32
+
+static LONG CALLBACK
+lazy_handler(PEXCEPTION_POINTERS info)
+{
+	EXCEPTION_RECORD *record;
+
+	record = info->ExceptionRecord;
+	if (record->ExceptionCode == EXCEPTION_ACCESS_VIOLATION && record->NumberParameters >= 2 &&
+		lazy_fault((const byte *)record->ExceptionInformation[1]))
+		return EXCEPTION_CONTINUE_EXECUTION;
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static int
+lazy_install()
+{
+	if (!lazy_installed)
+		lazy_installed = AddVectoredExceptionHandler(1, &lazy_handler) != NULL;
+	return lazy_installed;
+}
+
+#elif __linux__ || __APPLE__
+
+static struct sigaction previous_segv;
+static struct sigaction previous_bus;
+
+static void
+lazy_handler(int sig, siginfo_t *info, void *context)
+{
+	struct sigaction *previous;
+
+	if (lazy_fault(info->si_addr))
+		return;
+
+	// not a lazy file, pass it on, restoring the default action and
+	// letting the access fault again if there was no handler
+	previous = sig == SIGBUS ? &previous_bus : &previous_segv;
+	if (previous->sa_flags & SA_SIGINFO)
+		previous->sa_sigaction(sig, info, context);
+	else if (previous->sa_handler != SIG_DFL && previous->sa_handler != SIG_IGN)
+		previous->sa_handler(sig);
+	else
+		sigaction(sig, previous, NULL);
+}
+
+static int
+lazy_install()
+{
+	struct sigaction action;
+
+	if (lazy_installed)
+		return 1;
+
+	// filling may fault on a lazy file the data is decompressed from
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = &lazy_handler;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGSEGV, &action, &previous_segv))
+		return 0;
+	// some systems raise SIGBUS for protected pages
+	if (sigaction(SIGBUS, &action, &previous_bus))
+		return 0;
+
+	lazy_installed = 1;
+	return 1;
+}
+
+#endif
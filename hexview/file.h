@@ -3,11 +3,17 @@
 
 #include "defs.h"
 
+#define FILE_LAZY_CHUNK 1048576  // bytes of a lazy file filled at once
+#define FILE_LAZY_CACHE 64       // filled chunks of a lazy file kept in memory
+#define FILE_LAZY_ACTIVE 16      // of those, the ones last used which are read without faulting
+
 typedef struct file_s file_t;
 struct file_s
 {
 	byte *data;			// Pointer to the start of the file's data. Addressing valid from [data, data + size).
 	unsigned int size;	// Size of the file.
+	int lazy;			// The data is filled on first access, see file_lazy.
+	file_t *parent;		// File a slice is a window into, NULL for opened files.
 
 	byte reserved[1];
 };
@@ -20,7 +26,71 @@ struct file_s
 // The opened file, or NULL if it could not be opened.
 file_t *open_file(const char *filename);
 
-// Close an open file.
+// Make a window into part of an open file, which can be used as a file
+// of its own. Nothing is copied, the slice must be closed before the
+// file it is a window into.
+// Parameters:
+// - file: The file to slice.
+// - off: The offset of the first byte of the slice.
+// - size: The size of the slice, off + size must not be past the end
+//         of the file.
+//
+// Returns:
+// The slice, or NULL if memory could not be allocated.
+file_t *file_slice(file_t *file, unsigned int off, unsigned int size);
+
+// Produce part of the data of a lazy file. It is called from the
+// handler of the fault raised by the first access, on the thread which
+// made it, while the file is locked against other threads filling it.
+// The access may have been made anywhere, holding any lock, so it must
+// not allocate, print, take locks or touch the lazy file itself, only
+// compute into out from memory set up beforehand. It may read other lazy
+// files, which fault and fill in turn.
+// Parameters:
+// - arg: The argument given to file_lazy.
+// - off: The offset of the first byte to produce.
+// - out: Destination of the bytes.
+// - len: The number of bytes to produce.
+//
+// Returns:
+// The number of bytes produced, the rest of out is left zero.
+typedef unsigned int(*file_fill_fn)(void *arg, unsigned int off, byte *out, unsigned int len);
+
+// Make a file whose data is produced on demand, such as the
+// decompressed contents of another. Address space is reserved for all
+// of it, and FILE_LAZY_CHUNK bytes are filled when any of them is first
+// accessed. FILE_LAZY_CACHE chunks are kept, and when another is needed
+// the one least recently used is dropped, to be filled again when it is
+// accessed again. Use is seen from faults: the FILE_LAZY_ACTIVE chunks
+// used last are readable, the others are protected so their next access
+// faults and makes them the latest used again without filling them.
+//
+// The data is filled from a SIGSEGV handler on Linux and macOS, or a
+// vectored exception handler on Windows, which takes a spinlock of the
+// file and maps, protects and moves pages with system calls. These are
+// safe from a fault only because fill takes no locks of its own, see
+// file_fill_fn, and reading the data of a lazy file from another signal
+// handler is not supported.
+// Parameters:
+// - size: The size of the file.
+// - fill: The function producing the data, called with one chunk at a
+//         time, from any thread touching the data.
+// - arg: Passed to fill, it must stay valid until the file is closed.
+//
+// Returns:
+// The file, or NULL if the address space could not be reserved.
+file_t *file_lazy(unsigned int size, file_fill_fn fill, void *arg);
+
+// Ask the system to start reading part of a file into memory in the
+// background, so later accesses do not block on page faults. Does
+// nothing for files which are not memory mapped or are lazy.
+// Parameters:
+// - file: The file to prefetch from.
+// - off: The offset of the first byte to prefetch.
+// - len: The number of bytes to prefetch.
+void file_prefetch(file_t *file, unsigned int off, unsigned int len);
+
+// Close an open file or a slice.
 // Parameters:
 // - file: The file to close.
 void close_file(file_t *file);
@@ -0,0 +1,553 @@
+#include "formats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ZIP_EOCD_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+#define PNG_MAX_TYPES 64     // distinct chunk types counted
+#define GPT_MAX_ENTRIES 65536
+#define PE_DIRECTORIES 15
+
+struct signature
+{
+	int format;
+	unsigned int offset;
+	const char *magic;
+	unsigned int len;
+};
+
+// A bounds checked view of a file. Reads past its end return 0 and set
+// failed, so a parser can read a whole header and check once.
+struct reader
+{
+	const byte *data;
+	unsigned int size;
+	int big;
+	int failed;
+};
+
+static const struct signature signatures[] = {
+	{ FormatElf, 0, "\x7f" "ELF", 4 },
+	{ FormatPng, 0, "\x89PNG\r\n\x1a\n", 8 },
+	{ FormatZip, 0, "PK\x03\x04", 4 },
+	{ FormatZip, 0, "PK\x05\x06", 4 },
+	{ FormatPe, 0, "MZ", 2 },
+	{ FormatGpt, 512, "EFI PART", 8 },
+	{ FormatGpt, 4096, "EFI PART", 8 }
+};
+
+static const char *pe_directories[PE_DIRECTORIES] = {
+	"export", "import", "resource", "exception", "security", "reloc", "debug", "architecture",
+	"globalptr", "tls", "config", "bound", "iat", "delay", "clr"
+};
+
+static uint64 get(struct reader *r, uint64 off, unsigned int len);
+static void get_string(struct reader *r, uint64 off, uint64 len, int wide, char *const out);
+static int add(sections_t *sections, const char *name, uint64 offset, uint64 size, unsigned int file_size);
+static int index_elf(sections_t *sections, struct reader *r);
+static int index_pe(sections_t *sections, struct reader *r);
+static int pe_offset(struct reader *r, uint64 table, unsigned int count, uint64 rva, uint64 *const off);
+static int index_png(sections_t *sections, struct reader *r);
+static int index_zip(sections_t *sections, struct reader *r);
+static int index_gpt(sections_t *sections, struct reader *r);
+
+int
+format_detect(const byte *data, unsigned int size)
+{
+	struct reader r;
+	const struct signature *sig;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++)
+	{
+		sig = &signatures[i];
+		if ((uint64)sig->offset + sig->len > size || memcmp(data + sig->offset, sig->magic, sig->len))
+			continue;
+
+		// MZ alone is too short to trust, the PE header must be there too
+		if (sig->format == FormatPe)
+		{
+			r.data = data;
+			r.size = size;
+			r.big = 0;
+			r.failed = 0;
+			if (get(&r, get(&r, 0x3c, 4), 4) != 0x00004550 || r.failed)
+				continue;
+		}
+
+		return sig->format;
+	}
+
+	return FormatNone;
+}
+
+const char *
+format_name(int format)
+{
+	switch (format)
+	{
+	case FormatElf: return "ELF";
+	case FormatPe: return "PE";
+	case FormatPng: return "PNG";
+	case FormatZip: return "ZIP";
+	case FormatGpt: return "GPT";
+	default: return "unknown";
+	}
+}
+
+sections_t *
+format_index(const byte *data, unsigned int size, int format)
+{
+	sections_t *sections;
+	struct reader r;
+	int result;
+
+	sections = calloc(1, sizeof(sections_t));
+	if (!sections)
+		return NULL;
+	sections->format = format;
+
+	r.data = data;
+	r.size = size;
+	r.big = 0;
+	r.failed = 0;
+
+	switch (format)
+	{
+	case FormatElf: result = index_elf(sections, &r); break;
+	case FormatPe: result = index_pe(sections, &r); break;
+	case FormatPng: result = index_png(sections, &r); break;
+	case FormatZip: result = index_zip(sections, &r); break;
+	case FormatGpt: result = index_gpt(sections, &r); break;
+	default: result = 1; break;
+	}
+
+	if (!result)
+	{
+		sections_free(sections);
+		return NULL;
+	}
+
+	return sections;
+}
+
+void
+sections_free(sections_t *sections)
+{
+	if (!sections) return;
+
+	free(sections->items);
+	free(sections);
+}
+
+const section_t *
+sections_find(const sections_t *sections, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sections->count; i++)
+	{
+		if (!strcmp(sections->items[i].name, name))
+			return &sections->items[i];
+	}
+
+	return NULL;
+}
+
+// Read an integer of len bytes in the endianess of the reader
+static uint64
+get(struct reader *r, uint64 off, unsigned int len)
+{
+	uint64 value;
+	unsigned int i;
+
+	if (off > r->size || len > r->size - off)
+	{
+		r->failed = 1;
+		return 0;
+	}
+
+	value = 0;
+	for (i = 0; i < len; i++)
+	{
+		if (r->big)
+			value = value << 8 | r->data[off + i];
+		else
+			value |= (uint64)r->data[off + i] << (i * 8);
+	}
+
+	return value;
+}
+
+// Copy a string of at most len bytes, or UTF-16 units if wide, up to its
+// null. Characters outside printable ASCII become '?'.
+static void
+get_string(struct reader *r, uint64 off, uint64 len, int wide, char *const out)
+{
+	unsigned int i, c;
+
+	for (i = 0; i < len && i < SECTION_NAME_SIZE - 1; i++)
+	{
+		c = (unsigned int)get(r, off + (uint64)i * (wide ? 2 : 1), wide ? 2 : 1);
+		if (!c || r->failed)
+			break;
+		out[i] = c >= 0x20 && c < 0x7f ? (char)c : '?';
+	}
+	out[i] = 0;
+}
+
+static int
+add(sections_t *sections, const char *name, uint64 offset, uint64 size, unsigned int file_size)
+{
+	section_t *items;
+
+	// sections which are not in the file, such as .bss, are left out
+	if (offset >= file_size)
+		return 1;
+	if (size > file_size - offset)
+		size = file_size - offset;
+
+	if (sections->count == sections->capacity)
+	{
+		items = realloc(sections->items, (sections->capacity ? sections->capacity * 2 : 32) * sizeof(section_t));
+		if (!items)
+			return 0;
+		sections->items = items;
+		sections->capacity = sections->capacity ? sections->capacity * 2 : 32;
+	}
+
+	snprintf(sections->items[sections->count].name, SECTION_NAME_SIZE, "%s", name);
+	sections->items[sections->count].offset = (unsigned int)offset;
+	sections->items[sections->count].size = (unsigned int)size;
+	sections->count++;
+	return 1;
+}
+
+static int
+index_elf(sections_t *sections, struct reader *r)
+{
+	char name[SECTION_NAME_SIZE], unique[SECTION_NAME_SIZE + 16];
+	uint64 phoff, shoff, stroff, strsize, h, off, size;
+	unsigned int ehsize, phentsize, phnum, shentsize, shnum, shstrndx, i, n;
+	int wide;
+
+	wide = get(r, 4, 1) == 2;
+	r->big = get(r, 5, 1) == 2;
+
+	phoff = wide ? get(r, 0x20, 8) : get(r, 0x1c, 4);
+	shoff = wide ? get(r, 0x28, 8) : get(r, 0x20, 4);
+	ehsize = (unsigned int)get(r, wide ? 0x34 : 0x28, 2);
+	phentsize = (unsigned int)get(r, wide ? 0x36 : 0x2a, 2);
+	phnum = (unsigned int)get(r, wide ? 0x38 : 0x2c, 2);
+	shentsize = (unsigned int)get(r, wide ? 0x3a : 0x2e, 2);
+	shnum = (unsigned int)get(r, wide ? 0x3c : 0x30, 2);
+	shstrndx = (unsigned int)get(r, wide ? 0x3e : 0x32, 2);
+	if (r->failed)
+		return 1;
+
+	if (!add(sections, "elf:header", 0, ehsize, r->size))
+		return 0;
+	if (phnum && !add(sections, "elf:phdr", phoff, (uint64)phnum * phentsize, r->size))
+		return 0;
+	if (shnum && !add(sections, "elf:shdr", shoff, (uint64)shnum * shentsize, r->size))
+		return 0;
+
+	for (i = 0; i < phnum; i++)
+	{
+		h = phoff + (uint64)i * phentsize;
+		off = wide ? get(r, h + 8, 8) : get(r, h + 4, 4);
+		size = wide ? get(r, h + 32, 8) : get(r, h + 16, 4);
+		if (r->failed)
+			return 1;
+
+		sprintf(name, "segment:%u", i);
+		if (!add(sections, name, off, size, r->size))
+			return 0;
+	}
+
+	h = shoff + (uint64)shstrndx * shentsize;
+	stroff = wide ? get(r, h + 0x18, 8) : get(r, h + 0x10, 4);
+	strsize = wide ? get(r, h + 0x20, 8) : get(r, h + 0x14, 4);
+	if (r->failed)
+		return 1;
+
+	for (i = 1; i < shnum; i++)
+	{
+		h = shoff + (uint64)i * shentsize;
+		n = (unsigned int)get(r, h, 4);
+		off = wide ? get(r, h + 0x18, 8) : get(r, h + 0x10, 4);
+		size = get(r, h + 4, 4) == 8 ? 0 : wide ? get(r, h + 0x20, 8) : get(r, h + 0x14, 4);  // SHT_NOBITS
+		if (r->failed || n >= strsize)
+			return 1;
+
+		get_string(r, stroff + n, strsize - n, 0, name);
+		if (!name[0])
+			continue;
+
+		// relocatable objects can have several sections with one name
+		strcpy(unique, name);
+		for (n = 1; sections_find(sections, unique); n++)
+			snprintf(unique, sizeof(unique), "%s:%u", name, n);
+
+		if (!add(sections, unique, off, size, r->size))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+index_pe(sections_t *sections, struct reader *r)
+{
+	char name[SECTION_NAME_SIZE];
+	uint64 pe, opt, table, dirs, h, rva, off, size;
+	unsigned int nsections, optsize, ndirs, i;
+
+	pe = get(r, 0x3c, 4);
+	nsections = (unsigned int)get(r, pe + 6, 2);
+	optsize = (unsigned int)get(r, pe + 20, 2);
+	opt = pe + 24;
+	table = opt + optsize;
+
+	// PE32+ has 64 bit image base and stack sizes before the directories
+	dirs = opt + (get(r, opt, 2) == 0x20b ? 112 : 96);
+	ndirs = (unsigned int)get(r, dirs - 4, 4);
+	if (r->failed)
+		return 1;
+
+	if (!add(sections, "pe:header", pe, 24 + optsize, r->size))
+		return 0;
+	if (!add(sections, "pe:sections", table, (uint64)nsections * 40, r->size))
+		return 0;
+
+	for (i = 0; i < nsections; i++)
+	{
+		h = table + (uint64)i * 40;
+		get_string(r, h, 8, 0, name);
+		size = get(r, h + 16, 4);
+		off = get(r, h + 20, 4);
+		if (r->failed)
+			return 1;
+
+		if (name[0] && !sections_find(sections, name) && !add(sections, name, off, size, r->size))
+			return 0;
+	}
+
+	for (i = 0; i < ndirs && i < PE_DIRECTORIES; i++)
+	{
+		rva = get(r, dirs + i * 8, 4);
+		size = get(r, dirs + i * 8 + 4, 4);
+		if (r->failed)
+			return 1;
+		if (!rva)
+			continue;
+
+		// the security directory is the only one given as a file offset
+		off = rva;
+		if (i != 4 && !pe_offset(r, table, nsections, rva, &off))
+			continue;
+
+		sprintf(name, "dir:%s", pe_directories[i]);
+		if (!add(sections, name, off, size, r->size))
+			return 0;
+	}
+
+	return 1;
+}
+
+// Map a relative virtual address to a file offset through the section
+// table. Returns 0 if no section contains it.
+static int
+pe_offset(struct reader *r, uint64 table, unsigned int count, uint64 rva, uint64 *const off)
+{
+	uint64 h, va, vsize, rawsize;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+	{
+		h = table + (uint64)i * 40;
+		vsize = get(r, h + 8, 4);
+		va = get(r, h + 12, 4);
+		rawsize = get(r, h + 16, 4);
+		if (r->failed)
+			return 0;
+
+		if (rva >= va && rva < va + (vsize > rawsize ? vsize : rawsize))
+		{
+			*off = get(r, h + 20, 4) + (rva - va);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+index_png(sections_t *sections, struct reader *r)
+{
+	char name[SECTION_NAME_SIZE];
+	uint32 types[PNG_MAX_TYPES];
+	unsigned int counts[PNG_MAX_TYPES];
+	unsigned int ntypes, t, i;
+	uint64 pos, len;
+	byte c;
+
+	r->big = 1;
+	ntypes = 0;
+	for (pos = 8; pos + 12 <= r->size; pos += 12 + len)
+	{
+		len = get(r, pos, 4);
+		for (i = 0; i < 4; i++)
+		{
+			c = r->data[pos + 4 + i];
+			if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+				return 1;
+		}
+
+		for (t = 0; t < ntypes && types[t] != (uint32)get(r, pos + 4, 4); t++);
+		if (t == ntypes)
+		{
+			if (ntypes == PNG_MAX_TYPES)
+				return 1;
+			types[ntypes] = (uint32)get(r, pos + 4, 4);
+			counts[ntypes++] = 0;
+		}
+
+		// the first chunk of a type can also be named without its index
+		if (!counts[t])
+		{
+			sprintf(name, "chunk:%.4s", (const char *)r->data + pos + 4);
+			if (!add(sections, name, pos, 12 + len, r->size))
+				return 0;
+		}
+
+		sprintf(name, "chunk:%.4s:%u", (const char *)r->data + pos + 4, counts[t]++);
+		if (!add(sections, name, pos, 12 + len, r->size))
+			return 0;
+
+		if (!memcmp(r->data + pos + 4, "IEND", 4))
+			break;
+	}
+
+	return 1;
+}
+
+static int
+index_zip(sections_t *sections, struct reader *r)
+{
+	char name[SECTION_NAME_SIZE + 16], path[SECTION_NAME_SIZE];
+	uint64 eocd, p, local, csize;
+	unsigned int count, i, nlen, xlen, clen;
+	int found;
+
+	// the end of central directory record is followed only by a comment
+	found = 0;
+	for (eocd = r->size - ZIP_EOCD_SIZE; r->size >= ZIP_EOCD_SIZE; eocd--)
+	{
+		if (get(r, eocd, 4) == 0x06054b50)
+		{
+			found = 1;
+			break;
+		}
+		if (!eocd || r->size - eocd >= ZIP_EOCD_SIZE + ZIP_MAX_COMMENT)
+			break;
+	}
+
+	if (found)
+	{
+		count = (unsigned int)get(r, eocd + 10, 2);
+		p = get(r, eocd + 16, 4);
+		if (!add(sections, "zip:central", p, get(r, eocd + 12, 4), r->size) ||
+			!add(sections, "zip:end", eocd, ZIP_EOCD_SIZE + get(r, eocd + 20, 2), r->size))
+			return 0;
+
+		for (i = 0; i < count && get(r, p, 4) == 0x02014b50; i++)
+		{
+			csize = get(r, p + 20, 4);
+			nlen = (unsigned int)get(r, p + 28, 2);
+			xlen = (unsigned int)get(r, p + 30, 2);
+			clen = (unsigned int)get(r, p + 32, 2);
+			local = get(r, p + 42, 4);
+			get_string(r, p + 46, nlen, 0, path);
+			if (r->failed)
+				return 1;
+
+			snprintf(name, sizeof(name), "member:%s", path);
+			if (!add(sections, name, local, 30 + get(r, local + 26, 2) + get(r, local + 28, 2) + csize, r->size))
+				return 0;
+
+			p += 46 + nlen + xlen + clen;
+		}
+
+		return 1;
+	}
+
+	// without a central directory, walk the local headers while their
+	// sizes are known up front
+	for (p = 0; get(r, p, 4) == 0x04034b50 && !(get(r, p + 6, 2) & 8); p += 30 + nlen + xlen + csize)
+	{
+		csize = get(r, p + 18, 4);
+		nlen = (unsigned int)get(r, p + 26, 2);
+		xlen = (unsigned int)get(r, p + 28, 2);
+		get_string(r, p + 30, nlen, 0, path);
+		if (r->failed)
+			return 1;
+
+		snprintf(name, sizeof(name), "member:%s", path);
+		if (!add(sections, name, p, 30 + nlen + xlen + csize, r->size))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+index_gpt(sections_t *sections, struct reader *r)
+{
+	char name[SECTION_NAME_SIZE + 16], label[SECTION_NAME_SIZE];
+	uint64 sector, entries, e, first, last;
+	unsigned int count, size, i;
+
+	sector = memcmp(r->data + 512, "EFI PART", 8) ? 4096 : 512;
+
+	if (get(r, 510, 2) == 0xaa55 && !add(sections, "mbr", 0, 512, r->size))
+		return 0;
+	if (!add(sections, "gpt:header", sector, get(r, sector + 12, 4), r->size))
+		return 0;
+
+	entries = get(r, sector + 72, 8) * sector;
+	count = (unsigned int)get(r, sector + 80, 4);
+	size = (unsigned int)get(r, sector + 84, 4);
+	if (r->failed || size < 128 || count > GPT_MAX_ENTRIES)
+		return 1;
+
+	if (!add(sections, "gpt:entries", entries, (uint64)count * size, r->size))
+		return 0;
+
+	for (i = 0; i < count; i++)
+	{
+		e = entries + (uint64)i * size;
+		if (!get(r, e, 8) && !get(r, e + 8, 8))
+			continue;  // unused entry, its type is all zero
+
+		first = get(r, e + 32, 8);
+		last = get(r, e + 40, 8);
+		get_string(r, e + 56, 36, 1, label);
+		if (r->failed)
+			return 1;
+		if (last < first)
+			continue;
+
+		sprintf(name, "partition:%u", i + 1);
+		if (!add(sections, name, first * sector, (last - first + 1) * sector, r->size))
+			return 0;
+
+		snprintf(name, sizeof(name), "partition:%s", label);
+		if (label[0] && !add(sections, name, first * sector, (last - first + 1) * sector, r->size))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,74 @@
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include "defs.h"
+
+#define SECTION_NAME_SIZE 64
+
+enum
+{
+	FormatNone = 0,
+	FormatElf,
+	FormatPe,
+	FormatPng,
+	FormatZip,
+	FormatGpt
+};
+
+typedef struct section_s section_t;
+struct section_s
+{
+	char name[SECTION_NAME_SIZE];  // Such as ".text", "chunk:IDAT:3" or "partition:1".
+	unsigned int offset;
+	unsigned int size;             // Bytes of the section in the file, clipped to its end.
+};
+
+typedef struct sections_s sections_t;
+struct sections_s
+{
+	int format;
+	section_t *items;  // Sections in the order the headers list them.
+	unsigned int count;
+	unsigned int capacity;
+};
+
+// Recognize the container format of a file from its signature. Only a
+// few bytes at known offsets are read.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+//
+// Returns:
+// The format, or FormatNone if it is not recognized.
+int format_detect(const byte *data, unsigned int size);
+
+// Returns the name of a format, such as "ELF".
+const char *format_name(int format);
+
+// Parse the headers of a file into an index of named sections, segments,
+// chunks, members or partitions. Every read is checked against the size
+// of the file, malformed headers end the index early.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+// - format: The format, as returned by format_detect.
+//
+// Returns:
+// The index, or NULL if memory could not be allocated.
+sections_t *format_index(const byte *data, unsigned int size, int format);
+
+// Free an index.
+// Parameters:
+// - sections: The index to free, can be NULL.
+void sections_free(sections_t *sections);
+
+// Find a section by name.
+// Parameters:
+// - sections: The index to search.
+// - name: The name of the section.
+//
+// Returns:
+// The first section with that name, or NULL if there is none.
+const section_t *sections_find(const sections_t *sections, const char *name);
+
+#endif
@@ -0,0 +1,1088 @@
+#include "hash.h"
+
+#include <string.h>
+
+#include "thread.h"
+#include "util.h"
+
+#if HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+#define CRC32_POLY 0xedb88320   // reflected ISO-HDLC polynomial
+#define CRC32C_POLY 0x82f63b78  // reflected Castagnoli polynomial
+
+#define MIN_JOB_SIZE (4 << 20)  // smallest range worth giving its own thread
+
+#define XXH_PRIME32_1 0x9e3779b1U
+#define XXH_PRIME32_2 0x85ebca77U
+#define XXH_PRIME32_3 0xc2b2ae3dU
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+#define XXH_PRIME_MX1 0x165667919e3779f9ULL
+#define XXH_PRIME_MX2 0x9fb21c651e98df25ULL
+
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPE_LEN 64
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8)
+#define XXH_BLOCK_LEN (XXH_STRIPE_LEN * XXH_STRIPES_PER_BLOCK)
+
+// Incremental state of a SHA-1 or SHA-256 hash
+struct sha_ctx
+{
+	uint32 state[8];
+	byte buffer[64];
+	uint64 length;  // total bytes hashed
+	void(*compress)(uint32 *state, const byte *blocks, size_t count);
+};
+
+// A range of the data checksummed by a single thread
+struct crc_job
+{
+	const byte *data;
+	size_t size;
+	int algo;
+	uint32 crc;
+};
+
+static const char *hash_names[] = { "crc32", "crc32c", "xxh3", "sha1", "sha256" };
+static const unsigned int digest_sizes[] = { 4, 4, 8, 20, 32 };
+
+static uint32 crc32_table[8][256];
+static uint32 crc32c_table[8][256];
+static uint32 crc32_x2n[32];   // x^(2^n) mod p, used to combine CRCs
+static uint32 crc32c_x2n[32];
+static int tables_ready = 0;
+
+static const uint32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const byte xxh3_secret[XXH_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+static void init_tables();
+static void crc_proc(void *arg);
+static uint32 multmodp(uint32 a, uint32 b, uint32 poly);
+static uint32 crc_combine(int algo, uint32 crc1, uint32 crc2, size_t size2);
+static uint32 crc32c_update(uint32 crc, const byte *data, size_t size);
+
+static void sha_init(struct sha_ctx *ctx, int algo);
+static void sha_update(struct sha_ctx *ctx, const byte *data, size_t size);
+static void sha_final(struct sha_ctx *ctx, int words, byte *const digest);
+static void sha1_compress(uint32 *state, const byte *blocks, size_t count);
+static void sha256_compress(uint32 *state, const byte *blocks, size_t count);
+
+#if HAVE_SSE2
+static uint32 crc32_clmul(uint32 crc, const byte *data, size_t size);
+static uint32 crc32c_sse42(uint32 crc, const byte *data, size_t size);
+static void sha1_compress_ni(uint32 *state, const byte *blocks, size_t count);
+static void sha256_compress_ni(uint32 *state, const byte *blocks, size_t count);
+#endif
+
+static inline uint32
+read32(const byte *p)
+{
+	uint32 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64
+read64(const byte *p)
+{
+	uint64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32
+read32_be(const byte *p)
+{
+	return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | ((uint32)p[2] << 8) | p[3];
+}
+
+static inline void
+write32_be(byte *p, uint32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline uint32
+rotl32(uint32 v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+static inline uint32
+rotr32(uint32 v, int n)
+{
+	return (v >> n) | (v << (32 - n));
+}
+
+static inline uint64
+rotl64(uint64 v, int n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+int
+hash_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < HashCount; i++)
+	{
+		if (equals_ignore_case(name, hash_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+const char *
+hash_name(int algo)
+{
+	return hash_names[algo];
+}
+
+unsigned int
+hash_digest_size(int algo)
+{
+	return digest_sizes[algo];
+}
+
+void
+hash_data(int algo, const byte *data, size_t size, byte *const digest)
+{
+	struct crc_job *jobs;
+	struct sha_ctx ctx;
+	size_t jobsize;
+	uint32 crc;
+	uint64 h;
+	int njobs;
+	int i;
+
+	init_tables();
+
+	switch (algo)
+	{
+	case HashCrc32:
+	case HashCrc32c:
+		njobs = cpu_count();
+		if (size / MIN_JOB_SIZE < (size_t)njobs)
+			njobs = (int)(size / MIN_JOB_SIZE);
+		if (njobs < 1)
+			njobs = 1;
+
+		jobs = malloc(njobs * sizeof(struct crc_job));
+		if (!jobs)
+			njobs = 0;
+
+		jobsize = size / (njobs ? njobs : 1);
+		for (i = 0; i < njobs; i++)
+		{
+			jobs[i].data = data + i * jobsize;
+			jobs[i].size = i == njobs - 1 ? size - i * jobsize : jobsize;
+			jobs[i].algo = algo;
+		}
+
+		if (njobs)
+		{
+			run_parallel(&crc_proc, jobs, njobs, sizeof(struct crc_job));
+
+			// stitch the blocks back together
+			crc = jobs[0].crc;
+			for (i = 1; i < njobs; i++)
+				crc = crc_combine(algo, crc, jobs[i].crc, jobs[i].size);
+			free(jobs);
+		}
+		else
+			crc = algo == HashCrc32 ? crc32_update(0, data, size) : crc32c_update(0, data, size);
+
+		write32_be(digest, crc);
+		break;
+	case HashXxh3:
+		h = xxh3_64(data, size);
+		write32_be(digest, (uint32)(h >> 32));
+		write32_be(digest + 4, (uint32)h);
+		break;
+	case HashSha1:
+		sha_init(&ctx, algo);
+		sha_update(&ctx, data, size);
+		sha_final(&ctx, 5, digest);
+		break;
+	case HashSha256:
+		sha_init(&ctx, algo);
+		sha_update(&ctx, data, size);
+		sha_final(&ctx, 8, digest);
+		break;
+	}
+}
+
+uint32
+crc32_update(uint32 crc, const byte *data, size_t size)
+{
+	uint32 hi;
+
+	init_tables();
+
+	crc = ~crc;
+
+#if HAVE_SSE2
+	if (size >= 64 && (cpu_features() & (CpuPclmul | CpuSse41)) == (CpuPclmul | CpuSse41))
+	{
+		crc = crc32_clmul(crc, data, size & ~(size_t)15);
+		data += size & ~(size_t)15;
+		size &= 15;
+	}
+#endif
+
+	// slice-by-8
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		crc ^= read32(data);
+		hi = read32(data + 4);
+		crc = crc32_table[7][crc & 0xff] ^ crc32_table[6][(crc >> 8) & 0xff] ^
+			crc32_table[5][(crc >> 16) & 0xff] ^ crc32_table[4][crc >> 24] ^
+			crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+			crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+	}
+
+	for (; size; data++, size--)
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *data) & 0xff];
+
+	return ~crc;
+}
+
+static inline uint64
+xxh64_avalanche(uint64 h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64
+xxh3_avalanche(uint64 h)
+{
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static inline uint64
+xxh3_rrmxmx(uint64 h, uint64 len)
+{
+	h ^= rotl64(h, 49) ^ rotl64(h, 24);
+	h *= XXH_PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= XXH_PRIME_MX2;
+	h ^= h >> 28;
+	return h;
+}
+
+// 64x64 -> 128 bit multiply, folded to 64 bits
+static inline uint64
+xxh3_mul128_fold64(uint64 a, uint64 b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return (uint64)product ^ (uint64)(product >> 64);
+#elif _MSC_VER && _M_X64
+	uint64 hi;
+	uint64 lo = _umul128(a, b, &hi);
+	return lo ^ hi;
+#else
+	uint64 lolo = (a & 0xffffffff) * (b & 0xffffffff);
+	uint64 hilo = (a >> 32) * (b & 0xffffffff);
+	uint64 lohi = (a & 0xffffffff) * (b >> 32);
+	uint64 hihi = (a >> 32) * (b >> 32);
+	uint64 cross = (lolo >> 32) + (hilo & 0xffffffff) + lohi;
+	uint64 upper = (hilo >> 32) + (cross >> 32) + hihi;
+	uint64 lower = (cross << 32) | (lolo & 0xffffffff);
+	return lower ^ upper;
+#endif
+}
+
+static inline uint64
+xxh3_mix16(const byte *p, const byte *secret)
+{
+	return xxh3_mul128_fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+static inline void
+xxh3_accumulate_512(uint64 *acc, const byte *p, const byte *secret)
+{
+#if HAVE_SSE2
+	__m128i *xacc = (__m128i *)acc;
+	__m128i data, key, data_key, data_key_lo, product, swapped;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		data = _mm_loadu_si128((const __m128i *)(p + i * 16));
+		key = _mm_loadu_si128((const __m128i *)(secret + i * 16));
+		data_key = _mm_xor_si128(data, key);
+		data_key_lo = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+		product = _mm_mul_epu32(data_key, data_key_lo);
+		swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+		xacc[i] = _mm_add_epi64(xacc[i], _mm_add_epi64(product, swapped));
+	}
+#else
+	uint64 data, key;
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		data = read64(p + i * 8);
+		key = data ^ read64(secret + i * 8);
+		acc[i ^ 1] += data;
+		acc[i] += (key & 0xffffffff) * (key >> 32);
+	}
+#endif
+}
+
+static inline void
+xxh3_scramble(uint64 *acc, const byte *secret)
+{
+#if HAVE_SSE2
+	__m128i *xacc = (__m128i *)acc;
+	const __m128i prime = _mm_set1_epi32((int)XXH_PRIME32_1);
+	__m128i a, key, data_key, data_key_hi, lo, hi;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		a = xacc[i];
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		key = _mm_loadu_si128((const __m128i *)(secret + i * 16));
+		data_key = _mm_xor_si128(a, key);
+		data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+		lo = _mm_mul_epu32(data_key, prime);
+		hi = _mm_mul_epu32(data_key_hi, prime);
+		xacc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+	}
+#else
+	uint64 a;
+	int i;
+
+	for (i = 0; i < 8; i++)
+	{
+		a = acc[i];
+		a ^= a >> 47;
+		a ^= read64(secret + i * 8);
+		a *= XXH_PRIME32_1;
+		acc[i] = a;
+	}
+#endif
+}
+
+static uint64
+xxh3_long(const byte *data, size_t size)
+{
+#if _MSC_VER
+	__declspec(align(16)) uint64 acc[8];
+#else
+	uint64 acc[8] __attribute__((aligned(16)));
+#endif
+	size_t nblocks, block, nstripes, stripe;
+	uint64 result;
+	int i;
+
+	acc[0] = XXH_PRIME32_3;
+	acc[1] = XXH_PRIME64_1;
+	acc[2] = XXH_PRIME64_2;
+	acc[3] = XXH_PRIME64_3;
+	acc[4] = XXH_PRIME64_4;
+	acc[5] = XXH_PRIME32_2;
+	acc[6] = XXH_PRIME64_5;
+	acc[7] = XXH_PRIME32_1;
+
+	nblocks = (size - 1) / XXH_BLOCK_LEN;
+	for (block = 0; block < nblocks; block++)
+	{
+		for (stripe = 0; stripe < XXH_STRIPES_PER_BLOCK; stripe++)
+			xxh3_accumulate_512(acc, data + block * XXH_BLOCK_LEN + stripe * XXH_STRIPE_LEN, xxh3_secret + stripe * 8);
+		xxh3_scramble(acc, xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+	}
+
+	// partial last block, then the last stripe
+	nstripes = ((size - 1) - nblocks * XXH_BLOCK_LEN) / XXH_STRIPE_LEN;
+	for (stripe = 0; stripe < nstripes; stripe++)
+		xxh3_accumulate_512(acc, data + nblocks * XXH_BLOCK_LEN + stripe * XXH_STRIPE_LEN, xxh3_secret + stripe * 8);
+	xxh3_accumulate_512(acc, data + size - XXH_STRIPE_LEN, xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - 7);
+
+	result = size * XXH_PRIME64_1;
+	for (i = 0; i < 4; i++)
+		result += xxh3_mul128_fold64(acc[i * 2] ^ read64(xxh3_secret + 11 + i * 16), acc[i * 2 + 1] ^ read64(xxh3_secret + 11 + i * 16 + 8));
+	return xxh3_avalanche(result);
+}
+
+uint64
+xxh3_64(const byte *data, size_t size)
+{
+	const byte *secret = xxh3_secret;
+	uint64 acc, lo, hi;
+	uint32 combined;
+	size_t i, nrounds;
+
+	if (size == 0)
+		return xxh64_avalanche(read64(secret + 56) ^ read64(secret + 64));
+
+	if (size <= 3)
+	{
+		combined = ((uint32)data[0] << 16) | ((uint32)data[size >> 1] << 24) | data[size - 1] | ((uint32)size << 8);
+		return xxh64_avalanche((uint64)combined ^ (read32(secret) ^ read32(secret + 4)));
+	}
+
+	if (size <= 8)
+	{
+		acc = read32(data + size - 4) + ((uint64)read32(data) << 32);
+		return xxh3_rrmxmx(acc ^ (read64(secret + 8) ^ read64(secret + 16)), size);
+	}
+
+	if (size <= 16)
+	{
+		lo = read64(data) ^ (read64(secret + 24) ^ read64(secret + 32));
+		hi = read64(data + size - 8) ^ (read64(secret + 40) ^ read64(secret + 48));
+		acc = size + swap_endianess64(lo) + hi + xxh3_mul128_fold64(lo, hi);
+		return xxh3_avalanche(acc);
+	}
+
+	if (size <= 128)
+	{
+		acc = size * XXH_PRIME64_1;
+		if (size > 32)
+		{
+			if (size > 64)
+			{
+				if (size > 96)
+				{
+					acc += xxh3_mix16(data + 48, secret + 96);
+					acc += xxh3_mix16(data + size - 64, secret + 112);
+				}
+				acc += xxh3_mix16(data + 32, secret + 64);
+				acc += xxh3_mix16(data + size - 48, secret + 80);
+			}
+			acc += xxh3_mix16(data + 16, secret + 32);
+			acc += xxh3_mix16(data + size - 32, secret + 48);
+		}
+		acc += xxh3_mix16(data, secret);
+		acc += xxh3_mix16(data + size - 16, secret + 16);
+		return xxh3_avalanche(acc);
+	}
+
+	if (size <= 240)
+	{
+		acc = size * XXH_PRIME64_1;
+		for (i = 0; i < 8; i++)
+			acc += xxh3_mix16(data + i * 16, secret + i * 16);
+		acc = xxh3_avalanche(acc);
+
+		nrounds = size / 16;
+		for (i = 8; i < nrounds; i++)
+			acc += xxh3_mix16(data + i * 16, secret + (i - 8) * 16 + 3);
+		acc += xxh3_mix16(data + size - 16, secret + 136 - 17);
+		return xxh3_avalanche(acc);
+	}
+
+	return xxh3_long(data, size);
+}
+
+static void
+init_tables()
+{
+	uint32 crc, crcc, p, pc;
+	int i, j;
+
+	if (tables_ready)
+		return;
+
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		crcc = i;
+		for (j = 0; j < 8; j++)
+		{
+			crc = crc & 1 ? (crc >> 1) ^ CRC32_POLY : crc >> 1;
+			crcc = crcc & 1 ? (crcc >> 1) ^ CRC32C_POLY : crcc >> 1;
+		}
+		crc32_table[0][i] = crc;
+		crc32c_table[0][i] = crcc;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		for (j = 1; j < 8; j++)
+		{
+			crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^ crc32_table[0][crc32_table[j - 1][i] & 0xff];
+			crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+		}
+	}
+
+	// x^1, squared repeatedly
+	p = pc = 1U << 30;
+	crc32_x2n[0] = p;
+	crc32c_x2n[0] = pc;
+	for (i = 1; i < 32; i++)
+	{
+		crc32_x2n[i] = p = multmodp(p, p, CRC32_POLY);
+		crc32c_x2n[i] = pc = multmodp(pc, pc, CRC32C_POLY);
+	}
+
+	tables_ready = 1;
+}
+
+static void
+crc_proc(void *arg)
+{
+	struct crc_job *job = arg;
+
+	if (job->algo == HashCrc32)
+		job->crc = crc32_update(0, job->data, job->size);
+	else
+		job->crc = crc32c_update(0, job->data, job->size);
+}
+
+// Multiply two polynomials modulo a reflected CRC polynomial
+static uint32
+multmodp(uint32 a, uint32 b, uint32 poly)
+{
+	uint32 m, p;
+
+	m = 1U << 31;
+	p = 0;
+	for (;;)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ poly : b >> 1;
+	}
+
+	return p;
+}
+
+// Combine the CRCs of two adjacent blocks into the CRC of both
+static uint32
+crc_combine(int algo, uint32 crc1, uint32 crc2, size_t size2)
+{
+	const uint32 *x2n;
+	uint32 poly, p;
+	int k;
+
+	poly = algo == HashCrc32 ? CRC32_POLY : CRC32C_POLY;
+	x2n = algo == HashCrc32 ? crc32_x2n : crc32c_x2n;
+
+	// x^(8 * size2) mod p
+	p = 1U << 31;
+	for (k = 3; size2; size2 >>= 1, k++)
+	{
+		if (size2 & 1)
+			p = multmodp(x2n[k & 31], p, poly);
+	}
+
+	return multmodp(p, crc1, poly) ^ crc2;
+}
+
+static uint32
+crc32c_update(uint32 crc, const byte *data, size_t size)
+{
+	uint32 hi;
+
+	crc = ~crc;
+
+#if HAVE_SSE2
+	if (cpu_features() & CpuSse42)
+	{
+		crc = crc32c_sse42(crc, data, size);
+		return ~crc;
+	}
+#endif
+
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		crc ^= read32(data);
+		hi = read32(data + 4);
+		crc = crc32c_table[7][crc & 0xff] ^ crc32c_table[6][(crc >> 8) & 0xff] ^
+			crc32c_table[5][(crc >> 16) & 0xff] ^ crc32c_table[4][crc >> 24] ^
+			crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+			crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+	}
+
+	for (; size; data++, size--)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *data) & 0xff];
+
+	return ~crc;
+}
+
+static void
+sha_init(struct sha_ctx *ctx, int algo)
+{
+	static const uint32 sha1_iv[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	static const uint32 sha256_iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	ctx->length = 0;
+	if (algo == HashSha1)
+	{
+		memcpy(ctx->state, sha1_iv, sizeof(sha1_iv));
+		ctx->compress = &sha1_compress;
+#if HAVE_SSE2
+		if ((cpu_features() & (CpuSha | CpuSse41)) == (CpuSha | CpuSse41))
+			ctx->compress = &sha1_compress_ni;
+#endif
+	}
+	else
+	{
+		memcpy(ctx->state, sha256_iv, sizeof(sha256_iv));
+		ctx->compress = &sha256_compress;
+#if HAVE_SSE2
+		if ((cpu_features() & (CpuSha | CpuSse41)) == (CpuSha | CpuSse41))
+			ctx->compress = &sha256_compress_ni;
+#endif
+	}
+}
+
+static void
+sha_update(struct sha_ctx *ctx, const byte *data, size_t size)
+{
+	size_t used, take;
+
+	used = ctx->length % 64;
+	ctx->length += size;
+
+	if (used)
+	{
+		take = 64 - used < size ? 64 - used : size;
+		memcpy(ctx->buffer + used, data, take);
+		data += take;
+		size -= take;
+		if (used + take < 64)
+			return;
+		ctx->compress(ctx->state, ctx->buffer, 1);
+	}
+
+	// whole blocks straight from the input
+	if (size >= 64)
+	{
+		ctx->compress(ctx->state, data, size / 64);
+		data += size & ~(size_t)63;
+		size &= 63;
+	}
+
+	memcpy(ctx->buffer, data, size);
+}
+
+static void
+sha_final(struct sha_ctx *ctx, int words, byte *const digest)
+{
+	byte pad[72];
+	uint64 bits;
+	size_t padlen;
+	int i;
+
+	bits = ctx->length * 8;
+	padlen = 64 - (ctx->length + 8) % 64;
+
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (i = 0; i < 8; i++)
+		pad[padlen + i] = (byte)(bits >> (56 - i * 8));
+	sha_update(ctx, pad, padlen + 8);
+
+	for (i = 0; i < words; i++)
+		write32_be(digest + i * 4, ctx->state[i]);
+}
+
+static void
+sha1_compress(uint32 *state, const byte *blocks, size_t count)
+{
+	uint32 w[80];
+	uint32 a, b, c, d, e, f, k, t;
+	int i;
+
+	for (; count; count--, blocks += 64)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = read32_be(blocks + i * 4);
+		for (i = 16; i < 80; i++)
+			w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		for (i = 0; i < 80; i++)
+		{
+			if (i < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			}
+			else if (i < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			}
+			else if (i < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+
+			t = rotl32(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = rotl32(b, 30);
+			b = a;
+			a = t;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+static void
+sha256_compress(uint32 *state, const byte *blocks, size_t count)
+{
+	uint32 w[64];
+	uint32 s[8];
+	uint32 s0, s1, ch, maj, t1, t2;
+	int i;
+
+	for (; count; count--, blocks += 64)
+	{
+		for (i = 0; i < 16; i++)
+			w[i] = read32_be(blocks + i * 4);
+		for (i = 16; i < 64; i++)
+		{
+			s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		memcpy(s, state, sizeof(s));
+
+		for (i = 0; i < 64; i++)
+		{
+			s1 = rotr32(s[4], 6) ^ rotr32(s[4], 11) ^ rotr32(s[4], 25);
+			ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+			t1 = s[7] + s1 + ch + sha256_k[i] + w[i];
+			s0 = rotr32(s[0], 2) ^ rotr32(s[0], 13) ^ rotr32(s[0], 22);
+			maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+			t2 = s0 + maj;
+
+			s[7] = s[6];
+			s[6] = s[5];
+			s[5] = s[4];
+			s[4] = s[3] + t1;
+			s[3] = s[2];
+			s[2] = s[1];
+			s[1] = s[0];
+			s[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			state[i] += s[i];
+	}
+}
+
+#if HAVE_SSE2
+
+// Fold 64 bytes at a time with carry-less multiplies, size must be a
+// multiple of 16 and at least 64. crc is not inverted here.
+TARGET("sse4.1,pclmul")
+static uint32
+crc32_clmul(uint32 crc, const byte *data, size_t size)
+{
+	static const uint64 k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64 k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64 k5k0[2] = { 0x0163cd6124ULL, 0 };
+	static const uint64 poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	x0 = _mm_loadu_si128((const __m128i *)k1k2);
+
+	data += 64;
+	size -= 64;
+
+	// four lanes in parallel
+	while (size >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		data += 64;
+		size -= 64;
+	}
+
+	// fold the four lanes into one
+	x0 = _mm_loadu_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (size >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i *)data);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		data += 16;
+		size -= 16;
+	}
+
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_loadu_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32)_mm_extract_epi32(x1, 1);
+}
+
+// crc is not inverted here
+TARGET("sse4.2")
+static uint32
+crc32c_sse42(uint32 crc, const byte *data, size_t size)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64 crc64 = crc;
+
+	for (; size >= 8; data += 8, size -= 8)
+		crc64 = _mm_crc32_u64(crc64, read64(data));
+	crc = (uint32)crc64;
+#endif
+
+	for (; size >= 4; data += 4, size -= 4)
+		crc = _mm_crc32_u32(crc, read32(data));
+
+	for (; size; data++, size--)
+		crc = _mm_crc32_u8(crc, *data);
+
+	return crc;
+}
+
+TARGET("sse4.1,sha")
+static void
+sha1_compress_ni(uint32 *state, const byte *blocks, size_t count)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e1, e0_save;
+	__m128i msg[4];
+	int g;
+
+	abcd = _mm_loadu_si128((const __m128i *)state);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+	for (; count; count--, blocks += 64)
+	{
+		abcd_save = abcd;
+		e0_save = e0;
+		e1 = e0;
+
+		// 20 groups of 4 rounds, the schedule runs ahead in msg
+		for (g = 0; g < 20; g++)
+		{
+			if (g < 4)
+				msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + g * 16)), mask);
+
+			if (g == 0)
+			{
+				e0 = _mm_add_epi32(e0, msg[0]);
+				e1 = abcd;
+			}
+			else if (g & 1)
+			{
+				e1 = _mm_sha1nexte_epu32(e1, msg[g & 3]);
+				e0 = abcd;
+			}
+			else
+			{
+				e0 = _mm_sha1nexte_epu32(e0, msg[g & 3]);
+				e1 = abcd;
+			}
+
+			if (g >= 3 && g <= 18)
+				msg[(g + 1) & 3] = _mm_sha1msg2_epu32(msg[(g + 1) & 3], msg[g & 3]);
+
+			switch (g / 5)
+			{
+			case 0: abcd = _mm_sha1rnds4_epu32(abcd, g & 1 ? e1 : e0, 0); break;
+			case 1: abcd = _mm_sha1rnds4_epu32(abcd, g & 1 ? e1 : e0, 1); break;
+			case 2: abcd = _mm_sha1rnds4_epu32(abcd, g & 1 ? e1 : e0, 2); break;
+			default: abcd = _mm_sha1rnds4_epu32(abcd, g & 1 ? e1 : e0, 3); break;
+			}
+
+			if (g >= 1 && g <= 16)
+				msg[(g + 3) & 3] = _mm_sha1msg1_epu32(msg[(g + 3) & 3], msg[g & 3]);
+			if (g >= 2 && g <= 17)
+				msg[(g + 2) & 3] = _mm_xor_si128(msg[(g + 2) & 3], msg[g & 3]);
+		}
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *)state, abcd);
+	state[4] = (uint32)_mm_extract_epi32(e0, 3);
+}
+
+TARGET("sse4.1,sha")
+static void
+sha256_compress_ni(uint32 *state, const byte *blocks, size_t count)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef_save, cdgh_save;
+	__m128i m, tmp;
+	__m128i msg[4];
+	int g;
+
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+	state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);           // CDAB
+	state1 = _mm_shuffle_epi32(state1, 0x1b);     // EFGH
+	state0 = _mm_alignr_epi8(tmp, state1, 8);     // ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);  // CDGH
+
+	for (; count; count--, blocks += 64)
+	{
+		abef_save = state0;
+		cdgh_save = state1;
+
+		// 16 groups of 4 rounds, the schedule runs ahead in msg
+		for (g = 0; g < 16; g++)
+		{
+			if (g < 4)
+				msg[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + g * 16)), mask);
+
+			m = _mm_add_epi32(msg[g & 3], _mm_loadu_si128((const __m128i *)&sha256_k[g * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+
+			if (g >= 3 && g <= 14)
+			{
+				tmp = _mm_alignr_epi8(msg[g & 3], msg[(g + 3) & 3], 4);
+				msg[(g + 1) & 3] = _mm_add_epi32(msg[(g + 1) & 3], tmp);
+				msg[(g + 1) & 3] = _mm_sha256msg2_epu32(msg[(g + 1) & 3], msg[g & 3]);
+			}
+
+			m = _mm_shuffle_epi32(m, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+
+			if (g >= 1 && g <= 12)
+				msg[(g + 3) & 3] = _mm_sha256msg1_epu32(msg[(g + 3) & 3], msg[g & 3]);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);        // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xb1);     // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);  // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);     // ABEF
+
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+#endif
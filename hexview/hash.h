@@ -0,0 +1,64 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+#include "defs.h"
+
+#define MAX_DIGEST_SIZE 32
+
+enum
+{
+	HashCrc32,
+	HashCrc32c,
+	HashXxh3,
+	HashSha1,
+	HashSha256,
+	HashCount
+};
+
+// Find a hash algorithm by name, such as "crc32" or "sha256".
+// Parameters:
+// - name: The name of the algorithm, case-insensitive.
+//
+// Returns:
+// The algorithm, or -1 if there is no such algorithm.
+int hash_find(const char *name);
+
+// Returns the name of a hash algorithm.
+const char *hash_name(int algo);
+
+// Returns the size of the digest a hash algorithm produces in bytes.
+unsigned int hash_digest_size(int algo);
+
+// Hash a block of memory. Algorithms which can be split, such as the
+// CRCs, are computed in parallel blocks and combined. Digests are
+// written in their conventional byte order, so CRCs are big endian.
+// Parameters:
+// - algo: The algorithm to use.
+// - data: The data to hash.
+// - size: The number of bytes data points to.
+// - digest: Output parameter which will contain the digest, must be
+//           at least hash_digest_size(algo) bytes.
+void hash_data(int algo, const byte *data, size_t size, byte *const digest);
+
+// Update a CRC-32 (ISO-HDLC, as used by zip and gzip).
+// Parameters:
+// - crc: The CRC of the preceding data, 0 to begin.
+// - data: The data to append.
+// - size: The number of bytes data points to.
+//
+// Returns:
+// The CRC of the preceding data followed by data.
+uint32 crc32_update(uint32 crc, const byte *data, size_t size);
+
+// Compute the 64-bit XXH3 hash of a block of memory, with a seed of 0.
+// Parameters:
+// - data: The data to hash.
+// - size: The number of bytes data points to.
+//
+// Returns:
+// The hash.
+uint64 xxh3_64(const byte *data, size_t size);
+
+#endif
@@ -0,0 +1,543 @@
+#include "inflate.h"
+
+#include <string.h>
+
+#define MAX_MATCH 258
+
+static const uint16 length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const byte length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16 distance_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const byte distance_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// order the lengths of the code length code are stored in
+static const byte code_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static int need(inflate_t *st, unsigned int n);
+static unsigned int take(inflate_t *st, unsigned int n);
+static int build(huffman_t *h, const byte *lengths, unsigned int n);
+static int decode(inflate_t *st, const huffman_t *h);
+static int read_member(inflate_t *st);
+static int read_header(inflate_t *st);
+static int read_tables(inflate_t *st);
+static int end_member(inflate_t *st);
+static void codes(inflate_t *st);
+
+int
+inflate_is_gzip(const byte *data, unsigned int size)
+{
+	return size >= 18 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8;
+}
+
+void
+inflate_begin(inflate_t *st, const byte *in, uint64 size)
+{
+	st->in = in;
+	st->in_size = size;
+	st->in_pos = 0;
+	st->bits = 0;
+	st->nbits = 0;
+	st->last = 0;
+	st->stored = 0;
+	st->out = 0;
+	st->pos = 0;
+	st->state = read_member(st) ? InflateHeader : InflateError;
+}
+
+void
+inflate_resume(inflate_t *st, const byte *in, uint64 size, uint64 bit, uint64 out, const byte *window)
+{
+	st->in = in;
+	st->in_size = size;
+	st->in_pos = bit / 8;
+	st->bits = 0;
+	st->nbits = 0;
+	st->last = 0;
+	st->stored = 0;
+	st->out = out;
+	st->pos = out < INFLATE_WINDOW ? (unsigned int)out : INFLATE_WINDOW;
+	memcpy(st->buffer, window, st->pos);
+
+	st->state = InflateHeader;
+	if (bit % 8)
+	{
+		if (need(st, 8))
+			take(st, bit % 8);
+		else
+			st->state = InflateError;
+	}
+}
+
+uint64
+inflate_bit(const inflate_t *st)
+{
+	return st->in_pos * 8 - st->nbits;
+}
+
+int
+inflate_step(inflate_t *st)
+{
+	unsigned int n;
+
+	if (st->state == InflateEnd || st->state == InflateError)
+		return st->state;
+
+	// keep only the window when half the buffer is used
+	if (st->pos > INFLATE_BUFFER / 2)
+	{
+		memmove(st->buffer, st->buffer + st->pos - INFLATE_WINDOW, INFLATE_WINDOW);
+		st->pos = INFLATE_WINDOW;
+	}
+
+	if (st->state == InflateHeader)
+	{
+		if (!read_header(st))
+			return st->state = InflateError;
+		if (st->state != InflateStored && st->state != InflateCodes)
+			return st->state;
+	}
+
+	if (st->state == InflateStored)
+	{
+		// whole bytes still in bits come first, then straight from the input
+		n = INFLATE_BUFFER - st->pos < st->stored ? INFLATE_BUFFER - st->pos : st->stored;
+		while (n && st->nbits)
+		{
+			st->buffer[st->pos++] = (byte)take(st, 8);
+			st->stored--;
+			st->out++;
+			n--;
+		}
+
+		if (n > st->in_size - st->in_pos)
+			return st->state = InflateError;
+
+		// bits loaded ahead are of the input skipped here
+		if (n)
+			st->bits = 0;
+		memcpy(st->buffer + st->pos, st->in + st->in_pos, n);
+		st->in_pos += n;
+		st->pos += n;
+		st->out += n;
+		st->stored -= n;
+
+		if (!st->stored)
+			st->state = st->last ? end_member(st) : InflateHeader;
+		return st->state;
+	}
+
+	codes(st);
+	return st->state;
+}
+
+// Load bits until at least n are available. Returns 0 if the input ends
+// first.
+static int
+need(inflate_t *st, unsigned int n)
+{
+	uint64 word;
+
+	if (st->nbits >= n)
+		return 1;
+
+	// whole bytes up to 56 bits at once while 8 bytes of input remain, the
+	// bits loaded past them are the same bytes the next load adds again
+	if (NATIVE_ENDIANESS == LittleEndian && st->in_size - st->in_pos >= 8)
+	{
+		memcpy(&word, st->in + st->in_pos, 8);
+		st->bits |= word << st->nbits;
+		st->in_pos += (63 - st->nbits) >> 3;
+		st->nbits |= 56;
+		return 1;
+	}
+
+	while (st->nbits < n)
+	{
+		if (st->in_pos >= st->in_size)
+			return 0;
+		st->bits |= (uint64)st->in[st->in_pos++] << st->nbits;
+		st->nbits += 8;
+	}
+
+	return 1;
+}
+
+static unsigned int
+take(inflate_t *st, unsigned int n)
+{
+	unsigned int value;
+
+	value = (unsigned int)(st->bits & (((uint64)1 << n) - 1));
+	st->bits >>= n;
+	st->nbits -= n;
+	return value;
+}
+
+// Build the decoding tables of a canonical Huffman code from the length
+// of the code of each symbol. Returns 0 if the lengths are over
+// subscribed. Incomplete codes are allowed, a missing code is reported
+// when it is decoded.
+static int
+build(huffman_t *h, const byte *lengths, unsigned int n)
+{
+	uint16 offs[16], next[16];
+	unsigned int sym, len, code, rev, i;
+	int left;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (sym = 0; sym < n; sym++)
+		h->count[lengths[sym]]++;
+
+	left = 1;
+	for (len = 1; len < 16; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+		if (left < 0)
+			return 0;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (sym = 0; sym < n; sym++)
+	{
+		if (lengths[sym])
+			h->symbol[offs[lengths[sym]]++] = (uint16)sym;
+	}
+
+	// codes are sent from their most significant bit, so short codes are
+	// looked up reversed, repeated for every value of the bits after them
+	memset(h->fast, 0, sizeof(h->fast));
+	code = 0;
+	h->count[0] = 0;
+	for (len = 1; len < 16; len++)
+	{
+		code = (code + h->count[len - 1]) << 1;
+		next[len] = (uint16)code;
+	}
+
+	for (sym = 0; sym < n; sym++)
+	{
+		len = lengths[sym];
+		if (!len)
+			continue;
+
+		code = next[len]++;
+		if (len > INFLATE_FAST_BITS)
+			continue;
+
+		for (rev = 0, i = 0; i < len; i++)
+			rev |= ((code >> i) & 1) << (len - 1 - i);
+		for (i = rev; i < 1u << INFLATE_FAST_BITS; i += 1u << len)
+			h->fast[i] = (uint16)(sym << 4 | len);
+	}
+
+	return 1;
+}
+
+// Decode a symbol. Returns -1 if the input ends or the code is missing.
+static int
+decode(inflate_t *st, const huffman_t *h)
+{
+	unsigned int entry, len, code, first, index, count;
+
+	need(st, 15);
+	entry = h->fast[st->bits & ((1 << INFLATE_FAST_BITS) - 1)];
+	if (entry)
+	{
+		if ((entry & 15) > st->nbits)
+			return -1;
+		take(st, entry & 15);
+		return entry >> 4;
+	}
+
+	// longer codes a bit at a time, counting the codes of each length
+	code = first = index = 0;
+	for (len = 1; len < 16; len++)
+	{
+		if (!need(st, 1))
+			return -1;
+		code |= take(st, 1);
+		count = h->count[len];
+		if (code - first < count)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+// Read the header of a gzip member. Returns 0 if it is not one.
+static int
+read_member(inflate_t *st)
+{
+	unsigned int flags, len;
+
+	if (!need(st, 24) || take(st, 8) != 0x1f || take(st, 8) != 0x8b || take(st, 8) != 8)
+		return 0;
+	if (!need(st, 8))
+		return 0;
+	flags = take(st, 8);
+
+	// modification time, extra flags and system
+	for (len = 0; len < 6; len++)
+	{
+		if (!need(st, 8))
+			return 0;
+		take(st, 8);
+	}
+
+	if (flags & 4)
+	{
+		if (!need(st, 16))
+			return 0;
+		for (len = take(st, 16); len; len--)
+		{
+			if (!need(st, 8))
+				return 0;
+			take(st, 8);
+		}
+	}
+
+	// file name and comment, null terminated
+	for (len = 8; len <= 16; len += 8)
+	{
+		if (!(flags & len))
+			continue;
+		do
+		{
+			if (!need(st, 8))
+				return 0;
+		} while (take(st, 8));
+	}
+
+	if (flags & 2)
+	{
+		if (!need(st, 16))
+			return 0;
+		take(st, 16);
+	}
+
+	return 1;
+}
+
+// Read the header of a block. Returns 0 if it is malformed.
+static int
+read_header(inflate_t *st)
+{
+	byte lengths[288];
+	unsigned int type, len;
+
+	if (!need(st, 3))
+		return 0;
+	st->last = take(st, 1);
+	type = take(st, 2);
+
+	switch (type)
+	{
+	case 0:
+		take(st, st->nbits % 8);
+		if (!need(st, 32))
+			return 0;
+		len = take(st, 16);
+		if (take(st, 16) != (~len & 0xffff))
+			return 0;
+		st->stored = len;
+		st->state = InflateStored;
+		if (!len)
+			st->state = st->last ? end_member(st) : InflateHeader;
+		return 1;
+	case 1:
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		build(&st->lengths, lengths, 288);
+		memset(lengths, 5, 30);
+		build(&st->distances, lengths, 30);
+		st->state = InflateCodes;
+		return 1;
+	case 2:
+		if (!read_tables(st))
+			return 0;
+		st->state = InflateCodes;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Read the code lengths of a dynamic block. Returns 0 if they are
+// malformed.
+static int
+read_tables(inflate_t *st)
+{
+	byte lengths[320];
+	huffman_t *code;
+	unsigned int nlen, ndist, ncode, index, repeat, i;
+	int sym;
+
+	if (!need(st, 14))
+		return 0;
+	nlen = take(st, 5) + 257;
+	ndist = take(st, 5) + 1;
+	ncode = take(st, 4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return 0;
+
+	memset(lengths, 0, 19);
+	for (i = 0; i < ncode; i++)
+	{
+		if (!need(st, 3))
+			return 0;
+		lengths[code_order[i]] = (byte)take(st, 3);
+	}
+
+	// the distance table is free until the lengths are read
+	code = &st->distances;
+	if (!build(code, lengths, 19))
+		return 0;
+
+	for (index = 0; index < nlen + ndist;)
+	{
+		sym = decode(st, code);
+		if (sym < 0)
+			return 0;
+
+		if (sym < 16)
+		{
+			lengths[index++] = (byte)sym;
+			continue;
+		}
+
+		if (sym == 16)
+		{
+			if (!index || !need(st, 2))
+				return 0;
+			sym = lengths[index - 1];
+			repeat = 3 + take(st, 2);
+		}
+		else
+		{
+			if (!need(st, sym == 17 ? 3 : 7))
+				return 0;
+			repeat = sym == 17 ? 3 + take(st, 3) : 11 + take(st, 7);
+			sym = 0;
+		}
+
+		if (index + repeat > nlen + ndist)
+			return 0;
+		while (repeat--)
+			lengths[index++] = (byte)sym;
+	}
+
+	// a block without an end of block code could never end
+	if (!lengths[256])
+		return 0;
+
+	return build(&st->lengths, lengths, nlen) && build(&st->distances, lengths + nlen, ndist);
+}
+
+// Skip the trailer after the last block of a member and the header of
+// the next member if there is one. Returns the new state.
+static int
+end_member(inflate_t *st)
+{
+	// the crc and size of the member are not checked
+	take(st, st->nbits % 8);
+	if (!need(st, 32))
+		return InflateEnd;
+	take(st, 32);
+	if (!need(st, 32))
+		return InflateEnd;
+	take(st, 32);
+
+	// members can simply be concatenated, as pigz and bgzip write them
+	if (!need(st, 16) || (st->bits & 0xffff) != 0x8b1f)
+		return InflateEnd;
+
+	return read_member(st) ? InflateHeader : InflateError;
+}
+
+// Decode the symbols of a compressed block until it ends or the buffer
+// has no room for another match
+static void
+codes(inflate_t *st)
+{
+	byte *out;
+	const byte *from;
+	unsigned int len, dist, i;
+	int sym;
+
+	while (st->pos <= INFLATE_BUFFER - MAX_MATCH)
+	{
+		sym = decode(st, &st->lengths);
+		if (sym < 256)
+		{
+			if (sym < 0)
+			{
+				st->state = InflateError;
+				return;
+			}
+			st->buffer[st->pos++] = (byte)sym;
+			st->out++;
+			continue;
+		}
+
+		if (sym == 256)
+		{
+			st->state = st->last ? end_member(st) : InflateHeader;
+			return;
+		}
+
+		sym -= 257;
+		if (sym >= 29 || !need(st, length_extra[sym]))
+		{
+			st->state = InflateError;
+			return;
+		}
+		len = length_base[sym] + take(st, length_extra[sym]);
+
+		sym = decode(st, &st->distances);
+		if (sym < 0 || sym >= 30 || !need(st, distance_extra[sym]))
+		{
+			st->state = InflateError;
+			return;
+		}
+		dist = distance_base[sym] + take(st, distance_extra[sym]);
+		if (dist > st->pos)
+		{
+			st->state = InflateError;
+			return;
+		}
+
+		// overlapping matches repeat the bytes they copy
+		out = st->buffer + st->pos;
+		from = out - dist;
+		if (dist >= len)
+			memcpy(out, from, len);
+		else
+		{
+			for (i = 0; i < len; i++)
+				out[i] = from[i];
+		}
+		st->pos += len;
+		st->out += len;
+	}
+}
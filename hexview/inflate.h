@@ -0,0 +1,86 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include "defs.h"
+
+#define INFLATE_WINDOW 32768    // farthest back a match can refer to
+#define INFLATE_BUFFER 262144   // output kept, the window and what follows it
+#define INFLATE_FAST_BITS 10    // codes up to this long are decoded with one lookup
+
+enum
+{
+	InflateHeader,  // at the start of a block
+	InflateStored,  // in a stored block
+	InflateCodes,   // in a compressed block
+	InflateEnd,     // past the end of the last gzip member
+	InflateError    // the data is malformed or truncated
+};
+
+typedef struct huffman_s huffman_t;
+struct huffman_s
+{
+	uint16 count[16];   // number of codes of each length
+	uint16 symbol[288]; // symbols ordered by code
+	uint16 fast[1 << INFLATE_FAST_BITS];  // symbol << 4 | length, 0 for longer codes
+};
+
+// The state of a decoder of gzip streams, which can be stopped at any
+// block and resumed later from its position in the input and the last
+// INFLATE_WINDOW bytes of output. It allocates nothing, so it can be
+// used where allocating is not allowed.
+typedef struct inflate_s inflate_t;
+struct inflate_s
+{
+	const byte *in;
+	uint64 in_size;
+	uint64 in_pos;      // next byte of in to load into bits
+	uint64 bits;
+	unsigned int nbits;
+
+	int state;          // InflateHeader to InflateError.
+	int last;           // the current block is the last of its member
+	unsigned int stored;  // bytes left in a stored block
+	huffman_t lengths;
+	huffman_t distances;
+
+	uint64 out;         // Bytes of output produced so far.
+	unsigned int pos;   // Bytes of output in buffer, the last at buffer[pos - 1].
+	byte buffer[INFLATE_BUFFER];
+};
+
+// Returns nonzero if data starts with a gzip header.
+int inflate_is_gzip(const byte *data, unsigned int size);
+
+// Start decoding a gzip stream of one or more members at its start.
+// Parameters:
+// - st: The decoder.
+// - in: The compressed data.
+// - size: The size of the compressed data.
+void inflate_begin(inflate_t *st, const byte *in, uint64 size);
+
+// Resume decoding at the start of a block.
+// Parameters:
+// - st: The decoder.
+// - in: The compressed data.
+// - size: The size of the compressed data.
+// - bit: The position of the block in bits from the start of in.
+// - out: The number of bytes of output before the block.
+// - window: The last INFLATE_WINDOW bytes of output before the block,
+//           or fewer if out is smaller.
+void inflate_resume(inflate_t *st, const byte *in, uint64 size, uint64 bit, uint64 out, const byte *window);
+
+// Returns the position of the decoder in bits from the start of the
+// input.
+uint64 inflate_bit(const inflate_t *st);
+
+// Decode until the end of the current block or until the buffer is full.
+// When the buffer is full, all but the last INFLATE_WINDOW bytes are
+// dropped first, so st->buffer[0, st->pos) always holds the last output.
+// Parameters:
+// - st: The decoder.
+//
+// Returns:
+// The state after decoding, InflateHeader at the start of a block.
+int inflate_step(inflate_t *st);
+
+#endif
@@ -0,0 +1,568 @@
+#include "journal.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hash.h"
+#include "sidecar.h"
+
+#if _WIN32
+#include <Windows.h>
+#elif __linux__ || __APPLE__
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define JOURNAL_MAGIC "HVWL"
+#define JOURNAL_VERSION 1
+#define LOG_BUFFER 1048576  // bytes of records gathered before they are written
+#define MIN_OPS 64
+#define MIN_BYTES 4096
+
+struct journal_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;   // size of the file when the log was started
+	uint32 unused;
+	uint64 mtime;  // modification time of the file when the log was started
+};
+
+// A record of the log, followed by the old and new bytes of an edit
+struct log_record
+{
+	uint32 kind;
+	uint32 offset;
+	uint32 old_size;
+	uint32 new_size;
+	uint32 group;
+	uint32 check;  // hash of the record and its bytes, to find one not written whole
+};
+
+enum
+{
+	LogEdit = 1,
+	LogUndo,
+	LogRedo,
+	LogPatch,
+	LogRename
+};
+
+struct journal_log
+{
+#if _WIN32
+	HANDLE file;
+#elif __linux__ || __APPLE__
+	int file;
+#endif
+	byte *buffer;
+	unsigned int buffered;
+};
+
+static int push_op(journal_t *journal, unsigned int off, unsigned int old_size, unsigned int new_size, unsigned int group);
+static int undo_group(journal_t *journal, unsigned int *const first, unsigned int *const last);
+static int redo_group(journal_t *journal, unsigned int *const first, unsigned int *const last);
+static uint32 record_check(const struct log_record *record, const byte *data);
+static int append_record(journal_t *journal, int kind, const journal_op_t *op);
+static int write_log(struct journal_log *log, const byte *data, size_t size);
+static int flush_log(struct journal_log *log);
+static struct journal_log *open_log(const char *path, size_t keep);
+static void close_log(struct journal_log *log);
+
+journal_t *
+journal_create()
+{
+	return calloc(1, sizeof(journal_t));
+}
+
+int
+journal_log(journal_t *journal, const char *path, unsigned int size, uint64 mtime)
+{
+	struct journal_header header;
+
+	journal->log = open_log(path, 0);
+	if (!journal->log)
+		return 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.version = JOURNAL_VERSION;
+	header.size = size;
+	header.mtime = mtime;
+	if (!write_log(journal->log, (const byte *)&header, sizeof(header)) || !flush_log(journal->log))
+	{
+		close_log(journal->log);
+		journal->log = NULL;
+		return 0;
+	}
+
+	return 1;
+}
+
+journal_t *
+journal_open(const char *path, unsigned int size, uint64 mtime, int *const status)
+{
+	sidecar_t *sidecar;
+	journal_t *journal;
+	const struct journal_header *header;
+	struct log_record record;
+	size_t pos, data;
+	unsigned int first, last;
+	int mark, same;
+
+	*status = JournalNone;
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	header = (const struct journal_header *)sidecar->data;
+	if (sidecar->size < sizeof(struct journal_header) ||
+		memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) || header->version != JOURNAL_VERSION)
+	{
+		sidecar_close(sidecar);
+		*status = JournalStale;
+		remove(path);
+		return NULL;
+	}
+
+	journal = journal_create();
+	if (!journal)
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	// the records up to the first which was not written whole, the end of
+	// the session or a crash in the middle of writing it
+	mark = 0;
+	pos = sizeof(struct journal_header);
+	while (sidecar->size - pos >= sizeof(struct log_record))
+	{
+		memcpy(&record, sidecar->data + pos, sizeof(record));
+		data = (size_t)record.old_size + record.new_size;
+		if (sidecar->size - pos - sizeof(record) < data || record_check(&record, sidecar->data + pos + sizeof(record)) != record.check)
+			break;
+
+		if (record.kind == LogEdit)
+		{
+			if (!push_op(journal, record.offset, record.old_size, record.new_size, record.group))
+			{
+				journal_close(journal);
+				sidecar_close(sidecar);
+				return NULL;
+			}
+			memcpy(journal->bytes + journal->ops[journal->count - 1].data, sidecar->data + pos + sizeof(record), data);
+			if (record.group >= journal->group)
+				journal->group = record.group + 1;
+		}
+		else if (record.kind == LogUndo)
+			undo_group(journal, &first, &last);
+		else if (record.kind == LogRedo)
+			redo_group(journal, &first, &last);
+		else if (record.kind == LogPatch || record.kind == LogRename)
+			mark = record.kind;
+		else
+			break;
+
+		pos += sizeof(record) + data;
+	}
+
+	same = header->size == size && header->mtime == mtime;
+	sidecar_close(sidecar);
+	journal->logged = journal->count;
+
+	// a file changed since the log was started was changed by the save
+	// marked last, or by something else and the edits no longer apply
+	if (!same && mark == LogRename)
+		*status = JournalSaved;
+	else if (!same && mark == LogPatch)
+		*status = JournalInterrupted;
+	else if (!same)
+		*status = JournalStale;
+	else if (journal->done)
+		*status = JournalPending;
+
+	if (*status == JournalPending || *status == JournalInterrupted)
+	{
+		// a record cut short is dropped before the next is appended
+		journal->log = open_log(path, pos);
+		return journal;
+	}
+
+	// nothing is left to do with the log
+	journal_close(journal);
+	remove(path);
+	return NULL;
+}
+
+void
+journal_close(journal_t *journal)
+{
+	if (!journal) return;
+	close_log(journal->log);
+	free(journal->ops);
+	free(journal->bytes);
+	free(journal);
+}
+
+void
+journal_group(journal_t *journal)
+{
+	journal->group++;
+}
+
+int
+journal_add(journal_t *journal, unsigned int off, unsigned int old_size, file_fill_fn read, void *arg, const byte *bytes, unsigned int new_size)
+{
+	journal_op_t *op;
+
+	if (!push_op(journal, off, old_size, new_size, journal->group))
+		return 0;
+
+	op = &journal->ops[journal->count - 1];
+	read(arg, off, journal->bytes + op->data, old_size);
+	if (new_size)
+		memcpy(journal->bytes + op->data + old_size, bytes, new_size);
+	return 1;
+}
+
+void
+journal_cancel(journal_t *journal)
+{
+	journal->count--;
+	journal->done = journal->count;
+	journal->used = journal->ops[journal->count].data;
+}
+
+int
+journal_flush(journal_t *journal)
+{
+	if (!journal->log)
+	{
+		journal->logged = journal->count;
+		return 1;
+	}
+
+	for (; journal->logged < journal->count; journal->logged++)
+	{
+		if (!append_record(journal, LogEdit, &journal->ops[journal->logged]))
+			return 0;
+	}
+
+	return flush_log(journal->log);
+}
+
+int
+journal_undo(journal_t *journal, unsigned int *const first, unsigned int *const last)
+{
+	if (!undo_group(journal, first, last))
+		return 0;
+
+	// the undo is kept even if it is not logged, the log only loses it
+	if (journal->log && append_record(journal, LogUndo, NULL))
+		flush_log(journal->log);
+	return 1;
+}
+
+int
+journal_redo(journal_t *journal, unsigned int *const first, unsigned int *const last)
+{
+	if (!redo_group(journal, first, last))
+		return 0;
+
+	if (journal->log && append_record(journal, LogRedo, NULL))
+		flush_log(journal->log);
+	return 1;
+}
+
+int
+journal_mark(journal_t *journal, int kind)
+{
+	if (!journal->log)
+		return 1;
+	return append_record(journal, kind == JournalPatch ? LogPatch : LogRename, NULL) && flush_log(journal->log);
+}
+
+const byte *
+journal_bytes(const journal_t *journal, const journal_op_t *op)
+{
+	return journal->bytes + op->data;
+}
+
+// Add an edit with room for its bytes after those done, dropping the
+// edits which were undone. Returns 0 if memory could not be allocated.
+static int
+push_op(journal_t *journal, unsigned int off, unsigned int old_size, unsigned int new_size, unsigned int group)
+{
+	journal_op_t *grown_ops;
+	byte *grown;
+	size_t reserved, data;
+
+	if (journal->done < journal->count)
+	{
+		journal->used = journal->ops[journal->done].data;
+		journal->count = journal->done;
+		if (journal->logged > journal->count)
+			journal->logged = journal->count;
+	}
+
+	if (journal->count == journal->capacity)
+	{
+		if (journal->capacity > 0x7fffffff / sizeof(journal_op_t))
+			return 0;
+		grown_ops = realloc(journal->ops, (size_t)(journal->capacity ? journal->capacity * 2 : MIN_OPS) * sizeof(journal_op_t));
+		if (!grown_ops)
+			return 0;
+		journal->ops = grown_ops;
+		journal->capacity = journal->capacity ? journal->capacity * 2 : MIN_OPS;
+	}
+
+	data = (size_t)old_size + new_size;
+	if (data > journal->reserved - journal->used)
+	{
+		reserved = journal->reserved ? journal->reserved : MIN_BYTES;
+		while (reserved - journal->used < data)
+		{
+			if (reserved > (size_t)-1 / 2)
+				return 0;
+			reserved *= 2;
+		}
+
+		grown = realloc(journal->bytes, reserved);
+		if (!grown)
+			return 0;
+		journal->bytes = grown;
+		journal->reserved = reserved;
+	}
+
+	journal->ops[journal->count].offset = off;
+	journal->ops[journal->count].old_size = old_size;
+	journal->ops[journal->count].new_size = new_size;
+	journal->ops[journal->count].group = group;
+	journal->ops[journal->count].data = journal->used;
+	journal->used += data;
+	journal->count++;
+	journal->done = journal->count;
+	return 1;
+}
+
+static int
+undo_group(journal_t *journal, unsigned int *const first, unsigned int *const last)
+{
+	unsigned int group;
+
+	if (!journal->done)
+		return 0;
+
+	*last = journal->done;
+	group = journal->ops[journal->done - 1].group;
+	while (journal->done && journal->ops[journal->done - 1].group == group)
+		journal->done--;
+	*first = journal->done;
+	return 1;
+}
+
+static int
+redo_group(journal_t *journal, unsigned int *const first, unsigned int *const last)
+{
+	unsigned int group;
+
+	if (journal->done == journal->count)
+		return 0;
+
+	*first = journal->done;
+	group = journal->ops[journal->done].group;
+	while (journal->done < journal->count && journal->ops[journal->done].group == group)
+		journal->done++;
+	*last = journal->done;
+	return 1;
+}
+
+static uint32
+record_check(const struct log_record *record, const byte *data)
+{
+	struct log_record copy;
+
+	copy = *record;
+	copy.check = 0;
+	return (uint32)(xxh3_64((const byte *)&copy, sizeof(copy)) ^ xxh3_64(data, (size_t)copy.old_size + copy.new_size));
+}
+
+// Append a record to the log, with the bytes of an edit. Returns 0 if
+// it could not be written.
+static int
+append_record(journal_t *journal, int kind, const journal_op_t *op)
+{
+	struct log_record record;
+	const byte *data;
+
+	memset(&record, 0, sizeof(record));
+	record.kind = kind;
+	data = NULL;
+	if (op)
+	{
+		record.offset = op->offset;
+		record.old_size = op->old_size;
+		record.new_size = op->new_size;
+		record.group = op->group;
+		data = journal->bytes + op->data;
+	}
+	record.check = record_check(&record, data);
+
+	return write_log(journal->log, (const byte *)&record, sizeof(record)) &&
+		write_log(journal->log, data, (size_t)record.old_size + record.new_size);
+}
+
+// Gather bytes to write to the log, writing them when the buffer is
+// full. Returns 0 if they could not be written.
+static int
+write_log(struct journal_log *log, const byte *data, size_t size)
+{
+	unsigned int block;
+#if _WIN32
+	DWORD written;
+#elif __linux__ || __APPLE__
+	ssize_t written;
+#endif
+
+	// what fits is gathered, the rest goes straight to the file
+	if (size <= LOG_BUFFER - log->buffered)
+	{
+		if (size)
+			memcpy(log->buffer + log->buffered, data, size);
+		log->buffered += (unsigned int)size;
+		return 1;
+	}
+
+	if (!flush_log(log))
+		return 0;
+	if (size <= LOG_BUFFER)
+		return write_log(log, data, size);
+
+	while (size)
+	{
+		block = size < LOG_BUFFER ? (unsigned int)size : LOG_BUFFER;
+#if _WIN32
+		if (!WriteFile(log->file, data, block, &written, NULL) || !written)
+			return 0;
+		block = written;
+#elif __linux__ || __APPLE__
+		written = write(log->file, data, block);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+		block = (unsigned int)written;
+#endif
+		data += block;
+		size -= block;
+	}
+
+	return 1;
+}
+
+// Write the bytes gathered and wait until the log is on disk. Returns 0
+// if they could not be written.
+static int
+flush_log(struct journal_log *log)
+{
+	const byte *data;
+	unsigned int left;
+#if _WIN32
+	DWORD written;
+#elif __linux__ || __APPLE__
+	ssize_t written;
+#endif
+
+	data = log->buffer;
+	left = log->buffered;
+	log->buffered = 0;
+	while (left)
+	{
+#if _WIN32
+		if (!WriteFile(log->file, data, left, &written, NULL) || !written)
+			return 0;
+#elif __linux__ || __APPLE__
+		written = write(log->file, data, left);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+#endif
+		data += written;
+		left -= (unsigned int)written;
+	}
+
+#if _WIN32
+	return FlushFileBuffers(log->file) != 0;
+#elif __APPLE__
+	return !fsync(log->file);
+#elif __linux__
+	return !fdatasync(log->file);
+#endif
+}
+
+// Open a log to append to, keeping its first keep bytes, or creating it
+// if keep is 0
+static struct journal_log *
+open_log(const char *path, size_t keep)
+{
+	struct journal_log *log;
+#if _WIN32
+	LARGE_INTEGER at;
+#endif
+
+	log = malloc(sizeof(struct journal_log));
+	if (!log)
+		return NULL;
+	log->buffer = malloc(LOG_BUFFER);
+	log->buffered = 0;
+	if (!log->buffer)
+	{
+		free(log);
+		return NULL;
+	}
+
+#if _WIN32
+	log->file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, keep ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	at.QuadPart = keep;
+	if (log->file != INVALID_HANDLE_VALUE && (!SetFilePointerEx(log->file, at, NULL, FILE_BEGIN) || !SetEndOfFile(log->file)))
+	{
+		CloseHandle(log->file);
+		log->file = INVALID_HANDLE_VALUE;
+	}
+	if (log->file == INVALID_HANDLE_VALUE)
+#elif __linux__ || __APPLE__
+	log->file = open(path, keep ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (log->file != -1 && (ftruncate(log->file, (off_t)keep) || lseek(log->file, 0, SEEK_END) == -1))
+	{
+		close(log->file);
+		log->file = -1;
+	}
+	if (log->file == -1)
+#endif
+	{
+		free(log->buffer);
+		free(log);
+		return NULL;
+	}
+
+	return log;
+}
+
+static void
+close_log(struct journal_log *log)
+{
+	if (!log) return;
+	flush_log(log);
+#if _WIN32
+	CloseHandle(log->file);
+#elif __linux__ || __APPLE__
+	close(log->file);
+#endif
+	free(log->buffer);
+	free(log);
+}
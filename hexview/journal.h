@@ -0,0 +1,165 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+
+#include "defs.h"
+#include "file.h"
+
+#define JOURNAL_EXT ".hvwl"
+
+// What a log left by an earlier session holds, see journal_open
+enum
+{
+	JournalNone,        // there is no log
+	JournalStale,       // the file was changed by something else since, the log was deleted
+	JournalSaved,       // the edits were saved, only the log was left behind and it was deleted
+	JournalPending,     // edits which were not saved
+	JournalInterrupted  // edits which were being written over the file when the session ended
+};
+
+// Kinds of saves marked in the log before the file is written
+enum
+{
+	JournalPatch,   // the edited bytes are written over the file in place
+	JournalRename   // a new file is written and renamed over the file
+};
+
+// An edit, replacing old_size bytes at offset with new_size bytes
+typedef struct journal_op_s journal_op_t;
+struct journal_op_s
+{
+	unsigned int offset;
+	unsigned int old_size;
+	unsigned int new_size;
+	unsigned int group;  // Edits of one group are undone and redone together.
+	size_t data;         // Position of the old bytes in the bytes of the journal, the new bytes follow them.
+};
+
+struct journal_log;
+
+// The edits made to a file, in order, with the bytes they replaced, so
+// they can be undone and redone. Memory grows with the bytes changed
+// only. Every edit is also appended to a log next to the file, written
+// ahead of the file itself, so the edits of a session which ended
+// without saving them, or while saving them, are found again when the
+// file is next opened.
+typedef struct journal_s journal_t;
+struct journal_s
+{
+	journal_op_t *ops;
+	unsigned int count;
+	unsigned int done;      // Edits applied, those after were undone and can be redone.
+	unsigned int capacity;
+	unsigned int group;     // Group of the next edit, see journal_group.
+	byte *bytes;            // The old and new bytes of every edit.
+	size_t used;
+	size_t reserved;
+	unsigned int logged;    // Edits appended to the log so far.
+	struct journal_log *log;
+};
+
+// Make an empty journal with no log.
+//
+// Returns:
+// The journal, or NULL if memory could not be allocated.
+journal_t *journal_create();
+
+// Start a log for a journal, replacing any log left before.
+// Parameters:
+// - journal: The journal, which must have no edits yet.
+// - path: The path of the log.
+// - size: The size of the file the edits are made to.
+// - mtime: The modification time of the file, see sidecar_file_time.
+//
+// Returns:
+// Nonzero if the log was created.
+int journal_log(journal_t *journal, const char *path, unsigned int size, uint64 mtime);
+
+// Read the log left by an earlier session and go on appending to it.
+// Edits are read up to the first one not written whole, and the undos
+// and redos after them are applied to the journal, so the first done
+// edits are those to make to the file again.
+// Parameters:
+// - path: The path of the log.
+// - size: The size of the file as it is now.
+// - mtime: The modification time of the file as it is now.
+// - status: Destination of what the log holds, one of the Journal
+//           values.
+//
+// Returns:
+// The journal for JournalPending and JournalInterrupted, otherwise NULL.
+journal_t *journal_open(const char *path, unsigned int size, uint64 mtime, int *const status);
+
+// Close a journal and its log, leaving the log for the next session.
+// Parameters:
+// - journal: The journal to close, can be NULL.
+void journal_close(journal_t *journal);
+
+// Start a new group of edits, undone together.
+void journal_group(journal_t *journal);
+
+// Add an edit to the journal, dropping the edits which could be redone.
+// It is appended to the log by the next journal_flush.
+// Parameters:
+// - journal: The journal.
+// - off: The offset of the first byte replaced.
+// - old_size: The number of bytes replaced.
+// - read: Reads the bytes replaced from the data before the edit.
+// - arg: Passed to read.
+// - bytes: The bytes put in their place.
+// - new_size: The number of bytes put in their place.
+//
+// Returns:
+// Nonzero if the edit was added, 0 if memory could not be allocated.
+int journal_add(journal_t *journal, unsigned int off, unsigned int old_size, file_fill_fn read, void *arg, const byte *bytes, unsigned int new_size);
+
+// Remove the last edit added, which could not be made after all. It
+// must not have been flushed.
+void journal_cancel(journal_t *journal);
+
+// Append the edits added since the last flush to the log and wait until
+// they are on disk.
+// Parameters:
+// - journal: The journal.
+//
+// Returns:
+// Nonzero if the edits are in the log, or there is no log.
+int journal_flush(journal_t *journal);
+
+// Undo the last group of edits done.
+// Parameters:
+// - journal: The journal.
+// - first: Destination of the first edit of the group.
+// - last: Destination of the edit after the last of the group. The
+//         edits are undone from last - 1 down to first.
+//
+// Returns:
+// Nonzero if there was a group to undo.
+int journal_undo(journal_t *journal, unsigned int *const first, unsigned int *const last);
+
+// Redo the first group of edits undone.
+// Parameters:
+// - journal: The journal.
+// - first: Destination of the first edit of the group.
+// - last: Destination of the edit after the last of the group. The
+//         edits are redone from first up to last - 1.
+//
+// Returns:
+// Nonzero if there was a group to redo.
+int journal_redo(journal_t *journal, unsigned int *const first, unsigned int *const last);
+
+// Mark in the log that the edits are about to be saved, and wait until
+// the mark is on disk.
+// Parameters:
+// - journal: The journal.
+// - kind: JournalPatch or JournalRename.
+//
+// Returns:
+// Nonzero if the mark is in the log, or there is no log.
+int journal_mark(journal_t *journal, int kind);
+
+// Returns the bytes an edit replaced, its new bytes follow them.
+const byte *journal_bytes(const journal_t *journal, const journal_op_t *op);
+
+#endif
@@ -1,5 +1,8 @@
 #include "control.h"
 #include "util.h"
+#include "file.h"
+#include "render.h"
+#include "diff.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -13,11 +16,18 @@
 struct command_line
 {
 	const char *filename;
+	int pid;              // process to view instead of a file, 0 for none
+	const char *other;    // file to compare with, NULL for none
+	int aligned;          // align the files compared instead of comparing offsets
+	int dump;             // write the file in the format of xxd and exit
+	unsigned int start;   // first byte to dump
+	unsigned int length;  // number of bytes to dump, 0 for the rest of the file
 };
 
 static int parse_command_line(int argc, char *argv[], struct command_line *const out);
 static void print_help(int full);
 static void print_version();
+static int dump_file(const struct command_line *command_line);
 
 int
 main(int argc, char *argv[])
@@ -46,6 +56,9 @@ main(int argc, char *argv[])
 	if (parse_command_line(argc, argv, &command_line))
 		return 0;
 
+	if (command_line.dump)
+		return dump_file(&command_line);
+
 	state = create_state();
 	if (!state)
 	{
@@ -53,18 +66,30 @@ main(int argc, char *argv[])
 		goto cleanup;
 	}
 
-	if (!open_file_on_state(state, argv[1]))
+	if (command_line.pid)
+	{
+		if (!open_process_on_state(state, command_line.pid))
+		{
+			printf("Failed to open process.\n");
+			goto cleanup;
+		}
+	}
+	else if (!open_file_on_state(state, command_line.filename))
 	{
 		printf("Failed to open file.\n");
 		goto cleanup;
 	}
 
+	if (command_line.other)
+		compare_on_state(state, command_line.other, DIFF_GAP, command_line.aligned);
+
 	printf("Use \033[95mhelp\033[m for help.\n");
 	do
 	{
 		printf("> ");
 		fflush(stdout);
-		readline(line, sizeof(line));
+		if (readline(line, sizeof(line)) < 0)
+			break;
 		result = run_string(state, line);
 	} while (result == Continue);
 
@@ -82,6 +107,8 @@ cleanup:
 static int
 parse_command_line(int argc, char *argv[], struct command_line *const out)
 {
+	unsigned long value;
+	char *end;
 	int i;
 
 	memset(out, 0, sizeof(struct command_line));
@@ -97,6 +124,43 @@ parse_command_line(int argc, char *argv[], struct command_line *const out)
 			print_version();
 			return 1;
 		}
+		else if (equals_ignore_case(argv[i], "--dump") || equals_ignore_case(argv[i], "-d"))
+			out->dump = 1;
+		else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "-l")) && i + 1 < argc)
+		{
+			value = strtoul(argv[i + 1], &end, 0);
+			if (*end)
+			{
+				printf("Invalid value '%s' for %s.\n", argv[i + 1], argv[i]);
+				return 1;
+			}
+
+			if (argv[i][1] == 's')
+				out->start = value;
+			else
+				out->length = value;
+			i++;
+		}
+		else if (equals_ignore_case(argv[i], "--aligned"))
+			out->aligned = 1;
+		else if (equals_ignore_case(argv[i], "--diff") && i + 2 < argc)
+		{
+			out->filename = argv[i + 1];
+			out->other = argv[i + 2];
+			break;
+		}
+		else if ((equals_ignore_case(argv[i], "--pid") || equals_ignore_case(argv[i], "-p")) && i + 1 < argc)
+		{
+			value = strtoul(argv[i + 1], &end, 10);
+			if (*end || !value)
+			{
+				printf("Invalid value '%s' for %s.\n", argv[i + 1], argv[i]);
+				return 1;
+			}
+
+			out->pid = (int)value;
+			i++;
+		}
 		else if (argv[i][0] == '-')
 		{
 			printf("Unknown switch '%s', use --help for help.\n", argv[i]);
@@ -109,7 +173,25 @@ parse_command_line(int argc, char *argv[], struct command_line *const out)
 		}
 	}
 
-	if (!out->filename)
+	if (out->other && (out->pid || out->dump))
+	{
+		printf("--diff compares two files, and cannot be combined with --pid or --dump.\n");
+		return 1;
+	}
+
+	if (out->aligned && !out->other)
+	{
+		printf("--aligned only applies to --diff.\n");
+		return 1;
+	}
+
+	if (out->pid && (out->filename || out->dump))
+	{
+		printf("--pid views a process instead of a file, and cannot be dumped.\n");
+		return 1;
+	}
+
+	if (!out->filename && !out->pid)
 	{
 		print_help(0);
 		return 1;
@@ -122,6 +204,8 @@ static void
 print_help(int full)
 {
 	printf("Usage: hexview [options...] <filename>\n");
+	printf("       hexview --pid <pid>\n");
+	printf("       hexview [--aligned] --diff <filename> <other>\n");
 	if (!full)
 	{
 		printf("Try hexview --help\n");
@@ -132,10 +216,41 @@ print_help(int full)
 	printf("Where options include:\n");
 	printf(" --help -h      Display this message.\n");
 	printf(" --version -v   Display version information.\n");
+	printf(" --dump -d      Write the file in the format of xxd and exit.\n");
+	printf(" -s <offset>    Offset to start dumping at.\n");
+	printf(" -l <length>    Number of bytes to dump.\n");
+	printf(" --pid -p <pid> View the readable memory of a running process, Linux only.\n");
+	printf(" --diff <a> <b> View a and list where it differs from b, see cmp.\n");
+	printf(" --aligned      With --diff, line up inserted, deleted and moved bytes.\n");
 }
 
 static void
 print_version()
 {
 	printf("hexview %s\n", HEXVIEW_VERSION);
+}
+
+static int
+dump_file(const struct command_line *command_line)
+{
+	file_t *file;
+	unsigned int start, length;
+	int result;
+
+	file = open_file(command_line->filename);
+	if (!file)
+	{
+		printf("Failed to open file.\n");
+		return 1;
+	}
+
+	start = command_line->start < file->size ? command_line->start : file->size;
+	length = file->size - start;
+	if (command_line->length && command_line->length < length)
+		length = command_line->length;
+
+	result = render_dump(file->data + start, start, length, stdout);
+	close_file(file);
+
+	return !result;
 }
\ No newline at end of file
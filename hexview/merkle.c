@@ -0,0 +1,341 @@
+#include "merkle.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "sidecar.h"
+#include "thread.h"
+
+#define MERKLE_MAGIC "HVMT"
+#define MERKLE_VERSION 1
+#define MAX_LEVELS 34  // levels of a tree over the most leaves 32-bit sizes have
+
+struct merkle_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;       // size of the file hashed
+	uint32 leaf_size;  // MERKLE_LEAF_SIZE when built
+	uint32 nleaves;
+	uint32 nnodes;
+	uint64 mtime;
+};
+
+// A range of the leaves hashed by a single thread
+struct leaf_job
+{
+	const byte *data;
+	unsigned int size;
+	uint64 *leaves;
+	unsigned int start;
+	unsigned int end;
+};
+
+static void leaf_proc(void *arg);
+static unsigned int count_nodes(unsigned int nleaves);
+static unsigned int level_starts(unsigned int nleaves, unsigned int *const starts);
+static void build_levels(merkle_t *tree);
+static int descend(const merkle_t *old, const merkle_t *now, const unsigned int *starts, unsigned int level, unsigned int index,
+	merkle_range_t **const ranges, unsigned int *const count, unsigned int *const capacity);
+static int add_leaf(const merkle_t *now, unsigned int leaf, merkle_range_t **const ranges, unsigned int *const count, unsigned int *const capacity);
+
+merkle_t *
+merkle_build(const byte *data, unsigned int size, uint64 mtime)
+{
+	merkle_t *tree;
+	struct leaf_job *jobs;
+	unsigned int per;
+	int njobs, n;
+
+	tree = malloc(sizeof(merkle_t));
+	if (!tree)
+		return NULL;
+
+	tree->nleaves = (unsigned int)(((uint64)size + MERKLE_LEAF_SIZE - 1) / MERKLE_LEAF_SIZE);
+	tree->nnodes = count_nodes(tree->nleaves);
+	tree->size = size;
+	tree->mtime = mtime;
+	tree->nodes = malloc(((size_t)tree->nnodes + 1) * sizeof(uint64));
+	if (!tree->nodes)
+	{
+		free(tree);
+		return NULL;
+	}
+
+	njobs = cpu_count();
+	if ((unsigned int)njobs > tree->nleaves)
+		njobs = tree->nleaves;
+
+	if (njobs)
+	{
+		jobs = calloc(njobs, sizeof(struct leaf_job));
+		if (!jobs)
+		{
+			merkle_free(tree);
+			return NULL;
+		}
+
+		// contiguous shares keep each thread reading the file in order
+		per = (tree->nleaves + njobs - 1) / njobs;
+		for (n = 0; n < njobs; n++)
+		{
+			jobs[n].data = data;
+			jobs[n].size = size;
+			jobs[n].leaves = tree->nodes;
+			jobs[n].start = (uint64)n * per < tree->nleaves ? n * per : tree->nleaves;
+			jobs[n].end = tree->nleaves - jobs[n].start > per ? jobs[n].start + per : tree->nleaves;
+		}
+
+		run_parallel(&leaf_proc, jobs, njobs, sizeof(struct leaf_job));
+		free(jobs);
+	}
+
+	build_levels(tree);
+	return tree;
+}
+
+int
+merkle_save(const merkle_t *tree, const char *path)
+{
+	sidecar_t *sidecar;
+	struct merkle_header *header;
+
+	sidecar = sidecar_create(path, sizeof(struct merkle_header) + (size_t)tree->nnodes * sizeof(uint64));
+	if (!sidecar)
+		return 0;
+
+	header = (struct merkle_header *)sidecar->data;
+	memset(header, 0, sizeof(struct merkle_header));
+	memcpy(header->magic, MERKLE_MAGIC, sizeof(header->magic));
+	header->version = MERKLE_VERSION;
+	header->size = tree->size;
+	header->leaf_size = MERKLE_LEAF_SIZE;
+	header->nleaves = tree->nleaves;
+	header->nnodes = tree->nnodes;
+	header->mtime = tree->mtime;
+	memcpy(sidecar->data + sizeof(struct merkle_header), tree->nodes, (size_t)tree->nnodes * sizeof(uint64));
+
+	sidecar_close(sidecar);
+	return 1;
+}
+
+merkle_t *
+merkle_open(const char *path)
+{
+	merkle_t *tree;
+	sidecar_t *sidecar;
+	const struct merkle_header *header;
+
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	header = (const struct merkle_header *)sidecar->data;
+	if (sidecar->size < sizeof(struct merkle_header) ||
+		memcmp(header->magic, MERKLE_MAGIC, sizeof(header->magic)) ||
+		header->version != MERKLE_VERSION || header->leaf_size != MERKLE_LEAF_SIZE ||
+		header->nleaves != ((uint64)header->size + MERKLE_LEAF_SIZE - 1) / MERKLE_LEAF_SIZE ||
+		header->nnodes != count_nodes(header->nleaves) ||
+		sidecar->size != sizeof(struct merkle_header) + (size_t)header->nnodes * sizeof(uint64))
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	// the tree is small, a copy outlives the sidecar being replaced
+	tree = malloc(sizeof(merkle_t));
+	if (tree)
+		tree->nodes = malloc(((size_t)header->nnodes + 1) * sizeof(uint64));
+	if (!tree || !tree->nodes)
+	{
+		free(tree);
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	tree->nleaves = header->nleaves;
+	tree->nnodes = header->nnodes;
+	tree->size = header->size;
+	tree->mtime = header->mtime;
+	memcpy(tree->nodes, sidecar->data + sizeof(struct merkle_header), (size_t)tree->nnodes * sizeof(uint64));
+
+	sidecar_close(sidecar);
+	return tree;
+}
+
+void
+merkle_free(merkle_t *tree)
+{
+	if (!tree) return;
+	free(tree->nodes);
+	free(tree);
+}
+
+uint64
+merkle_root(const merkle_t *tree)
+{
+	return tree->nnodes ? tree->nodes[tree->nnodes - 1] : 0;
+}
+
+int
+merkle_changes(const merkle_t *old, const merkle_t *now, merkle_range_t **const out)
+{
+	merkle_range_t *ranges;
+	unsigned int starts[MAX_LEVELS];
+	unsigned int count, capacity, levels, i;
+	int failed;
+
+	ranges = NULL;
+	count = 0;
+	capacity = 0;
+	failed = 0;
+
+	if (old->nleaves == now->nleaves)
+	{
+		levels = level_starts(now->nleaves, starts);
+		if (levels)
+			failed = !descend(old, now, starts, levels - 1, 0, &ranges, &count, &capacity);
+	}
+	else
+	{
+		for (i = 0; i < now->nleaves && !failed; i++)
+		{
+			if (i >= old->nleaves || old->nodes[i] != now->nodes[i])
+				failed = !add_leaf(now, i, &ranges, &count, &capacity);
+		}
+	}
+
+	if (failed)
+	{
+		free(ranges);
+		return -1;
+	}
+
+	*out = ranges;
+	return (int)count;
+}
+
+static void
+leaf_proc(void *arg)
+{
+	struct leaf_job *job;
+	unsigned int leaf, off;
+
+	job = arg;
+	for (leaf = job->start; leaf < job->end; leaf++)
+	{
+		off = leaf * MERKLE_LEAF_SIZE;
+		job->leaves[leaf] = xxh3_64(job->data + off, job->size - off > MERKLE_LEAF_SIZE ? MERKLE_LEAF_SIZE : job->size - off);
+	}
+}
+
+// Returns the number of nodes in a tree over nleaves leaves
+static unsigned int
+count_nodes(unsigned int nleaves)
+{
+	unsigned int starts[MAX_LEVELS];
+	unsigned int levels;
+
+	levels = level_starts(nleaves, starts);
+	return levels ? starts[levels - 1] + 1 : 0;
+}
+
+// Find where each level of a tree over nleaves leaves starts, the
+// leaves first. Returns the number of levels.
+static unsigned int
+level_starts(unsigned int nleaves, unsigned int *const starts)
+{
+	unsigned int levels, start, n;
+
+	if (!nleaves)
+		return 0;
+
+	levels = 0;
+	start = 0;
+	for (n = nleaves;; n = (n + 1) / 2)
+	{
+		starts[levels++] = start;
+		if (n == 1)
+			return levels;
+		start += n;
+	}
+}
+
+// Hash each pair of nodes into the level above, a node without a pair
+// on its own
+static void
+build_levels(merkle_t *tree)
+{
+	unsigned int starts[MAX_LEVELS];
+	unsigned int levels, level, n, i;
+	uint64 *below, *above;
+
+	levels = level_starts(tree->nleaves, starts);
+	n = tree->nleaves;
+	for (level = 1; level < levels; level++)
+	{
+		below = tree->nodes + starts[level - 1];
+		above = tree->nodes + starts[level];
+		for (i = 0; 2 * i < n; i++)
+			above[i] = xxh3_64((const byte *)(below + 2 * i), (2 * i + 1 < n ? 2 : 1) * sizeof(uint64));
+		n = (n + 1) / 2;
+	}
+}
+
+// Add the leaves under a node which differ between two trees of the
+// same shape, skipping subtrees with equal hashes. Returns 0 if memory
+// could not be allocated.
+static int
+descend(const merkle_t *old, const merkle_t *now, const unsigned int *starts, unsigned int level, unsigned int index,
+	merkle_range_t **const ranges, unsigned int *const count, unsigned int *const capacity)
+{
+	unsigned int width;
+
+	if (old->nodes[starts[level] + index] == now->nodes[starts[level] + index])
+		return 1;
+	if (!level)
+		return add_leaf(now, index, ranges, count, capacity);
+
+	// the nodes of the level below, the second child may be missing
+	width = starts[level] - starts[level - 1];
+	if (!descend(old, now, starts, level - 1, 2 * index, ranges, count, capacity))
+		return 0;
+	return 2 * index + 1 >= width || descend(old, now, starts, level - 1, 2 * index + 1, ranges, count, capacity);
+}
+
+// Add the bytes of a leaf after the ranges, joining it to the last one
+// when they are adjacent. Returns 0 if memory could not be allocated.
+static int
+add_leaf(const merkle_t *now, unsigned int leaf, merkle_range_t **const ranges, unsigned int *const count, unsigned int *const capacity)
+{
+	merkle_range_t *grown, *last;
+	unsigned int offset, size;
+
+	offset = leaf * MERKLE_LEAF_SIZE;
+	size = now->size - offset > MERKLE_LEAF_SIZE ? MERKLE_LEAF_SIZE : now->size - offset;
+
+	if (*count)
+	{
+		last = &(*ranges)[*count - 1];
+		if (last->offset + last->size == offset)
+		{
+			last->size += size;
+			return 1;
+		}
+	}
+
+	if (*count == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 64;
+		grown = realloc(*ranges, *capacity * sizeof(merkle_range_t));
+		if (!grown)
+			return 0;
+		*ranges = grown;
+	}
+
+	last = &(*ranges)[(*count)++];
+	last->offset = offset;
+	last->size = size;
+	return 1;
+}
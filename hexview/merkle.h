@@ -0,0 +1,81 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include "defs.h"
+
+#define MERKLE_EXT ".hvmt"
+#define MERKLE_LEAF_SIZE 1048576  // bytes of the file hashed into each leaf
+
+typedef struct merkle_range_s merkle_range_t;
+struct merkle_range_s
+{
+	unsigned int offset;
+	unsigned int size;
+};
+
+// A tree of xxh3 hashes over the blocks of a file, each node the hash
+// of its two children, so two versions of a file are compared from the
+// root down through the subtrees which differ only.
+typedef struct merkle_s merkle_t;
+struct merkle_s
+{
+	uint64 *nodes;          // The levels from the leaves up to the root, each half the one below rounded up.
+	unsigned int nleaves;
+	unsigned int nnodes;
+	unsigned int size;      // Size of the file hashed.
+	uint64 mtime;           // Modification time of the file when hashed, see sidecar_file_time.
+};
+
+// Hash the blocks of a file on all avaliable cores and build the tree
+// over them.
+// Parameters:
+// - data: The data of the file.
+// - size: The size of the file.
+// - mtime: The modification time of the file.
+//
+// Returns:
+// The tree, or NULL if memory could not be allocated.
+merkle_t *merkle_build(const byte *data, unsigned int size, uint64 mtime);
+
+// Write a tree to a sidecar.
+// Parameters:
+// - tree: The tree to save.
+// - path: The path of the sidecar to create.
+//
+// Returns:
+// Nonzero if the sidecar was written.
+int merkle_save(const merkle_t *tree, const char *path);
+
+// Read a tree saved with merkle_save. Unlike other indexes the file may
+// have changed since, which is what the tree is compared to find.
+// Parameters:
+// - path: The path of the sidecar.
+//
+// Returns:
+// The tree, or NULL if there is no valid sidecar or memory could not be
+// allocated.
+merkle_t *merkle_open(const char *path);
+
+// Free a tree.
+// Parameters:
+// - tree: The tree to free, can be NULL.
+void merkle_free(merkle_t *tree);
+
+// Returns the hash at the root of a tree, 0 for an empty file.
+uint64 merkle_root(const merkle_t *tree);
+
+// Find the blocks which changed between two versions of a file. Trees
+// over as many blocks are compared from the root down, otherwise the
+// leaves are compared in order. Blocks past the end of one version have
+// changed, ranges stop at the end of the newer one.
+// Parameters:
+// - old: The tree of the earlier version.
+// - now: The tree of the later version.
+// - out: Destination of the changed ranges by increasing offset, with
+//        adjacent blocks merged. Free with free.
+//
+// Returns:
+// The number of ranges, or -1 if memory could not be allocated.
+int merkle_changes(const merkle_t *old, const merkle_t *now, merkle_range_t **const out);
+
+#endif
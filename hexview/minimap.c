@@ -0,0 +1,247 @@
+#include "minimap.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread.h"
+
+// Fraction of a block, in eighths, which must be zero or text for it to
+// be classified as such
+#define DOMINANT_EIGHTHS 6
+
+// Fraction of the maximum entropy of a block, in eighths, for it to be
+// classified as random
+#define RANDOM_EIGHTHS 7
+
+struct refine_job
+{
+	minimap_t *map;
+	const byte *data;
+	unsigned int size;
+	unsigned int first;  // first cell to refine
+	unsigned int end;    // one past the last cell to refine
+};
+
+static int tables_ready;
+static float plogp[MINIMAP_BLOCK + 1];  // i * log2(i)
+static byte is_text[256];
+
+static void init_tables();
+static int classify_block(const byte *data, unsigned int len);
+static void refine_proc(void *arg);
+
+minimap_t *
+minimap_create(unsigned int size, unsigned int count)
+{
+	minimap_t *map;
+
+	if (!size || !count)
+		return NULL;
+
+	init_tables();
+
+	if (count > size)
+		count = size;
+
+	map = malloc(sizeof(minimap_t));
+	if (!map)
+		return NULL;
+
+	map->cell_size = (unsigned int)(((uint64)size + count - 1) / count);
+	map->count = (unsigned int)(((uint64)size + map->cell_size - 1) / map->cell_size);
+	map->refined = 0;
+	map->cells = calloc(map->count, 1);
+	if (!map->cells)
+	{
+		free(map);
+		return NULL;
+	}
+
+	return map;
+}
+
+void
+minimap_free(minimap_t *map)
+{
+	if (!map) return;
+
+	free(map->cells);
+	free(map);
+}
+
+void
+minimap_sample(minimap_t *map, const byte *data, unsigned int size)
+{
+	unsigned int i, start, len, at;
+
+	for (i = map->refined; i < map->count; i++)
+	{
+		start = i * map->cell_size;
+		len = size - start < map->cell_size ? size - start : map->cell_size;
+
+		at = start;
+		if (len > MINIMAP_BLOCK)
+		{
+			at = start + len / 2 - MINIMAP_BLOCK / 2;
+			len = MINIMAP_BLOCK;
+		}
+
+		map->cells[i] = classify_block(data + at, len);
+	}
+}
+
+int
+minimap_refine(minimap_t *map, const byte *data, unsigned int size, unsigned int count)
+{
+	struct refine_job *jobs;
+	unsigned int per, first;
+	int njobs, n;
+
+	if (count > map->count - map->refined)
+		count = map->count - map->refined;
+	if (!count)
+		return 1;
+
+	njobs = cpu_count();
+	if ((unsigned int)njobs > count)
+		njobs = count;
+
+	jobs = malloc(njobs * sizeof(struct refine_job));
+	if (!jobs)
+		njobs = 1;
+
+	per = (count + njobs - 1) / njobs;
+	first = map->refined;
+	for (n = 0; n < njobs && jobs; n++)
+	{
+		jobs[n].map = map;
+		jobs[n].data = data;
+		jobs[n].size = size;
+		jobs[n].first = first + n * per;
+		jobs[n].end = first + (n + 1) * per < first + count ? first + (n + 1) * per : first + count;
+	}
+
+	if (jobs)
+	{
+		run_parallel(&refine_proc, jobs, njobs, sizeof(struct refine_job));
+		free(jobs);
+	}
+	else
+	{
+		struct refine_job job = { map, data, size, first, first + count };
+		refine_proc(&job);
+	}
+
+	map->refined += count;
+	return map->refined == map->count;
+}
+
+unsigned int
+minimap_cell(const minimap_t *map, unsigned int off)
+{
+	unsigned int cell;
+
+	cell = off / map->cell_size;
+	return cell < map->count ? cell : map->count - 1;
+}
+
+static void
+init_tables()
+{
+	unsigned int i;
+
+	if (tables_ready)
+		return;
+
+	plogp[0] = 0.0f;
+	for (i = 1; i <= MINIMAP_BLOCK; i++)
+		plogp[i] = (float)(i * log2((double)i));
+
+	for (i = 0x20; i < 0x7f; i++)
+		is_text[i] = 1;
+	is_text['\t'] = 1;
+	is_text['\n'] = 1;
+	is_text['\r'] = 1;
+
+	tables_ready = 1;
+}
+
+// Classify up to MINIMAP_BLOCK bytes from their histogram
+static int
+classify_block(const byte *data, unsigned int len)
+{
+	unsigned int hist[4][256];
+	unsigned int i, n, text, distinct;
+	float sum, entropy, max;
+
+	memset(hist, 0, sizeof(hist));
+
+	// four histograms so consecutive equal bytes do not wait on each other
+	for (i = 0; i + 4 <= len; i += 4)
+	{
+		hist[0][data[i]]++;
+		hist[1][data[i + 1]]++;
+		hist[2][data[i + 2]]++;
+		hist[3][data[i + 3]]++;
+	}
+	for (; i < len; i++)
+		hist[0][data[i]]++;
+
+	text = 0;
+	distinct = 0;
+	sum = 0.0f;
+	for (i = 0; i < 256; i++)
+	{
+		n = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+		hist[0][i] = n;
+		if (is_text[i])
+			text += n;
+		if (n)
+			distinct++;
+		sum += plogp[n];
+	}
+
+	if (hist[0][0] * 8 >= len * DOMINANT_EIGHTHS)
+		return MapZero;
+	if (text * 8 >= len * DOMINANT_EIGHTHS)
+		return MapText;
+
+	// entropy in bits per byte, against the most a block this long can have
+	entropy = (plogp[len] - sum) / len;
+	max = len < 256 ? plogp[len] / len : 8.0f;
+	if (distinct > 1 && entropy * 8 >= max * RANDOM_EIGHTHS)
+		return MapRandom;
+
+	return MapOther;
+}
+
+static void
+refine_proc(void *arg)
+{
+	struct refine_job *job = arg;
+	minimap_t *map = job->map;
+	unsigned int votes[MapClasses];
+	unsigned int i, c, best, at, start, end, len;
+
+	for (i = job->first; i < job->end; i++)
+	{
+		start = i * map->cell_size;
+		end = job->size - start < map->cell_size ? job->size : start + map->cell_size;
+
+		memset(votes, 0, sizeof(votes));
+		for (at = start; at < end; at += len)
+		{
+			len = end - at < MINIMAP_BLOCK ? end - at : MINIMAP_BLOCK;
+			votes[classify_block(job->data + at, len)]++;
+		}
+
+		best = MapZero;
+		for (c = MapZero + 1; c < MapClasses; c++)
+		{
+			if (votes[c] > votes[best])
+				best = c;
+		}
+		map->cells[i] = (byte)best;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef MINIMAP_H
+#define MINIMAP_H
+
+#include "defs.h"
+
+// Bytes classified together. A cell takes the class most of its blocks
+// have.
+#define MINIMAP_BLOCK 1024
+
+enum
+{
+	MapUnknown = 0,  // not classified yet
+	MapZero,         // mostly zero bytes
+	MapText,         // mostly printable ASCII and whitespace
+	MapRandom,       // close to the maximum entropy, compressed or encrypted data
+	MapOther,        // anything else, such as code or tables
+	MapClasses
+};
+
+typedef struct minimap_s minimap_t;
+struct minimap_s
+{
+	byte *cells;             // Class of each cell.
+	unsigned int count;      // Number of cells.
+	unsigned int cell_size;  // Bytes covered by each cell, the last may cover fewer.
+	unsigned int refined;    // Cells before this one have been classified from all of their bytes.
+};
+
+// Create a map of a file split into cells, with every cell unknown.
+// Parameters:
+// - size: The size of the file, must not be 0.
+// - count: The number of cells wanted. Fewer are used if the file is
+//          smaller than count bytes.
+//
+// Returns:
+// The map, or NULL if memory could not be allocated.
+minimap_t *minimap_create(unsigned int size, unsigned int count);
+
+// Free a map.
+// Parameters:
+// - map: The map to free, can be NULL.
+void minimap_free(minimap_t *map);
+
+// Classify every cell which is not refined from a single block in its
+// middle. This touches one page per cell, so it is fast for any size
+// of file, but may misclassify cells with mixed contents.
+// Parameters:
+// - map: The map to classify.
+// - data: The data of the file.
+// - size: The size of the file.
+void minimap_sample(minimap_t *map, const byte *data, unsigned int size);
+
+// Classify the next cells from all of their bytes, on all avaliable
+// cores.
+// Parameters:
+// - map: The map to refine.
+// - data: The data of the file.
+// - size: The size of the file.
+// - count: The maximum number of cells to refine.
+//
+// Returns:
+// Nonzero once every cell is refined.
+int minimap_refine(minimap_t *map, const byte *data, unsigned int size, unsigned int count);
+
+// Returns the cell containing an offset.
+unsigned int minimap_cell(const minimap_t *map, unsigned int off);
+
+#endif
@@ -0,0 +1,1189 @@
+#include "numeric.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "thread.h"
+
+#if HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+#define BLOCK_COUNT 4096         // elements decoded at a time by a job
+#define EXPORT_COUNT 65536       // elements formatted at a time by a job
+#define EXPORT_LINE_SIZE (NUMERIC_MAX_CHARS + 32)  // longest NDJSON line
+#define MIN_JOB_COUNT 65536      // elements below which statistics are not split
+
+// Exponents outside these are formatted in scientific notation
+#define MIN_PLAIN_EXP -4
+#define MAX_PLAIN_EXP_64 15
+#define MAX_PLAIN_EXP_32 6
+
+// Smallest binary exponent Grisu2 scales values to, the largest is -32
+#define GRISU_ALPHA -60
+
+// A floating point number as a 64 bit significand and binary exponent
+typedef struct diyfp_s diyfp;
+struct diyfp_s
+{
+	uint64 f;
+	int e;
+};
+
+// A power of ten as a normalized diyfp
+struct cached_power
+{
+	uint64 f;
+	int e;
+	int k;  // the decimal exponent
+};
+
+// Part of an array handled by a single thread
+struct stats_job
+{
+	const byte *data;
+	unsigned int count;
+	int type;
+	int endianess;
+
+	uint64 nvalues;
+	uint64 nans;
+	int seen;      // min and max are set
+	value_u min;
+	value_u max;
+	double mean;
+	double m2;     // sum of squared deviations from the mean
+
+	double lo;     // histogram range, set for the second pass
+	double scale;  // bins per unit
+	uint64 histogram[NUMERIC_BINS];
+	int failed;
+};
+
+struct downsample_job
+{
+	const byte *data;
+	unsigned int count;    // elements in the whole array
+	int type;
+	int endianess;
+	unsigned int buckets;  // buckets in the whole array
+	unsigned int first;    // first bucket of this job
+	unsigned int end;      // one past the last bucket of this job
+	double *mins;
+	double *maxs;
+	int failed;
+};
+
+struct export_job
+{
+	const byte *data;
+	unsigned int first;  // index of the first element
+	unsigned int count;
+	int type;
+	int endianess;
+	int format;
+	char *buf;
+	size_t size;  // bytes written to buf
+};
+
+static const char digit_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// 10^k for k from -300 to 324 in steps of 8, enough to bring any
+// double into the range Grisu2 works with
+static const struct cached_power cached_powers[] =
+{
+	{ 0xAB70FE17C79AC6CA, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4F, -1034, -292 },
+	{ 0xBE5691EF416BD60C, -1007, -284 },
+	{ 0x8DD01FAD907FFC3C,  -980, -276 },
+	{ 0xD3515C2831559A83,  -954, -268 },
+	{ 0x9D71AC8FADA6C9B5,  -927, -260 },
+	{ 0xEA9C227723EE8BCB,  -901, -252 },
+	{ 0xAECC49914078536D,  -874, -244 },
+	{ 0x823C12795DB6CE57,  -847, -236 },
+	{ 0xC21094364DFB5637,  -821, -228 },
+	{ 0x9096EA6F3848984F,  -794, -220 },
+	{ 0xD77485CB25823AC7,  -768, -212 },
+	{ 0xA086CFCD97BF97F4,  -741, -204 },
+	{ 0xEF340A98172AACE5,  -715, -196 },
+	{ 0xB23867FB2A35B28E,  -688, -188 },
+	{ 0x84C8D4DFD2C63F3B,  -661, -180 },
+	{ 0xC5DD44271AD3CDBA,  -635, -172 },
+	{ 0x936B9FCEBB25C996,  -608, -164 },
+	{ 0xDBAC6C247D62A584,  -582, -156 },
+	{ 0xA3AB66580D5FDAF6,  -555, -148 },
+	{ 0xF3E2F893DEC3F126,  -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8,  -502, -132 },
+	{ 0x87625F056C7C4A8B,  -475, -124 },
+	{ 0xC9BCFF6034C13053,  -449, -116 },
+	{ 0x964E858C91BA2655,  -422, -108 },
+	{ 0xDFF9772470297EBD,  -396, -100 },
+	{ 0xA6DFBD9FB8E5B88F,  -369,  -92 },
+	{ 0xF8A95FCF88747D94,  -343,  -84 },
+	{ 0xB94470938FA89BCF,  -316,  -76 },
+	{ 0x8A08F0F8BF0F156B,  -289,  -68 },
+	{ 0xCDB02555653131B6,  -263,  -60 },
+	{ 0x993FE2C6D07B7FAC,  -236,  -52 },
+	{ 0xE45C10C42A2B3B06,  -210,  -44 },
+	{ 0xAA242499697392D3,  -183,  -36 },
+	{ 0xFD87B5F28300CA0E,  -157,  -28 },
+	{ 0xBCE5086492111AEB,  -130,  -20 },
+	{ 0x8CBCCC096F5088CC,  -103,  -12 },
+	{ 0xD1B71758E219652C,   -77,   -4 },
+	{ 0x9C40000000000000,   -50,    4 },
+	{ 0xE8D4A51000000000,   -24,   12 },
+	{ 0xAD78EBC5AC620000,     3,   20 },
+	{ 0x813F3978F8940984,    30,   28 },
+	{ 0xC097CE7BC90715B3,    56,   36 },
+	{ 0x8F7E32CE7BEA5C70,    83,   44 },
+	{ 0xD5D238A4ABE98068,   109,   52 },
+	{ 0x9F4F2726179A2245,   136,   60 },
+	{ 0xED63A231D4C4FB27,   162,   68 },
+	{ 0xB0DE65388CC8ADA8,   189,   76 },
+	{ 0x83C7088E1AAB65DB,   216,   84 },
+	{ 0xC45D1DF942711D9A,   242,   92 },
+	{ 0x924D692CA61BE758,   269,  100 },
+	{ 0xDA01EE641A708DEA,   295,  108 },
+	{ 0xA26DA3999AEF774A,   322,  116 },
+	{ 0xF209787BB47D6B85,   348,  124 },
+	{ 0xB454E4A179DD1877,   375,  132 },
+	{ 0x865B86925B9BC5C2,   402,  140 },
+	{ 0xC83553C5C8965D3D,   428,  148 },
+	{ 0x952AB45CFA97A0B3,   455,  156 },
+	{ 0xDE469FBD99A05FE3,   481,  164 },
+	{ 0xA59BC234DB398C25,   508,  172 },
+	{ 0xF6C69A72A3989F5C,   534,  180 },
+	{ 0xB7DCBF5354E9BECE,   561,  188 },
+	{ 0x88FCF317F22241E2,   588,  196 },
+	{ 0xCC20CE9BD35C78A5,   614,  204 },
+	{ 0x98165AF37B2153DF,   641,  212 },
+	{ 0xE2A0B5DC971F303A,   667,  220 },
+	{ 0xA8D9D1535CE3B396,   694,  228 },
+	{ 0xFB9B7CD9A4A7443C,   720,  236 },
+	{ 0xBB764C4CA7A44410,   747,  244 },
+	{ 0x8BAB8EEFB6409C1A,   774,  252 },
+	{ 0xD01FEF10A657842C,   800,  260 },
+	{ 0x9B10A4E5E9913129,   827,  268 },
+	{ 0xE7109BFBA19C0C9D,   853,  276 },
+	{ 0xAC2820D9623BF429,   880,  284 },
+	{ 0x80444B5E7AA7CF85,   907,  292 },
+	{ 0xBF21E44003ACDD2D,   933,  300 },
+	{ 0x8E679C2F5E44FF8F,   960,  308 },
+	{ 0xD433179D9C8CB841,   986,  316 },
+	{ 0x9E19DB92B4E31BA9,  1013,  324 },
+};
+
+static void swap_scalar(const byte *in, byte *out, unsigned int count, int size);
+#if HAVE_SSE2
+TARGET("ssse3") static void swap_ssse3(const byte *in, byte *out, unsigned int count, int size);
+#endif
+
+static int value_less(const value_u *first, const value_u *second, int type);
+static unsigned int to_doubles(struct stats_job *job, const void *in, unsigned int count, double *const out);
+static void block_moments(const double *v, unsigned int n, double *const mean, double *const m2);
+static void merge_moments(struct stats_job *into, uint64 n, double mean, double m2);
+static void stats_proc(void *arg);
+static void histogram_proc(void *arg);
+static void downsample_proc(void *arg);
+static void export_proc(void *arg);
+
+static size_t format_uint(uint64 value, char *const out);
+static size_t format_int(int64 value, char *const out);
+static size_t format_real(double value, int single, char *const out);
+static void grisu2(char *const buf, int *const len, int *const exp10, diyfp m_minus, diyfp v, diyfp m_plus);
+
+int
+numeric_type(const char *name)
+{
+	if (!strcmp(name, "int8"))
+		return Int8;
+	if (!strcmp(name, "uint8"))
+		return Uint8;
+	if (!strcmp(name, "int16"))
+		return Int16;
+	if (!strcmp(name, "uint16"))
+		return Uint16;
+	if (!strcmp(name, "int32"))
+		return Int32;
+	if (!strcmp(name, "uint32"))
+		return Uint32;
+	if (!strcmp(name, "int64"))
+		return Int64;
+	if (!strcmp(name, "uint64"))
+		return Uint64;
+	if (!strcmp(name, "float32") || !strcmp(name, "float"))
+		return Float32;
+	if (!strcmp(name, "float64") || !strcmp(name, "double"))
+		return Float64;
+	if (!strcmp(name, "char8"))
+		return Char8;
+	if (!strcmp(name, "char16"))
+		return Char16;
+	return -1;
+}
+
+const char *
+numeric_name(int type)
+{
+	static const char *names[] = {
+		"int8", "uint8", "int16", "uint16", "int32", "uint32",
+		"int64", "uint64", "float32", "float64", "char8", "char16"
+	};
+
+	return type >= Int8 && type <= Char16 ? names[type] : "?";
+}
+
+int
+numeric_size(int type)
+{
+	switch (type)
+	{
+	case Int16:
+	case Uint16:
+	case Char16:
+		return 2;
+	case Int32:
+	case Uint32:
+	case Float32:
+		return 4;
+	case Int64:
+	case Uint64:
+	case Float64:
+		return 8;
+	default:
+		return 1;
+	}
+}
+
+double
+numeric_to_double(const void *value, int type)
+{
+	switch (type)
+	{
+	case Int8: return *(const int8 *)value;
+	case Uint8: case Char8: return *(const uint8 *)value;
+	case Int16: return *(const int16 *)value;
+	case Uint16: case Char16: return *(const uint16 *)value;
+	case Int32: return *(const int32 *)value;
+	case Uint32: return *(const uint32 *)value;
+	case Int64: return (double)*(const int64 *)value;
+	case Uint64: return (double)*(const uint64 *)value;
+	case Float32: return *(const float32 *)value;
+	case Float64: return *(const float64 *)value;
+	}
+	return 0.0;
+}
+
+void
+numeric_decode(const byte *in, unsigned int count, int type, int endianess, void *const out)
+{
+	int size;
+
+	size = numeric_size(type);
+	if (endianess == NATIVE_ENDIANESS || size == 1)
+	{
+		memcpy(out, in, (size_t)count * size);
+		return;
+	}
+
+#if HAVE_SSE2
+	if (cpu_features() & CpuSsse3)
+	{
+		swap_ssse3(in, out, count, size);
+		return;
+	}
+#endif
+	swap_scalar(in, out, count, size);
+}
+
+size_t
+numeric_format(const void *value, int type, char *const out)
+{
+	switch (type)
+	{
+	case Int8: return format_int(*(const int8 *)value, out);
+	case Uint8: case Char8: return format_uint(*(const uint8 *)value, out);
+	case Int16: return format_int(*(const int16 *)value, out);
+	case Uint16: case Char16: return format_uint(*(const uint16 *)value, out);
+	case Int32: return format_int(*(const int32 *)value, out);
+	case Uint32: return format_uint(*(const uint32 *)value, out);
+	case Int64: return format_int(*(const int64 *)value, out);
+	case Uint64: return format_uint(*(const uint64 *)value, out);
+	case Float32: return format_real(*(const float32 *)value, 1, out);
+	case Float64: return format_real(*(const float64 *)value, 0, out);
+	}
+	return 0;
+}
+
+int
+numeric_stats(const byte *data, unsigned int count, int type, int endianess, numeric_stats_t *const out)
+{
+	struct stats_job *jobs;
+	double lo, hi;
+	unsigned int per;
+	int njobs, n, i, failed;
+
+	memset(out, 0, sizeof(numeric_stats_t));
+
+	njobs = cpu_count();
+	if ((unsigned int)njobs > count / MIN_JOB_COUNT)
+		njobs = count / MIN_JOB_COUNT ? count / MIN_JOB_COUNT : 1;
+
+	jobs = calloc(njobs, sizeof(struct stats_job));
+	if (!jobs)
+		return 0;
+
+	per = count / njobs;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].data = data + (size_t)n * per * numeric_size(type);
+		jobs[n].count = n == njobs - 1 ? count - n * per : per;
+		jobs[n].type = type;
+		jobs[n].endianess = endianess;
+	}
+
+	run_parallel(&stats_proc, jobs, njobs, sizeof(struct stats_job));
+
+	// combine the jobs into the first
+	failed = jobs[0].failed;
+	for (n = 1; n < njobs; n++)
+	{
+		failed |= jobs[n].failed;
+		jobs[0].nans += jobs[n].nans;
+		if (!jobs[n].seen)
+			continue;
+
+		if (!jobs[0].seen || value_less(&jobs[n].min, &jobs[0].min, type))
+			jobs[0].min = jobs[n].min;
+		if (!jobs[0].seen || value_less(&jobs[0].max, &jobs[n].max, type))
+			jobs[0].max = jobs[n].max;
+		jobs[0].seen = 1;
+
+		merge_moments(&jobs[0], jobs[n].nvalues, jobs[n].mean, jobs[n].m2);
+	}
+
+	if (failed)
+	{
+		free(jobs);
+		return 0;
+	}
+
+	out->count = jobs[0].nvalues;
+	out->nans = jobs[0].nans;
+	out->min = jobs[0].min;
+	out->max = jobs[0].max;
+	out->mean = jobs[0].mean;
+	out->stddev = out->count ? sqrt(jobs[0].m2 / (double)out->count) : 0.0;
+
+	// the histogram needs the range, so it takes a second pass
+	lo = numeric_to_double(&out->min, type);
+	hi = numeric_to_double(&out->max, type);
+	if (out->count && lo - lo == 0.0 && hi - hi == 0.0)
+	{
+		for (n = 0; n < njobs; n++)
+		{
+			jobs[n].lo = lo;
+			jobs[n].scale = hi > lo ? NUMERIC_BINS / (hi - lo) : 0.0;
+		}
+
+		run_parallel(&histogram_proc, jobs, njobs, sizeof(struct stats_job));
+
+		for (n = 0; n < njobs; n++)
+		{
+			for (i = 0; i < NUMERIC_BINS; i++)
+				out->histogram[i] += jobs[n].histogram[i];
+		}
+	}
+
+	free(jobs);
+	return 1;
+}
+
+int
+numeric_downsample(const byte *data, unsigned int count, int type, int endianess, unsigned int buckets, double *const mins, double *const maxs)
+{
+	struct downsample_job *jobs;
+	unsigned int per;
+	int njobs, n, failed;
+
+	if (!buckets || buckets > count)
+		return 0;
+
+	njobs = cpu_count();
+	if ((unsigned int)njobs > buckets)
+		njobs = buckets;
+
+	jobs = calloc(njobs, sizeof(struct downsample_job));
+	if (!jobs)
+		return 0;
+
+	per = buckets / njobs;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].data = data;
+		jobs[n].count = count;
+		jobs[n].type = type;
+		jobs[n].endianess = endianess;
+		jobs[n].buckets = buckets;
+		jobs[n].first = n * per;
+		jobs[n].end = n == njobs - 1 ? buckets : (n + 1) * per;
+		jobs[n].mins = mins;
+		jobs[n].maxs = maxs;
+	}
+
+	run_parallel(&downsample_proc, jobs, njobs, sizeof(struct downsample_job));
+
+	failed = 0;
+	for (n = 0; n < njobs; n++)
+		failed |= jobs[n].failed;
+
+	free(jobs);
+	return !failed;
+}
+
+int
+numeric_export(const byte *data, unsigned int count, int type, int endianess, int format, FILE *fp)
+{
+	struct export_job *jobs;
+	unsigned int pos;
+	size_t bufsize;
+	int njobs, n, i, result;
+
+	if (format == ExportCsv && fputs("index,value\n", fp) == EOF)
+		return 0;
+
+	njobs = cpu_count();
+	jobs = calloc(njobs, sizeof(struct export_job));
+	if (!jobs)
+		return 0;
+
+	bufsize = format == ExportRaw ? (size_t)EXPORT_COUNT * numeric_size(type) : (size_t)EXPORT_COUNT * EXPORT_LINE_SIZE;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].buf = malloc(bufsize);
+		if (!jobs[n].buf)
+			break;
+	}
+
+	// rounds of one chunk per job, written in order
+	result = n == njobs;
+	for (pos = 0; pos < count && result;)
+	{
+		for (n = 0; n < njobs && pos < count; n++)
+		{
+			jobs[n].data = data + (size_t)pos * numeric_size(type);
+			jobs[n].first = pos;
+			jobs[n].count = count - pos < EXPORT_COUNT ? count - pos : EXPORT_COUNT;
+			jobs[n].type = type;
+			jobs[n].endianess = endianess;
+			jobs[n].format = format;
+			pos += jobs[n].count;
+		}
+
+		run_parallel(&export_proc, jobs, n, sizeof(struct export_job));
+
+		for (i = 0; i < n && result; i++)
+			result = fwrite(jobs[i].buf, 1, jobs[i].size, fp) == jobs[i].size;
+	}
+
+	for (n = 0; n < njobs; n++)
+		free(jobs[n].buf);
+	free(jobs);
+
+	return result && !fflush(fp);
+}
+
+static void
+swap_scalar(const byte *in, byte *out, unsigned int count, int size)
+{
+	unsigned int i;
+	uint16 v16;
+	uint32 v32;
+	uint64 v64;
+
+	for (i = 0; i < count; i++, in += size, out += size)
+	{
+		switch (size)
+		{
+		case 2:
+			memcpy(&v16, in, 2);
+			v16 = swap_endianess16(v16);
+			memcpy(out, &v16, 2);
+			break;
+		case 4:
+			memcpy(&v32, in, 4);
+			v32 = swap_endianess32(v32);
+			memcpy(out, &v32, 4);
+			break;
+		case 8:
+			memcpy(&v64, in, 8);
+			v64 = swap_endianess64(v64);
+			memcpy(out, &v64, 8);
+			break;
+		}
+	}
+}
+
+#if HAVE_SSE2
+// Reverse the bytes of every element, 16 bytes at a time
+TARGET("ssse3") static void
+swap_ssse3(const byte *in, byte *out, unsigned int count, int size)
+{
+	__m128i mask;
+	size_t i, bytes;
+
+	switch (size)
+	{
+	case 2:
+		mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		break;
+	case 4:
+		mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		break;
+	default:
+		mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+		break;
+	}
+
+	bytes = (size_t)count * size;
+	for (i = 0; i + 16 <= bytes; i += 16)
+		_mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), mask));
+
+	swap_scalar(in + i, out + i, (unsigned int)((bytes - i) / size), size);
+}
+#endif
+
+// Compare native values exactly, 64 bit integers do not fit a double
+static int
+value_less(const value_u *first, const value_u *second, int type)
+{
+	switch (type)
+	{
+	case Int64:
+		return first->i64 < second->i64;
+	case Uint64:
+		return first->ui64 < second->ui64;
+	default:
+		return numeric_to_double(first, type) < numeric_to_double(second, type);
+	}
+}
+
+// Convert a block of native elements to doubles, dropping NaNs, while
+// tracking the extremes exactly in the native type
+#define CONVERT(T, field) \
+	for (i = 0; i < count; i++) \
+	{ \
+		T v = ((const T *)in)[i]; \
+		if (v != v) \
+		{ \
+			job->nans++; \
+			continue; \
+		} \
+		if (!job->seen) \
+		{ \
+			job->min.field = v; \
+			job->max.field = v; \
+			job->seen = 1; \
+		} \
+		else if (v < job->min.field) \
+			job->min.field = v; \
+		else if (v > job->max.field) \
+			job->max.field = v; \
+		out[n++] = (double)v; \
+	}
+
+static unsigned int
+to_doubles(struct stats_job *job, const void *in, unsigned int count, double *const out)
+{
+	unsigned int i, n;
+
+	n = 0;
+	switch (job->type)
+	{
+	case Int8: CONVERT(int8, i8); break;
+	case Uint8: case Char8: CONVERT(uint8, ui8); break;
+	case Int16: CONVERT(int16, i16); break;
+	case Uint16: case Char16: CONVERT(uint16, ui16); break;
+	case Int32: CONVERT(int32, i32); break;
+	case Uint32: CONVERT(uint32, ui32); break;
+	case Int64: CONVERT(int64, i64); break;
+	case Uint64: CONVERT(uint64, ui64); break;
+	case Float32: CONVERT(float32, f32); break;
+	case Float64: CONVERT(float64, f64); break;
+	}
+
+	return n;
+}
+
+#undef CONVERT
+
+// Mean and sum of squared deviations of a block, in two passes over
+// values which are still in cache
+static void
+block_moments(const double *v, unsigned int n, double *const mean, double *const m2)
+{
+	unsigned int i;
+	double sum, dev, d;
+#if HAVE_SSE2
+	__m128d acc0, acc1, m, x0, x1;
+	double lanes[2];
+
+	acc0 = _mm_setzero_pd();
+	acc1 = _mm_setzero_pd();
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc0 = _mm_add_pd(acc0, _mm_loadu_pd(v + i));
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(v + i + 2));
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	sum = lanes[0] + lanes[1];
+	for (; i < n; i++)
+		sum += v[i];
+
+	*mean = sum / n;
+
+	m = _mm_set1_pd(*mean);
+	acc0 = _mm_setzero_pd();
+	acc1 = _mm_setzero_pd();
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		x0 = _mm_sub_pd(_mm_loadu_pd(v + i), m);
+		x1 = _mm_sub_pd(_mm_loadu_pd(v + i + 2), m);
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(x0, x0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(x1, x1));
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	dev = lanes[0] + lanes[1];
+#else
+	sum = 0.0;
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	*mean = sum / n;
+
+	dev = 0.0;
+	i = 0;
+#endif
+	for (; i < n; i++)
+	{
+		d = v[i] - *mean;
+		dev += d * d;
+	}
+
+	*m2 = dev;
+}
+
+// Combine the moments of another set of values, by Chan's method
+static void
+merge_moments(struct stats_job *into, uint64 n, double mean, double m2)
+{
+	double delta, total;
+
+	if (!n)
+		return;
+
+	total = (double)(into->nvalues + n);
+	delta = mean - into->mean;
+	into->mean += delta * (double)n / total;
+	into->m2 += m2 + delta * delta * ((double)into->nvalues * (double)n / total);
+	into->nvalues += n;
+}
+
+static void
+stats_proc(void *arg)
+{
+	struct stats_job *job = arg;
+	value_u *native;
+	double *values, mean, m2;
+	unsigned int pos, len, n;
+	int size;
+
+	native = malloc(BLOCK_COUNT * sizeof(value_u));
+	values = malloc(BLOCK_COUNT * sizeof(double));
+	if (!native || !values)
+	{
+		job->failed = 1;
+		free(native);
+		free(values);
+		return;
+	}
+
+	size = numeric_size(job->type);
+	for (pos = 0; pos < job->count; pos += len)
+	{
+		len = job->count - pos < BLOCK_COUNT ? job->count - pos : BLOCK_COUNT;
+		numeric_decode(job->data + (size_t)pos * size, len, job->type, job->endianess, native);
+
+		n = to_doubles(job, native, len, values);
+		if (!n)
+			continue;
+
+		block_moments(values, n, &mean, &m2);
+		merge_moments(job, n, mean, m2);
+	}
+
+	free(native);
+	free(values);
+}
+
+static void
+histogram_proc(void *arg)
+{
+	struct stats_job *job = arg;
+	struct stats_job scratch;
+	value_u *native;
+	double *values;
+	unsigned int pos, len, n, i;
+	int size, bin;
+
+	native = malloc(BLOCK_COUNT * sizeof(value_u));
+	values = malloc(BLOCK_COUNT * sizeof(double));
+	if (!native || !values)
+	{
+		job->failed = 1;
+		free(native);
+		free(values);
+		return;
+	}
+
+	// conversion tracks extremes, which are already known
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.type = job->type;
+
+	size = numeric_size(job->type);
+	for (pos = 0; pos < job->count; pos += len)
+	{
+		len = job->count - pos < BLOCK_COUNT ? job->count - pos : BLOCK_COUNT;
+		numeric_decode(job->data + (size_t)pos * size, len, job->type, job->endianess, native);
+
+		n = to_doubles(&scratch, native, len, values);
+		for (i = 0; i < n; i++)
+		{
+			bin = (int)((values[i] - job->lo) * job->scale);
+			job->histogram[bin < NUMERIC_BINS ? bin : NUMERIC_BINS - 1]++;
+		}
+	}
+
+	free(native);
+	free(values);
+}
+
+static void
+downsample_proc(void *arg)
+{
+	struct downsample_job *job = arg;
+	struct stats_job scratch;
+	value_u *native;
+	double *values;
+	unsigned int b, pos, end, len;
+	int size;
+
+	native = malloc(BLOCK_COUNT * sizeof(value_u));
+	values = malloc(BLOCK_COUNT * sizeof(double));
+	if (!native || !values)
+	{
+		job->failed = 1;
+		free(native);
+		free(values);
+		return;
+	}
+
+	// the conversion to doubles tracks the extremes of each bucket
+	memset(&scratch, 0, sizeof(scratch));
+	scratch.type = job->type;
+
+	size = numeric_size(job->type);
+	for (b = job->first; b < job->end; b++)
+	{
+		pos = (unsigned int)((uint64)b * job->count / job->buckets);
+		end = (unsigned int)((uint64)(b + 1) * job->count / job->buckets);
+
+		scratch.seen = 0;
+		for (; pos < end; pos += len)
+		{
+			len = end - pos < BLOCK_COUNT ? end - pos : BLOCK_COUNT;
+			numeric_decode(job->data + (size_t)pos * size, len, job->type, job->endianess, native);
+			to_doubles(&scratch, native, len, values);
+		}
+
+		job->mins[b] = scratch.seen ? numeric_to_double(&scratch.min, job->type) : NAN;
+		job->maxs[b] = scratch.seen ? numeric_to_double(&scratch.max, job->type) : NAN;
+	}
+
+	free(native);
+	free(values);
+}
+
+static void
+export_proc(void *arg)
+{
+	struct export_job *job = arg;
+	value_u native[BLOCK_COUNT / 8];
+	unsigned int pos, len, i;
+	char *p;
+	int size;
+
+	size = numeric_size(job->type);
+	if (job->format == ExportRaw)
+	{
+		numeric_decode(job->data, job->count, job->type, job->endianess, job->buf);
+		job->size = (size_t)job->count * size;
+		return;
+	}
+
+	p = job->buf;
+	for (pos = 0; pos < job->count; pos += len)
+	{
+		len = job->count - pos < BLOCK_COUNT / 8 ? job->count - pos : BLOCK_COUNT / 8;
+		numeric_decode(job->data + (size_t)pos * size, len, job->type, job->endianess, native);
+
+		for (i = 0; i < len; i++)
+		{
+			if (job->format == ExportNdjson)
+			{
+				memcpy(p, "{\"index\":", 9);
+				p += 9;
+				p += format_uint(job->first + pos + i, p);
+				memcpy(p, ",\"value\":", 9);
+				p += 9;
+			}
+			else
+			{
+				p += format_uint(job->first + pos + i, p);
+				*p++ = ',';
+			}
+
+			// JSON has no NaN or infinity
+			if (job->format == ExportNdjson && (job->type == Float32 || job->type == Float64)
+				&& numeric_to_double((byte *)native + i * size, job->type) - numeric_to_double((byte *)native + i * size, job->type) != 0.0)
+			{
+				memcpy(p, "null", 4);
+				p += 4;
+			}
+			else
+				p += numeric_format((byte *)native + i * size, job->type, p);
+
+			if (job->format == ExportNdjson)
+				*p++ = '}';
+			*p++ = '\n';
+		}
+	}
+
+	job->size = p - job->buf;
+}
+
+static size_t
+format_uint(uint64 value, char *const out)
+{
+	char buf[20];
+	char *p;
+	size_t len;
+
+	// two digits at a time from the end
+	p = buf + sizeof(buf);
+	while (value >= 100)
+	{
+		p -= 2;
+		memcpy(p, digit_pairs + (value % 100) * 2, 2);
+		value /= 100;
+	}
+
+	if (value >= 10)
+	{
+		p -= 2;
+		memcpy(p, digit_pairs + value * 2, 2);
+	}
+	else
+		*--p = (char)('0' + value);
+
+	len = buf + sizeof(buf) - p;
+	memcpy(out, p, len);
+	return len;
+}
+
+static size_t
+format_int(int64 value, char *const out)
+{
+	if (value < 0)
+	{
+		*out = '-';
+		return 1 + format_uint(0 - (uint64)value, out + 1);
+	}
+	return format_uint((uint64)value, out);
+}
+
+static diyfp
+diyfp_make(uint64 f, int e)
+{
+	diyfp result;
+
+	result.f = f;
+	result.e = e;
+	return result;
+}
+
+// The upper 64 bits of the product, rounded
+static diyfp
+diyfp_mul(diyfp x, diyfp y)
+{
+	uint64 u_lo, u_hi, v_lo, v_hi;
+	uint64 p0, p1, p2, p3, q;
+
+	u_lo = x.f & 0xffffffff;
+	u_hi = x.f >> 32;
+	v_lo = y.f & 0xffffffff;
+	v_hi = y.f >> 32;
+
+	p0 = u_lo * v_lo;
+	p1 = u_lo * v_hi;
+	p2 = u_hi * v_lo;
+	p3 = u_hi * v_hi;
+
+	q = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff);
+	q += (uint64)1 << 31;
+
+	return diyfp_make(p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+static diyfp
+diyfp_normalize(diyfp x)
+{
+	while (!(x.f >> 63))
+	{
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+// Format a finite or non finite value. The boundaries of the value, the
+// midpoints to its neighbours, are those of float32 if single is set,
+// so floats get their own shortest representation.
+static size_t
+format_real(double value, int single, char *const out)
+{
+	char *p;
+	uint64 bits, f, hidden;
+	diyfp v, m_plus, m_minus;
+	int precision, bias, e, len, exp10, n, k, max_exp, x;
+	float32 value32;
+	uint32 bits32;
+
+	p = out;
+	if (value != value)
+	{
+		memcpy(p, "nan", 3);
+		return 3;
+	}
+
+	if (value < 0.0 || (value == 0.0 && 1.0 / value < 0.0))
+	{
+		*p++ = '-';
+		value = -value;
+	}
+
+	if (value == 0.0)
+	{
+		*p++ = '0';
+		return p - out;
+	}
+
+	if (value - value != 0.0)
+	{
+		memcpy(p, "inf", 3);
+		return p + 3 - out;
+	}
+
+	if (single)
+	{
+		value32 = (float32)value;
+		memcpy(&bits32, &value32, 4);
+		bits = bits32;
+		precision = 24;
+		bias = 127 + 23;
+		max_exp = MAX_PLAIN_EXP_32;
+	}
+	else
+	{
+		memcpy(&bits, &value, 8);
+		precision = 53;
+		bias = 1023 + 52;
+		max_exp = MAX_PLAIN_EXP_64;
+	}
+
+	hidden = (uint64)1 << (precision - 1);
+	e = (int)(bits >> (precision - 1));
+	f = bits & (hidden - 1);
+
+	// denormals have no hidden bit
+	v = e ? diyfp_make(f + hidden, e - bias) : diyfp_make(f, 1 - bias);
+
+	// the lower boundary is closer at powers of two
+	m_plus = diyfp_normalize(diyfp_make(2 * v.f + 1, v.e - 1));
+	m_minus = f == 0 && e > 1 ? diyfp_make(4 * v.f - 1, v.e - 2) : diyfp_make(2 * v.f - 1, v.e - 1);
+	m_minus.f <<= m_minus.e - m_plus.e;
+	m_minus.e = m_plus.e;
+
+	len = 0;
+	exp10 = 0;
+	grisu2(p, &len, &exp10, m_minus, diyfp_normalize(v), m_plus);
+
+	// place the decimal point, n is its position after the first digit
+	k = len;
+	n = len + exp10;
+
+	if (k <= n && n <= max_exp)
+	{
+		// 1234000
+		memset(p + k, '0', n - k);
+		return p + n - out;
+	}
+
+	if (0 < n && n <= max_exp)
+	{
+		// 1234.5
+		memmove(p + n + 1, p + n, k - n);
+		p[n] = '.';
+		return p + k + 1 - out;
+	}
+
+	if (MIN_PLAIN_EXP < n && n <= 0)
+	{
+		// 0.0012345
+		memmove(p + 2 - n, p, k);
+		p[0] = '0';
+		p[1] = '.';
+		memset(p + 2, '0', -n);
+		return p + 2 - n + k - out;
+	}
+
+	// 1.2345e+20, with at least two digits of exponent as printf does
+	if (k > 1)
+	{
+		memmove(p + 2, p + 1, k - 1);
+		p[1] = '.';
+		p += k + 1;
+	}
+	else
+		p++;
+
+	*p++ = 'e';
+	x = n - 1;
+	*p++ = x < 0 ? '-' : '+';
+	if (x < 0)
+		x = -x;
+	if (x >= 100)
+	{
+		*p++ = (char)('0' + x / 100);
+		x %= 100;
+	}
+	memcpy(p, digit_pairs + x * 2, 2);
+	p += 2;
+
+	return p - out;
+}
+
+// Move the last digit down while the result stays within the boundaries
+// and gets closer to the exact value
+static void
+grisu2_round(char *const buf, int len, uint64 dist, uint64 delta, uint64 rest, uint64 ten_k)
+{
+	while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+	{
+		buf[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+// Generate the shortest digits between m_minus and m_plus, which have
+// been scaled into [2^alpha, 2^gamma)
+static void
+grisu2_digit_gen(char *const buf, int *const len, int *const exp10, diyfp m_minus, diyfp w, diyfp m_plus)
+{
+	static const uint32 pow10s[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+	uint64 delta, dist, one, p2, rest;
+	uint32 p1, pow10, d;
+	int shift, n, m;
+
+	delta = m_plus.f - m_minus.f;
+	dist = m_plus.f - w.f;
+
+	shift = -m_plus.e;
+	one = (uint64)1 << shift;
+
+	// integral and fractional parts of m_plus
+	p1 = (uint32)(m_plus.f >> shift);
+	p2 = m_plus.f & (one - 1);
+
+	for (n = 9; n > 0 && p1 < pow10s[n]; n--)
+		;
+	pow10 = pow10s[n];
+	n++;
+
+	while (n > 0)
+	{
+		d = p1 / pow10;
+		p1 %= pow10;
+		buf[(*len)++] = (char)('0' + d);
+		n--;
+
+		rest = ((uint64)p1 << shift) + p2;
+		if (rest <= delta)
+		{
+			*exp10 += n;
+			grisu2_round(buf, *len, dist, delta, rest, (uint64)pow10 << shift);
+			return;
+		}
+
+		pow10 /= 10;
+	}
+
+	for (m = 0;;)
+	{
+		p2 *= 10;
+		buf[(*len)++] = (char)('0' + (p2 >> shift));
+		p2 &= one - 1;
+		m++;
+
+		delta *= 10;
+		dist *= 10;
+		if (p2 <= delta)
+			break;
+	}
+
+	*exp10 -= m;
+	grisu2_round(buf, *len, dist, delta, p2, one);
+}
+
+// Shortest digits of v given its boundaries, by Florian Loitsch's Grisu2
+// with the boundary handling of later implementations. The digits read
+// back as v, and are the shortest such in all but rare cases.
+static void
+grisu2(char *const buf, int *const len, int *const exp10, diyfp m_minus, diyfp v, diyfp m_plus)
+{
+	const struct cached_power *cached;
+	diyfp c, w, w_minus, w_plus;
+	int f, k;
+
+	// a power of ten bringing the exponent of m_plus into range
+	f = GRISU_ALPHA - m_plus.e - 1;
+	k = (f * 78913) / (1 << 18) + (f > 0);
+	cached = &cached_powers[(300 + k + 7) / 8];
+	c = diyfp_make(cached->f, cached->e);
+
+	w = diyfp_mul(v, c);
+	w_minus = diyfp_mul(m_minus, c);
+	w_plus = diyfp_mul(m_plus, c);
+
+	// keep strictly inside the boundaries, the products are inexact
+	w_minus.f++;
+	w_plus.f--;
+
+	*exp10 = -cached->k;
+	grisu2_digit_gen(buf, len, exp10, w_minus, w, w_plus);
+}
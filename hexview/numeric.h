@@ -0,0 +1,122 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "defs.h"
+#include "util.h"
+
+#define NUMERIC_MAX_CHARS 32   // longest formatted value, see numeric_format
+#define NUMERIC_BINS 16        // histogram bins in numeric_stats_t
+
+enum
+{
+	ExportCsv,     // "index,value" lines with a header
+	ExportNdjson,  // one {"index":..,"value":..} object per line
+	ExportRaw      // native endian binary
+};
+
+typedef struct numeric_stats_s numeric_stats_t;
+struct numeric_stats_s
+{
+	uint64 count;  // Number of values, NaNs excluded.
+	uint64 nans;   // Number of NaNs, only for float types.
+	value_u min;   // Smallest value, in the native type.
+	value_u max;   // Largest value, in the native type.
+	double mean;
+	double stddev;  // Population standard deviation.
+
+	// Number of values in each of NUMERIC_BINS equal bins from min to max,
+	// all zero if min or max is infinite.
+	uint64 histogram[NUMERIC_BINS];
+};
+
+// Parse the name of an element type, as used by darr.
+// Parameters:
+// - name: The name, such as "uint16" or "float".
+//
+// Returns:
+// The type, Int8 to Char16, or -1 if the name is unknown.
+int numeric_type(const char *name);
+
+// Returns the name of an element type, as numeric_type parses it.
+const char *numeric_name(int type);
+
+// Returns the size in bytes of an element type.
+int numeric_size(int type);
+
+// Returns the value of a native element as a double.
+// Parameters:
+// - value: Pointer to the element.
+// - type: The type of the element.
+double numeric_to_double(const void *value, int type);
+
+// Convert an array to native endianess. Whole vectors of elements are
+// byte swapped at a time where the processor allows.
+// Parameters:
+// - in: The elements to convert.
+// - count: The number of elements.
+// - type: The type of the elements.
+// - endianess: The endianess of in.
+// - out: Destination, count elements. Must not overlap in.
+void numeric_decode(const byte *in, unsigned int count, int type, int endianess, void *const out);
+
+// Format a native element as the shortest decimal string which reads
+// back as the same value. Characters are formatted as their code.
+// Parameters:
+// - value: Pointer to the element.
+// - type: The type of the element.
+// - out: Destination buffer, at least NUMERIC_MAX_CHARS characters.
+//
+// Returns:
+// The number of characters written to out, not null terminated.
+size_t numeric_format(const void *value, int type, char *const out);
+
+// Compute statistics of an array, decoding blocks of it on all
+// avaliable cores. Extremes, mean and deviation are found in one pass,
+// then the histogram in a second pass once the range is known.
+// Parameters:
+// - data: The elements, in the given endianess.
+// - count: The number of elements.
+// - type: The type of the elements.
+// - endianess: The endianess of data.
+// - out: Output parameter which will contain the statistics.
+//
+// Returns:
+// Nonzero on success, 0 if memory could not be allocated.
+int numeric_stats(const byte *data, unsigned int count, int type, int endianess, numeric_stats_t *const out);
+
+// Reduce an array to the smallest and largest value in each of a number
+// of equal buckets, for plotting. Buckets are split among all avaliable
+// cores, each decoding its elements a block at a time.
+// Parameters:
+// - data: The elements, in the given endianess.
+// - count: The number of elements.
+// - type: The type of the elements.
+// - endianess: The endianess of data.
+// - buckets: The number of buckets, at most count.
+// - mins: Output parameter which will contain the smallest value of each
+//         bucket, or NaN if it only has NaNs.
+// - maxs: Output parameter which will contain the largest value of each
+//         bucket, or NaN if it only has NaNs.
+//
+// Returns:
+// Nonzero on success, 0 if memory could not be allocated.
+int numeric_downsample(const byte *data, unsigned int count, int type, int endianess, unsigned int buckets, double *const mins, double *const maxs);
+
+// Write an array to a file as text or native binary. Text is formatted
+// in chunks on all avaliable cores and written in order.
+// Parameters:
+// - data: The elements, in the given endianess.
+// - count: The number of elements.
+// - type: The type of the elements.
+// - endianess: The endianess of data.
+// - format: ExportCsv, ExportNdjson or ExportRaw.
+// - fp: The file to write to.
+//
+// Returns:
+// Nonzero if everything was written.
+int numeric_export(const byte *data, unsigned int count, int type, int endianess, int format, FILE *fp);
+
+#endif
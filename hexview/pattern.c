@@ -1,7 +1,9 @@
 #include "pattern.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#include "thread.h"
 #include "tokenizer.h"
 #include "util.h"
 
@@ -27,10 +29,30 @@ struct pattern_s
 	unsigned int capacity;
 };
 
+// A range of the data searched by a single thread, for matches which
+// start in it
+struct find_job
+{
+	pattern_t *pattern;
+	const byte *data;
+	unsigned int size;
+	unsigned int start;
+	unsigned int end;
+	unsigned int *matches;
+	unsigned int count;
+	unsigned int capacity;
+	int failed;
+};
+
 static int has_prefix(const char *s, const char *prefix);
 static void append_entry(pattern_t *pattern, struct pat_entry entry);
 static void append_memory(pattern_t *pattern, void *mem, unsigned int length);
 static void append_bytes(pattern_t *pattern, short *bytes, unsigned int count);
+static void find_proc(void *arg);
+static int find_range(pattern_t *pattern, const byte *data, unsigned int size, unsigned int start, unsigned int end,
+	unsigned int **const matches, unsigned int *const count, unsigned int *const capacity);
+static int find_first(pattern_t *pattern, const byte *data, unsigned int size, unsigned int start, unsigned int end, unsigned int *const out);
+static int add_match(unsigned int off, unsigned int **const matches, unsigned int *const count, unsigned int *const capacity);
 
 static inline void
 append_byte(pattern_t *pattern, uint8 byte)
@@ -269,6 +291,95 @@ pattern_find_next(pattern_t *pattern, const byte *bytes, unsigned int maxsearch,
 	return 1;
 }
 
+int
+pattern_find_all(pattern_t *pattern, const byte *data, unsigned int size, unsigned int **const out)
+{
+	struct find_job *jobs, *job;
+	unsigned int *matches;
+	unsigned int count, capacity, per, next, stop, off, i;
+	int njobs, n, failed;
+
+	matches = NULL;
+	count = 0;
+	capacity = 0;
+	if (!pattern->count || pattern->count > size)
+	{
+		*out = NULL;
+		return 0;
+	}
+
+	njobs = cpu_count();
+	if ((unsigned int)njobs > size / pattern->count)
+		njobs = size / pattern->count;
+
+	jobs = calloc(njobs, sizeof(struct find_job));
+	if (!jobs)
+		return -1;
+
+	// contiguous shares keep each thread reading the data in order
+	per = size / njobs + 1;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].pattern = pattern;
+		jobs[n].data = data;
+		jobs[n].size = size;
+		jobs[n].start = (uint64)n * per < size ? n * per : size;
+		jobs[n].end = size - jobs[n].start > per ? jobs[n].start + per : size;
+	}
+
+	run_parallel(&find_proc, jobs, njobs, sizeof(struct find_job));
+
+	// each share was searched from its start, when a match runs over
+	// from the share before, the matches after it can start at other
+	// bytes than a single search finds, so they are searched again one by
+	// one until they meet those of the share
+	failed = 0;
+	next = 0;
+	for (n = 0; n < njobs && !failed; n++)
+	{
+		job = &jobs[n];
+		failed = job->failed;
+		i = 0;
+		while (!failed && next > job->start)
+		{
+			while (i < job->count && job->matches[i] < next)
+				i++;
+			stop = i < job->count ? job->matches[i] + 1 : job->end;
+			if (next >= stop || !find_first(pattern, data, size, next, stop, &off) || (i < job->count && off == job->matches[i]))
+				break;
+			failed = !add_match(off, &matches, &count, &capacity);
+			next = off + pattern->count;
+		}
+
+		for (; i < job->count && !failed; i++)
+			failed = !add_match(job->matches[i], &matches, &count, &capacity);
+		if (count)
+			next = matches[count - 1] + pattern->count;
+	}
+
+	for (n = 0; n < njobs; n++)
+		free(jobs[n].matches);
+	free(jobs);
+
+	if (failed)
+	{
+		free(matches);
+		return -1;
+	}
+
+	*out = matches;
+	return (int)count;
+}
+
+int
+pattern_get(pattern_t *pattern, unsigned int i)
+{
+	struct pat_entry m;
+
+	m = pattern->bytes[i];
+	return m.wildcard ? -1 : m.value;
+}
+
 static int
 has_prefix(const char *s, const char *prefix)
 {
@@ -318,4 +429,65 @@ static void
 append_bytes(pattern_t *pattern, short *bytes, unsigned int count)
 {
 
-}
\ No newline at end of file
+}
+
+static void
+find_proc(void *arg)
+{
+	struct find_job *job;
+
+	job = arg;
+	job->failed = !find_range(job->pattern, job->data, job->size, job->start, job->end, &job->matches, &job->count, &job->capacity);
+}
+
+// Add the matches which start in [start, end) to the end of an array,
+// each after the end of the one before. Returns 0 if memory could not
+// be allocated.
+static int
+find_range(pattern_t *pattern, const byte *data, unsigned int size, unsigned int start, unsigned int end,
+	unsigned int **const matches, unsigned int *const count, unsigned int *const capacity)
+{
+	unsigned int pos, off;
+
+	for (pos = start; pos < end && find_first(pattern, data, size, pos, end, &off); pos = off + pattern->count)
+	{
+		if (!add_match(off, matches, count, capacity))
+			return 0;
+	}
+
+	return 1;
+}
+
+// Find the first match which starts in [start, end), it can run past
+// the end. Returns nonzero if there is one.
+static int
+find_first(pattern_t *pattern, const byte *data, unsigned int size, unsigned int start, unsigned int end, unsigned int *const out)
+{
+	unsigned int limit, off;
+
+	limit = size - end > pattern->count - 1 ? end + pattern->count - 1 : size;
+	if (limit - start < pattern->count || !pattern_find_next(pattern, data + start, limit - start, &off))
+		return 0;
+
+	*out = start + off;
+	return 1;
+}
+
+// Returns 0 if memory could not be allocated.
+static int
+add_match(unsigned int off, unsigned int **const matches, unsigned int *const count, unsigned int *const capacity)
+{
+	unsigned int *grown;
+
+	if (*count == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 1024;
+		grown = realloc(*matches, (size_t)*capacity * sizeof(unsigned int));
+		if (!grown)
+			return 0;
+		*matches = grown;
+	}
+
+	(*matches)[(*count)++] = off;
+	return 1;
+}
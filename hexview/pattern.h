@@ -38,4 +38,29 @@ void pattern_free(pattern_t *pattern);
 // Nonzero if a match was found.
 int pattern_find_next(pattern_t *pattern, const byte *bytes, unsigned int maxsearch, unsigned int *const out);
 
+// Finds every match of a pattern on an array of bytes, each starting
+// after the end of the one before as a search from the start would find
+// them, searching a share of the bytes on each processor.
+//
+// Parameters:
+// - pattern: The pattern to test against.
+// - data: Pointer to the start of the data to search.
+// - size: The number of bytes to search.
+// - out: Output parameter giving the offsets of the matches in
+//        ascending order, to be freed with free.
+//
+// Returns:
+// The number of matches, or -1 if memory could not be allocated.
+int pattern_find_all(pattern_t *pattern, const byte *data, unsigned int size, unsigned int **const out);
+
+// Gets the byte matched at a position in a pattern.
+//
+// Parameters:
+// - pattern: The pattern to query.
+// - i: The position in the pattern, must be less than its size.
+//
+// Returns:
+// The byte matched, or -1 if the position is a wildcard.
+int pattern_get(pattern_t *pattern, unsigned int i);
+
 #endif
@@ -0,0 +1,633 @@
+#if __linux__
+#define _GNU_SOURCE  // for copy_file_range
+#endif
+
+#include "piece.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32
+#include <Windows.h>
+#elif __linux__ || __APPLE__
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+#define MIN_NODES 64
+#define MIN_ADDED 4096
+#define WRITE_BLOCK 1048576  // most bytes written by one call, Windows takes 32-bit counts
+
+struct piece
+{
+	unsigned int left;
+	unsigned int right;
+	unsigned int priority;  // no lower than the priorities of the children
+	unsigned int start;     // offset of the bytes in the original data or the added bytes
+	unsigned int length;
+	unsigned int sum;       // bytes in the subtree
+	int added;              // the bytes are added ones
+};
+
+// Where a save writes the pieces
+struct save_job
+{
+	const pieces_t *pieces;
+#if _WIN32
+	HANDLE file;
+#elif __linux__ || __APPLE__
+	int file;
+	int source;  // the file the original data was read from, -1 once copy_file_range fails
+#endif
+};
+
+typedef int(*piece_fn)(const struct piece *piece, unsigned int pos, void *arg);
+
+static int reserve(pieces_t *pieces, unsigned int count);
+static unsigned int new_node(pieces_t *pieces, unsigned int start, unsigned int length, int added);
+static void release(pieces_t *pieces, unsigned int t);
+static void update(pieces_t *pieces, unsigned int t);
+static void split(pieces_t *pieces, unsigned int t, unsigned int pos, unsigned int *const left, unsigned int *const right);
+static unsigned int merge(pieces_t *pieces, unsigned int left, unsigned int right);
+static void read_range(const pieces_t *pieces, unsigned int t, unsigned int pos, unsigned int off, unsigned int end, byte *const out);
+static int each_piece(const pieces_t *pieces, unsigned int t, unsigned int pos, piece_fn fn, void *arg);
+static int check_place(const struct piece *piece, unsigned int pos, void *arg);
+static int patch_piece(const struct piece *piece, unsigned int pos, void *arg);
+static int save_piece(const struct piece *piece, unsigned int pos, void *arg);
+static int write_all(struct save_job *job, const byte *bytes, unsigned int len);
+
+pieces_t *
+pieces_create(const byte *data, unsigned int size)
+{
+	pieces_t *pieces;
+
+	pieces = calloc(1, sizeof(pieces_t));
+	if (!pieces)
+		return NULL;
+
+	pieces->base = data;
+	pieces->base_size = size;
+	pieces->seed = 0x9e3779b9;
+	if (!reserve(pieces, MIN_NODES))
+	{
+		free(pieces);
+		return NULL;
+	}
+
+	if (size)
+		pieces->root = new_node(pieces, 0, size, 0);
+	pieces->size = size;
+	return pieces;
+}
+
+void
+pieces_free(pieces_t *pieces)
+{
+	if (!pieces) return;
+	free(pieces->added);
+	free(pieces->nodes);
+	free(pieces);
+}
+
+int
+pieces_reserve(pieces_t *pieces, unsigned int count, uint64 bytes)
+{
+	byte *grown;
+	uint64 capacity;
+
+	if (count > 0x7fffffff / 3 || !reserve(pieces, 3 * count))
+		return 0;
+
+	if (bytes <= pieces->added_capacity - pieces->added_size)
+		return 1;
+
+	capacity = pieces->added_capacity ? pieces->added_capacity : MIN_ADDED;
+	while (capacity < pieces->added_size + bytes)
+		capacity *= 2;
+	if (capacity > 0xffffffff)
+		capacity = 0xffffffff;
+	if (capacity < pieces->added_size + bytes)
+		return 0;
+
+	grown = realloc(pieces->added, (size_t)capacity);
+	if (!grown)
+		return 0;
+	pieces->added = grown;
+	pieces->added_capacity = (unsigned int)capacity;
+	return 1;
+}
+
+int
+pieces_splice(pieces_t *pieces, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size)
+{
+	unsigned int left, middle, right, node, start;
+
+	if (!old_size && !new_size)
+		return 1;
+	if (new_size > old_size && new_size - old_size > 0xffffffff - pieces->size)
+		return 0;
+	if (!pieces_reserve(pieces, 1, new_size))
+		return 0;
+
+	split(pieces, pieces->root, off, &left, &right);
+	split(pieces, right, old_size, &middle, &right);
+	release(pieces, middle);
+
+	if (new_size)
+	{
+		// the same bytes added again, as by a fill or a replace, are
+		// added once
+		if (pieces->added_size >= new_size && !memcmp(pieces->added + pieces->added_size - new_size, bytes, new_size))
+			start = pieces->added_size - new_size;
+		else
+		{
+			start = pieces->added_size;
+			memcpy(pieces->added + start, bytes, new_size);
+			pieces->added_size += new_size;
+		}
+
+		node = new_node(pieces, start, new_size, 1);
+		left = merge(pieces, left, node);
+	}
+
+	pieces->root = merge(pieces, left, right);
+	pieces->size += new_size - old_size;
+	return 1;
+}
+
+unsigned int
+pieces_read(void *arg, unsigned int off, byte *out, unsigned int len)
+{
+	const pieces_t *pieces;
+
+	pieces = arg;
+	if (off >= pieces->size)
+		return 0;
+	if (len > pieces->size - off)
+		len = pieces->size - off;
+
+	read_range(pieces, pieces->root, 0, off, off + len, out);
+	return len;
+}
+
+int
+pieces_in_place(const pieces_t *pieces)
+{
+	return pieces->size == pieces->base_size && each_piece(pieces, pieces->root, 0, &check_place, NULL);
+}
+
+int
+pieces_patch(const pieces_t *pieces, const char *filename)
+{
+	struct save_job job;
+	int result;
+
+	job.pieces = pieces;
+#if _WIN32
+	job.file = CreateFileA(filename, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (job.file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	result = each_piece(pieces, pieces->root, 0, &patch_piece, &job) && FlushFileBuffers(job.file);
+	CloseHandle(job.file);
+#elif __linux__ || __APPLE__
+	job.file = open(filename, O_WRONLY);
+	if (job.file == -1)
+		return 0;
+	job.source = -1;
+
+	result = each_piece(pieces, pieces->root, 0, &patch_piece, &job) && !fsync(job.file);
+	result &= !close(job.file);
+#endif
+
+	return result;
+}
+
+int
+pieces_save(const pieces_t *pieces, const char *filename, const char *path)
+{
+	struct save_job job;
+	int result;
+#if __linux__ || __APPLE__
+	struct stat st;
+#endif
+
+	job.pieces = pieces;
+#if _WIN32
+	job.file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (job.file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	result = each_piece(pieces, pieces->root, 0, &save_piece, &job) && FlushFileBuffers(job.file);
+	CloseHandle(job.file);
+	if (!result)
+		DeleteFileA(path);
+#elif __linux__ || __APPLE__
+	// the new file keeps the permissions of the one it replaces
+	job.source = open(filename, O_RDONLY);
+	if (job.source == -1)
+		return 0;
+	if (fstat(job.source, &st))
+	{
+		close(job.source);
+		return 0;
+	}
+
+	job.file = open(path, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+	if (job.file == -1)
+	{
+		close(job.source);
+		return 0;
+	}
+
+	result = each_piece(pieces, pieces->root, 0, &save_piece, &job) && !fsync(job.file);
+	result &= !close(job.file);
+	if (job.source != -1)
+		close(job.source);
+	if (!result)
+		unlink(path);
+#endif
+
+	return result;
+}
+
+int
+pieces_replace(const char *path, const char *filename)
+{
+#if _WIN32
+	return MoveFileExA(path, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#elif __linux__ || __APPLE__
+	const char *slash;
+	char *dir;
+	size_t len;
+	int fd;
+
+	if (rename(path, filename))
+		return 0;
+
+	// the rename is only on disk once the directory holding it is
+	slash = strrchr(filename, '/');
+	len = slash ? (size_t)(slash - filename) + (slash == filename) : 1;
+	dir = malloc(len + 1);
+	if (dir)
+	{
+		memcpy(dir, slash ? filename : ".", len);
+		dir[len] = 0;
+		fd = open(dir, O_RDONLY);
+		if (fd != -1)
+		{
+			fsync(fd);
+			close(fd);
+		}
+		free(dir);
+	}
+
+	return 1;
+#endif
+}
+
+int
+pieces_target(const char *filename, char *out, size_t size)
+{
+#if _WIN32
+	HANDLE file;
+	DWORD len;
+
+	file = CreateFileA(filename, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+
+	len = GetFinalPathNameByHandleA(file, out, (DWORD)size, FILE_NAME_NORMALIZED);
+	CloseHandle(file);
+	return len && len < size;
+#elif __linux__ || __APPLE__
+	char *resolved;
+	size_t len;
+
+	resolved = realpath(filename, NULL);
+	if (!resolved)
+		return 0;
+
+	len = strlen(resolved);
+	if (len < size)
+		memcpy(out, resolved, len + 1);
+	free(resolved);
+	return len < size;
+#endif
+}
+
+// Make sure count more nodes can be made without allocating, so an
+// edit cannot fail halfway. Returns 0 if memory could not be allocated.
+static int
+reserve(pieces_t *pieces, unsigned int count)
+{
+	struct piece *grown;
+	unsigned int capacity;
+
+	// node 0 is the empty tree, nodes are taken from the end of the pool
+	// when none are free
+	if ((uint64)pieces->used + count < pieces->capacity)
+		return 1;
+
+	capacity = pieces->capacity ? pieces->capacity : MIN_NODES;
+	while ((uint64)pieces->used + count >= capacity)
+	{
+		if (capacity > 0x7fffffff / sizeof(struct piece))
+			return 0;
+		capacity *= 2;
+	}
+
+	grown = realloc(pieces->nodes, (size_t)capacity * sizeof(struct piece));
+	if (!grown)
+		return 0;
+	if (!pieces->nodes)
+		memset(grown, 0, sizeof(struct piece));
+
+	pieces->nodes = grown;
+	pieces->capacity = capacity;
+	return 1;
+}
+
+// Take a node from the free list or the end of the pool, which reserve
+// made room for
+static unsigned int
+new_node(pieces_t *pieces, unsigned int start, unsigned int length, int added)
+{
+	struct piece *node;
+	unsigned int t;
+
+	if (pieces->unused)
+	{
+		t = pieces->unused;
+		pieces->unused = pieces->nodes[t].left;
+	}
+	else
+		t = ++pieces->used;
+
+	// xorshift32
+	pieces->seed ^= pieces->seed << 13;
+	pieces->seed ^= pieces->seed >> 17;
+	pieces->seed ^= pieces->seed << 5;
+
+	node = &pieces->nodes[t];
+	node->left = 0;
+	node->right = 0;
+	node->priority = pieces->seed;
+	node->start = start;
+	node->length = length;
+	node->sum = length;
+	node->added = added;
+	return t;
+}
+
+// Put the nodes of a subtree on the free list
+static void
+release(pieces_t *pieces, unsigned int t)
+{
+	unsigned int left, right;
+
+	if (!t) return;
+	left = pieces->nodes[t].left;
+	right = pieces->nodes[t].right;
+	pieces->nodes[t].left = pieces->unused;
+	pieces->unused = t;
+
+	release(pieces, left);
+	release(pieces, right);
+}
+
+static void
+update(pieces_t *pieces, unsigned int t)
+{
+	struct piece *node;
+
+	node = &pieces->nodes[t];
+	node->sum = pieces->nodes[node->left].sum + node->length + pieces->nodes[node->right].sum;
+}
+
+// Split a subtree into the one holding its first pos bytes and the one
+// holding the rest, cutting the piece pos falls inside of in two
+static void
+split(pieces_t *pieces, unsigned int t, unsigned int pos, unsigned int *const left, unsigned int *const right)
+{
+	unsigned int before, cut, tail;
+
+	if (!t)
+	{
+		*left = 0;
+		*right = 0;
+		return;
+	}
+
+	before = pieces->nodes[pieces->nodes[t].left].sum;
+	if (pos <= before)
+	{
+		split(pieces, pieces->nodes[t].left, pos, left, &cut);
+		pieces->nodes[t].left = cut;
+		update(pieces, t);
+		*right = t;
+	}
+	else if (pos >= before + pieces->nodes[t].length)
+	{
+		split(pieces, pieces->nodes[t].right, pos - before - pieces->nodes[t].length, &cut, right);
+		pieces->nodes[t].right = cut;
+		update(pieces, t);
+		*left = t;
+	}
+	else
+	{
+		// the tail of the piece keeps its priority, which is no lower
+		// than that of the right subtree it takes over
+		pos -= before;
+		tail = new_node(pieces, pieces->nodes[t].start + pos, pieces->nodes[t].length - pos, pieces->nodes[t].added);
+		pieces->nodes[tail].priority = pieces->nodes[t].priority;
+		pieces->nodes[tail].right = pieces->nodes[t].right;
+		pieces->nodes[t].right = 0;
+		pieces->nodes[t].length = pos;
+		update(pieces, tail);
+		update(pieces, t);
+		*left = t;
+		*right = tail;
+	}
+}
+
+// Join two subtrees, every byte of the first before those of the second
+static unsigned int
+merge(pieces_t *pieces, unsigned int left, unsigned int right)
+{
+	if (!left || !right)
+		return left ? left : right;
+
+	if (pieces->nodes[left].priority >= pieces->nodes[right].priority)
+	{
+		pieces->nodes[left].right = merge(pieces, pieces->nodes[left].right, right);
+		update(pieces, left);
+		return left;
+	}
+
+	pieces->nodes[right].left = merge(pieces, left, pieces->nodes[right].left);
+	update(pieces, right);
+	return right;
+}
+
+// Copy the bytes [off, end) of a subtree starting at pos, visiting only
+// the pieces which overlap them
+static void
+read_range(const pieces_t *pieces, unsigned int t, unsigned int pos, unsigned int off, unsigned int end, byte *const out)
+{
+	const struct piece *node;
+	unsigned int first, lo, hi;
+
+	while (t)
+	{
+		node = &pieces->nodes[t];
+		first = pos + pieces->nodes[node->left].sum;
+		if (off < first)
+			read_range(pieces, node->left, pos, off, end, out);
+
+		lo = off > first ? off : first;
+		hi = end < first + node->length ? end : first + node->length;
+		if (lo < hi)
+			memcpy(out + (lo - off), (node->added ? pieces->added : pieces->base) + node->start + (lo - first), hi - lo);
+
+		// the right subtree by iteration, long runs of pieces are common
+		if (end <= first + node->length)
+			return;
+		pos = first + node->length;
+		t = node->right;
+	}
+}
+
+// Call a function on each piece of a subtree in order, with the offset
+// of the piece, until it returns 0. Returns 0 if it did.
+static int
+each_piece(const pieces_t *pieces, unsigned int t, unsigned int pos, piece_fn fn, void *arg)
+{
+	const struct piece *node;
+
+	while (t)
+	{
+		node = &pieces->nodes[t];
+		if (!each_piece(pieces, node->left, pos, fn, arg))
+			return 0;
+		pos += pieces->nodes[node->left].sum;
+		if (!fn(node, pos, arg))
+			return 0;
+		pos += node->length;
+		t = node->right;
+	}
+
+	return 1;
+}
+
+static int
+check_place(const struct piece *piece, unsigned int pos, void *arg)
+{
+	(void)arg;
+	return piece->added || piece->start == pos;
+}
+
+// Write an added piece at its offset in the file
+static int
+patch_piece(const struct piece *piece, unsigned int pos, void *arg)
+{
+	struct save_job *job;
+#if _WIN32
+	LARGE_INTEGER at;
+#endif
+
+	job = arg;
+	if (!piece->added)
+		return 1;
+
+#if _WIN32
+	at.QuadPart = pos;
+	if (!SetFilePointerEx(job->file, at, NULL, FILE_BEGIN))
+		return 0;
+#elif __linux__ || __APPLE__
+	if (lseek(job->file, pos, SEEK_SET) == -1)
+		return 0;
+#endif
+
+	return write_all(job, job->pieces->added + piece->start, piece->length);
+}
+
+// Write a piece at the end of the new file
+static int
+save_piece(const struct piece *piece, unsigned int pos, void *arg)
+{
+	struct save_job *job;
+#if __linux__
+	loff_t from;
+	ssize_t copied;
+	unsigned int left;
+#endif
+
+	// pieces are written in order, so the end of the new file is pos
+	(void)pos;
+	job = arg;
+	if (piece->added)
+		return write_all(job, job->pieces->added + piece->start, piece->length);
+
+#if __linux__
+	// the kernel copies the original bytes, or shares their extents on
+	// file systems which can, until it cannot copy between these files
+	from = piece->start;
+	left = piece->length;
+	while (left && job->source != -1)
+	{
+		copied = copy_file_range(job->source, &from, job->file, NULL, left, 0);
+		if (copied > 0)
+			left -= (unsigned int)copied;
+		else if (copied == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)
+		{
+			close(job->source);
+			job->source = -1;
+		}
+		else if (errno != EINTR)
+			return 0;
+	}
+
+	return write_all(job, job->pieces->base + piece->start + (piece->length - left), left);
+#else
+	return write_all(job, job->pieces->base + piece->start, piece->length);
+#endif
+}
+
+// Write bytes at the position of the file of a save. Returns 0 if they
+// could not be written.
+static int
+write_all(struct save_job *job, const byte *bytes, unsigned int len)
+{
+	unsigned int block;
+#if _WIN32
+	DWORD written;
+#elif __linux__ || __APPLE__
+	ssize_t written;
+#endif
+
+	while (len)
+	{
+		block = len < WRITE_BLOCK ? len : WRITE_BLOCK;
+#if _WIN32
+		if (!WriteFile(job->file, bytes, block, &written, NULL) || !written)
+			return 0;
+		block = written;
+#elif __linux__ || __APPLE__
+		written = write(job->file, bytes, block);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return 0;
+		block = (unsigned int)written;
+#endif
+		bytes += block;
+		len -= block;
+	}
+
+	return 1;
+}
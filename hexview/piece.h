@@ -0,0 +1,138 @@
+#ifndef PIECE_H
+#define PIECE_H
+
+#include "defs.h"
+
+#define PIECE_TEMP_EXT ".hvtmp"  // suffix of the file a save is written to before it replaces the original
+
+struct piece;
+
+// The edited contents of a file as a list of pieces, each a run of
+// bytes from the original data or from a buffer the added bytes are
+// appended to. The pieces are kept in a treap ordered by position,
+// each node knowing the size of its subtree, so finding, splitting and
+// joining them at an offset takes logarithmic time however many edits
+// were made, and the original data is never written to.
+typedef struct pieces_s pieces_t;
+struct pieces_s
+{
+	const byte *base;        // The original data.
+	unsigned int base_size;
+	byte *added;             // Every byte inserted or written, in the order they were added.
+	unsigned int added_size;
+	unsigned int added_capacity;
+	struct piece *nodes;     // Pool of the nodes, 0 is the empty tree.
+	unsigned int used;       // Nodes taken from the pool, free ones are reused first.
+	unsigned int capacity;
+	unsigned int unused;     // First node of the list of free nodes, linked by their left child.
+	unsigned int root;
+	unsigned int size;       // Size of the edited data.
+	unsigned int seed;       // State of the generator of node priorities.
+};
+
+// Make a piece table over data which is not edited yet.
+// Parameters:
+// - data: The original data, it must stay valid until the table is
+//         freed.
+// - size: The size of the data.
+//
+// Returns:
+// The table, or NULL if memory could not be allocated.
+pieces_t *pieces_create(const byte *data, unsigned int size);
+
+// Free a piece table.
+// Parameters:
+// - pieces: The table to free, can be NULL.
+void pieces_free(pieces_t *pieces);
+
+// Make room for edits in advance, so the next count edits adding at
+// most bytes bytes in all cannot fail.
+// Parameters:
+// - pieces: The table to edit.
+// - count: The number of edits.
+// - bytes: The number of bytes they add.
+//
+// Returns:
+// Nonzero if there is room, 0 if memory could not be allocated.
+int pieces_reserve(pieces_t *pieces, unsigned int count, uint64 bytes);
+
+// Replace bytes with others, which may be more or fewer. Inserting and
+// deleting are replacing nothing or with nothing.
+// Parameters:
+// - pieces: The table to edit.
+// - off: The offset of the first byte to replace, at most the size of
+//        the data.
+// - old_size: The number of bytes to replace, off + old_size must not be
+//             past the end of the data.
+// - bytes: The bytes to put in their place.
+// - new_size: The number of bytes to put in their place.
+//
+// Returns:
+// Nonzero if the bytes were replaced, 0 if memory could not be
+// allocated or the data would be 4 GiB or more.
+int pieces_splice(pieces_t *pieces, unsigned int off, unsigned int old_size, const byte *bytes, unsigned int new_size);
+
+// Read the edited data, in the form of a file_fill_fn so a lazy file
+// can show it.
+// Parameters:
+// - arg: The table.
+// - off: The offset of the first byte to read.
+// - out: Destination of the bytes.
+// - len: The number of bytes to read.
+//
+// Returns:
+// The number of bytes read, fewer than len past the end of the data.
+unsigned int pieces_read(void *arg, unsigned int off, byte *out, unsigned int len);
+
+// Returns nonzero if the edits only overwrote bytes, so every byte of
+// the original data left is still at its own offset and a save can
+// write the added bytes over the file in place.
+int pieces_in_place(const pieces_t *pieces);
+
+// Write the added bytes over the file the original data was read from,
+// for edits which pieces_in_place allows, and flush them to disk.
+// Parameters:
+// - pieces: The table to save.
+// - filename: The file to write to.
+//
+// Returns:
+// Nonzero if the bytes were written.
+int pieces_patch(const pieces_t *pieces, const char *filename);
+
+// Write the edited data to a new file, copying the runs of original
+// data from the file it was read from with copy_file_range where the
+// system has it, so the kernel moves them without reading them in, and
+// flush it to disk.
+// Parameters:
+// - pieces: The table to save.
+// - filename: The file the original data was read from.
+// - path: The file to create, it is replaced if it exists.
+//
+// Returns:
+// Nonzero if the file was written. On failure it is deleted.
+int pieces_save(const pieces_t *pieces, const char *filename, const char *path);
+
+// Replace a file with another in a single step, so the file is never
+// seen half written, and flush the directory holding it so the new file
+// is there after a crash. On Windows the file must not be open.
+// Parameters:
+// - path: The file to move, as written by pieces_save.
+// - filename: The file to replace, as found by pieces_target, since a
+//             symbolic link would be replaced rather than its target.
+//
+// Returns:
+// Nonzero if the file was replaced.
+int pieces_replace(const char *path, const char *filename);
+
+// Find the file a path leads to through symbolic links, which a save
+// writes beside and replaces.
+// Parameters:
+// - filename: The path of the file.
+// - out: Receives the path of the file, with no links in it.
+// - size: The size of out.
+//
+// Returns:
+// Nonzero if the file was found and its path fits in out.
+int pieces_target(const char *filename, char *out, size_t size);
+
+#endif
@@ -0,0 +1,321 @@
+#if __linux__
+#define _GNU_SOURCE  // for process_vm_readv
+#endif
+
+#include "process.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pattern.h"
+#include "thread.h"
+
+#if __linux__
+#include <stdint.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#define MAX_VIEW_SIZE 0xffffffffu  // most bytes unsigned offsets address
+#define READ_BATCH 256             // most regions read with one system call
+#define SCAN_BUFFER 4194304        // bytes each thread of find reads at once
+#define MIN_JOB_SIZE 1048576       // fewest bytes worth giving their own thread
+
+// A range of the view searched by a single thread
+struct find_job
+{
+	process_t *process;
+	pattern_t *pattern;
+	unsigned int size;
+	unsigned int start;  // matches start from start
+	unsigned int end;    // and before end
+	unsigned int max;
+	byte *buffer;
+	unsigned int matches[PROCESS_MAX_MATCHES];
+	unsigned int count;
+};
+
+static void find_proc(void *arg);
+static int add_region(process_t *process, unsigned int *const capacity, uint64 start, uint64 end, const char *perms, const char *path);
+
+process_t *
+process_open(int pid)
+{
+#if __linux__
+	process_t *process;
+	FILE *maps;
+	char path[64];
+	char line[4096 + 128];
+	char perms[8];
+	unsigned long long start, end;
+	unsigned int capacity;
+	size_t len;
+	int name;
+
+	snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	maps = fopen(path, "r");
+	if (!maps)
+		return NULL;
+
+	process = malloc(sizeof(process_t));
+	if (!process)
+	{
+		fclose(maps);
+		return NULL;
+	}
+	process->pid = pid;
+	process->regions = NULL;
+	process->count = 0;
+	process->size = 0;
+	process->clipped = 0;
+	process->page_size = (unsigned int)sysconf(_SC_PAGESIZE);
+
+	// start-end perms offset dev inode path, the path is optional
+	capacity = 0;
+	while (fgets(line, sizeof(line), maps))
+	{
+		name = 0;
+		if (sscanf(line, "%llx-%llx %7s %*s %*s %*s %n", &start, &end, perms, &name) < 3 || end <= start)
+			continue;
+
+		len = strlen(line);
+		if (len && line[len - 1] == '\n')
+			line[len - 1] = 0;
+
+		if (perms[0] != 'r')
+			continue;
+
+		if (!add_region(process, &capacity, start, end, perms, name ? line + name : ""))
+		{
+			fclose(maps);
+			process_free(process);
+			return NULL;
+		}
+	}
+
+	fclose(maps);
+	return process;
+#else
+	return NULL;
+#endif
+}
+
+void
+process_free(process_t *process)
+{
+	if (!process) return;
+	free(process->regions);
+	free(process);
+}
+
+const region_t *
+process_region(const process_t *process, unsigned int off)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = process->count;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (process->regions[mid].offset <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return &process->regions[lo];
+}
+
+unsigned int
+process_read(void *arg, unsigned int off, byte *out, unsigned int len)
+{
+#if __linux__
+	process_t *process;
+	const region_t *region, *last;
+	struct iovec local;
+	struct iovec remote[READ_BATCH];
+	uint64 address;
+	unsigned int pos, end, batch_end, skip;
+	ssize_t n;
+	int count;
+
+	process = arg;
+	if (off >= process->size)
+		return 0;
+	if (len > process->size - off)
+		len = process->size - off;
+
+	last = process->regions + process->count;
+	pos = off;
+	end = off + len;
+	while (pos < end)
+	{
+		// the regions from pos, in one call
+		region = process_region(process, pos);
+		batch_end = pos;
+		for (count = 0; count < READ_BATCH && region < last && batch_end < end; count++, region++)
+		{
+			remote[count].iov_base = (void *)(uintptr_t)(region->address + (batch_end - region->offset));
+			remote[count].iov_len = (region->offset + region->size < end ? region->offset + region->size : end) - batch_end;
+			batch_end += (unsigned int)remote[count].iov_len;
+		}
+
+		local.iov_base = out + (pos - off);
+		local.iov_len = batch_end - pos;
+		n = process_vm_readv(process->pid, &local, 1, remote, count, 0);
+		if (n > 0)
+			pos += (unsigned int)n;
+		if (pos == batch_end)
+			continue;
+
+		// a page which cannot be read stops the call, it reads as zeros
+		region = process_region(process, pos);
+		address = region->address + (pos - region->offset);
+		skip = process->page_size - (unsigned int)(address % process->page_size);
+		if (skip > region->offset + region->size - pos)
+			skip = region->offset + region->size - pos;
+		if (skip > end - pos)
+			skip = end - pos;
+		memset(out + (pos - off), 0, skip);
+		pos += skip;
+	}
+
+	return len;
+#else
+	return 0;
+#endif
+}
+
+int
+process_find(process_t *process, pattern_t *pattern, unsigned int size, unsigned int from, unsigned int *const out, unsigned int max)
+{
+	struct find_job *jobs;
+	unsigned int jobsize, count, i;
+	int njobs, j;
+
+	if (!size || from >= process->size)
+		return 0;
+	if (max > PROCESS_MAX_MATCHES)
+		max = PROCESS_MAX_MATCHES;
+
+	njobs = cpu_count();
+	jobsize = (process->size - from) / njobs + 1;
+	if (jobsize < MIN_JOB_SIZE)
+	{
+		jobsize = MIN_JOB_SIZE;
+		njobs = (int)((process->size - from) / MIN_JOB_SIZE + 1);
+	}
+
+	jobs = calloc(njobs, sizeof(struct find_job));
+	if (!jobs)
+		return -1;
+
+	for (j = 0; j < njobs; j++)
+	{
+		jobs[j].process = process;
+		jobs[j].pattern = pattern;
+		jobs[j].size = size;
+		jobs[j].start = (uint64)j * jobsize < process->size - from ? from + (unsigned int)j * jobsize : process->size;
+		jobs[j].end = process->size - jobs[j].start > jobsize ? jobs[j].start + jobsize : process->size;
+		jobs[j].max = max;
+		jobs[j].buffer = malloc((size_t)SCAN_BUFFER + size);
+		if (!jobs[j].buffer)
+		{
+			while (j >= 0)
+				free(jobs[j--].buffer);
+			free(jobs);
+			return -1;
+		}
+	}
+
+	run_parallel(&find_proc, jobs, njobs, sizeof(struct find_job));
+
+	// the jobs are in order, so the first matches are those of the first jobs
+	count = 0;
+	for (j = 0; j < njobs; j++)
+	{
+		for (i = 0; i < jobs[j].count && count < max; i++)
+			out[count++] = jobs[j].matches[i];
+		free(jobs[j].buffer);
+	}
+
+	free(jobs);
+	return (int)count;
+}
+
+static void
+find_proc(void *arg)
+{
+	struct find_job *job;
+	const region_t *region;
+	unsigned int pos, stop, limit, region_end, at, off, n;
+
+	job = arg;
+	pos = job->start;
+	while (pos < job->end && job->count < job->max)
+	{
+		region = process_region(job->process, pos);
+		region_end = region->offset + region->size;
+
+		// matches starting before stop, read with the bytes they can run into
+		stop = job->end < region_end ? job->end : region_end;
+		if (stop - pos > SCAN_BUFFER)
+			stop = pos + SCAN_BUFFER;
+		limit = region_end - stop > job->size - 1 ? stop + job->size - 1 : region_end;
+		n = process_read(job->process, pos, job->buffer, limit - pos);
+
+		at = 0;
+		while (job->count < job->max && pattern_find_next(job->pattern, job->buffer + at, n - at, &off) && pos + at + off < stop)
+		{
+			job->matches[job->count++] = pos + at + off;
+			at += off + 1;
+		}
+
+		pos = stop;
+	}
+}
+
+// Add a readable mapping after the others. Returns 0 if memory could
+// not be allocated.
+static int
+add_region(process_t *process, unsigned int *const capacity, uint64 start, uint64 end, const char *perms, const char *path)
+{
+	region_t *regions, *region;
+	const char *name;
+
+	if (process->size == MAX_VIEW_SIZE)
+	{
+		process->clipped = 1;
+		return 1;
+	}
+
+	if (process->count == *capacity)
+	{
+		*capacity = *capacity ? *capacity * 2 : 256;
+		regions = realloc(process->regions, *capacity * sizeof(region_t));
+		if (!regions)
+			return 0;
+		process->regions = regions;
+	}
+
+	region = &process->regions[process->count++];
+	region->address = start;
+	region->offset = process->size;
+	if (end - start > MAX_VIEW_SIZE - process->size)
+	{
+		end = start + (MAX_VIEW_SIZE - process->size);
+		process->clipped = 1;
+	}
+	region->size = (unsigned int)(end - start);
+	process->size += region->size;
+
+	memcpy(region->perms, perms, 4);
+	region->perms[4] = 0;
+
+	// files are named without their directories, pseudo names are kept
+	name = path[0] == '/' && strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	snprintf(region->name, sizeof(region->name), "%s", name);
+	return 1;
+}
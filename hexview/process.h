@@ -0,0 +1,89 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "defs.h"
+
+typedef struct pattern_s pattern_t;
+
+#define REGION_NAME_SIZE 64
+#define PROCESS_MAX_MATCHES 64  // most matches process_find reports
+
+typedef struct region_s region_t;
+struct region_s
+{
+	uint64 address;       // Address of the mapping in the process.
+	unsigned int offset;  // Offset of the mapping in the view.
+	unsigned int size;    // Bytes of the mapping in the view, clipped where the view ends.
+	char perms[5];        // As listed in maps, such as "r-xp".
+	char name[REGION_NAME_SIZE];  // File name without directories, or such as "[heap]", empty if anonymous.
+};
+
+// The readable mappings of a process laid end to end, so the address
+// space can be viewed as a file without its gaps
+typedef struct process_s process_t;
+struct process_s
+{
+	int pid;
+	region_t *regions;  // Regions by increasing address and offset.
+	unsigned int count;
+	unsigned int size;  // Size of the view.
+	int clipped;        // some mappings did not fit in what offsets can address
+	unsigned int page_size;
+};
+
+// Read the mappings of a process. Only implemented on Linux.
+// Parameters:
+// - pid: The process to view.
+//
+// Returns:
+// The process, or NULL if its mappings could not be read or memory
+// could not be allocated.
+process_t *process_open(int pid);
+
+// Free a process opened with process_open.
+// Parameters:
+// - process: The process to free, can be NULL.
+void process_free(process_t *process);
+
+// Find the region holding an offset of the view.
+// Parameters:
+// - process: The process to search.
+// - off: The offset, must be less than process->size.
+//
+// Returns:
+// The region.
+const region_t *process_region(const process_t *process, unsigned int off);
+
+// Read part of the view from the memory of the process, with one
+// system call for many regions. Pages which cannot be read, such as
+// ones unmapped since the view was made, are read as zeros. Nothing is
+// allocated, so it can fill a file made with file_lazy.
+// Parameters:
+// - arg: The process.
+// - off: The offset in the view of the first byte to read.
+// - out: Destination of the bytes.
+// - len: The number of bytes to read.
+//
+// Returns:
+// The number of bytes read, fewer only past the end of the view.
+unsigned int process_read(void *arg, unsigned int off, byte *out, unsigned int len);
+
+// Search the view for a pattern straight from the memory of the
+// process, bypassing the cache of the view, with the regions split
+// between all avaliable cores. Matches do not cross from one region
+// into the next, as the regions are not adjacent in the process.
+// Parameters:
+// - process: The process to search.
+// - pattern: The pattern to search for.
+// - size: The number of bytes the pattern matches.
+// - from: The offset of the view to search from.
+// - out: Destination of the offsets of the first matches, at least
+//        max elements.
+// - max: The most matches to report, at most PROCESS_MAX_MATCHES.
+//
+// Returns:
+// The number of matches written to out, or -1 if memory could not be
+// allocated.
+int process_find(process_t *process, pattern_t *pattern, unsigned int size, unsigned int from, unsigned int *const out, unsigned int max);
+
+#endif
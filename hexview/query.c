@@ -0,0 +1,798 @@
+#include "query.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numeric.h"
+#include "thread.h"
+
+#if HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+#define QUERY_BLOCK 4096          // records extracted and compared at a time, a multiple of 64
+#define MIN_JOB_RECORDS 65536     // records below which a query is not split
+#define GROUP_INITIAL_SLOTS 1024  // a power of two
+#define SIGN64 0x8000000000000000ULL
+
+// How the values of a column compare, unsigned integers are stored with
+// their sign bit flipped so they compare as signed
+enum
+{
+	KeyI8,
+	KeyI16,
+	KeyI32,
+	KeyI64,
+	KeyF32,
+	KeyF64
+};
+
+// A record ranked by the value of a field
+struct ranked
+{
+	uint64 key;
+	unsigned int record;
+};
+
+// Distinct values of a field, open addressing on the value
+struct group_table
+{
+	uint64 *keys;
+	query_row_t *rows;  // a count of 0 marks an empty slot
+	unsigned int slots;
+	unsigned int used;
+};
+
+// Part of the records handled by a single thread
+struct query_job
+{
+	const query_t *query;
+	const int *kinds;          // kind of each field
+	const value_u *constants;  // value of each predicate as its column stores it
+	unsigned int first;
+	unsigned int end;
+
+	byte *columns[QUERY_MAX_FIELDS];  // QUERY_BLOCK values of each field used
+	uint64 bits[QUERY_BLOCK / 64];    // records of the block which match
+
+	uint64 matches;
+	query_row_t *rows;  // first matches for QueryList
+	struct ranked *top;  // heap with the smallest key first for QueryTop
+	unsigned int nrows;
+	struct group_table groups;
+	int failed;
+};
+
+static int key_kind(int type);
+static int is_unsigned(int type);
+static value_u to_column(value_u value, int type);
+static void query_proc(void *arg);
+static void extract(const byte *in, unsigned int stride, unsigned int count, int type, int endianess, byte *const column);
+static void compare(const byte *column, unsigned int count, int kind, int op, value_u value, uint64 *const bits);
+static int compare_scalar(const byte *column, unsigned int i, int kind, int op, value_u value);
+static uint64 select_op(int op, uint64 lt, uint64 eq, uint64 gt);
+static int sort_key(const byte *column, unsigned int i, int kind, uint64 *const key);
+static void heap_push(struct ranked *heap, unsigned int *const count, unsigned int limit, uint64 key, unsigned int record);
+static int ranked_before(const struct ranked *a, const struct ranked *b);
+static int compare_ranked(const void *a, const void *b);
+static int compare_groups(const void *a, const void *b);
+static int group_add(struct group_table *table, uint64 key, unsigned int record, uint64 count);
+static void group_free(struct group_table *table);
+
+#if HAVE_SSE2
+static void compare_sse2(const byte *column, unsigned int words, int kind, int op, value_u value, uint64 *const bits);
+#endif
+
+int
+query_parse_value(const char *s, int type, value_u *const out)
+{
+	char *end;
+	int64 i;
+	uint64 u;
+	double d;
+
+	if (!*s)
+		return 0;
+
+	// a character field can be compared to the character itself
+	if ((type == Char8 || type == Char16) && !s[1] && (s[0] < '0' || s[0] > '9'))
+	{
+		if (type == Char8)
+			out->ui8 = (byte)s[0];
+		else
+			out->ui16 = (byte)s[0];
+		return 1;
+	}
+
+	errno = 0;
+	switch (type)
+	{
+	case Float32:
+	case Float64:
+		d = strtod(s, &end);
+		if (*end)
+			return 0;
+		if (type == Float32)
+			out->f32 = (float32)d;
+		else
+			out->f64 = d;
+		return 1;
+	case Int8:
+	case Int16:
+	case Int32:
+	case Int64:
+		i = strtoll(s, &end, 0);
+		if (*end || errno)
+			return 0;
+		if (type == Int8 && (i < -0x80 || i > 0x7f))
+			return 0;
+		if (type == Int16 && (i < -0x8000 || i > 0x7fff))
+			return 0;
+		if (type == Int32 && (i < -0x7fffffffLL - 1 || i > 0x7fffffffLL))
+			return 0;
+		if (type == Int8)
+			out->i8 = (int8)i;
+		else if (type == Int16)
+			out->i16 = (int16)i;
+		else if (type == Int32)
+			out->i32 = (int32)i;
+		else
+			out->i64 = i;
+		return 1;
+	default:
+		if (s[0] == '-')
+			return 0;
+		u = strtoull(s, &end, 0);
+		if (*end || errno || u > (numeric_size(type) == 8 ? ~0ULL : (1ULL << numeric_size(type) * 8) - 1))
+			return 0;
+		if (numeric_size(type) == 1)
+			out->ui8 = (uint8)u;
+		else if (numeric_size(type) == 2)
+			out->ui16 = (uint16)u;
+		else if (numeric_size(type) == 4)
+			out->ui32 = (uint32)u;
+		else
+			out->ui64 = u;
+		return 1;
+	}
+}
+
+int
+query_run(const query_t *query, query_result_t *const out)
+{
+	struct query_job *jobs;
+	struct group_table groups;
+	struct ranked *ranked;
+	int kinds[QUERY_MAX_FIELDS];
+	int used[QUERY_MAX_FIELDS];
+	value_u constants[QUERY_MAX_PREDICATES];
+	unsigned int i, j, per, total;
+	int njobs, n, failed;
+
+	memset(out, 0, sizeof(query_result_t));
+
+	memset(used, 0, sizeof(used));
+	for (i = 0; i < query->nfields; i++)
+		kinds[i] = key_kind(query->fields[i].type);
+	for (i = 0; i < query->npredicates; i++)
+	{
+		used[query->predicates[i].field] = 1;
+		constants[i] = to_column(query->predicates[i].value, query->fields[query->predicates[i].field].type);
+	}
+	if (query->action == QueryTop || query->action == QueryGroup)
+		used[query->field] = 1;
+
+	njobs = cpu_count();
+	if ((uint64)njobs * MIN_JOB_RECORDS > query->count)
+		njobs = (query->count + MIN_JOB_RECORDS - 1) / MIN_JOB_RECORDS;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = calloc(njobs, sizeof(struct query_job));
+	if (!jobs)
+		return 0;
+
+	// contiguous shares keep each thread reading the file in order
+	per = (query->count + njobs - 1) / njobs;
+	failed = 0;
+	for (n = 0; n < njobs; n++)
+	{
+		jobs[n].query = query;
+		jobs[n].kinds = kinds;
+		jobs[n].constants = constants;
+		jobs[n].first = n * per < query->count ? n * per : query->count;
+		jobs[n].end = jobs[n].first + per < query->count ? jobs[n].first + per : query->count;
+
+		for (i = 0; i < query->nfields; i++)
+		{
+			if (used[i] && !(jobs[n].columns[i] = malloc(QUERY_BLOCK * sizeof(uint64))))
+				failed = 1;
+		}
+
+		if (query->action == QueryList && query->limit && !(jobs[n].rows = malloc(query->limit * sizeof(query_row_t))))
+			failed = 1;
+		if (query->action == QueryTop && query->limit && !(jobs[n].top = malloc(query->limit * sizeof(struct ranked))))
+			failed = 1;
+	}
+
+	if (!failed)
+		run_parallel(&query_proc, jobs, njobs, sizeof(struct query_job));
+
+	total = 0;
+	for (n = 0; n < njobs; n++)
+	{
+		failed |= jobs[n].failed;
+		out->matches += jobs[n].matches;
+		total += jobs[n].nrows;
+	}
+
+	if (!failed && query->action == QueryList)
+	{
+		// shares are in order, so the first matches are the first of each
+		out->rows = malloc((total ? total : 1) * sizeof(query_row_t));
+		failed = !out->rows;
+		for (n = 0; n < njobs && !failed; n++)
+		{
+			for (i = 0; i < jobs[n].nrows && out->nrows < query->limit; i++)
+				out->rows[out->nrows++] = jobs[n].rows[i];
+		}
+	}
+	else if (!failed && query->action == QueryTop)
+	{
+		ranked = malloc((total ? total : 1) * sizeof(struct ranked));
+		out->rows = malloc((total ? total : 1) * sizeof(query_row_t));
+		failed = !ranked || !out->rows;
+		for (n = 0, j = 0; n < njobs && !failed; n++)
+		{
+			memcpy(ranked + j, jobs[n].top, jobs[n].nrows * sizeof(struct ranked));
+			j += jobs[n].nrows;
+		}
+
+		if (!failed)
+		{
+			qsort(ranked, total, sizeof(struct ranked), &compare_ranked);
+			for (i = 0; i < total && i < query->limit; i++)
+			{
+				out->rows[i].record = ranked[i].record;
+				out->rows[i].count = 1;
+			}
+			out->nrows = i;
+		}
+		free(ranked);
+	}
+	else if (!failed && query->action == QueryGroup)
+	{
+		memset(&groups, 0, sizeof(groups));
+		for (n = 0; n < njobs && !failed; n++)
+		{
+			for (i = 0; i < jobs[n].groups.slots && !failed; i++)
+			{
+				if (jobs[n].groups.rows[i].count)
+					failed = !group_add(&groups, jobs[n].groups.keys[i], jobs[n].groups.rows[i].record, jobs[n].groups.rows[i].count);
+			}
+		}
+
+		// the table is packed and sorted by count in place
+		if (!failed)
+		{
+			for (i = 0, j = 0; i < groups.slots; i++)
+			{
+				if (groups.rows[i].count)
+					groups.rows[j++] = groups.rows[i];
+			}
+			qsort(groups.rows, j, sizeof(query_row_t), &compare_groups);
+
+			out->groups = j;
+			out->nrows = j < query->limit ? j : query->limit;
+			out->rows = groups.rows;
+			groups.rows = NULL;
+		}
+		group_free(&groups);
+	}
+
+	for (n = 0; n < njobs; n++)
+	{
+		for (i = 0; i < query->nfields; i++)
+			free(jobs[n].columns[i]);
+		free(jobs[n].rows);
+		free(jobs[n].top);
+		group_free(&jobs[n].groups);
+	}
+	free(jobs);
+
+	if (failed)
+	{
+		query_result_free(out);
+		return 0;
+	}
+
+	return 1;
+}
+
+void
+query_result_free(query_result_t *result)
+{
+	free(result->rows);
+	result->rows = NULL;
+	result->nrows = 0;
+}
+
+static int
+key_kind(int type)
+{
+	switch (type)
+	{
+	case Float32:
+		return KeyF32;
+	case Float64:
+		return KeyF64;
+	default:
+		switch (numeric_size(type))
+		{
+		case 1: return KeyI8;
+		case 2: return KeyI16;
+		case 4: return KeyI32;
+		default: return KeyI64;
+		}
+	}
+}
+
+static int
+is_unsigned(int type)
+{
+	return type == Uint8 || type == Uint16 || type == Uint32 || type == Uint64 || type == Char8 || type == Char16;
+}
+
+// Convert a value to how a column of its type stores it
+static value_u
+to_column(value_u value, int type)
+{
+	if (!is_unsigned(type))
+		return value;
+
+	switch (numeric_size(type))
+	{
+	case 1: value.ui8 ^= 0x80; break;
+	case 2: value.ui16 ^= 0x8000; break;
+	case 4: value.ui32 ^= 0x80000000; break;
+	default: value.ui64 ^= SIGN64; break;
+	}
+
+	return value;
+}
+
+static void
+query_proc(void *arg)
+{
+	struct query_job *job = arg;
+	const query_t *q = job->query;
+	const byte *data;
+	const query_field_t *field;
+	unsigned int start, count, words, i, w, p;
+	uint64 bits, key;
+
+	for (start = job->first; start < job->end; start += count)
+	{
+		count = job->end - start < QUERY_BLOCK ? job->end - start : QUERY_BLOCK;
+		data = q->data + (size_t)start * q->stride;
+		words = (count + 63) / 64;
+
+		// only the fields the query uses are extracted
+		for (i = 0; i < q->nfields; i++)
+		{
+			field = &q->fields[i];
+			if (job->columns[i])
+				extract(data + field->offset, q->stride, count, field->type, field->endianess, job->columns[i]);
+		}
+
+		for (w = 0; w < words; w++)
+			job->bits[w] = ~0ULL;
+		if (count % 64)
+			job->bits[words - 1] = (1ULL << (count % 64)) - 1;
+
+		for (p = 0; p < q->npredicates; p++)
+		{
+			compare(job->columns[q->predicates[p].field], count, job->kinds[q->predicates[p].field],
+				q->predicates[p].op, job->constants[p], job->bits);
+		}
+
+		for (w = 0; w < words; w++)
+		{
+			bits = job->bits[w];
+			job->matches += popcount64(bits);
+			if (q->action == QueryCount || (q->action == QueryList && job->nrows == q->limit))
+				continue;
+
+			for (; bits; bits &= bits - 1)
+			{
+				i = w * 64 + lowest_bit64(bits);
+
+				if (q->action == QueryList)
+				{
+					if (job->nrows == q->limit)
+						break;
+					job->rows[job->nrows].record = start + i;
+					job->rows[job->nrows].count = 1;
+					job->nrows++;
+				}
+				else if (sort_key(job->columns[q->field], i, job->kinds[q->field], &key) && q->action == QueryTop)
+					heap_push(job->top, &job->nrows, q->limit, key, start + i);
+				else if (q->action == QueryGroup && !group_add(&job->groups, key, start + i, 1))
+				{
+					job->failed = 1;
+					return;
+				}
+			}
+		}
+	}
+}
+
+// Gather a field of count records into a packed column in native
+// endianess, flipping the sign bit of unsigned integers
+static void
+extract(const byte *in, unsigned int stride, unsigned int count, int type, int endianess, byte *const column)
+{
+	unsigned int i;
+	int swap;
+	uint16 v16, m16;
+	uint32 v32, m32;
+	uint64 v64, m64;
+
+	swap = endianess != NATIVE_ENDIANESS;
+	switch (numeric_size(type))
+	{
+	case 1:
+		m16 = is_unsigned(type) ? 0x80 : 0;
+		for (i = 0; i < count; i++)
+			column[i] = in[(size_t)i * stride] ^ (byte)m16;
+		break;
+	case 2:
+		m16 = is_unsigned(type) ? 0x8000 : 0;
+		for (i = 0; i < count; i++)
+		{
+			memcpy(&v16, in + (size_t)i * stride, 2);
+			((uint16 *)column)[i] = (swap ? swap_endianess16(v16) : v16) ^ m16;
+		}
+		break;
+	case 4:
+		m32 = is_unsigned(type) ? 0x80000000 : 0;
+		for (i = 0; i < count; i++)
+		{
+			memcpy(&v32, in + (size_t)i * stride, 4);
+			((uint32 *)column)[i] = (swap ? swap_endianess32(v32) : v32) ^ m32;
+		}
+		break;
+	case 8:
+		m64 = is_unsigned(type) ? SIGN64 : 0;
+		for (i = 0; i < count; i++)
+		{
+			memcpy(&v64, in + (size_t)i * stride, 8);
+			((uint64 *)column)[i] = (swap ? swap_endianess64(v64) : v64) ^ m64;
+		}
+		break;
+	}
+}
+
+// Clear the bits of records whose value does not compare to value by op
+static void
+compare(const byte *column, unsigned int count, int kind, int op, value_u value, uint64 *const bits)
+{
+	unsigned int i, words;
+
+	words = 0;
+#if HAVE_SSE2
+	// SSE2 has no 64 bit integer compares
+	if (kind != KeyI64)
+	{
+		words = count / 64;
+		compare_sse2(column, words, kind, op, value, bits);
+	}
+#endif
+
+	for (i = words * 64; i < count; i++)
+	{
+		if (!compare_scalar(column, i, kind, op, value))
+			bits[i / 64] &= ~(1ULL << (i % 64));
+	}
+}
+
+static int
+compare_scalar(const byte *column, unsigned int i, int kind, int op, value_u value)
+{
+	int64 a, b;
+	double x, y;
+
+	switch (kind)
+	{
+	case KeyI8: a = ((const int8 *)column)[i]; b = value.i8; break;
+	case KeyI16: a = ((const int16 *)column)[i]; b = value.i16; break;
+	case KeyI32: a = ((const int32 *)column)[i]; b = value.i32; break;
+	case KeyI64: a = ((const int64 *)column)[i]; b = value.i64; break;
+	default:
+		x = kind == KeyF32 ? ((const float32 *)column)[i] : ((const float64 *)column)[i];
+		y = kind == KeyF32 ? value.f32 : value.f64;
+		return (int)(select_op(op, x < y, x == y, x > y) & 1);
+	}
+
+	return (int)(select_op(op, a < b, a == b, a > b) & 1);
+}
+
+// Combine masks of values less than, equal to and greater than a value
+// into the mask of those matching op. NaNs are in none of the three.
+static uint64
+select_op(int op, uint64 lt, uint64 eq, uint64 gt)
+{
+	switch (op)
+	{
+	case QueryEq: return eq;
+	case QueryNe: return ~eq;
+	case QueryLt: return lt;
+	case QueryLe: return lt | eq;
+	case QueryGt: return gt;
+	default: return gt | eq;
+	}
+}
+
+#if HAVE_SSE2
+// Compare 64 values of a column at a time into a word of bits, with the
+// kind of the column known outside the loop
+static void
+compare_sse2(const byte *column, unsigned int words, int kind, int op, value_u value, uint64 *const bits)
+{
+	const byte *p;
+	unsigned int w, j;
+	uint64 lt, eq, gt;
+	__m128i c, a, b, d, e;
+	__m128 cf, vf;
+	__m128d cd, vd;
+
+	switch (kind)
+	{
+	case KeyI8:
+		c = _mm_set1_epi8(value.i8);
+		for (w = 0; w < words; w++)
+		{
+			p = column + (size_t)w * 64;
+			eq = gt = 0;
+			for (j = 0; j < 4; j++)
+			{
+				a = _mm_loadu_si128((const __m128i *)(p + j * 16));
+				eq |= (uint64)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, c)) << (j * 16);
+				gt |= (uint64)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(a, c)) << (j * 16);
+			}
+			bits[w] &= select_op(op, ~(eq | gt), eq, gt);
+		}
+		break;
+	case KeyI16:
+		c = _mm_set1_epi16(value.i16);
+		for (w = 0; w < words; w++)
+		{
+			p = column + (size_t)w * 128;
+			eq = gt = 0;
+			for (j = 0; j < 4; j++)
+			{
+				// two vectors of masks pack into one of bytes
+				a = _mm_loadu_si128((const __m128i *)(p + j * 32));
+				b = _mm_loadu_si128((const __m128i *)(p + j * 32 + 16));
+				e = _mm_packs_epi16(_mm_cmpeq_epi16(a, c), _mm_cmpeq_epi16(b, c));
+				eq |= (uint64)(unsigned int)_mm_movemask_epi8(e) << (j * 16);
+				e = _mm_packs_epi16(_mm_cmpgt_epi16(a, c), _mm_cmpgt_epi16(b, c));
+				gt |= (uint64)(unsigned int)_mm_movemask_epi8(e) << (j * 16);
+			}
+			bits[w] &= select_op(op, ~(eq | gt), eq, gt);
+		}
+		break;
+	case KeyI32:
+		c = _mm_set1_epi32(value.i32);
+		for (w = 0; w < words; w++)
+		{
+			p = column + (size_t)w * 256;
+			eq = gt = 0;
+			for (j = 0; j < 4; j++)
+			{
+				a = _mm_loadu_si128((const __m128i *)(p + j * 64));
+				b = _mm_loadu_si128((const __m128i *)(p + j * 64 + 16));
+				d = _mm_loadu_si128((const __m128i *)(p + j * 64 + 32));
+				e = _mm_loadu_si128((const __m128i *)(p + j * 64 + 48));
+				eq |= (uint64)(unsigned int)_mm_movemask_epi8(_mm_packs_epi16(
+					_mm_packs_epi32(_mm_cmpeq_epi32(a, c), _mm_cmpeq_epi32(b, c)),
+					_mm_packs_epi32(_mm_cmpeq_epi32(d, c), _mm_cmpeq_epi32(e, c)))) << (j * 16);
+				gt |= (uint64)(unsigned int)_mm_movemask_epi8(_mm_packs_epi16(
+					_mm_packs_epi32(_mm_cmpgt_epi32(a, c), _mm_cmpgt_epi32(b, c)),
+					_mm_packs_epi32(_mm_cmpgt_epi32(d, c), _mm_cmpgt_epi32(e, c)))) << (j * 16);
+			}
+			bits[w] &= select_op(op, ~(eq | gt), eq, gt);
+		}
+		break;
+	case KeyF32:
+		cf = _mm_set1_ps(value.f32);
+		for (w = 0; w < words; w++)
+		{
+			p = column + (size_t)w * 256;
+			lt = eq = gt = 0;
+			for (j = 0; j < 16; j++)
+			{
+				vf = _mm_loadu_ps((const float *)(p + j * 16));
+				lt |= (uint64)(unsigned int)_mm_movemask_ps(_mm_cmplt_ps(vf, cf)) << (j * 4);
+				eq |= (uint64)(unsigned int)_mm_movemask_ps(_mm_cmpeq_ps(vf, cf)) << (j * 4);
+				gt |= (uint64)(unsigned int)_mm_movemask_ps(_mm_cmpgt_ps(vf, cf)) << (j * 4);
+			}
+			bits[w] &= select_op(op, lt, eq, gt);
+		}
+		break;
+	case KeyF64:
+		cd = _mm_set1_pd(value.f64);
+		for (w = 0; w < words; w++)
+		{
+			p = column + (size_t)w * 512;
+			lt = eq = gt = 0;
+			for (j = 0; j < 32; j++)
+			{
+				vd = _mm_loadu_pd((const double *)(p + j * 16));
+				lt |= (uint64)(unsigned int)_mm_movemask_pd(_mm_cmplt_pd(vd, cd)) << (j * 2);
+				eq |= (uint64)(unsigned int)_mm_movemask_pd(_mm_cmpeq_pd(vd, cd)) << (j * 2);
+				gt |= (uint64)(unsigned int)_mm_movemask_pd(_mm_cmpgt_pd(vd, cd)) << (j * 2);
+			}
+			bits[w] &= select_op(op, lt, eq, gt);
+		}
+		break;
+	}
+}
+#endif
+
+// Map a value to an unsigned key in the same order. Returns 0 for NaNs,
+// which have no order, all of them with the same key after every other
+// value so they can still be grouped.
+static int
+sort_key(const byte *column, unsigned int i, int kind, uint64 *const key)
+{
+	uint32 b32;
+	uint64 b64;
+
+	switch (kind)
+	{
+	case KeyI8: *key = (uint64)(int64)((const int8 *)column)[i] ^ SIGN64; return 1;
+	case KeyI16: *key = (uint64)(int64)((const int16 *)column)[i] ^ SIGN64; return 1;
+	case KeyI32: *key = (uint64)(int64)((const int32 *)column)[i] ^ SIGN64; return 1;
+	case KeyI64: *key = (uint64)((const int64 *)column)[i] ^ SIGN64; return 1;
+	case KeyF32:
+		if (((const float32 *)column)[i] != ((const float32 *)column)[i])
+		{
+			*key = 0xffffffff;
+			return 0;
+		}
+		b32 = ((const uint32 *)column)[i];
+		*key = b32 & 0x80000000 ? ~b32 & 0xffffffff : b32 | 0x80000000;
+		return 1;
+	default:
+		if (((const float64 *)column)[i] != ((const float64 *)column)[i])
+		{
+			*key = ~0ULL;
+			return 0;
+		}
+		b64 = ((const uint64 *)column)[i];
+		*key = b64 & SIGN64 ? ~b64 : b64 | SIGN64;
+		return 1;
+	}
+}
+
+// Keep the limit best records in a heap with the worst at the root
+static void
+heap_push(struct ranked *heap, unsigned int *const count, unsigned int limit, uint64 key, unsigned int record)
+{
+	struct ranked item, tmp;
+	unsigned int i, child;
+
+	item.key = key;
+	item.record = record;
+
+	if (*count < limit)
+	{
+		i = (*count)++;
+		heap[i] = item;
+		while (i && ranked_before(&heap[(i - 1) / 2], &heap[i]))
+		{
+			tmp = heap[i];
+			heap[i] = heap[(i - 1) / 2];
+			heap[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+		return;
+	}
+
+	if (!limit || !ranked_before(&item, &heap[0]))
+		return;
+
+	heap[0] = item;
+	for (i = 0; (child = i * 2 + 1) < *count; i = child)
+	{
+		if (child + 1 < *count && ranked_before(&heap[child], &heap[child + 1]))
+			child++;
+		if (!ranked_before(&heap[i], &heap[child]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+	}
+}
+
+// Returns nonzero if a ranks before b, larger values then earlier records
+static int
+ranked_before(const struct ranked *a, const struct ranked *b)
+{
+	return a->key > b->key || (a->key == b->key && a->record < b->record);
+}
+
+static int
+compare_ranked(const void *a, const void *b)
+{
+	if (ranked_before(a, b))
+		return -1;
+	return ranked_before(b, a) ? 1 : 0;
+}
+
+static int
+compare_groups(const void *a, const void *b)
+{
+	const query_row_t *x = a, *y = b;
+
+	if (x->count != y->count)
+		return x->count > y->count ? -1 : 1;
+	return x->record < y->record ? -1 : x->record > y->record;
+}
+
+// Add count records with a value to a table, keeping the first record
+static int
+group_add(struct group_table *table, uint64 key, unsigned int record, uint64 count)
+{
+	struct group_table grown;
+	unsigned int i, mask;
+
+	if (table->used * 2 >= table->slots)
+	{
+		memset(&grown, 0, sizeof(grown));
+		grown.slots = table->slots ? table->slots * 2 : GROUP_INITIAL_SLOTS;
+		grown.keys = malloc(grown.slots * sizeof(uint64));
+		grown.rows = calloc(grown.slots, sizeof(query_row_t));
+		if (!grown.keys || !grown.rows)
+		{
+			group_free(&grown);
+			return 0;
+		}
+
+		for (i = 0; i < table->slots; i++)
+		{
+			if (table->rows[i].count)
+				group_add(&grown, table->keys[i], table->rows[i].record, table->rows[i].count);
+		}
+		group_free(table);
+		*table = grown;
+	}
+
+	mask = table->slots - 1;
+	for (i = (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask; table->rows[i].count; i = (i + 1) & mask)
+	{
+		if (table->keys[i] == key)
+		{
+			table->rows[i].count += count;
+			if (record < table->rows[i].record)
+				table->rows[i].record = record;
+			return 1;
+		}
+	}
+
+	table->keys[i] = key;
+	table->rows[i].record = record;
+	table->rows[i].count = count;
+	table->used++;
+	return 1;
+}
+
+static void
+group_free(struct group_table *table)
+{
+	free(table->keys);
+	free(table->rows);
+	memset(table, 0, sizeof(struct group_table));
+}
@@ -0,0 +1,103 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "defs.h"
+#include "util.h"
+
+#define QUERY_MAX_FIELDS 8      // distinct fields a query can refer to
+#define QUERY_MAX_PREDICATES 8  // predicates joined by "and"
+
+enum
+{
+	QueryEq,
+	QueryNe,
+	QueryLt,
+	QueryLe,
+	QueryGt,
+	QueryGe
+};
+
+enum
+{
+	QueryList,   // the first matching records
+	QueryCount,  // only the number of matching records
+	QueryTop,    // the matching records with the largest values of a field
+	QueryGroup   // the number of matching records with each value of a field
+};
+
+typedef struct query_field_s query_field_t;
+struct query_field_s
+{
+	unsigned int offset;  // Offset in the record.
+	int type;             // Type of the field, Int8 to Char16.
+	int endianess;
+};
+
+typedef struct query_predicate_s query_predicate_t;
+struct query_predicate_s
+{
+	unsigned int field;  // Index in query_t.fields.
+	int op;              // QueryEq to QueryGe.
+	value_u value;       // Value to compare to, in the type of the field.
+};
+
+typedef struct query_s query_t;
+struct query_s
+{
+	const byte *data;    // First record.
+	unsigned int stride;  // Size of a record.
+	unsigned int count;  // Number of records.
+
+	query_field_t fields[QUERY_MAX_FIELDS];
+	unsigned int nfields;
+	query_predicate_t predicates[QUERY_MAX_PREDICATES];
+	unsigned int npredicates;
+
+	int action;          // QueryList to QueryGroup.
+	unsigned int field;  // Field ranked by QueryTop or grouped by QueryGroup.
+	unsigned int limit;  // Most rows returned.
+};
+
+typedef struct query_row_s query_row_t;
+struct query_row_s
+{
+	unsigned int record;  // Index of the record, the first with the value for QueryGroup.
+	uint64 count;         // Number of matching records with the value, only for QueryGroup.
+};
+
+typedef struct query_result_s query_result_t;
+struct query_result_s
+{
+	uint64 matches;      // Number of matching records.
+	uint64 groups;       // Number of distinct values, only for QueryGroup.
+	query_row_t *rows;   // Matching records in order, largest values first or largest groups first.
+	unsigned int nrows;
+};
+
+// Parse a value to compare a field to.
+// Parameters:
+// - s: The value, an integer or for float types any decimal number.
+// - type: The type of the field.
+// - out: Output parameter which will contain the value in that type.
+//
+// Returns:
+// Nonzero on success, 0 if s is not a number or out of range for type.
+int query_parse_value(const char *s, int type, value_u *const out);
+
+// Run a query over fixed size records. The records are split among all
+// avaliable cores, each extracting the fields of a block of records into
+// columns and comparing whole vectors of a column at a time into bitmaps
+// of matching records.
+// Parameters:
+// - query: The query.
+// - out: Output parameter which will contain the result. Free the rows
+//        with query_result_free.
+//
+// Returns:
+// Nonzero on success, 0 if memory could not be allocated.
+int query_run(const query_t *query, query_result_t *const out);
+
+// Free the rows of a result.
+void query_result_free(query_result_t *result);
+
+#endif
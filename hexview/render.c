@@ -0,0 +1,803 @@
+#include "render.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "minimap.h"
+#include "thread.h"
+#include "util.h"
+
+#if _WIN32
+#include <Windows.h>
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#define write _write
+#elif __linux__ || __APPLE__
+#include <unistd.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#endif
+
+#if HAVE_SSE2
+#include <immintrin.h>
+#endif
+
+#define OFFSET_COLOR "\033[90m"
+#define MISSING_COLOR "\033[41m"
+#define DIFF_COLOR "\033[91m"
+#define HEADER_COLOR "\033[4m"
+#define RESET_COLOR "\033[m"
+#define STRLEN(s) (sizeof(s) - 1)
+
+#define PLOT_LABEL_WIDTH 13  // "%12.5g ", which fits "-1.2346e+308 "
+
+#define DEFAULT_TERM_ROWS 24
+#define DEFAULT_TERM_COLS 80
+
+#define XXD_WIDTH 16
+#define XXD_LINE_SIZE 68    // "%08x: ", 8 groups of "%04x ", a space, 16 characters and a newline
+#define XXD_GLYPH_COLUMN 51
+#define DUMP_CHUNK_SIZE (1 << 20)  // bytes rendered by a thread at a time, a multiple of XXD_WIDTH
+
+#if _WIN32
+#define MAX_DUMP_JOBS 64
+#elif defined(IOV_MAX)
+#define MAX_DUMP_JOBS (IOV_MAX < 64 ? IOV_MAX : 64)
+#else
+#define MAX_DUMP_JOBS 16
+#endif
+
+#define MAP_MARK '*'
+#define MAP_LEGEND_SIZE 128
+#define MAX_MAP_COLOR_SIZE 6  // "\033[100m"
+
+// Longest row prefix, "0x00000000 " with colors
+#define MAX_PREFIX_SIZE (STRLEN(OFFSET_COLOR) + 11 + STRLEN(RESET_COLOR))
+// Longest hex cell, a missing byte
+#define MAX_CELL_SIZE (1 + STRLEN(MISSING_COLOR) + 2 + STRLEN(RESET_COLOR))
+
+static char hex_table[256][2];  // two hex digits of each byte
+static char glyph_table[256];   // character shown for each byte
+static int tables_ready;
+
+// Bit of each dot of a braille character, by column then row
+static const byte braille_bits[2][4] =
+{
+	{ 0x01, 0x02, 0x04, 0x40 },
+	{ 0x08, 0x10, 0x20, 0x80 }
+};
+
+// Background of each minimap class, indexed by class
+static const char *const map_colors[MapClasses] =
+{
+	"\033[49m",   // MapUnknown
+	"\033[100m",  // MapZero
+	"\033[42m",   // MapText
+	"\033[41m",   // MapRandom
+	"\033[44m"    // MapOther
+};
+
+// A chunk of a dump rendered by a single thread
+struct dump_job
+{
+	const byte *data;
+	unsigned int off;
+	unsigned int len;
+	char *buf;
+	size_t size;  // characters rendered into buf
+};
+
+static void init_tables();
+static char *put_str(char *out, const char *s, size_t len);
+static char *put_offset(char *out, unsigned int off);
+static char *put_hex_spaced(char *out, const byte *p, unsigned int count);
+static char *put_glyphs(char *out, const byte *p, unsigned int count);
+static char *put_compare(char *out, const byte *p, const byte *other, unsigned int count, unsigned int other_count, unsigned int width, int color);
+static unsigned int plot_row(double v, double lo, double hi, unsigned int dots);
+static void dump_proc(void *arg);
+static int write_all(int fd, const char *buf, size_t len);
+static int write_jobs(int fd, struct dump_job *jobs, int count);
+
+#if HAVE_SSE2
+TARGET("ssse3") static void hex_spaced16(const byte *p, char *out);
+TARGET("ssse3") static void hex_grouped16(const byte *p, char *out);
+static void glyphs16(const byte *p, char *out);
+#endif
+
+int
+render_is_tty()
+{
+	return isatty(fileno(stdout));
+}
+
+void
+render_term_size(unsigned int *const rows, unsigned int *const cols)
+{
+#if _WIN32
+	CONSOLE_SCREEN_BUFFER_INFO info;
+#elif __linux__ || __APPLE__
+	struct winsize ws;
+#endif
+
+	*rows = DEFAULT_TERM_ROWS;
+	*cols = DEFAULT_TERM_COLS;
+
+#if _WIN32
+	if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+	{
+		*rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+		*cols = info.srWindow.Right - info.srWindow.Left + 1;
+	}
+#elif __linux__ || __APPLE__
+	if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_row && ws.ws_col)
+	{
+		*rows = ws.ws_row;
+		*cols = ws.ws_col;
+	}
+#endif
+}
+
+size_t
+render_peek_size(unsigned int rows, unsigned int width)
+{
+	size_t header, row;
+
+	header = 11 + STRLEN(HEADER_COLOR) + (size_t)width * 3 + STRLEN(RESET_COLOR) + 1;
+	row = MAX_PREFIX_SIZE + (size_t)width * MAX_CELL_SIZE + 3 + width + 1;
+	return header + row * (rows ? rows : 1);
+}
+
+size_t
+render_peek(const byte *data, unsigned int size, unsigned int off, unsigned int rows, unsigned int width, int color, char *const out)
+{
+	char *p;
+	unsigned int row, at;
+
+	p = out;
+	p += render_peek_header(width, color, p);
+	*p++ = '\n';
+
+	for (row = 0; row < rows || row == 0; row++)
+	{
+		at = off + row * width;
+		p += render_peek_row(data, size, at, width, color, p);
+		*p++ = '\n';
+
+		// the row reaching the end of the data is the last
+		if (at >= size || size - at <= width)
+			break;
+	}
+
+	return p - out;
+}
+
+size_t
+render_peek_header(unsigned int width, int color, char *const out)
+{
+	char *p;
+	unsigned int i;
+
+	init_tables();
+
+	p = put_str(out, "           ", 11);
+	if (color)
+		p = put_str(p, HEADER_COLOR, STRLEN(HEADER_COLOR));
+	for (i = 0; i < width; i++)
+	{
+		*p++ = ' ';
+		p = put_str(p, hex_table[i & 0xff], 2);
+	}
+	if (color)
+		p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+
+	return p - out;
+}
+
+size_t
+render_peek_row(const byte *data, unsigned int size, unsigned int at, unsigned int width, int color, char *const out)
+{
+	char *p;
+	unsigned int i, count;
+
+	init_tables();
+
+	count = at < size ? size - at : 0;
+	if (count > width)
+		count = width;
+
+	p = out;
+	if (color)
+		p = put_str(p, OFFSET_COLOR, STRLEN(OFFSET_COLOR));
+	p = put_offset(p, at);
+	if (color)
+		p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+
+	p = put_hex_spaced(p, data + at, count);
+	for (i = count; i < width; i++)
+	{
+		*p++ = ' ';
+		if (color)
+			p = put_str(p, MISSING_COLOR, STRLEN(MISSING_COLOR));
+		*p++ = '?';
+		*p++ = '?';
+		if (color)
+			p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+	}
+
+	p = put_str(p, "   ", 3);
+	p = put_glyphs(p, data + at, count);
+
+	return p - out;
+}
+
+size_t
+render_compare_size(unsigned int width)
+{
+	return MAX_PREFIX_SIZE + (size_t)width * 2 * (MAX_CELL_SIZE + STRLEN(DIFF_COLOR)) + 3;
+}
+
+size_t
+render_compare_row(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int at, unsigned int bat, unsigned int width, int color, char *const out)
+{
+	char *p;
+	unsigned int acount, bcount;
+
+	init_tables();
+
+	acount = at < asize ? asize - at : 0;
+	if (acount > width)
+		acount = width;
+	bcount = bat < bsize ? bsize - bat : 0;
+	if (bcount > width)
+		bcount = width;
+
+	p = out;
+	if (color)
+		p = put_str(p, OFFSET_COLOR, STRLEN(OFFSET_COLOR));
+	p = put_offset(p, at);
+	if (color)
+		p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+
+	p = put_compare(p, a + at, b + bat, acount, bcount, width, color);
+	p = put_str(p, "  |", 3);
+	p = put_compare(p, b + bat, a + at, bcount, acount, width, color);
+
+	return p - out;
+}
+
+size_t
+render_map_size(unsigned int count)
+{
+	return (size_t)count * (MAX_MAP_COLOR_SIZE + 1) + STRLEN(RESET_COLOR) + MAP_LEGEND_SIZE;
+}
+
+size_t
+render_map_row(const byte *cells, unsigned int count, unsigned int mark, unsigned int mark_end, char *const out)
+{
+	char *p;
+	unsigned int i, last;
+
+	p = out;
+	last = MapClasses;
+	for (i = 0; i < count; i++)
+	{
+		// only changes of class need an escape
+		if (cells[i] != last)
+		{
+			last = cells[i];
+			p = put_str(p, map_colors[last], strlen(map_colors[last]));
+		}
+
+		if (i >= mark && i < mark_end)
+			*p++ = MAP_MARK;
+		else
+			*p++ = last == MapUnknown ? '?' : ' ';
+	}
+	p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+
+	return p - out;
+}
+
+size_t
+render_map_legend(char *const out)
+{
+	return sprintf(out, "%s %s zeros  %s %s text  %s %s random  %s %s other  %c current",
+		map_colors[MapZero], RESET_COLOR,
+		map_colors[MapText], RESET_COLOR,
+		map_colors[MapRandom], RESET_COLOR,
+		map_colors[MapOther], RESET_COLOR,
+		MAP_MARK);
+}
+
+size_t
+render_plot_size(unsigned int count, unsigned int height)
+{
+	return (size_t)height * (MAX_PREFIX_SIZE + PLOT_LABEL_WIDTH + (count + 1) / 2 * 3 + 1);
+}
+
+size_t
+render_plot(const double *mins, const double *maxs, unsigned int count, unsigned int height, char *const out)
+{
+	byte *grid;
+	char *p;
+	double lo, hi, a, b;
+	unsigned int width, dots, x, y, top, bottom, cell;
+	int label;
+
+	lo = 0.0;
+	hi = 0.0;
+	label = 0;
+	for (x = 0; x < count; x++)
+	{
+		if (mins[x] != mins[x])
+			continue;
+		if (!label || mins[x] < lo)
+			lo = mins[x];
+		if (!label || maxs[x] > hi)
+			hi = maxs[x];
+		label = 1;
+	}
+
+	width = (count + 1) / 2;
+	grid = calloc((size_t)width * height, 1);
+	if (!label || !grid || hi - lo != hi - lo)
+	{
+		free(grid);
+		return 0;
+	}
+
+	// a column spans its range, stretched to meet the previous column
+	dots = height * 4;
+	for (x = 0; x < count; x++)
+	{
+		if (mins[x] != mins[x])
+			continue;
+
+		a = mins[x];
+		b = maxs[x];
+		if (x > 0 && mins[x - 1] == mins[x - 1])
+		{
+			if (maxs[x - 1] < a)
+				a = maxs[x - 1];
+			if (mins[x - 1] > b)
+				b = mins[x - 1];
+		}
+
+		top = plot_row(b, lo, hi, dots);
+		bottom = plot_row(a, lo, hi, dots);
+		for (y = top; y <= bottom; y++)
+			grid[(y / 4) * width + x / 2] |= braille_bits[x % 2][y % 4];
+	}
+
+	p = out;
+	for (y = 0; y < height; y++)
+	{
+		p = put_str(p, OFFSET_COLOR, STRLEN(OFFSET_COLOR));
+		if (y == 0 || y == height - 1)
+			p += sprintf(p, "%*.5g ", PLOT_LABEL_WIDTH - 1, y == 0 ? hi : lo);
+		else
+		{
+			memset(p, ' ', PLOT_LABEL_WIDTH);
+			p += PLOT_LABEL_WIDTH;
+		}
+		p = put_str(p, RESET_COLOR, STRLEN(RESET_COLOR));
+
+		// U+2800 plus the dots, as UTF-8
+		for (x = 0; x < width; x++)
+		{
+			cell = grid[y * width + x];
+			*p++ = (char)0xe2;
+			*p++ = (char)(0xa0 | (cell >> 6));
+			*p++ = (char)(0x80 | (cell & 0x3f));
+		}
+		*p++ = '\n';
+	}
+
+	free(grid);
+	return p - out;
+}
+
+size_t
+render_xxd_size(unsigned int len)
+{
+	size_t size;
+
+	size = (size_t)(len / XXD_WIDTH) * XXD_LINE_SIZE;
+	if (len % XXD_WIDTH)
+		size += XXD_GLYPH_COLUMN + len % XXD_WIDTH + 1;
+	return size;
+}
+
+size_t
+render_xxd(const byte *data, unsigned int off, unsigned int len, char *const out)
+{
+	char *p;
+	unsigned int i, n;
+	int ssse3;
+
+	init_tables();
+	ssse3 = (cpu_features() & CpuSsse3) != 0;
+
+	p = out;
+	for (; len; data += n, off += n, len -= n)
+	{
+		n = len < XXD_WIDTH ? len : XXD_WIDTH;
+
+		memcpy(p, hex_table[(off >> 24) & 0xff], 2);
+		memcpy(p + 2, hex_table[(off >> 16) & 0xff], 2);
+		memcpy(p + 4, hex_table[(off >> 8) & 0xff], 2);
+		memcpy(p + 6, hex_table[off & 0xff], 2);
+		p[8] = ':';
+		p[9] = ' ';
+
+#if HAVE_SSE2
+		if (n == XXD_WIDTH && ssse3)
+		{
+			// also fills the gap before the characters
+			hex_grouped16(data, p + 10);
+			glyphs16(data, p + XXD_GLYPH_COLUMN);
+			p[XXD_LINE_SIZE - 1] = '\n';
+			p += XXD_LINE_SIZE;
+			continue;
+		}
+#endif
+
+		memset(p + 10, ' ', XXD_GLYPH_COLUMN - 10);
+		for (i = 0; i < n; i++)
+			memcpy(p + 10 + (i / 2) * 5 + (i % 2) * 2, hex_table[data[i]], 2);
+
+		p = put_glyphs(p + XXD_GLYPH_COLUMN, data, n);
+		*p++ = '\n';
+	}
+
+	return p - out;
+}
+
+int
+render_dump(const byte *data, unsigned int off, unsigned int len, FILE *fp)
+{
+	struct dump_job *jobs;
+	unsigned int pos, n;
+	int njobs, count;
+	int i;
+	int fd;
+	int result;
+
+	init_tables();
+	cpu_features();
+
+	fflush(fp);
+	fd = fileno(fp);
+
+	njobs = cpu_count();
+	if (njobs > MAX_DUMP_JOBS)
+		njobs = MAX_DUMP_JOBS;
+	if (len / DUMP_CHUNK_SIZE + 1 < (unsigned int)njobs)
+		njobs = len / DUMP_CHUNK_SIZE + 1;
+
+	jobs = calloc(njobs, sizeof(struct dump_job));
+	if (!jobs)
+		return 0;
+
+	result = 1;
+	for (i = 0; i < njobs; i++)
+	{
+		jobs[i].buf = malloc(render_xxd_size(len < DUMP_CHUNK_SIZE ? len : DUMP_CHUNK_SIZE));
+		if (!jobs[i].buf)
+			result = 0;
+	}
+
+	// each round renders a chunk per thread, then writes them in order
+	for (pos = 0; pos < len && result; )
+	{
+		for (count = 0; count < njobs && pos < len; count++, pos += n)
+		{
+			n = len - pos < DUMP_CHUNK_SIZE ? len - pos : DUMP_CHUNK_SIZE;
+			jobs[count].data = data + pos;
+			jobs[count].off = off + pos;
+			jobs[count].len = n;
+		}
+
+		run_parallel(&dump_proc, jobs, count, sizeof(struct dump_job));
+		result = write_jobs(fd, jobs, count);
+	}
+
+	for (i = 0; i < njobs; i++)
+		free(jobs[i].buf);
+	free(jobs);
+
+	return result;
+}
+
+int
+render_write(const char *buf, size_t len)
+{
+	fflush(stdout);
+	return write_all(fileno(stdout), buf, len);
+}
+
+static void
+init_tables()
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	if (tables_ready)
+		return;
+
+	for (i = 0; i < 256; i++)
+	{
+		hex_table[i][0] = digits[i >> 4];
+		hex_table[i][1] = digits[i & 0xf];
+		glyph_table[i] = i >= 0x20 && i < 0x7f ? (char)i : '.';
+	}
+
+	tables_ready = 1;
+}
+
+// The row of dots of a value, 0 at the top
+static unsigned int
+plot_row(double v, double lo, double hi, unsigned int dots)
+{
+	double scaled;
+
+	if (hi == lo)
+		return dots / 2;
+
+	scaled = (v - lo) * (dots - 1) / (hi - lo) + 0.5;
+	return dots - 1 - (scaled < 0.0 ? 0 : scaled > dots - 1 ? dots - 1 : (unsigned int)scaled);
+}
+
+static void
+dump_proc(void *arg)
+{
+	struct dump_job *job = arg;
+
+	job->size = render_xxd(job->data, job->off, job->len, job->buf);
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	int written;
+	unsigned int chunk;
+
+	while (len)
+	{
+		chunk = len > 0x40000000 ? 0x40000000 : (unsigned int)len;
+		written = write(fd, buf, chunk);
+		if (written <= 0)
+			return 0;
+
+		buf += written;
+		len -= written;
+	}
+
+	return 1;
+}
+
+// Write the buffers of a round of jobs in order
+static int
+write_jobs(int fd, struct dump_job *jobs, int count)
+{
+#if _WIN32
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!write_all(fd, jobs[i].buf, jobs[i].size))
+			return 0;
+	}
+
+	return 1;
+#elif __linux__ || __APPLE__
+	struct iovec iov[MAX_DUMP_JOBS];
+	struct iovec *it;
+	ssize_t written;
+	int i, left;
+
+	for (i = 0; i < count; i++)
+	{
+		iov[i].iov_base = jobs[i].buf;
+		iov[i].iov_len = jobs[i].size;
+	}
+
+	it = iov;
+	left = count;
+	while (left)
+	{
+		written = writev(fd, it, left);
+		if (written < 0)
+			return 0;
+
+		// skip what was written, the rest is retried
+		while (left && (size_t)written >= it->iov_len)
+		{
+			written -= it->iov_len;
+			it++;
+			left--;
+		}
+
+		if (left)
+		{
+			it->iov_base = (char *)it->iov_base + written;
+			it->iov_len -= written;
+		}
+	}
+
+	return 1;
+#endif
+}
+
+static char *
+put_str(char *out, const char *s, size_t len)
+{
+	memcpy(out, s, len);
+	return out + len;
+}
+
+// "0x%08x "
+static char *
+put_offset(char *out, unsigned int off)
+{
+	out[0] = '0';
+	out[1] = 'x';
+	memcpy(out + 2, hex_table[(off >> 24) & 0xff], 2);
+	memcpy(out + 4, hex_table[(off >> 16) & 0xff], 2);
+	memcpy(out + 6, hex_table[(off >> 8) & 0xff], 2);
+	memcpy(out + 8, hex_table[off & 0xff], 2);
+	out[10] = ' ';
+	return out + 11;
+}
+
+// " %02x" for each byte
+static char *
+put_hex_spaced(char *out, const byte *p, unsigned int count)
+{
+	unsigned int i;
+
+	i = 0;
+#if HAVE_SSE2
+	if (cpu_features() & CpuSsse3)
+	{
+		for (; i + 16 <= count; i += 16)
+			hex_spaced16(p + i, out + i * 3);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		out[i * 3] = ' ';
+		memcpy(out + i * 3 + 1, hex_table[p[i]], 2);
+	}
+
+	return out + count * 3;
+}
+
+static char *
+put_glyphs(char *out, const byte *p, unsigned int count)
+{
+	unsigned int i;
+
+	i = 0;
+#if HAVE_SSE2
+	for (; i + 16 <= count; i += 16)
+		glyphs16(p + i, out + i);
+#endif
+
+	for (; i < count; i++)
+		out[i] = glyph_table[p[i]];
+
+	return out + count;
+}
+
+// " %02x" for each byte, colored where the other side differs or has
+// no byte, then ?? up to width
+static char *
+put_compare(char *out, const byte *p, const byte *other, unsigned int count, unsigned int other_count, unsigned int width, int color)
+{
+	unsigned int i;
+	int differs;
+
+	for (i = 0; i < width; i++)
+	{
+		*out++ = ' ';
+		if (i >= count)
+		{
+			if (color)
+				out = put_str(out, MISSING_COLOR, STRLEN(MISSING_COLOR));
+			*out++ = '?';
+			*out++ = '?';
+			if (color)
+				out = put_str(out, RESET_COLOR, STRLEN(RESET_COLOR));
+			continue;
+		}
+
+		differs = color && (i >= other_count || p[i] != other[i]);
+		if (differs)
+			out = put_str(out, DIFF_COLOR, STRLEN(DIFF_COLOR));
+		memcpy(out, hex_table[p[i]], 2);
+		out += 2;
+		if (differs)
+			out = put_str(out, RESET_COLOR, STRLEN(RESET_COLOR));
+	}
+
+	return out;
+}
+
+#if HAVE_SSE2
+
+// Convert 16 bytes to 32 hex digits, split across two vectors
+TARGET("ssse3")
+static inline void
+hex_digits16(const byte *p, __m128i *const first, __m128i *const second)
+{
+	const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	const __m128i nibble = _mm_set1_epi8(0xf);
+	__m128i v, hi, lo;
+
+	v = _mm_loadu_si128((const __m128i *)p);
+	hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+	lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+
+	*first = _mm_unpacklo_epi8(hi, lo);
+	*second = _mm_unpackhi_epi8(hi, lo);
+}
+
+// " %02x" for 16 bytes, 48 characters. Gaps in the shuffles read as
+// zero and become spaces, hex digits already have 0x20 set.
+TARGET("ssse3")
+static void
+hex_spaced16(const byte *p, char *out)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i shuf0 = _mm_setr_epi8(-128, 0, 1, -128, 2, 3, -128, 4, 5, -128, 6, 7, -128, 8, 9, -128);
+	const __m128i shuf1 = _mm_setr_epi8(0, 1, -128, 2, 3, -128, 4, 5, -128, 6, 7, -128, 8, 9, -128, 10);
+	const __m128i shuf2 = _mm_setr_epi8(5, -128, 6, 7, -128, 8, 9, -128, 10, 11, -128, 12, 13, -128, 14, 15);
+	__m128i first, second;
+
+	hex_digits16(p, &first, &second);
+
+	_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_shuffle_epi8(first, shuf0), space));
+	_mm_storeu_si128((__m128i *)(out + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(second, first, 10), shuf1), space));
+	_mm_storeu_si128((__m128i *)(out + 32), _mm_or_si128(_mm_shuffle_epi8(second, shuf2), space));
+}
+
+// "%04x " for 8 pairs of bytes followed by 8 spaces, 48 characters
+TARGET("ssse3")
+static void
+hex_grouped16(const byte *p, char *out)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i shuf0 = _mm_setr_epi8(0, 1, 2, 3, -128, 4, 5, 6, 7, -128, 8, 9, 10, 11, -128, 12);
+	const __m128i shuf1 = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, 6, -128, 7, 8, 9, 10, -128, 11, 12);
+	const __m128i shuf2 = _mm_setr_epi8(10, 11, -128, 12, 13, 14, 15, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+	__m128i first, second;
+
+	hex_digits16(p, &first, &second);
+
+	_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_shuffle_epi8(first, shuf0), space));
+	_mm_storeu_si128((__m128i *)(out + 16), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(second, first, 13), shuf1), space));
+	_mm_storeu_si128((__m128i *)(out + 32), _mm_or_si128(_mm_shuffle_epi8(second, shuf2), space));
+}
+
+// Printable characters of 16 bytes, others become '.'
+static void
+glyphs16(const byte *p, char *out)
+{
+	const __m128i bias = _mm_set1_epi8(0x20);
+	const __m128i sign = _mm_set1_epi8((char)0x80);
+	const __m128i limit = _mm_set1_epi8((char)(0x5f ^ 0x80));
+	const __m128i dot = _mm_set1_epi8('.');
+	__m128i v, printable;
+
+	v = _mm_loadu_si128((const __m128i *)p);
+
+	// (unsigned)(v - 0x20) < 0x5f, done as a signed compare
+	printable = _mm_cmplt_epi8(_mm_xor_si128(_mm_sub_epi8(v, bias), sign), limit);
+	_mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, dot)));
+}
+
+#endif
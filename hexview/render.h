@@ -0,0 +1,191 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "defs.h"
+
+// Returns nonzero if stdout is a terminal, so color escapes should be
+// written.
+int render_is_tty();
+
+// Get the size of the terminal stdout is written to, or 24 by 80 if it
+// is not a terminal.
+// Parameters:
+// - rows: Output parameter which will contain the number of rows.
+// - cols: Output parameter which will contain the number of columns.
+void render_term_size(unsigned int *const rows, unsigned int *const cols);
+
+// Returns an upper bound of the number of characters render_peek
+// writes. A header and a single row together take at most
+// render_peek_size(1, width) characters.
+// Parameters:
+// - rows: The number of rows to render.
+// - width: The number of bytes in each row.
+size_t render_peek_size(unsigned int rows, unsigned int width);
+
+// Render a hex view of the bytes at an offset, with a header row, then
+// each row as its offset, its bytes in hexadecimal, and its printable
+// characters. Rows end at the end of the data, positions past the end
+// are shown as ??.
+// Parameters:
+// - data: The data to render.
+// - size: The number of bytes data points to.
+// - off: The offset of the first byte to render.
+// - rows: The number of rows to render.
+// - width: The number of bytes in each row.
+// - color: Nonzero to include color escapes.
+// - out: Destination buffer, at least render_peek_size(rows, width)
+//        characters.
+//
+// Returns:
+// The number of characters written to out.
+size_t render_peek(const byte *data, unsigned int size, unsigned int off, unsigned int rows, unsigned int width, int color, char *const out);
+
+// Render the header of a hex view, the column numbers.
+// Parameters:
+// - width: The number of bytes in each row.
+// - color: Nonzero to include color escapes.
+// - out: Destination buffer.
+//
+// Returns:
+// The number of characters written to out, without a newline.
+size_t render_peek_header(unsigned int width, int color, char *const out);
+
+// Render a single row of a hex view, as render_peek does.
+// Parameters:
+// - data: The data to render.
+// - size: The number of bytes data points to.
+// - at: The offset of the first byte in the row.
+// - width: The number of bytes in the row.
+// - color: Nonzero to include color escapes.
+// - out: Destination buffer.
+//
+// Returns:
+// The number of characters written to out, without a newline.
+size_t render_peek_row(const byte *data, unsigned int size, unsigned int at, unsigned int width, int color, char *const out);
+
+// Returns an upper bound of the number of characters render_compare_row
+// writes.
+// Parameters:
+// - width: The number of bytes of each file in the row.
+size_t render_compare_size(unsigned int width);
+
+// Render a row of two files side by side, the offset then the bytes of
+// each in hexadecimal. Bytes which differ from the other file are
+// colored, positions past the end of a file are shown as ??.
+// Parameters:
+// - a: The data of the first file.
+// - asize: The size of the first file.
+// - b: The data of the second file.
+// - bsize: The size of the second file.
+// - at: The offset of the first byte in the row.
+// - bat: The offset of the first byte of the second file in the row,
+//        at unless the files are aligned.
+// - width: The number of bytes of each file in the row.
+// - color: Nonzero to include color escapes.
+// - out: Destination buffer, at least render_compare_size(width)
+//        characters.
+//
+// Returns:
+// The number of characters written to out, without a newline.
+size_t render_compare_row(const byte *a, unsigned int asize, const byte *b, unsigned int bsize, unsigned int at, unsigned int bat, unsigned int width, int color, char *const out);
+
+// Returns an upper bound of the number of characters render_map_row
+// writes.
+// Parameters:
+// - count: The number of cells to render.
+size_t render_map_size(unsigned int count);
+
+// Render cells of a minimap, one character each colored by its class.
+// Cells in [mark, mark_end) are drawn with a marker, to show where the
+// current offset is.
+// Parameters:
+// - cells: The class of each cell, from minimap_t.
+// - count: The number of cells to render.
+// - mark: The first cell to mark, relative to cells.
+// - mark_end: One past the last cell to mark.
+// - out: Destination buffer, at least render_map_size(count)
+//        characters.
+//
+// Returns:
+// The number of characters written to out, without a newline.
+size_t render_map_row(const byte *cells, unsigned int count, unsigned int mark, unsigned int mark_end, char *const out);
+
+// Render the key to the colors of render_map_row.
+// Parameters:
+// - out: Destination buffer, at least render_map_size(0) characters.
+//
+// Returns:
+// The number of characters written to out, without a newline.
+size_t render_map_legend(char *const out);
+
+// Returns the number of characters render_xxd writes.
+// Parameters:
+// - len: The number of bytes to render.
+size_t render_xxd_size(unsigned int len);
+
+// Returns an upper bound of the number of characters render_plot
+// writes.
+// Parameters:
+// - count: The number of columns of dots, two to a character.
+// - height: The number of rows of characters.
+size_t render_plot_size(unsigned int count, unsigned int height);
+
+// Render a plot of the ranges of values in buckets with braille
+// characters, each two dots wide and four high. Each column of dots
+// covers the range of its bucket, joined to the range of the previous
+// bucket so the line has no gaps. The first and last rows are labelled
+// with the largest and smallest value.
+// Parameters:
+// - mins: The smallest value of each bucket, NaN if empty.
+// - maxs: The largest value of each bucket, NaN if empty.
+// - count: The number of buckets, the columns of dots.
+// - height: The number of rows of characters.
+// - out: Destination buffer, at least render_plot_size(count, height)
+//        characters.
+//
+// Returns:
+// The number of characters written to out, or 0 if no bucket has a
+// value or memory could not be allocated.
+size_t render_plot(const double *mins, const double *maxs, unsigned int count, unsigned int height, char *const out);
+
+// Render bytes in the default format of xxd, 16 bytes to a line in
+// groups of 2, with lines labelled by their offset.
+// Parameters:
+// - data: Pointer to the first byte to render.
+// - off: The offset shown for the first byte.
+// - len: The number of bytes to render.
+// - out: Destination buffer, at least render_xxd_size(len) characters.
+//
+// Returns:
+// The number of characters written to out.
+size_t render_xxd(const byte *data, unsigned int off, unsigned int len, char *const out);
+
+// Render a range of bytes as with render_xxd and write it to a file
+// descriptor. The range is split into chunks rendered in parallel on
+// all avaliable cores, then written in order with one gathered write
+// per round of chunks.
+// Parameters:
+// - data: Pointer to the first byte to render.
+// - off: The offset shown for the first byte.
+// - len: The number of bytes to render.
+// - fp: The file to write to, anything it has buffered is flushed
+//       first.
+//
+// Returns:
+// Nonzero if everything was written.
+int render_dump(const byte *data, unsigned int off, unsigned int len, FILE *fp);
+
+// Write a buffer to stdout with as few system calls as possible.
+// Anything buffered by stdio is flushed first.
+// Parameters:
+// - buf: The characters to write.
+// - len: The number of characters buf points to.
+//
+// Returns:
+// Nonzero if everything was written.
+int render_write(const char *buf, size_t len);
+
+#endif
@@ -0,0 +1,268 @@
+#include "sidecar.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if _WIN32
+#include <Windows.h>
+
+struct win32_sidecar
+{
+	HANDLE hFile;  // file handle
+	HANDLE hMap;   // file mapping
+};
+
+#elif __linux__ || __APPLE__
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct linux_sidecar
+{
+	int file;  // file descriptor
+};
+
+#endif
+
+enum
+{
+	MapRead,    // an existing sidecar, read only
+	MapCreate,  // a new sidecar of a given size
+	MapEdit     // an existing sidecar, read and written
+};
+
+static sidecar_t *map_sidecar(const char *path, size_t size, int mode);
+
+int
+sidecar_path(const char *filename, const char *ext, char *const out, size_t size)
+{
+	size_t flen, elen;
+
+	flen = strlen(filename);
+	elen = strlen(ext);
+	if (flen + elen + 1 > size)
+		return 0;
+
+	memcpy(out, filename, flen);
+	memcpy(out + flen, ext, elen + 1);
+	return 1;
+}
+
+sidecar_t *
+sidecar_create(const char *path, size_t size)
+{
+	if (!size)
+		return NULL;
+	return map_sidecar(path, size, MapCreate);
+}
+
+sidecar_t *
+sidecar_open(const char *path)
+{
+	return map_sidecar(path, 0, MapRead);
+}
+
+sidecar_t *
+sidecar_edit(const char *path)
+{
+	return map_sidecar(path, 0, MapEdit);
+}
+
+int
+sidecar_file_time(const char *filename, uint64 *const out)
+{
+#if _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA source;
+
+	if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &source))
+		return 0;
+
+	*out = (uint64)source.ftLastWriteTime.dwHighDateTime << 32 | source.ftLastWriteTime.dwLowDateTime;
+	return 1;
+#elif __linux__ || __APPLE__
+	struct stat source;
+
+	if (stat(filename, &source))
+		return 0;
+
+	// nanoseconds, so a change within the same second is seen
+#if __APPLE__
+	*out = (uint64)source.st_mtimespec.tv_sec * 1000000000 + source.st_mtimespec.tv_nsec;
+#else
+	*out = (uint64)source.st_mtim.tv_sec * 1000000000 + source.st_mtim.tv_nsec;
+#endif
+	return 1;
+#endif
+}
+
+void
+sidecar_close(sidecar_t *sidecar)
+{
+#if _WIN32
+	struct win32_sidecar *sidecar32;
+
+	if (!sidecar) return;
+	sidecar32 = (struct win32_sidecar *)&sidecar->reserved;
+
+	UnmapViewOfFile(sidecar->data);
+	CloseHandle(sidecar32->hMap);
+	CloseHandle(sidecar32->hFile);
+	free(sidecar);
+#elif __linux__ || __APPLE__
+	struct linux_sidecar *linux_sidecar;
+
+	if (!sidecar) return;
+	linux_sidecar = (struct linux_sidecar *)&sidecar->reserved;
+
+	munmap(sidecar->data, sidecar->size);
+	close(linux_sidecar->file);
+	free(sidecar);
+#endif
+}
+
+// Open or create a sidecar and map all of it. When creating, the file
+// is truncated to size, otherwise size is ignored.
+static sidecar_t *
+map_sidecar(const char *path, size_t size, int mode)
+{
+	sidecar_t *result;
+	int create, write;
+
+	create = mode == MapCreate;
+	write = mode != MapRead;
+
+#if _WIN32
+	struct win32_sidecar *sidecar32;
+	LARGE_INTEGER liSize;
+
+	result = malloc(sizeof(sidecar_t) + sizeof(struct win32_sidecar));
+	if (!result)
+		return NULL;
+	sidecar32 = (struct win32_sidecar *)&result->reserved;
+
+	sidecar32->hFile = CreateFileA(
+		path,
+		write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		create ? CREATE_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	if (sidecar32->hFile == INVALID_HANDLE_VALUE)
+	{
+		free(result);
+		return NULL;
+	}
+
+	if (create)
+	{
+		liSize.QuadPart = size;
+		if (!SetFilePointerEx(sidecar32->hFile, liSize, NULL, FILE_BEGIN) || !SetEndOfFile(sidecar32->hFile))
+		{
+			CloseHandle(sidecar32->hFile);
+			DeleteFileA(path);
+			free(result);
+			return NULL;
+		}
+	}
+	else if (!GetFileSizeEx(sidecar32->hFile, &liSize) || !liSize.QuadPart)
+	{
+		CloseHandle(sidecar32->hFile);
+		free(result);
+		return NULL;
+	}
+
+	result->size = (size_t)liSize.QuadPart;
+
+	sidecar32->hMap = CreateFileMappingA(
+		sidecar32->hFile,
+		NULL,
+		write ? PAGE_READWRITE : PAGE_READONLY,
+		liSize.HighPart,
+		liSize.LowPart,
+		NULL
+	);
+
+	if (!sidecar32->hMap)
+	{
+		CloseHandle(sidecar32->hFile);
+		free(result);
+		return NULL;
+	}
+
+	result->data = MapViewOfFile(
+		sidecar32->hMap,
+		write ? FILE_MAP_WRITE : FILE_MAP_READ,
+		0,
+		0,
+		result->size
+	);
+
+	if (!result->data)
+	{
+		CloseHandle(sidecar32->hMap);
+		CloseHandle(sidecar32->hFile);
+		free(result);
+		return NULL;
+	}
+#elif __linux__ || __APPLE__
+	struct linux_sidecar *linux_sidecar;
+	struct stat st;
+
+	result = malloc(sizeof(sidecar_t) + sizeof(struct linux_sidecar));
+	if (!result)
+		return NULL;
+	linux_sidecar = (struct linux_sidecar *)&result->reserved;
+
+	if (create)
+		linux_sidecar->file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	else
+		linux_sidecar->file = open(path, write ? O_RDWR : O_RDONLY);
+
+	if (linux_sidecar->file == -1)
+	{
+		free(result);
+		return NULL;
+	}
+
+	if (create)
+	{
+		if (ftruncate(linux_sidecar->file, size))
+		{
+			close(linux_sidecar->file);
+			unlink(path);
+			free(result);
+			return NULL;
+		}
+	}
+	else
+	{
+		if (fstat(linux_sidecar->file, &st) || !st.st_size)
+		{
+			close(linux_sidecar->file);
+			free(result);
+			return NULL;
+		}
+		size = st.st_size;
+	}
+
+	result->size = size;
+	result->data = mmap(NULL, size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, linux_sidecar->file, 0);
+	if (result->data == MAP_FAILED)
+	{
+		close(linux_sidecar->file);
+		if (create)
+			unlink(path);
+		free(result);
+		return NULL;
+	}
+#endif
+
+	return result;
+}
@@ -0,0 +1,75 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <stddef.h>
+
+#include "defs.h"
+
+// Index files stored next to the file they describe, such as
+// "file.bin.hvsa" for "file.bin". They are memory mapped so indexes
+// larger than physical memory are paged in and out by the system.
+
+typedef struct sidecar_s sidecar_t;
+struct sidecar_s
+{
+	byte *data;   // Pointer to the mapped contents, valid from [data, data + size).
+	size_t size;  // Size of the sidecar.
+
+	byte reserved[1];
+};
+
+// Make the path of a sidecar by appending an extension to a filename.
+// Parameters:
+// - filename: The file the sidecar describes.
+// - ext: The extension of the sidecar, including the dot.
+// - out: Destination string.
+// - size: The number of characters out can hold.
+//
+// Returns:
+// Nonzero if the path fit in out.
+int sidecar_path(const char *filename, const char *ext, char *const out, size_t size);
+
+// Create a sidecar, replacing any existing file, and map it for
+// reading and writing.
+// Parameters:
+// - path: The path of the sidecar.
+// - size: The size of the sidecar in bytes, must not be 0.
+//
+// Returns:
+// The sidecar, or NULL if it could not be created.
+sidecar_t *sidecar_create(const char *path, size_t size);
+
+// Open an existing sidecar and map it for reading.
+// Parameters:
+// - path: The path of the sidecar.
+//
+// Returns:
+// The sidecar, or NULL if it does not exist or could not be mapped.
+sidecar_t *sidecar_open(const char *path);
+
+// Open an existing sidecar and map it for reading and writing, to
+// update it in place.
+// Parameters:
+// - path: The path of the sidecar.
+//
+// Returns:
+// The sidecar, or NULL if it does not exist or could not be mapped.
+sidecar_t *sidecar_edit(const char *path);
+
+// Get the modification time of a file, in units which only compare
+// with other times returned by this function.
+// Parameters:
+// - filename: The file.
+// - out: Destination of the time.
+//
+// Returns:
+// Nonzero if the time was read.
+int sidecar_file_time(const char *filename, uint64 *const out);
+
+// Unmap and close a sidecar. Changes to a sidecar created with
+// sidecar_create are written back to the file.
+// Parameters:
+// - sidecar: The sidecar to close, can be NULL.
+void sidecar_close(sidecar_t *sidecar);
+
+#endif
@@ -0,0 +1,424 @@
+#include "simhash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+
+#define MIN_JOB_SIZE (1 << 20)  // smallest range worth giving its own thread
+#define WINDOW_SIZE 5
+#define INITIAL_DB_CAP 64
+#define MAX_DB_LINE 1024
+
+// A range of the data counted by a single thread
+struct count_job
+{
+	const byte *data;
+	unsigned int start;  // first window end counted by the job
+	unsigned int end;
+	unsigned int counts[SIMHASH_BUCKETS];
+};
+
+struct simdb_entry
+{
+	simhash_t hash;
+	char *name;
+};
+
+struct simdb_s
+{
+	char *path;
+	struct simdb_entry *entries;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+static byte pearson[256];
+static int pearson_ready = 0;
+
+static void init_pearson();
+static void count_proc(void *arg);
+static int compare_counts(const void *first, const void *second);
+static int db_append(simdb_t *db, const char *name, const simhash_t *hash);
+
+// Pearson hash of a salted byte triplet
+static inline byte
+triplet_bucket(byte salt, byte a, byte b, byte c)
+{
+	byte h;
+
+	h = pearson[salt];
+	h = pearson[h ^ a];
+	h = pearson[h ^ b];
+	h = pearson[h ^ c];
+	return h & (SIMHASH_BUCKETS - 1);
+}
+
+static inline int
+mod_diff(int x, int y, int range)
+{
+	int d = x > y ? x - y : y - x;
+	return d < range - d ? d : range - d;
+}
+
+int
+simhash_compute(const byte *data, unsigned int size, simhash_t *const out)
+{
+	struct count_job *jobs;
+	unsigned int counts[SIMHASH_BUCKETS];
+	unsigned int sorted[SIMHASH_BUCKETS];
+	unsigned int q1, q2, q3;
+	unsigned int jobsize, nonzero, x;
+	int njobs, i, j;
+	byte code;
+
+	if (size < SIMHASH_MIN_SIZE)
+		return 0;
+
+	init_pearson();
+
+	njobs = cpu_count();
+	if (size / MIN_JOB_SIZE < (unsigned int)njobs)
+		njobs = size / MIN_JOB_SIZE;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = malloc(njobs * sizeof(struct count_job));
+	if (!jobs)
+		return 0;
+
+	jobsize = size / njobs;
+	for (i = 0; i < njobs; i++)
+	{
+		jobs[i].data = data;
+		jobs[i].start = i == 0 ? WINDOW_SIZE - 1 : i * jobsize;
+		jobs[i].end = i == njobs - 1 ? size : (i + 1) * jobsize;
+	}
+
+	run_parallel(&count_proc, jobs, njobs, sizeof(struct count_job));
+
+	// the counts are additive, so the split does not change the digest
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < njobs; i++)
+	{
+		for (j = 0; j < SIMHASH_BUCKETS; j++)
+			counts[j] += jobs[i].counts[j];
+	}
+	free(jobs);
+
+	nonzero = 0;
+	for (j = 0; j < SIMHASH_BUCKETS; j++)
+		nonzero += counts[j] != 0;
+
+	// too uniform, most buckets are empty
+	if (nonzero <= SIMHASH_BUCKETS / 2)
+		return 0;
+
+	memcpy(sorted, counts, sizeof(sorted));
+	qsort(sorted, SIMHASH_BUCKETS, sizeof(unsigned int), &compare_counts);
+	q1 = sorted[SIMHASH_BUCKETS / 4 - 1];
+	q2 = sorted[SIMHASH_BUCKETS / 2 - 1];
+	q3 = sorted[SIMHASH_BUCKETS * 3 / 4 - 1];
+	if (q3 == 0)
+		return 0;
+
+	memset(out, 0, sizeof(simhash_t));
+	for (j = 0; j < SIMHASH_BUCKETS; j++)
+	{
+		if (counts[j] <= q1)
+			code = 0;
+		else if (counts[j] <= q2)
+			code = 1;
+		else if (counts[j] <= q3)
+			code = 2;
+		else
+			code = 3;
+		out->body[j / 4] |= code << ((j % 4) * 2);
+	}
+
+	// log base 1.5 of the length
+	out->lvalue = 0;
+	for (x = size; x > 1 && out->lvalue < 255; x = x / 3 * 2)
+		out->lvalue++;
+
+	out->qratios = (byte)((((uint64)q1 * 100 / q3) % 16) << 4 | (((uint64)q2 * 100 / q3) % 16));
+
+	return 1;
+}
+
+void
+simhash_format(const simhash_t *hash, char *const out)
+{
+	int i;
+
+	snprintf(out, 5, "%02X%02X", hash->lvalue, hash->qratios);
+	for (i = 0; i < SIMHASH_BODY_SIZE; i++)
+		snprintf(out + 4 + i * 2, 3, "%02X", hash->body[i]);
+}
+
+int
+simhash_parse(const char *s, simhash_t *const out)
+{
+	byte bytes[2 + SIMHASH_BODY_SIZE];
+	unsigned int i, value;
+	char digits[3];
+	char *end;
+
+	for (i = 0; i < sizeof(bytes); i++)
+	{
+		if (!s[i * 2] || !s[i * 2 + 1])
+			return 0;
+
+		digits[0] = s[i * 2];
+		digits[1] = s[i * 2 + 1];
+		digits[2] = 0;
+		value = strtoul(digits, &end, 16);
+		if (*end)
+			return 0;
+		bytes[i] = (byte)value;
+	}
+
+	out->lvalue = bytes[0];
+	out->qratios = bytes[1];
+	memcpy(out->body, bytes + 2, SIMHASH_BODY_SIZE);
+	return 1;
+}
+
+int
+simhash_distance(const simhash_t *first, const simhash_t *second)
+{
+	int distance, d;
+	int i, k;
+	int x, y;
+
+	distance = 0;
+
+	d = mod_diff(first->lvalue, second->lvalue, 256);
+	distance += d <= 1 ? d : d * 12;
+
+	d = mod_diff(first->qratios >> 4, second->qratios >> 4, 16);
+	distance += d <= 1 ? d : (d - 1) * 12;
+	d = mod_diff(first->qratios & 0xf, second->qratios & 0xf, 16);
+	distance += d <= 1 ? d : (d - 1) * 12;
+
+	for (i = 0; i < SIMHASH_BODY_SIZE; i++)
+	{
+		for (k = 0; k < 8; k += 2)
+		{
+			x = (first->body[i] >> k) & 3;
+			y = (second->body[i] >> k) & 3;
+			d = x > y ? x - y : y - x;
+
+			// opposite quartiles count extra
+			distance += d == 3 ? 6 : d;
+		}
+	}
+
+	return distance;
+}
+
+simdb_t *
+simdb_load(const char *path)
+{
+	simdb_t *db;
+	FILE *fp;
+	char line[MAX_DB_LINE];
+	char *name, *nl;
+	simhash_t hash;
+
+	db = calloc(1, sizeof(simdb_t));
+	if (!db)
+		return NULL;
+
+	db->path = malloc(strlen(path) + 1);
+	if (!db->path)
+	{
+		free(db);
+		return NULL;
+	}
+	strcpy(db->path, path);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return db;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		nl = strpbrk(line, "\r\n");
+		if (nl)
+			*nl = 0;
+
+		name = strchr(line, ' ');
+		if (!name || !simhash_parse(line, &hash))
+			continue;
+
+		if (!db_append(db, name + 1, &hash))
+		{
+			fclose(fp);
+			simdb_free(db);
+			return NULL;
+		}
+	}
+
+	fclose(fp);
+
+	return db;
+}
+
+int
+simdb_add(simdb_t *db, const char *name, const simhash_t *hash)
+{
+	FILE *fp;
+	char s[SIMHASH_STRING_SIZE];
+
+	fp = fopen(db->path, "a");
+	if (!fp)
+		return 0;
+
+	simhash_format(hash, s);
+	fprintf(fp, "%s %s\n", s, name);
+	fclose(fp);
+
+	return db_append(db, name, hash);
+}
+
+unsigned int
+simdb_count(simdb_t *db)
+{
+	return db->count;
+}
+
+unsigned int
+simdb_rank(simdb_t *db, const simhash_t *hash, simdb_match_t *const out, unsigned int max)
+{
+	unsigned int found, i, j;
+	int distance;
+
+	found = 0;
+	for (i = 0; i < db->count; i++)
+	{
+		distance = simhash_distance(hash, &db->entries[i].hash);
+		if (found == max && distance >= out[found - 1].distance)
+			continue;
+
+		// insertion into the sorted output
+		j = found < max ? found++ : found - 1;
+		for (; j > 0 && out[j - 1].distance > distance; j--)
+			out[j] = out[j - 1];
+		out[j].name = db->entries[i].name;
+		out[j].distance = distance;
+	}
+
+	return found;
+}
+
+void
+simdb_free(simdb_t *db)
+{
+	unsigned int i;
+
+	if (!db) return;
+
+	for (i = 0; i < db->count; i++)
+		free(db->entries[i].name);
+	free(db->entries);
+	free(db->path);
+	free(db);
+}
+
+static void
+count_proc(void *arg)
+{
+	struct count_job *job = arg;
+	const byte *p;
+	unsigned int i;
+	byte a, b, c, d, e;
+
+	memset(job->counts, 0, sizeof(job->counts));
+
+	for (i = job->start; i < job->end; i++)
+	{
+		p = job->data + i;
+		a = p[-4];
+		b = p[-3];
+		c = p[-2];
+		d = p[-1];
+		e = p[0];
+
+		job->counts[triplet_bucket(2, e, d, c)]++;
+		job->counts[triplet_bucket(3, e, d, b)]++;
+		job->counts[triplet_bucket(5, e, c, b)]++;
+		job->counts[triplet_bucket(7, e, c, a)]++;
+		job->counts[triplet_bucket(11, e, d, a)]++;
+		job->counts[triplet_bucket(13, e, b, a)]++;
+	}
+}
+
+// Fill the Pearson table with a fixed permutation, so digests are
+// stable between runs
+static void
+init_pearson()
+{
+	uint64 x, z;
+	int i, j;
+	byte t;
+
+	if (pearson_ready)
+		return;
+
+	for (i = 0; i < 256; i++)
+		pearson[i] = (byte)i;
+
+	x = 0x73696d6861736821ULL;
+	for (i = 255; i > 0; i--)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+
+		j = (int)(z % (i + 1));
+		t = pearson[i];
+		pearson[i] = pearson[j];
+		pearson[j] = t;
+	}
+
+	pearson_ready = 1;
+}
+
+static int
+compare_counts(const void *first, const void *second)
+{
+	unsigned int a = *(const unsigned int *)first, b = *(const unsigned int *)second;
+	return a < b ? -1 : a > b;
+}
+
+static int
+db_append(simdb_t *db, const char *name, const simhash_t *hash)
+{
+	struct simdb_entry *nbuf;
+	unsigned int ncap;
+	char *copy;
+
+	if (db->count == db->capacity)
+	{
+		ncap = db->capacity ? db->capacity << 1 : INITIAL_DB_CAP;
+		nbuf = realloc(db->entries, ncap * sizeof(struct simdb_entry));
+		if (!nbuf)
+			return 0;
+		db->entries = nbuf;
+		db->capacity = ncap;
+	}
+
+	copy = malloc(strlen(name) + 1);
+	if (!copy)
+		return 0;
+	strcpy(copy, name);
+
+	db->entries[db->count].hash = *hash;
+	db->entries[db->count].name = copy;
+	db->count++;
+
+	return 1;
+}
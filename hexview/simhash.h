@@ -0,0 +1,99 @@
+#ifndef SIMHASH_H
+#define SIMHASH_H
+
+#include "defs.h"
+
+#define SIMHASH_BUCKETS 128
+#define SIMHASH_BODY_SIZE (SIMHASH_BUCKETS / 4)
+#define SIMHASH_STRING_SIZE (4 + SIMHASH_BODY_SIZE * 2 + 1)
+#define SIMHASH_MIN_SIZE 50
+
+typedef struct simhash_s simhash_t;
+struct simhash_s
+{
+	byte lvalue;   // Logarithmic length of the data.
+	byte qratios;  // Ratios of the first and second quartiles to the third.
+	byte body[SIMHASH_BODY_SIZE];  // 2 bits per bucket, the quartile of its count.
+};
+
+typedef struct simdb_s simdb_t;
+
+typedef struct simdb_match_s simdb_match_t;
+struct simdb_match_s
+{
+	const char *name;  // Name of the digest in the database.
+	int distance;      // Distance from the queried digest, 0 is identical.
+};
+
+// Compute a locality-sensitive digest of a block of memory, in the
+// spirit of TLSH. Similar data gives digests a small distance apart.
+// Byte triplets from a sliding window are counted into buckets on all
+// avaliable cores, then each bucket is encoded by its quartile.
+// Parameters:
+// - data: The data to digest.
+// - size: The number of bytes data points to.
+// - out: Output parameter which will contain the digest.
+//
+// Returns:
+// Nonzero on success, or 0 if the data is smaller than
+// SIMHASH_MIN_SIZE or too uniform to produce a meaningful digest.
+int simhash_compute(const byte *data, unsigned int size, simhash_t *const out);
+
+// Format a digest as a string of hexadecimal characters.
+// Parameters:
+// - hash: The digest to format.
+// - out: Destination string, at least SIMHASH_STRING_SIZE characters.
+void simhash_format(const simhash_t *hash, char *const out);
+
+// Parse a digest formatted with simhash_format.
+// Parameters:
+// - s: The string to parse.
+// - out: Output parameter which will contain the digest.
+//
+// Returns:
+// Nonzero on success.
+int simhash_parse(const char *s, simhash_t *const out);
+
+// Returns the distance between two digests, 0 if they are identical.
+int simhash_distance(const simhash_t *first, const simhash_t *second);
+
+// Load a digest database. Each line of the file holds a digest followed
+// by a space and its name. A missing file loads as an empty database.
+// Parameters:
+// - path: The path of the database file.
+//
+// Returns:
+// The database, or NULL if the file could not be read.
+simdb_t *simdb_load(const char *path);
+
+// Add a digest to a database and append it to the database file.
+// Parameters:
+// - db: The database to add to.
+// - name: The name of the digest.
+// - hash: The digest.
+//
+// Returns:
+// Nonzero on success.
+int simdb_add(simdb_t *db, const char *name, const simhash_t *hash);
+
+// Returns the number of digests in a database.
+unsigned int simdb_count(simdb_t *db);
+
+// Find the digests in a database closest to a digest.
+// Parameters:
+// - db: The database to search.
+// - hash: The digest to compare against.
+// - out: Output array which will contain the closest matches, nearest
+//        first.
+// - max: The number of elements in out.
+//
+// Returns:
+// The number of matches written to out.
+unsigned int simdb_rank(simdb_t *db, const simhash_t *hash, simdb_match_t *const out, unsigned int max);
+
+// Free a database.
+// Parameters:
+// - db: The database to free, can be NULL.
+void simdb_free(simdb_t *db);
+
+#endif
@@ -0,0 +1,386 @@
+#include "strscan.h"
+
+#include <string.h>
+
+#include "thread.h"
+#include "util.h"
+
+#if HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define BLOCK_SIZE 64           // bytes classified at a time
+#define MIN_JOB_SIZE (1 << 20)  // smallest range worth giving its own thread
+#define INITIAL_RESULT_CAP 256
+
+#define EVEN_BITS 0x5555555555555555ULL
+
+// A range of the data scanned by a single thread
+struct scan_job
+{
+	const byte *data;       // data scanned, shifted by parity
+	unsigned int size;      // size of the whole data, less parity
+	unsigned int parity;    // 1 when looking for UTF-16 at odd offsets
+	unsigned int start;     // first byte owned by the job, a multiple of BLOCK_SIZE
+	unsigned int end;       // one past the last byte owned by the job
+	unsigned int minbytes;  // minimum string length in bytes
+	int enc;
+
+	strent_t *ents;  // strings starting in [start, end)
+	unsigned int count;
+	unsigned int capacity;
+	int failed;
+};
+
+static void scan_proc(void *arg);
+static void append_string(struct scan_job *job, unsigned int off, unsigned int len);
+
+static inline int
+is_printable(byte b)
+{
+	return (b >= 0x20 && b < 0x7f) || b == '\t';
+}
+
+// Classify up to 64 bytes. Bit i of the result is set if p[i] is
+// printable, bit i of zeros is set if p[i] is zero. Bits at or above
+// count are clear.
+static inline uint64
+classify_block(const byte *p, unsigned int count, uint64 *const zeros)
+{
+	uint64 printable, zero;
+	unsigned int i;
+#if HAVE_SSE2
+	__m128i v, x, pr, z;
+	const __m128i bias = _mm_set1_epi8(0x20);
+	const __m128i sign = _mm_set1_epi8((char)0x80);
+	const __m128i limit = _mm_set1_epi8((char)(0x5f ^ 0x80));
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i nul = _mm_setzero_si128();
+
+	if (count == BLOCK_SIZE)
+	{
+		printable = 0;
+		zero = 0;
+		for (i = 0; i < BLOCK_SIZE; i += 16)
+		{
+			v = _mm_loadu_si128((const __m128i *)(p + i));
+
+			// (unsigned)(v - 0x20) < 0x5f, done as a signed compare
+			x = _mm_xor_si128(_mm_sub_epi8(v, bias), sign);
+			pr = _mm_or_si128(_mm_cmplt_epi8(x, limit), _mm_cmpeq_epi8(v, tab));
+			z = _mm_cmpeq_epi8(v, nul);
+
+			printable |= (uint64)(unsigned int)_mm_movemask_epi8(pr) << i;
+			zero |= (uint64)(unsigned int)_mm_movemask_epi8(z) << i;
+		}
+
+		*zeros = zero;
+		return printable;
+	}
+#endif
+
+	printable = 0;
+	zero = 0;
+	for (i = 0; i < count; i++)
+	{
+		printable |= (uint64)is_printable(p[i]) << i;
+		zero |= (uint64)(p[i] == 0) << i;
+	}
+
+	*zeros = zero;
+	return printable;
+}
+
+// Build a mask of bytes belonging to a printable character in the
+// given encoding. UTF-16 characters set both of their bits.
+static inline uint64
+character_mask(const byte *p, unsigned int count, int enc)
+{
+	uint64 printable, zero, units;
+
+	printable = classify_block(p, count, &zero);
+	switch (enc)
+	{
+	case EncUtf16le:
+		units = printable & (zero >> 1) & EVEN_BITS;
+		return units | (units << 1);
+	case EncUtf16be:
+		units = zero & (printable >> 1) & EVEN_BITS;
+		return units | (units << 1);
+	default:
+		return printable;
+	}
+}
+
+strindex_t *
+strindex_build(const byte *data, unsigned int size, unsigned int minlen, int enc)
+{
+	strindex_t *index;
+	struct scan_job *jobs, *job;
+	unsigned int jobsize;
+	unsigned int total;
+	unsigned int parity, nparities;
+	unsigned int a, b;
+	int njobs;
+	int failed;
+	int i;
+
+	index = malloc(sizeof(strindex_t));
+	if (!index)
+		return NULL;
+
+	index->ents = NULL;
+	index->count = 0;
+	index->minlen = minlen ? minlen : 1;
+	index->enc = enc;
+
+	njobs = cpu_count();
+	if (size / MIN_JOB_SIZE < (unsigned int)njobs)
+		njobs = size / MIN_JOB_SIZE;
+	if (njobs < 1)
+		njobs = 1;
+
+	// UTF-16 strings are not always aligned, scan both byte parities
+	nparities = enc == EncAscii || size < 2 ? 1 : 2;
+
+	jobs = calloc(njobs * nparities, sizeof(struct scan_job));
+	if (!jobs)
+	{
+		free(index);
+		return NULL;
+	}
+
+	// every job must start on a block boundary so UTF-16 units stay aligned
+	jobsize = size / njobs;
+	jobsize = (jobsize + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+
+	for (parity = 0; parity < nparities; parity++)
+	{
+		for (i = 0; i < njobs; i++)
+		{
+			job = &jobs[parity * njobs + i];
+			job->data = data + parity;
+			job->size = size - parity;
+			job->parity = parity;
+			job->start = i * jobsize;
+			job->end = i == njobs - 1 ? job->size : (i + 1) * jobsize;
+			job->minbytes = index->minlen * (enc == EncAscii ? 1 : 2);
+			job->enc = enc;
+		}
+	}
+
+	run_parallel(&scan_proc, jobs, njobs * nparities, sizeof(struct scan_job));
+
+	total = 0;
+	failed = 0;
+	for (i = 0; i < njobs * (int)nparities; i++)
+	{
+		total += jobs[i].count;
+		failed |= jobs[i].failed;
+	}
+
+	if (!failed && total)
+	{
+		index->ents = malloc(total * sizeof(strent_t));
+		failed = !index->ents;
+	}
+
+	if (!failed)
+	{
+		// jobs of one parity are already in order
+		for (i = 0; i < njobs; i++)
+		{
+			if (jobs[i].count)
+				memcpy(index->ents + index->count, jobs[i].ents, jobs[i].count * sizeof(strent_t));
+			index->count += jobs[i].count;
+		}
+
+		// merge in the odd strings
+		if (nparities == 2 && index->count < total)
+		{
+			a = index->count;
+			b = total;
+			for (i = njobs * 2 - 1; i >= njobs; i--)
+			{
+				job = &jobs[i];
+				while (job->count)
+				{
+					if (a && index->ents[a - 1].off > job->ents[job->count - 1].off)
+						index->ents[--b] = index->ents[--a];
+					else
+						index->ents[--b] = job->ents[--job->count];
+				}
+			}
+			index->count = total;
+		}
+	}
+
+	for (i = 0; i < njobs * (int)nparities; i++)
+		free(jobs[i].ents);
+	free(jobs);
+
+	if (failed)
+	{
+		strindex_free(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void
+strindex_free(strindex_t *index)
+{
+	if (!index) return;
+	free(index->ents);
+	free(index);
+}
+
+unsigned int
+strindex_lower_bound(strindex_t *index, unsigned int off)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = index->count;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (index->ents[mid].off < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int
+strindex_contains(strindex_t *index, const byte *data, const strent_t *ent, const char *needle)
+{
+	unsigned int unit, shift;
+	unsigned int nchars, nlen;
+	unsigned int i, j;
+	const byte *s;
+
+	unit = index->enc == EncAscii ? 1 : 2;
+	shift = index->enc == EncUtf16be ? 1 : 0;
+
+	s = data + ent->off + shift;
+	nchars = ent->len / unit;
+	nlen = strlen(needle);
+
+	if (nlen > nchars)
+		return 0;
+
+	for (i = 0; i + nlen <= nchars; i++)
+	{
+		for (j = 0; j < nlen; j++)
+		{
+			if (s[(i + j) * unit] != (byte)needle[j])
+				break;
+		}
+
+		if (j == nlen)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void
+scan_proc(void *arg)
+{
+	struct scan_job *job = arg;
+	unsigned int pos, count;
+	unsigned int run_start;
+	unsigned int bit;
+	unsigned int unit;
+	int in_run, skip;
+	uint64 mask, rest;
+
+	unit = job->enc == EncAscii ? 1 : 2;
+
+	// a string running into the start of the range belongs to the previous job
+	in_run = 0;
+	skip = 0;
+	run_start = job->start;
+	if (job->start >= unit)
+	{
+		mask = character_mask(job->data + job->start - unit, unit, job->enc);
+		if (mask & 1)
+		{
+			in_run = 1;
+			skip = 1;
+		}
+	}
+
+	for (pos = job->start; pos < job->size && (pos < job->end || in_run); pos += BLOCK_SIZE)
+	{
+		count = job->size - pos;
+		if (count > BLOCK_SIZE)
+			count = BLOCK_SIZE;
+
+		mask = character_mask(job->data + pos, count, job->enc);
+
+		bit = 0;
+		while (bit < BLOCK_SIZE)
+		{
+			if (!in_run)
+			{
+				rest = mask >> bit;
+				if (!rest)
+					break;
+				bit += lowest_bit64(rest);
+
+				// strings starting here belong to the next job
+				if (pos + bit >= job->end)
+					return;
+
+				in_run = 1;
+				run_start = pos + bit;
+			}
+
+			rest = ~mask >> bit;
+			if (!rest)
+				break;  // run continues into the next block
+			bit += lowest_bit64(rest);
+
+			if (!skip)
+				append_string(job, run_start, pos + bit - run_start);
+			skip = 0;
+			in_run = 0;
+		}
+	}
+
+	// string runs to the end of the data
+	if (in_run && !skip)
+		append_string(job, run_start, job->size - run_start);
+}
+
+static void
+append_string(struct scan_job *job, unsigned int off, unsigned int len)
+{
+	strent_t *nbuf;
+	unsigned int ncap;
+
+	if (len < job->minbytes || job->failed)
+		return;
+
+	if (job->count == job->capacity)
+	{
+		ncap = job->capacity ? job->capacity << 1 : INITIAL_RESULT_CAP;
+		nbuf = realloc(job->ents, ncap * sizeof(strent_t));
+		if (!nbuf)
+		{
+			job->failed = 1;
+			return;
+		}
+		job->ents = nbuf;
+		job->capacity = ncap;
+	}
+
+	job->ents[job->count].off = off + job->parity;
+	job->ents[job->count].len = len;
+	job->count++;
+}
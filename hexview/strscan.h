@@ -0,0 +1,69 @@
+#ifndef STRSCAN_H
+#define STRSCAN_H
+
+#include "defs.h"
+
+enum
+{
+	EncAscii,
+	EncUtf16le,
+	EncUtf16be
+};
+
+typedef struct strent_s strent_t;
+struct strent_s
+{
+	unsigned int off;  // Offset of the first character in the file.
+	unsigned int len;  // Length of the string in bytes, not characters.
+};
+
+typedef struct strindex_s strindex_t;
+struct strindex_s
+{
+	strent_t *ents;      // Strings found, sorted by offset.
+	unsigned int count;  // Number of elements in ents.
+	unsigned int minlen; // Minimum length of a string in characters.
+	int enc;             // Encoding of every string in the index.
+};
+
+// Extract every printable string of at least minlen characters from
+// a block of memory. The work is split across all avaliable cores.
+// Parameters:
+// - data: The data to scan.
+// - size: The number of bytes data points to.
+// - minlen: Minimum number of characters in a string.
+// - enc: Encoding to look for, one of EncAscii, EncUtf16le, or
+//        EncUtf16be.
+//
+// Returns:
+// The index, or NULL if it could not be allocated.
+strindex_t *strindex_build(const byte *data, unsigned int size, unsigned int minlen, int enc);
+
+// Free an index created with strindex_build.
+// Parameters:
+// - index: The index to free, can be NULL.
+void strindex_free(strindex_t *index);
+
+// Find the first string beginning at or after an offset.
+// Parameters:
+// - index: The index to search.
+// - off: The offset to search from.
+//
+// Returns:
+// The position of the string in index->ents, or index->count if
+// there is no such string.
+unsigned int strindex_lower_bound(strindex_t *index, unsigned int off);
+
+// Test whether a string contains a substring of char8 characters.
+// UTF-16 strings are compared by their code units.
+// Parameters:
+// - index: The index the string belongs to.
+// - data: The data the index was built from.
+// - ent: The string to test.
+// - needle: Null-terminated substring to look for.
+//
+// Returns:
+// Nonzero if the string contains needle.
+int strindex_contains(strindex_t *index, const byte *data, const strent_t *ent, const char *needle);
+
+#endif
@@ -0,0 +1,567 @@
+#include "suffix.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "thread.h"
+#include "util.h"
+
+#define SUFFIX_MAGIC "HVSA"
+#define SUFFIX_VERSION 2
+#define MIN_JOB_SIZE (1 << 20)  // smallest range worth giving its own thread
+#define MAX_PATH_SIZE 4096
+
+#define EMPTY 0xffffffffu
+
+// S-type suffixes are smaller than the suffix following them, L-type
+// suffixes are larger. Types are packed into a bitmap, set for S.
+#define TYPE_S(t, i) (((t)[(i) >> 3] >> ((i) & 7)) & 1)
+#define IS_LMS(t, i) ((i) > 0 && TYPE_S(t, i) && !TYPE_S(t, (i) - 1))
+
+// Character i of a string of bytes (cs 1) or of names (cs 4)
+#define CHR(i) (cs == 1 ? (uint32)((const byte *)T)[i] : ((const uint32 *)T)[i])
+
+struct suffix_header
+{
+	char magic[4];
+	uint32 version;
+	uint32 size;  // size of the indexed file
+	uint32 reserved;
+	uint64 mtime; // modification time of the indexed file
+};
+
+enum
+{
+	PhasePhi,
+	PhasePlcp,
+	PhaseLcp
+};
+
+// A range of the arrays handled by a single thread while computing LCPs
+struct lcp_job
+{
+	const byte *data;
+	unsigned int size;
+	uint32 *sa;
+	uint32 *lcp;
+	uint32 *phi;        // scratch array indexed by offset
+	unsigned int start;
+	unsigned int end;
+	int phase;
+};
+
+static int sais(const void *T, uint32 *SA, uint32 n, uint32 K, int cs);
+static void induce(const void *T, uint32 *SA, const byte *t, uint32 n, uint32 K, int cs, const uint32 *cnt, uint32 *bkt);
+static int build_lcp(const byte *data, unsigned int size, uint32 *sa, uint32 *lcp, uint32 *phi);
+static void lcp_proc(void *arg);
+static int compare_suffix(const byte *data, unsigned int size, uint32 off, const byte *pattern, unsigned int len);
+
+static inline void
+bucket_starts(const uint32 *cnt, uint32 *bkt, uint32 K)
+{
+	uint32 i, sum;
+
+	for (i = 0, sum = 0; i < K; i++)
+	{
+		bkt[i] = sum;
+		sum += cnt[i];
+	}
+}
+
+static inline void
+bucket_ends(const uint32 *cnt, uint32 *bkt, uint32 K)
+{
+	uint32 i, sum;
+
+	for (i = 0, sum = 0; i < K; i++)
+	{
+		sum += cnt[i];
+		bkt[i] = sum;
+	}
+}
+
+suffix_t *
+suffix_build(const byte *data, unsigned int size, uint64 mtime, const char *path)
+{
+	suffix_t *suffix;
+	struct suffix_header *header;
+	sidecar_t *scratch;
+	char scratchpath[MAX_PATH_SIZE];
+	uint32 *sa, *lcp;
+
+	if (!size || !sidecar_path(path, ".tmp", scratchpath, sizeof(scratchpath)))
+		return NULL;
+
+	suffix = malloc(sizeof(suffix_t));
+	if (!suffix)
+		return NULL;
+
+	suffix->sidecar = sidecar_create(path, sizeof(struct suffix_header) + (size_t)size * 2 * sizeof(uint32));
+	if (!suffix->sidecar)
+	{
+		free(suffix);
+		return NULL;
+	}
+
+	sa = (uint32 *)(suffix->sidecar->data + sizeof(struct suffix_header));
+	lcp = sa + size;
+
+	scratch = NULL;
+	if (!sais(data, sa, size, 256, 1))
+		goto on_error;
+
+	scratch = sidecar_create(scratchpath, (size_t)size * sizeof(uint32));
+	if (!scratch)
+		goto on_error;
+
+	if (!build_lcp(data, size, sa, lcp, (uint32 *)scratch->data))
+		goto on_error;
+
+	sidecar_close(scratch);
+	remove(scratchpath);
+
+	// the header goes last so an interrupted build is never mistaken for an index
+	header = (struct suffix_header *)suffix->sidecar->data;
+	memcpy(header->magic, SUFFIX_MAGIC, sizeof(header->magic));
+	header->version = SUFFIX_VERSION;
+	header->size = size;
+	header->reserved = 0;
+	header->mtime = mtime;
+
+	suffix->sa = sa;
+	suffix->lcp = lcp;
+	suffix->size = size;
+	return suffix;
+
+on_error:
+	if (scratch)
+	{
+		sidecar_close(scratch);
+		remove(scratchpath);
+	}
+	sidecar_close(suffix->sidecar);
+	remove(path);
+	free(suffix);
+	return NULL;
+}
+
+suffix_t *
+suffix_open(const char *path, unsigned int size, uint64 mtime)
+{
+	suffix_t *suffix;
+	sidecar_t *sidecar;
+	const struct suffix_header *header;
+
+	sidecar = sidecar_open(path);
+	if (!sidecar)
+		return NULL;
+
+	header = (const struct suffix_header *)sidecar->data;
+	if (sidecar->size != sizeof(struct suffix_header) + (size_t)size * 2 * sizeof(uint32) ||
+		memcmp(header->magic, SUFFIX_MAGIC, sizeof(header->magic)) ||
+		header->version != SUFFIX_VERSION || header->size != size || header->mtime != mtime)
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	suffix = malloc(sizeof(suffix_t));
+	if (!suffix)
+	{
+		sidecar_close(sidecar);
+		return NULL;
+	}
+
+	suffix->sidecar = sidecar;
+	suffix->sa = (const uint32 *)(sidecar->data + sizeof(struct suffix_header));
+	suffix->lcp = suffix->sa + size;
+	suffix->size = size;
+	return suffix;
+}
+
+void
+suffix_free(suffix_t *suffix)
+{
+	if (!suffix) return;
+	sidecar_close(suffix->sidecar);
+	free(suffix);
+}
+
+unsigned int
+suffix_find(suffix_t *suffix, const byte *data, const byte *pattern, unsigned int len, unsigned int *const first)
+{
+	unsigned int lo, hi, mid;
+	unsigned int start;
+
+	// first suffix not less than the pattern
+	lo = 0;
+	hi = suffix->size;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (compare_suffix(data, suffix->size, suffix->sa[mid], pattern, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	start = lo;
+
+	// first suffix not starting with the pattern
+	hi = suffix->size;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (compare_suffix(data, suffix->size, suffix->sa[mid], pattern, len) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*first = start;
+	return lo - start;
+}
+
+unsigned int
+suffix_repeats(suffix_t *suffix, const byte *data, unsigned int minlen, suffix_repeat_t *const out, unsigned int max)
+{
+	const uint32 *sa, *lcp;
+	unsigned int i, j, n;
+	unsigned int a, b, k, best;
+	unsigned int count;
+	int left;
+	suffix_repeat_t rep;
+
+	sa = suffix->sa;
+	lcp = suffix->lcp;
+	n = suffix->size;
+	if (!minlen)
+		minlen = 1;
+
+	count = 0;
+	i = 1;
+	while (i < n && max)
+	{
+		if (lcp[i] < minlen)
+		{
+			i++;
+			continue;
+		}
+
+		// run of suffixes sa[i - 1] through sa[j - 1] sharing minlen bytes
+		best = i;
+		for (j = i; j < n && lcp[j] >= minlen; j++)
+		{
+			if (lcp[j] > lcp[best])
+				best = j;
+		}
+
+		// the suffixes sharing the longest prefix in the run
+		for (a = best; a > i && lcp[a - 1] >= lcp[best]; a--);
+		for (b = best + 1; b < j && lcp[b] >= lcp[best]; b++);
+
+		// a repeat always preceded by the same byte is part of a longer one
+		left = sa[a - 1] ? data[sa[a - 1] - 1] : -1;
+		for (k = a; k < b && left >= 0; k++)
+		{
+			if (!sa[k] || data[sa[k] - 1] != left)
+				left = -1;
+		}
+
+		if (left >= 0)
+		{
+			i = j;
+			continue;
+		}
+
+		rep.len = lcp[best];
+		rep.count = b - a + 1;
+		rep.off = sa[a - 1];
+		for (; a < b; a++)
+		{
+			if (sa[a] < rep.off)
+				rep.off = sa[a];
+		}
+
+		// insert, keeping the longest
+		if (count < max || rep.len > out[count - 1].len)
+		{
+			if (count < max)
+				count++;
+			for (a = count - 1; a > 0 && out[a - 1].len < rep.len; a--)
+				out[a] = out[a - 1];
+			out[a] = rep;
+		}
+
+		i = j;
+	}
+
+	return count;
+}
+
+// Build the suffix array of T with SA-IS (Nong, Zhang & Chan). The
+// string is treated as if followed by a sentinel smaller than every
+// character. The reduced problem is stored in the upper half of SA so
+// only the type bitmap and buckets are allocated.
+static int
+sais(const void *T, uint32 *SA, uint32 n, uint32 K, int cs)
+{
+	byte *t;
+	uint32 *cnt, *bkt, *s1;
+	uint32 i, j, d;
+	uint32 n1, name, pos, prev;
+	uint32 c0, c1;
+	int diff;
+
+	if (n == 0)
+		return 1;
+	if (n == 1)
+	{
+		SA[0] = 0;
+		return 1;
+	}
+
+	t = calloc((n + 7) / 8, 1);
+	cnt = calloc(K, sizeof(uint32));
+	bkt = malloc(K * sizeof(uint32));
+	if (!t || !cnt || !bkt)
+	{
+		free(t);
+		free(cnt);
+		free(bkt);
+		return 0;
+	}
+
+	// the last character is L-type as it is followed by the sentinel
+	c1 = CHR(n - 1);
+	cnt[c1]++;
+	for (i = n - 1; i-- > 0;)
+	{
+		c0 = CHR(i);
+		if (c0 < c1 || (c0 == c1 && TYPE_S(t, i + 1)))
+			t[i >> 3] |= 1 << (i & 7);
+		cnt[c0]++;
+		c1 = c0;
+	}
+
+	// sort the LMS substrings by inducing from their first characters
+	for (i = 0; i < n; i++)
+		SA[i] = EMPTY;
+	bucket_ends(cnt, bkt, K);
+	for (i = 1; i < n; i++)
+	{
+		if (IS_LMS(t, i))
+			SA[--bkt[CHR(i)]] = i;
+	}
+	induce(T, SA, t, n, K, cs, cnt, bkt);
+
+	// gather the sorted LMS substrings at the front
+	n1 = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (IS_LMS(t, SA[i]))
+			SA[n1++] = SA[i];
+	}
+
+	// name them, equal substrings get equal names. LMS positions are
+	// never adjacent so pos / 2 is unique.
+	for (i = n1; i < n; i++)
+		SA[i] = EMPTY;
+	name = 0;
+	prev = EMPTY;
+	for (i = 0; i < n1; i++)
+	{
+		pos = SA[i];
+		diff = prev == EMPTY;
+		for (d = 0; !diff; d++)
+		{
+			if (pos + d == n || prev + d == n || CHR(pos + d) != CHR(prev + d) ||
+				TYPE_S(t, pos + d) != TYPE_S(t, prev + d))
+				diff = 1;
+			else if (d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d)))
+				break;
+		}
+
+		if (diff)
+		{
+			name++;
+			prev = pos;
+		}
+		SA[n1 + pos / 2] = name - 1;
+	}
+
+	// the reduced string, names in order of position, goes at the end
+	for (i = n, j = n; i-- > n1;)
+	{
+		if (SA[i] != EMPTY)
+			SA[--j] = SA[i];
+	}
+	s1 = SA + n - n1;
+
+	// sort the LMS suffixes, recursing if any names repeat
+	if (name < n1)
+	{
+		if (!sais(s1, SA, n1, name, 4))
+		{
+			free(t);
+			free(cnt);
+			free(bkt);
+			return 0;
+		}
+	}
+	else
+	{
+		for (i = 0; i < n1; i++)
+			SA[s1[i]] = i;
+	}
+
+	// induce the full array from the sorted LMS suffixes
+	for (i = 1, j = 0; i < n; i++)
+	{
+		if (IS_LMS(t, i))
+			s1[j++] = i;
+	}
+	for (i = 0; i < n1; i++)
+		SA[i] = s1[SA[i]];
+	for (i = n1; i < n; i++)
+		SA[i] = EMPTY;
+
+	bucket_ends(cnt, bkt, K);
+	for (i = n1; i-- > 0;)
+	{
+		j = SA[i];
+		SA[i] = EMPTY;
+		SA[--bkt[CHR(j)]] = j;
+	}
+	induce(T, SA, t, n, K, cs, cnt, bkt);
+
+	free(t);
+	free(cnt);
+	free(bkt);
+	return 1;
+}
+
+// Induce L-type suffixes left to right, then S-type right to left
+static void
+induce(const void *T, uint32 *SA, const byte *t, uint32 n, uint32 K, int cs, const uint32 *cnt, uint32 *bkt)
+{
+	uint32 i, j;
+
+	bucket_starts(cnt, bkt, K);
+
+	// the sentinel precedes everything and induces the last suffix
+	SA[bkt[CHR(n - 1)]++] = n - 1;
+	for (i = 0; i < n; i++)
+	{
+		j = SA[i];
+		if (j != EMPTY && j > 0 && !TYPE_S(t, j - 1))
+			SA[bkt[CHR(j - 1)]++] = j - 1;
+	}
+
+	bucket_ends(cnt, bkt, K);
+	for (i = n; i-- > 0;)
+	{
+		j = SA[i];
+		if (j != EMPTY && j > 0 && TYPE_S(t, j - 1))
+			SA[--bkt[CHR(j - 1)]] = j - 1;
+	}
+}
+
+// Compute the LCP array with the permuted LCP method of Karkkainen,
+// Manzini & Puglisi. Each phase is split across threads: phi is
+// filled from the suffix array, replaced in place by the PLCP values,
+// then permuted into suffix order. Returns 0 if out of memory.
+static int
+build_lcp(const byte *data, unsigned int size, uint32 *sa, uint32 *lcp, uint32 *phi)
+{
+	struct lcp_job *jobs;
+	unsigned int jobsize;
+	int njobs;
+	int phase;
+	int i;
+
+	njobs = cpu_count();
+	if (size / MIN_JOB_SIZE < (unsigned int)njobs)
+		njobs = size / MIN_JOB_SIZE;
+	if (njobs < 1)
+		njobs = 1;
+
+	jobs = calloc(njobs, sizeof(struct lcp_job));
+	if (!jobs)
+		return 0;
+
+	jobsize = size / njobs;
+	for (i = 0; i < njobs; i++)
+	{
+		jobs[i].data = data;
+		jobs[i].size = size;
+		jobs[i].sa = sa;
+		jobs[i].lcp = lcp;
+		jobs[i].phi = phi;
+		jobs[i].start = i * jobsize;
+		jobs[i].end = i == njobs - 1 ? size : (i + 1) * jobsize;
+	}
+
+	for (phase = PhasePhi; phase <= PhaseLcp; phase++)
+	{
+		for (i = 0; i < njobs; i++)
+			jobs[i].phase = phase;
+		run_parallel(&lcp_proc, jobs, njobs, sizeof(struct lcp_job));
+	}
+
+	free(jobs);
+	return 1;
+}
+
+static void
+lcp_proc(void *arg)
+{
+	struct lcp_job *job = arg;
+	unsigned int i, j, h;
+
+	switch (job->phase)
+	{
+	case PhasePhi:
+		// phi maps each suffix to the one before it in sorted order
+		for (i = job->start; i < job->end; i++)
+			job->phi[job->sa[i]] = i ? job->sa[i - 1] : EMPTY;
+		break;
+	case PhasePlcp:
+		// PLCP[i + 1] >= PLCP[i] - 1, so h only restarts at each job
+		h = 0;
+		for (i = job->start; i < job->end; i++)
+		{
+			j = job->phi[i];
+			if (j == EMPTY)
+				h = 0;
+			else
+			{
+				while (i + h < job->size && j + h < job->size && job->data[i + h] == job->data[j + h])
+					h++;
+			}
+
+			job->phi[i] = h;
+			if (h)
+				h--;
+		}
+		break;
+	case PhaseLcp:
+		for (i = job->start; i < job->end; i++)
+			job->lcp[i] = job->phi[job->sa[i]];
+		break;
+	}
+}
+
+// Compare the start of a suffix to a pattern, a suffix shorter than
+// the pattern but otherwise equal is less than it
+static int
+compare_suffix(const byte *data, unsigned int size, uint32 off, const byte *pattern, unsigned int len)
+{
+	unsigned int avail;
+	int result;
+
+	avail = size - off;
+	result = memcmp(data + off, pattern, avail < len ? avail : len);
+	if (result)
+		return result;
+	return avail < len ? -1 : 0;
+}
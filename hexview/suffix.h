@@ -0,0 +1,86 @@
+#ifndef SUFFIX_H
+#define SUFFIX_H
+
+#include "defs.h"
+#include "sidecar.h"
+
+#define SUFFIX_EXT ".hvsa"
+
+typedef struct suffix_s suffix_t;
+struct suffix_s
+{
+	const uint32 *sa;   // Offsets of every suffix of the file, in sorted order.
+	const uint32 *lcp;  // lcp[i] is the length of the common prefix of sa[i - 1] and sa[i], lcp[0] is 0.
+	unsigned int size;  // Size of the indexed file, the number of elements in sa and lcp.
+
+	sidecar_t *sidecar;  // mapping holding sa and lcp
+};
+
+typedef struct suffix_repeat_s suffix_repeat_t;
+struct suffix_repeat_s
+{
+	unsigned int off;    // Offset of the first occurrence.
+	unsigned int len;    // Length of the repeated bytes.
+	unsigned int count;  // Number of occurrences, at least 2.
+};
+
+// Build the suffix and LCP arrays of a block of memory and store them
+// in a sidecar. The suffix array is built with SA-IS directly into
+// the sidecar mapping, then the LCP array is computed on all avaliable
+// cores. Scratch arrays the size of the data are also file backed.
+// Parameters:
+// - data: The data to index.
+// - size: The number of bytes data points to.
+// - mtime: The modification time of the file, see sidecar_file_time.
+// - path: The path of the sidecar to create.
+//
+// Returns:
+// The index, or NULL if the sidecar could not be created.
+suffix_t *suffix_build(const byte *data, unsigned int size, uint64 mtime, const char *path);
+
+// Open a sidecar created with suffix_build.
+// Parameters:
+// - path: The path of the sidecar.
+// - size: The size of the file the sidecar should describe.
+// - mtime: The modification time of the file as it is now.
+//
+// Returns:
+// The index, or NULL if there is no sidecar or it describes a file of
+// a different size or modification time.
+suffix_t *suffix_open(const char *path, unsigned int size, uint64 mtime);
+
+// Close an index.
+// Parameters:
+// - suffix: The index to close, can be NULL.
+void suffix_free(suffix_t *suffix);
+
+// Find every occurrence of a string by binary search.
+// Parameters:
+// - suffix: The index to search.
+// - data: The data the index was built from.
+// - pattern: The bytes to search for.
+// - len: The number of bytes pattern points to, must not be 0.
+// - first: Output parameter giving the position in suffix->sa of the
+//          first occurrence. The occurrences are consecutive, but not
+//          sorted by offset.
+//
+// Returns:
+// The number of occurrences.
+unsigned int suffix_find(suffix_t *suffix, const byte *data, const byte *pattern, unsigned int len, unsigned int *const first);
+
+// Find the longest repeated strings. Each run of suffixes sharing at
+// least minlen bytes gives at most one result, its longest shared
+// prefix, unless it only occurs inside a longer repeat.
+// Parameters:
+// - suffix: The index to search.
+// - data: The data the index was built from.
+// - minlen: The minimum length of a repeat.
+// - out: Output parameter which will contain the results, longest
+//        first.
+// - max: The number of elements out can hold.
+//
+// Returns:
+// The number of results written to out.
+unsigned int suffix_repeats(suffix_t *suffix, const byte *data, unsigned int minlen, suffix_repeat_t *const out, unsigned int max);
+
+#endif
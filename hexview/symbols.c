@@ -0,0 +1,446 @@
+#include "symbols.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SHT_SYMTAB 2
+#define SHT_NOBITS 8
+#define SHT_DYNSYM 11
+#define SHN_LORESERVE 0xff00
+#define SHN_ABS 0xfff1
+#define PT_LOAD 1
+#define ET_REL 1
+#define EM_ARM 40
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+#define STT_TLS 6
+#define SORT_BITS 13  // most bits of the offset sorted in each pass
+
+// The headers of an ELF file, read once. Every table is checked to be
+// inside the file before its entries are read.
+struct elf
+{
+	const byte *data;
+	unsigned int size;
+	int wide;
+	int swap;  // the file is not in the native endianess
+	unsigned int type;
+	unsigned int machine;
+
+	uint64 shoff;
+	unsigned int shentsize;
+	unsigned int shnum;
+
+	struct segment *segments;
+	unsigned int nsegments;
+	unsigned int last;  // segment of the last symbol, the next is likely in it too
+};
+
+struct segment
+{
+	uint64 vaddr;
+	uint64 offset;
+	uint64 filesz;
+};
+
+static uint64 read_int(const struct elf *elf, uint64 off, unsigned int len);
+static int in_file(const struct elf *elf, uint64 off, uint64 len);
+static int read_headers(struct elf *elf);
+static unsigned int read_table(struct elf *elf, uint64 sh, symbol_t *out);
+static int map_address(struct elf *elf, uint64 value, unsigned int shndx, unsigned int *const off);
+static int sort_symbols(symbol_t *items, unsigned int count);
+static void build_tree(symbols_t *symbols, unsigned int *const next, uint64 k);
+
+symbols_t *
+symbols_load(const byte *data, unsigned int size)
+{
+	symbols_t *symbols;
+	struct elf elf;
+	symbol_t *items;
+	uint64 sh, total;
+	unsigned int i, j, count, type, entsize;
+
+	symbols = calloc(1, sizeof(symbols_t));
+	if (!symbols)
+		return NULL;
+
+	memset(&elf, 0, sizeof(elf));
+	elf.data = data;
+	elf.size = size;
+	if (!read_headers(&elf))
+		return symbols;
+
+	// room for every entry of every symbol table, most will be kept
+	total = 0;
+	for (i = 0; i < elf.shnum; i++)
+	{
+		sh = elf.shoff + (uint64)i * elf.shentsize;
+		type = (unsigned int)read_int(&elf, sh + 4, 4);
+		entsize = (unsigned int)(elf.wide ? read_int(&elf, sh + 0x38, 8) : read_int(&elf, sh + 0x24, 4));
+		if ((type == SHT_SYMTAB || type == SHT_DYNSYM) && entsize)
+			total += (elf.wide ? read_int(&elf, sh + 0x20, 8) : read_int(&elf, sh + 0x14, 4)) / entsize;
+	}
+
+	if (!total || total > size)
+	{
+		free(elf.segments);
+		return symbols;
+	}
+
+	items = malloc(total * sizeof(symbol_t));
+	if (!items)
+	{
+		free(elf.segments);
+		free(symbols);
+		return NULL;
+	}
+
+	// .symtab before .dynsym, so its names win when both have a symbol
+	count = 0;
+	for (type = SHT_SYMTAB; type; type = type == SHT_SYMTAB ? SHT_DYNSYM : 0)
+	{
+		for (i = 0; i < elf.shnum; i++)
+		{
+			sh = elf.shoff + (uint64)i * elf.shentsize;
+			if (read_int(&elf, sh + 4, 4) == type)
+				count += read_table(&elf, sh, items + count);
+		}
+	}
+	free(elf.segments);
+
+	if (!sort_symbols(items, count))
+	{
+		free(items);
+		free(symbols);
+		return NULL;
+	}
+
+	// of the symbols at one offset keep the first with a size, aliases
+	// and labels usually have none
+	for (i = 0, j = 0; i < count; i++)
+	{
+		if (j && items[j - 1].offset == items[i].offset)
+		{
+			if (!items[j - 1].size && items[i].size)
+				items[j - 1] = items[i];
+		}
+		else
+			items[j++] = items[i];
+	}
+
+	symbols->items = items;
+	symbols->count = j;
+	symbols->keys = malloc((j + 1) * sizeof(uint32));
+	symbols->ranks = malloc((j + 1) * sizeof(unsigned int));
+	if (!symbols->keys || !symbols->ranks)
+	{
+		symbols_free(symbols);
+		return NULL;
+	}
+
+	i = 0;
+	build_tree(symbols, &i, 1);
+
+	return symbols;
+}
+
+void
+symbols_free(symbols_t *symbols)
+{
+	if (!symbols) return;
+
+	free(symbols->items);
+	free(symbols->keys);
+	free(symbols->ranks);
+	free(symbols);
+}
+
+const symbol_t *
+symbols_lookup(const symbols_t *symbols, unsigned int off)
+{
+	const symbol_t *symbol;
+	uint64 k;
+	unsigned int rank;
+
+	// descend to the right past every key at or below off, the path ends
+	// with the left turn at the first key above it followed by only right
+	// turns, which are undone by shifting off the trailing ones
+	k = 1;
+	while (k <= symbols->count)
+		k = 2 * k + (symbols->keys[k] <= off);
+	k >>= lowest_bit64(~k) + 1;
+
+	rank = k ? symbols->ranks[k] : symbols->count;
+	if (!rank)
+		return NULL;
+
+	symbol = &symbols->items[rank - 1];
+	if (symbol->size && off - symbol->offset >= symbol->size)
+		return NULL;
+
+	return symbol;
+}
+
+// Read an integer of 1, 2, 4 or 8 bytes in the endianess of the file,
+// the range must be checked to be in the file
+static uint64
+read_int(const struct elf *elf, uint64 off, unsigned int len)
+{
+	uint16 v16;
+	uint32 v32;
+	uint64 v64;
+
+	switch (len)
+	{
+	case 2:
+		memcpy(&v16, elf->data + off, 2);
+		return elf->swap ? swap_endianess16(v16) : v16;
+	case 4:
+		memcpy(&v32, elf->data + off, 4);
+		return elf->swap ? swap_endianess32(v32) : v32;
+	case 8:
+		memcpy(&v64, elf->data + off, 8);
+		return elf->swap ? swap_endianess64(v64) : v64;
+	default:
+		return elf->data[off];
+	}
+}
+
+static int
+in_file(const struct elf *elf, uint64 off, uint64 len)
+{
+	return off <= elf->size && len <= elf->size - off;
+}
+
+// Read the file header and the loadable segments. Returns 0 if the file
+// is not ELF or its section headers are not in the file.
+static int
+read_headers(struct elf *elf)
+{
+	uint64 phoff, ph;
+	unsigned int phentsize, phnum, i;
+
+	if (elf->size < 0x34 || memcmp(elf->data, "\x7f" "ELF", 4))
+		return 0;
+
+	elf->wide = elf->data[4] == 2;
+	elf->swap = (elf->data[5] == 2 ? BigEndian : LittleEndian) != NATIVE_ENDIANESS;
+	if (elf->wide && elf->size < 0x40)
+		return 0;
+
+	elf->type = (unsigned int)read_int(elf, 0x10, 2);
+	elf->machine = (unsigned int)read_int(elf, 0x12, 2);
+	phoff = elf->wide ? read_int(elf, 0x20, 8) : read_int(elf, 0x1c, 4);
+	elf->shoff = elf->wide ? read_int(elf, 0x28, 8) : read_int(elf, 0x20, 4);
+	phentsize = (unsigned int)read_int(elf, elf->wide ? 0x36 : 0x2a, 2);
+	phnum = (unsigned int)read_int(elf, elf->wide ? 0x38 : 0x2c, 2);
+	elf->shentsize = (unsigned int)read_int(elf, elf->wide ? 0x3a : 0x2e, 2);
+	elf->shnum = (unsigned int)read_int(elf, elf->wide ? 0x3c : 0x30, 2);
+
+	if (elf->shentsize < (elf->wide ? 0x40u : 0x28u) || !in_file(elf, elf->shoff, (uint64)elf->shnum * elf->shentsize))
+		return 0;
+
+	// segments are optional, relocatable objects have none
+	if (!phnum || phentsize < (elf->wide ? 0x38u : 0x20u) || !in_file(elf, phoff, (uint64)phnum * phentsize))
+		return 1;
+
+	elf->segments = malloc(phnum * sizeof(struct segment));
+	if (!elf->segments)
+		return 1;
+
+	for (i = 0; i < phnum; i++)
+	{
+		ph = phoff + (uint64)i * phentsize;
+		if (read_int(elf, ph, 4) != PT_LOAD)
+			continue;
+
+		elf->segments[elf->nsegments].offset = elf->wide ? read_int(elf, ph + 8, 8) : read_int(elf, ph + 4, 4);
+		elf->segments[elf->nsegments].vaddr = elf->wide ? read_int(elf, ph + 16, 8) : read_int(elf, ph + 8, 4);
+		elf->segments[elf->nsegments].filesz = elf->wide ? read_int(elf, ph + 32, 8) : read_int(elf, ph + 16, 4);
+		elf->nsegments++;
+	}
+
+	return 1;
+}
+
+// Read the symbols of a symbol table section into out. Returns the
+// number of symbols read.
+static unsigned int
+read_table(struct elf *elf, uint64 sh, symbol_t *out)
+{
+	const char *strtab;
+	uint64 off, size, entsize, stroff, strsize, sym, value, len;
+	unsigned int link, count, n, i, type, shndx;
+
+	off = elf->wide ? read_int(elf, sh + 0x18, 8) : read_int(elf, sh + 0x10, 4);
+	size = elf->wide ? read_int(elf, sh + 0x20, 8) : read_int(elf, sh + 0x14, 4);
+	link = (unsigned int)read_int(elf, sh + (elf->wide ? 0x28 : 0x18), 4);
+	entsize = elf->wide ? read_int(elf, sh + 0x38, 8) : read_int(elf, sh + 0x24, 4);
+	if (entsize < (elf->wide ? 24u : 16u) || !in_file(elf, off, size) || link >= elf->shnum)
+		return 0;
+
+	sh = elf->shoff + (uint64)link * elf->shentsize;
+	stroff = elf->wide ? read_int(elf, sh + 0x18, 8) : read_int(elf, sh + 0x10, 4);
+	strsize = elf->wide ? read_int(elf, sh + 0x20, 8) : read_int(elf, sh + 0x14, 4);
+	if (!in_file(elf, stroff, strsize))
+		return 0;
+	strtab = (const char *)elf->data + stroff;
+
+	count = 0;
+	for (i = 0; i < size / entsize; i++)
+	{
+		sym = off + i * entsize;
+		n = (unsigned int)read_int(elf, sym, 4);
+		if (elf->wide)
+		{
+			type = elf->data[sym + 4] & 0xf;
+			shndx = (unsigned int)read_int(elf, sym + 6, 2);
+			value = read_int(elf, sym + 8, 8);
+			len = read_int(elf, sym + 16, 8);
+		}
+		else
+		{
+			value = read_int(elf, sym + 4, 4);
+			len = read_int(elf, sym + 8, 4);
+			type = elf->data[sym + 12] & 0xf;
+			shndx = (unsigned int)read_int(elf, sym + 14, 2);
+		}
+
+		// undefined, common and TLS symbols have no address in the file
+		if (!n || n >= strsize || !shndx || (shndx >= SHN_LORESERVE && shndx != SHN_ABS))
+			continue;
+		if (type == STT_SECTION || type == STT_FILE || type == STT_TLS)
+			continue;
+
+		// ARM mapping symbols such as $t and $d only mark code and data
+		if (strtab[n] == '$' || !memchr(strtab + n, 0, strsize - n))
+			continue;
+
+		// the low bit of a Thumb function address selects the instruction set
+		if (elf->machine == EM_ARM && type == STT_FUNC)
+			value &= ~(uint64)1;
+
+		if (!map_address(elf, value, shndx, &out[count].offset))
+			continue;
+
+		out[count].name = strtab + n;
+		out[count].size = len > 0xffffffff ? 0xffffffff : (unsigned int)len;
+		count++;
+	}
+
+	return count;
+}
+
+// Map the value of a symbol to a file offset. Returns nonzero if it is
+// in the file.
+static int
+map_address(struct elf *elf, uint64 value, unsigned int shndx, unsigned int *const off)
+{
+	const struct segment *seg;
+	uint64 sh, addr, size, result;
+	unsigned int i;
+
+	result = elf->size;
+	if (elf->type != ET_REL)
+	{
+		for (i = 0; i < elf->nsegments; i++)
+		{
+			seg = &elf->segments[(elf->last + i) % elf->nsegments];
+			if (value >= seg->vaddr && value - seg->vaddr < seg->filesz)
+			{
+				elf->last = (elf->last + i) % elf->nsegments;
+				result = seg->offset + (value - seg->vaddr);
+				break;
+			}
+		}
+	}
+
+	// relocatable objects, or files without segments, through the section
+	if (result >= elf->size && shndx < elf->shnum)
+	{
+		sh = elf->shoff + (uint64)shndx * elf->shentsize;
+		addr = elf->type == ET_REL ? 0 : elf->wide ? read_int(elf, sh + 0x10, 8) : read_int(elf, sh + 0x0c, 4);
+		size = elf->wide ? read_int(elf, sh + 0x20, 8) : read_int(elf, sh + 0x14, 4);
+		if (read_int(elf, sh + 4, 4) != SHT_NOBITS && value >= addr && value - addr < size)
+			result = (elf->wide ? read_int(elf, sh + 0x18, 8) : read_int(elf, sh + 0x10, 4)) + (value - addr);
+	}
+
+	if (result >= elf->size)
+		return 0;
+
+	*off = (unsigned int)result;
+	return 1;
+}
+
+// Sort symbols by offset with a stable radix sort, in as few passes of
+// at most SORT_BITS as the largest offset needs, so the offsets of files
+// up to 64 MiB are sorted in two. Returns 0 if memory could not be
+// allocated.
+static int
+sort_symbols(symbol_t *items, unsigned int count)
+{
+	symbol_t *temp, *from, *to, *swap;
+	unsigned int counts[1 << SORT_BITS];
+	unsigned int largest, bits, passes, digit, mask, shift, i, sum, c;
+
+	largest = 0;
+	for (i = 0; i < count; i++)
+		largest |= items[i].offset;
+	for (bits = 0; bits < 32 && largest >> bits; bits++);
+	if (!bits)
+		return 1;
+
+	passes = (bits + SORT_BITS - 1) / SORT_BITS;
+	digit = (bits + passes - 1) / passes;
+	mask = (1 << digit) - 1;
+
+	temp = malloc(count * sizeof(symbol_t));
+	if (!temp)
+		return 0;
+
+	from = items;
+	to = temp;
+	for (shift = 0; shift < bits; shift += digit)
+	{
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < count; i++)
+			counts[(from[i].offset >> shift) & mask]++;
+
+		for (i = 0, sum = 0; i <= mask; i++)
+		{
+			c = counts[i];
+			counts[i] = sum;
+			sum += c;
+		}
+
+		for (i = 0; i < count; i++)
+			to[counts[(from[i].offset >> shift) & mask]++] = from[i];
+
+		swap = from;
+		from = to;
+		to = swap;
+	}
+
+	if (from != items)
+		memcpy(items, from, count * sizeof(symbol_t));
+	free(temp);
+
+	return 1;
+}
+
+// Lay out the sorted offsets from *next on in Eytzinger order, an in
+// order walk of the tree rooted at k
+static void
+build_tree(symbols_t *symbols, unsigned int *const next, uint64 k)
+{
+	if (k > symbols->count)
+		return;
+
+	build_tree(symbols, next, 2 * k);
+	symbols->keys[k] = symbols->items[*next].offset;
+	symbols->ranks[k] = *next;
+	(*next)++;
+	build_tree(symbols, next, 2 * k + 1);
+}
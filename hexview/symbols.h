@@ -0,0 +1,56 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "defs.h"
+
+typedef struct symbol_s symbol_t;
+struct symbol_s
+{
+	const char *name;     // Points into the data of the file.
+	unsigned int offset;  // File offset the address of the symbol maps to.
+	unsigned int size;    // Size of the symbol, 0 if unknown.
+};
+
+typedef struct symbols_s symbols_t;
+struct symbols_s
+{
+	symbol_t *items;     // Symbols sorted by offset, one for each offset.
+	unsigned int count;
+
+	// Offsets of the symbols in Eytzinger order, the sorted array laid out
+	// as a complete binary tree in breadth first order starting at index 1,
+	// so the first levels of a search share a few cache lines.
+	uint32 *keys;
+	unsigned int *ranks;  // Index in items of each element of keys.
+};
+
+// Load the symbols of an ELF file from its .symtab and .dynsym sections.
+// Addresses are mapped to file offsets through the loadable segments,
+// or the section of the symbol for relocatable objects. Symbols without
+// a name or an offset in the file are left out, and of several symbols
+// at one offset the first with a size is kept.
+// Parameters:
+// - data: The data of the file, which must outlive the table.
+// - size: The size of the file.
+//
+// Returns:
+// The table, which is empty if the file is not ELF or has no symbols,
+// or NULL if memory could not be allocated.
+symbols_t *symbols_load(const byte *data, unsigned int size);
+
+// Free a table.
+// Parameters:
+// - symbols: The table to free, can be NULL.
+void symbols_free(symbols_t *symbols);
+
+// Find the symbol an offset belongs to, the nearest at or below it.
+// Parameters:
+// - symbols: The table to search.
+// - off: The file offset.
+//
+// Returns:
+// The symbol, or NULL if there is none below off or off is past the end
+// of a symbol with a known size.
+const symbol_t *symbols_lookup(const symbols_t *symbols, unsigned int off);
+
+#endif
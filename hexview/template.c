@@ -0,0 +1,877 @@
+#include "template.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numeric.h"
+
+#define MAX_TOKEN 64          // longest name in a definition
+#define MAX_FLATTEN 4096      // most fields a struct can be flattened to
+#define FLATTEN_ELEMENTS 16   // longest array of structs flattened into its parent
+#define FORMAT_ELEMENTS 16    // elements of an array shown by template_format
+#define FORMAT_STRUCTS 4      // elements of an array of structs shown by template_format
+#define FORMAT_CHARS 64       // characters of a string shown by template_format
+#define DEFAULT_ENDIANESS LittleEndian
+
+struct template_s
+{
+	plan_t **plans;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+struct parser
+{
+	const char *p;
+	unsigned int line;
+	char token[MAX_TOKEN];
+	int failed;
+	char *error;
+	size_t size;
+	template_t *templates;
+};
+
+// the struct being compiled
+struct builder
+{
+	plan_op_t *ops;
+	unsigned int nops;
+	unsigned int capacity;
+	unsigned int offset;  // offset of the next field in the current segment
+	int variable;         // a field of variable size was added
+};
+
+// formatted text, cut off at the end of the buffer
+struct writer
+{
+	char *out;
+	size_t len;
+	size_t size;
+};
+
+static int next_token(struct parser *ps);
+static int fail(struct parser *ps, const char *format, const char *arg);
+static int is_word(char c);
+static int is_endianess(const char *token, int *const endianess);
+static int parse_struct(struct parser *ps);
+static int parse_field(struct parser *ps, struct builder *b, int endianess);
+static int add_field(struct parser *ps, struct builder *b, const char *name, int type, plan_t *sub, int endianess, int kind, unsigned int count);
+static int add_flattened(struct parser *ps, struct builder *b, const char *prefix, plan_t *sub);
+static plan_op_t *add_op(struct parser *ps, struct builder *b, const char *prefix, const char *name);
+static int find_field(struct builder *b, const char *name);
+static int is_defined(struct builder *b, const char *name);
+static int is_variable(const plan_op_t *op);
+static void plan_free(plan_t *plan);
+static uint64 read_integer(const byte *data, int type, int endianess);
+static void decode_column(const byte *in, unsigned int stride, unsigned int count, int size, int swap, value_u *const out);
+static int walk(plan_t *plan, const byte *data, unsigned int avail, const value_u *columns, unsigned int stride, unsigned int record, const char *sep, struct writer *w, unsigned int *const size);
+static void format_elements(const plan_op_t *op, const byte *data, uint64 n, struct writer *w);
+static void put(struct writer *w, const char *s, size_t len);
+static void puts_w(struct writer *w, const char *s);
+
+template_t *
+template_create()
+{
+	return calloc(1, sizeof(template_t));
+}
+
+void
+template_free(template_t *templates)
+{
+	unsigned int i;
+
+	if (!templates) return;
+
+	for (i = 0; i < templates->count; i++)
+		plan_free(templates->plans[i]);
+	free(templates->plans);
+	free(templates);
+}
+
+int
+template_load(template_t *templates, const char *path, char *const error, size_t size)
+{
+	FILE *fp;
+	char *text;
+	long len;
+	size_t read;
+	struct parser ps;
+	unsigned int first;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+	{
+		snprintf(error, size, "Could not open the file.");
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = len >= 0 ? malloc(len + 1) : NULL;
+	if (!text)
+	{
+		fclose(fp);
+		snprintf(error, size, "Failed to allocate memory.");
+		return -1;
+	}
+
+	read = fread(text, 1, len, fp);
+	text[read] = 0;
+	fclose(fp);
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = text;
+	ps.line = 1;
+	ps.error = error;
+	ps.size = size;
+	ps.templates = templates;
+
+	first = templates->count;
+	while (next_token(&ps))
+	{
+		if (!parse_struct(&ps))
+			break;
+	}
+	free(text);
+
+	// a definition file is added whole or not at all
+	if (ps.failed)
+	{
+		while (templates->count > first)
+			plan_free(templates->plans[--templates->count]);
+		return -1;
+	}
+
+	return templates->count - first;
+}
+
+plan_t *
+template_find(template_t *templates, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < templates->count; i++)
+	{
+		if (!strcmp(templates->plans[i]->name, name))
+			return templates->plans[i];
+	}
+
+	return NULL;
+}
+
+plan_t *
+template_at(template_t *templates, unsigned int index)
+{
+	return index < templates->count ? templates->plans[index] : NULL;
+}
+
+unsigned int
+template_measure(plan_t *plan, const byte *data, unsigned int avail)
+{
+	unsigned int size;
+
+	if (plan->size)
+		return plan->size <= avail ? plan->size : 0;
+
+	return walk(plan, data, avail, NULL, 0, 0, NULL, NULL, &size) ? size : 0;
+}
+
+void
+template_columns(plan_t *plan, const byte *data, unsigned int count, value_u *const columns)
+{
+	const plan_op_t *op;
+	unsigned int i;
+
+	// one field at a time, so each loop is a fixed stride load with the
+	// type known outside it
+	for (i = 0; i < plan->nops; i++)
+	{
+		op = &plan->ops[i];
+		if (op->kind != OpValue || op->type < 0)
+			continue;
+
+		decode_column(data + op->offset, plan->size, count, numeric_size(op->type),
+			op->endianess != NATIVE_ENDIANESS, columns + (size_t)i * count);
+	}
+}
+
+unsigned int
+template_format(plan_t *plan, const byte *data, unsigned int avail, const value_u *columns, unsigned int stride, unsigned int record, const char *sep, char *const out, size_t size, size_t *const len)
+{
+	struct writer w;
+	unsigned int record_size;
+
+	w.out = out;
+	w.len = 0;
+	w.size = size;
+
+	if (!walk(plan, data, avail, plan->size ? columns : NULL, stride, record, sep, &w, &record_size))
+		record_size = 0;
+
+	*len = w.len;
+	return record_size;
+}
+
+// Read the next name, number or punctuation character into ps->token.
+// Returns 0 at the end of the text or if the name is too long.
+static int
+next_token(struct parser *ps)
+{
+	const char *p = ps->p;
+	size_t n;
+
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		{
+			if (*p == '\n')
+				ps->line++;
+			p++;
+		}
+
+		if (*p != '#' && (p[0] != '/' || p[1] != '/'))
+			break;
+		while (*p && *p != '\n')
+			p++;
+	}
+
+	ps->token[0] = 0;
+	if (!*p)
+	{
+		ps->p = p;
+		return 0;
+	}
+
+	n = 1;
+	if (is_word(*p))
+	{
+		while (is_word(p[n]))
+			n++;
+	}
+
+	if (n >= MAX_TOKEN)
+		return fail(ps, "name is too long", "");
+
+	memcpy(ps->token, p, n);
+	ps->token[n] = 0;
+	ps->p = p + n;
+	return 1;
+}
+
+// Record the first error of a file, with its line. Always returns 0.
+static int
+fail(struct parser *ps, const char *format, const char *arg)
+{
+	int n;
+
+	if (ps->failed)
+		return 0;
+
+	n = snprintf(ps->error, ps->size, "line %u: ", ps->line);
+	if (n >= 0 && (size_t)n < ps->size)
+		snprintf(ps->error + n, ps->size - n, format, arg);
+	ps->failed = 1;
+	return 0;
+}
+
+static int
+is_word(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.';
+}
+
+static int
+is_endianess(const char *token, int *const endianess)
+{
+	if (!strcmp(token, "big") || !strcmp(token, "be"))
+		*endianess = BigEndian;
+	else if (!strcmp(token, "little") || !strcmp(token, "le"))
+		*endianess = LittleEndian;
+	else
+		return 0;
+
+	return 1;
+}
+
+// Parse and compile one definition, the "struct" keyword is in ps->token
+static int
+parse_struct(struct parser *ps)
+{
+	struct builder b;
+	template_t *t = ps->templates;
+	plan_t *plan, **plans;
+	int endianess;
+
+	if (strcmp(ps->token, "struct"))
+		return fail(ps, "expected 'struct' but found '%s'", ps->token);
+
+	if (!next_token(ps) || !is_word(ps->token[0]) || (ps->token[0] >= '0' && ps->token[0] <= '9') || strchr(ps->token, '.'))
+		return fail(ps, "expected the name of the struct but found '%s'", ps->token);
+	if (numeric_type(ps->token) >= 0 || template_find(t, ps->token))
+		return fail(ps, "'%s' is already defined", ps->token);
+
+	plan = calloc(1, sizeof(plan_t));
+	if (!plan || !(plan->name = malloc(strlen(ps->token) + 1)))
+	{
+		free(plan);
+		return fail(ps, "Failed to allocate memory.", "");
+	}
+	strcpy(plan->name, ps->token);
+
+	memset(&b, 0, sizeof(b));
+	endianess = DEFAULT_ENDIANESS;
+
+	next_token(ps);
+	if (is_endianess(ps->token, &endianess))
+		next_token(ps);
+	if (strcmp(ps->token, "{"))
+	{
+		fail(ps, "expected '{' but found '%s'", ps->token);
+		goto error;
+	}
+
+	for (;;)
+	{
+		if (!next_token(ps))
+		{
+			fail(ps, "expected '}' at the end of the file", "");
+			goto error;
+		}
+		if (!strcmp(ps->token, "}"))
+			break;
+		if (!parse_field(ps, &b, endianess))
+			goto error;
+	}
+
+	if (!b.nops || (!b.variable && !b.offset))
+	{
+		fail(ps, "struct '%s' is empty", plan->name);
+		goto error;
+	}
+
+	plan->ops = b.ops;
+	plan->nops = b.nops;
+	plan->size = b.variable ? 0 : b.offset;
+	plan->tail = b.offset;
+	plan->values = calloc(b.nops, sizeof(uint64));
+
+	if (t->count == t->capacity)
+	{
+		plans = realloc(t->plans, (t->capacity ? t->capacity * 2 : 8) * sizeof(plan_t *));
+		if (plans)
+		{
+			t->plans = plans;
+			t->capacity = t->capacity ? t->capacity * 2 : 8;
+		}
+	}
+	if (!plan->values || t->count == t->capacity)
+	{
+		plan_free(plan);
+		return fail(ps, "Failed to allocate memory.", "");
+	}
+
+	t->plans[t->count++] = plan;
+	return 1;
+
+error:
+	plan->ops = b.ops;
+	plan->nops = b.nops;
+	plan_free(plan);
+	return 0;
+}
+
+// Parse "<type> <name>[<count>] [endianess];" with the type in ps->token
+static int
+parse_field(struct parser *ps, struct builder *b, int endianess)
+{
+	char name[MAX_TOKEN];
+	plan_t *sub;
+	int type, kind, field, prefix;
+	unsigned long count;
+	char *end;
+
+	sub = NULL;
+	type = numeric_type(ps->token);
+	if (type < 0)
+	{
+		sub = template_find(ps->templates, ps->token);
+		if (!sub)
+			return fail(ps, "unknown type '%s'", ps->token);
+	}
+
+	if (!next_token(ps) || !is_word(ps->token[0]) || (ps->token[0] >= '0' && ps->token[0] <= '9') || strchr(ps->token, '.'))
+		return fail(ps, "expected the name of a field but found '%s'", ps->token);
+	if (is_defined(b, ps->token))
+		return fail(ps, "field '%s' is already defined", ps->token);
+	strcpy(name, ps->token);
+
+	kind = OpValue;
+	count = 1;
+	next_token(ps);
+	if (!strcmp(ps->token, "["))
+	{
+		next_token(ps);
+		prefix = numeric_type(ps->token);
+		if (ps->token[0] >= '0' && ps->token[0] <= '9')
+		{
+			kind = OpArray;
+			count = strtoul(ps->token, &end, 0);
+			if (*end || count > 0xffffffffUL)
+				return fail(ps, "invalid count '%s'", ps->token);
+		}
+		else if (prefix >= 0)
+		{
+			// an integer type is the type of a count stored before the elements
+			if (prefix > Uint64)
+				return fail(ps, "count '%s' is not an integer type or field", ps->token);
+			kind = OpPrefixed;
+			count = prefix;
+		}
+		else
+		{
+			field = find_field(b, ps->token);
+			if (field < 0 || b->ops[field].kind != OpValue || b->ops[field].type < Int8 || b->ops[field].type > Uint64)
+				return fail(ps, "count '%s' is not an integer type or field", ps->token);
+			kind = OpCounted;
+			count = field;
+		}
+
+		next_token(ps);
+		if (strcmp(ps->token, "]"))
+			return fail(ps, "expected ']' but found '%s'", ps->token);
+		next_token(ps);
+	}
+
+	if (is_endianess(ps->token, &endianess))
+	{
+		if (sub)
+			return fail(ps, "the endianess of '%s' is set by its struct", name);
+		next_token(ps);
+	}
+
+	if (strcmp(ps->token, ";"))
+		return fail(ps, "expected ';' but found '%s'", ps->token);
+
+	return add_field(ps, b, name, type, sub, endianess, kind, (unsigned int)count);
+}
+
+static int
+add_field(struct parser *ps, struct builder *b, const char *name, int type, plan_t *sub, int endianess, int kind, unsigned int count)
+{
+	plan_op_t *op;
+	char prefix[MAX_TOKEN + 16];
+	uint64 size;
+	unsigned int i;
+
+	// fields of nested structs become fields of this one, so fixed size
+	// structs decode as a single flat list
+	if (sub && kind == OpValue)
+	{
+		sprintf(prefix, "%s.", name);
+		return add_flattened(ps, b, prefix, sub);
+	}
+
+	if (sub && kind == OpArray && sub->size && count && count <= FLATTEN_ELEMENTS)
+	{
+		for (i = 0; i < count; i++)
+		{
+			sprintf(prefix, "%s[%u].", name, i);
+			if (!add_flattened(ps, b, prefix, sub))
+				return 0;
+		}
+		return 1;
+	}
+
+	op = add_op(ps, b, "", name);
+	if (!op)
+		return 0;
+
+	op->offset = b->offset;
+	op->type = sub ? -1 : type;
+	op->endianess = endianess;
+	op->kind = kind;
+	op->count = count;
+	op->sub = sub;
+
+	// fields after one of variable size are placed from its end
+	if (is_variable(op))
+	{
+		b->variable = 1;
+		b->offset = 0;
+		return 1;
+	}
+
+	size = (uint64)(sub ? sub->size : (unsigned int)numeric_size(type)) * (kind == OpArray ? count : 1);
+	if (b->offset + size > 0xffffffff)
+		return fail(ps, "struct is too large at '%s'", name);
+	b->offset += (unsigned int)size;
+	return 1;
+}
+
+static int
+add_flattened(struct parser *ps, struct builder *b, const char *prefix, plan_t *sub)
+{
+	const plan_op_t *from;
+	plan_op_t *op;
+	unsigned int i, base;
+	int first_segment;
+
+	if ((uint64)b->offset + sub->tail > 0xffffffff)
+		return fail(ps, "struct is too large at '%s'", prefix);
+
+	base = b->nops;
+	first_segment = 1;
+	for (i = 0; i < sub->nops; i++)
+	{
+		from = &sub->ops[i];
+		op = add_op(ps, b, prefix, from->name);
+		if (!op)
+			return 0;
+
+		op->offset = from->offset + (first_segment ? b->offset : 0);
+		op->type = from->type;
+		op->endianess = from->endianess;
+		op->kind = from->kind;
+		op->count = from->kind == OpCounted ? from->count + base : from->count;
+		op->sub = from->sub;
+
+		if (is_variable(from))
+			first_segment = 0;
+	}
+
+	if (sub->size)
+	{
+		b->offset += sub->size;
+	}
+	else
+	{
+		b->variable = 1;
+		b->offset = sub->tail;
+	}
+
+	return 1;
+}
+
+static plan_op_t *
+add_op(struct parser *ps, struct builder *b, const char *prefix, const char *name)
+{
+	plan_op_t *ops, *op;
+
+	if (b->nops == MAX_FLATTEN)
+	{
+		fail(ps, "struct has too many fields at '%s'", name);
+		return NULL;
+	}
+
+	if (b->nops == b->capacity)
+	{
+		ops = realloc(b->ops, (b->capacity ? b->capacity * 2 : 16) * sizeof(plan_op_t));
+		if (!ops)
+		{
+			fail(ps, "Failed to allocate memory.", "");
+			return NULL;
+		}
+		b->ops = ops;
+		b->capacity = b->capacity ? b->capacity * 2 : 16;
+	}
+
+	op = &b->ops[b->nops];
+	memset(op, 0, sizeof(plan_op_t));
+	op->name = malloc(strlen(prefix) + strlen(name) + 1);
+	if (!op->name)
+	{
+		fail(ps, "Failed to allocate memory.", "");
+		return NULL;
+	}
+	strcpy(op->name, prefix);
+	strcat(op->name, name);
+
+	b->nops++;
+	return op;
+}
+
+// Returns the index of the field with a name, or -1 if there is none
+static int
+find_field(struct builder *b, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->nops; i++)
+	{
+		if (!strcmp(b->ops[i].name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+// Returns nonzero if a field, or a nested struct, already has a name
+static int
+is_defined(struct builder *b, const char *name)
+{
+	unsigned int i;
+	size_t len;
+
+	len = strlen(name);
+	for (i = 0; i < b->nops; i++)
+	{
+		if (!strncmp(b->ops[i].name, name, len) &&
+			(!b->ops[i].name[len] || b->ops[i].name[len] == '.' || b->ops[i].name[len] == '['))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+is_variable(const plan_op_t *op)
+{
+	return op->kind == OpCounted || op->kind == OpPrefixed || (op->type < 0 && !op->sub->size);
+}
+
+static void
+plan_free(plan_t *plan)
+{
+	unsigned int i;
+
+	for (i = 0; i < plan->nops; i++)
+		free(plan->ops[i].name);
+	free(plan->ops);
+	free(plan->values);
+	free(plan->name);
+	free(plan);
+}
+
+// Read an integer as unsigned, negative values become huge
+static uint64
+read_integer(const byte *data, int type, int endianess)
+{
+	value_u value;
+
+	numeric_decode(data, 1, type, endianess, &value);
+	switch (type)
+	{
+	case Int8: return (uint64)(int64)value.i8;
+	case Uint8: return value.ui8;
+	case Int16: return (uint64)(int64)value.i16;
+	case Uint16: return value.ui16;
+	case Int32: return (uint64)(int64)value.i32;
+	case Uint32: return value.ui32;
+	default: return value.ui64;
+	}
+}
+
+static void
+decode_column(const byte *in, unsigned int stride, unsigned int count, int size, int swap, value_u *const out)
+{
+	unsigned int r;
+	uint16 v16;
+	uint32 v32;
+	uint64 v64;
+
+	switch (size)
+	{
+	case 1:
+		for (r = 0; r < count; r++)
+			out[r].ui8 = in[(size_t)r * stride];
+		break;
+	case 2:
+		for (r = 0; r < count; r++)
+		{
+			memcpy(&v16, in + (size_t)r * stride, 2);
+			out[r].ui16 = swap ? swap_endianess16(v16) : v16;
+		}
+		break;
+	case 4:
+		for (r = 0; r < count; r++)
+		{
+			memcpy(&v32, in + (size_t)r * stride, 4);
+			out[r].ui32 = swap ? swap_endianess32(v32) : v32;
+		}
+		break;
+	case 8:
+		for (r = 0; r < count; r++)
+		{
+			memcpy(&v64, in + (size_t)r * stride, 8);
+			out[r].ui64 = swap ? swap_endianess64(v64) : v64;
+		}
+		break;
+	}
+}
+
+// Walk the fields of a record, following counts to find where variable
+// fields end, and format them if w is not NULL
+static int
+walk(plan_t *plan, const byte *data, unsigned int avail, const value_u *columns, unsigned int stride, unsigned int record, const char *sep, struct writer *w, unsigned int *const size)
+{
+	const plan_op_t *op;
+	struct writer *element;
+	uint64 base, pos, n, len, j;
+	unsigned int i, sub_size;
+	value_u value;
+	char text[NUMERIC_MAX_CHARS + 32];
+
+	base = 0;
+	for (i = 0; i < plan->nops; i++)
+	{
+		op = &plan->ops[i];
+		pos = base + op->offset;
+
+		switch (op->kind)
+		{
+		case OpValue:
+			n = 1;
+			break;
+		case OpArray:
+			n = op->count;
+			break;
+		case OpCounted:
+			n = plan->values[op->count];
+			break;
+		default:
+			if (pos + numeric_size(op->count) > avail)
+				return 0;
+			n = read_integer(data + pos, op->count, op->endianess);
+			pos += numeric_size(op->count);
+			break;
+		}
+		if (pos > avail)
+			return 0;
+
+		if (w)
+		{
+			if (i)
+				puts_w(w, sep);
+			puts_w(w, op->name);
+			put(w, "=", 1);
+		}
+
+		if (op->type >= 0)
+		{
+			if (n > (avail - pos) / numeric_size(op->type))
+				return 0;
+			len = n * numeric_size(op->type);
+
+			if (op->kind == OpValue && !plan->size && op->type <= Uint64)
+				plan->values[i] = read_integer(data + pos, op->type, op->endianess);
+
+			if (w && op->kind == OpValue)
+			{
+				if (columns)
+					value = columns[(size_t)i * stride + record];
+				else
+					numeric_decode(data + pos, 1, op->type, op->endianess, &value);
+				put(w, text, numeric_format(&value, op->type, text));
+			}
+			else if (w)
+			{
+				format_elements(op, data + pos, n, w);
+			}
+		}
+		else
+		{
+			if (op->sub->size ? n > (avail - pos) / op->sub->size : n > avail - pos)
+				return 0;
+
+			if (w)
+				put(w, "[", 1);
+
+			// elements of variable size have to be walked one by one to
+			// find the end, the others only to be shown
+			len = 0;
+			element = w;
+			for (j = 0; j < n && (!op->sub->size || (element && j < FORMAT_STRUCTS)); j++)
+			{
+				if (j == FORMAT_STRUCTS)
+					element = NULL;
+				if (element)
+					puts_w(element, j ? ", {" : "{");
+				if (!walk(op->sub, data + pos + len, (unsigned int)(avail - pos - len), NULL, 0, 0, ", ", element, &sub_size))
+					return 0;
+				if (element)
+					put(element, "}", 1);
+				len += sub_size;
+			}
+			if (op->sub->size)
+				len = n * op->sub->size;
+
+			if (w)
+			{
+				if (n > FORMAT_STRUCTS)
+					put(w, text, sprintf(text, ", ... (%llu)", (unsigned long long)n));
+				put(w, "]", 1);
+			}
+		}
+
+		if (is_variable(op))
+			base = pos + len;
+	}
+
+	if (base + plan->tail > avail)
+		return 0;
+
+	*size = (unsigned int)(base + plan->tail);
+	return 1;
+}
+
+static void
+format_elements(const plan_op_t *op, const byte *data, uint64 n, struct writer *w)
+{
+	value_u value;
+	char text[NUMERIC_MAX_CHARS + 32];
+	unsigned int j, size;
+	uint64 c;
+
+	size = numeric_size(op->type);
+
+	// character arrays are shown as strings up to the first null
+	if (op->type == Char8 || op->type == Char16)
+	{
+		put(w, "\"", 1);
+		for (j = 0; j < n && j < FORMAT_CHARS; j++)
+		{
+			c = read_integer(data + (size_t)j * size, op->type == Char8 ? Uint8 : Uint16, op->endianess);
+			if (!c)
+				break;
+			if (c == '"' || c == '\\')
+				put(w, "\\", 1);
+			text[0] = c >= 0x20 && c < 0x7f ? (char)c : '.';
+			put(w, text, 1);
+		}
+		if (j == FORMAT_CHARS && j < n)
+			put(w, "...", 3);
+		put(w, "\"", 1);
+		return;
+	}
+
+	put(w, "[", 1);
+	for (j = 0; j < n && j < FORMAT_ELEMENTS; j++)
+	{
+		if (j)
+			put(w, ", ", 2);
+		numeric_decode(data + (size_t)j * size, 1, op->type, op->endianess, &value);
+		put(w, text, numeric_format(&value, op->type, text));
+	}
+	if (n > FORMAT_ELEMENTS)
+		put(w, text, sprintf(text, ", ... (%llu)", (unsigned long long)n));
+	put(w, "]", 1);
+}
+
+static void
+put(struct writer *w, const char *s, size_t len)
+{
+	if (len > w->size - w->len)
+		len = w->size - w->len;
+
+	memcpy(w->out + w->len, s, len);
+	w->len += len;
+}
+
+static void
+puts_w(struct writer *w, const char *s)
+{
+	put(w, s, strlen(s));
+}
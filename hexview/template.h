@@ -0,0 +1,132 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stddef.h>
+
+#include "defs.h"
+#include "util.h"
+
+#define TEMPLATE_ERROR_SIZE 256
+
+enum
+{
+	OpValue,     // a single element
+	OpArray,     // a fixed number of elements
+	OpCounted,   // as many elements as an earlier field says
+	OpPrefixed   // as many elements as an integer stored just before them says
+};
+
+typedef struct plan_s plan_t;
+
+typedef struct plan_op_s plan_op_t;
+struct plan_op_s
+{
+	char *name;           // Name of the field, nested fields as "outer.inner" or "outer[1].inner".
+	unsigned int offset;  // Offset from the end of the last variable field, or the start of the record.
+	int type;             // Element type, Int8 to Char16, or -1 for a struct.
+	int endianess;        // Endianess of the elements.
+	int kind;             // OpValue, OpArray, OpCounted or OpPrefixed.
+	unsigned int count;   // Elements of OpArray, index of the count field of OpCounted or type of the count of OpPrefixed.
+	plan_t *sub;          // Plan of the elements when type is -1.
+};
+
+// A struct compiled to a flat list of fields at known offsets. Nested
+// structs of fixed size are flattened into their parent.
+struct plan_s
+{
+	char *name;
+	plan_op_t *ops;
+	unsigned int nops;
+	unsigned int size;       // Size of a record if every field is fixed, otherwise 0.
+	unsigned int tail;       // Bytes after the last variable field, or size.
+
+	uint64 *values;  // value of each integer field of the record being decoded
+};
+
+typedef struct template_s template_t;
+
+// Create an empty set of struct definitions.
+//
+// Returns:
+// The set, or NULL if memory could not be allocated.
+template_t *template_create();
+
+// Free a set of struct definitions.
+// Parameters:
+// - templates: The set to free, can be NULL.
+void template_free(template_t *templates);
+
+// Load struct definitions from a file into a set. A definition looks
+// like:
+//   struct name [big|little] {
+//       <type> <field>;
+//       <type> <field>[<count>|<field>|<integer type>] [big|little];
+//   }
+// where <type> is an element type as used by darr or an earlier struct.
+// A count which is an earlier field takes the value of that field, an
+// integer type is a count stored just before the elements. Definitions
+// may refer to those loaded earlier. If the file has an error, nothing
+// from it is added.
+// Parameters:
+// - templates: The set to add to.
+// - path: The file to load.
+// - error: Output parameter which will contain a message on failure.
+// - size: The number of characters error can hold.
+//
+// Returns:
+// The number of structs added, or -1 on failure.
+int template_load(template_t *templates, const char *path, char *const error, size_t size);
+
+// Find a struct by name.
+// Parameters:
+// - templates: The set to search.
+// - name: The name of the struct.
+//
+// Returns:
+// The compiled struct, or NULL if there is none with that name.
+plan_t *template_find(template_t *templates, const char *name);
+
+// Get a struct of a set by position, to list them.
+// Parameters:
+// - templates: The set.
+// - index: The position, from 0 in the order they were loaded.
+//
+// Returns:
+// The compiled struct, or NULL if index is past the end.
+plan_t *template_at(template_t *templates, unsigned int index);
+
+// Returns the size of the record at data, or 0 if it does not fit in
+// avail bytes.
+unsigned int template_measure(plan_t *plan, const byte *data, unsigned int avail);
+
+// Decode every single element field of fixed size records into columns,
+// one field at a time across all records.
+// Parameters:
+// - plan: The struct, which must have a fixed size.
+// - data: The first record.
+// - count: The number of records, all of which must be in bounds.
+// - columns: Output parameter, nops * count values. The value of field
+//            i of record r is at columns[i * count + r]. Fields which
+//            are not single elements are left untouched.
+void template_columns(plan_t *plan, const byte *data, unsigned int count, value_u *const columns);
+
+// Format a record as "field=value" pairs.
+// Parameters:
+// - plan: The struct.
+// - data: The record.
+// - avail: The number of bytes data points to.
+// - columns: Values decoded by template_columns for a fixed size struct,
+//            or NULL to decode as the record is formatted.
+// - stride: The number of records in columns.
+// - record: The index of the record in columns.
+// - sep: Separator between fields.
+// - out: Destination buffer. Text past its end is cut off.
+// - size: The number of characters out can hold.
+// - len: Output parameter which will contain the number of characters
+//        written to out, not null terminated.
+//
+// Returns:
+// The size of the record, or 0 if it does not fit in avail bytes.
+unsigned int template_format(plan_t *plan, const byte *data, unsigned int avail, const value_u *columns, unsigned int stride, unsigned int record, const char *sep, char *const out, size_t size, size_t *const len);
+
+#endif
@@ -0,0 +1,122 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#if _WIN32
+#include <Windows.h>
+#elif __linux__ || __APPLE__
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Arguments passed to a spawned thread
+struct thread_start
+{
+	thread_fn proc;
+	void *arg;
+};
+
+#if _WIN32
+static DWORD WINAPI
+thread_entry(LPVOID param)
+{
+	struct thread_start *start = param;
+	start->proc(start->arg);
+	return 0;
+}
+#elif __linux__ || __APPLE__
+static void *
+thread_entry(void *param)
+{
+	struct thread_start *start = param;
+	start->proc(start->arg);
+	return NULL;
+}
+#endif
+
+int
+cpu_count()
+{
+	static int count = 0;
+#if _WIN32
+	SYSTEM_INFO sysinfo;
+#endif
+
+	if (count)
+		return count;
+
+#if _WIN32
+	GetSystemInfo(&sysinfo);
+	count = sysinfo.dwNumberOfProcessors;
+#elif __linux__ || __APPLE__
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if (count < 1)
+		count = 1;
+	return count;
+}
+
+void
+run_parallel(thread_fn proc, void *args, int count, int argsize)
+{
+	struct thread_start *starts;
+	int i;
+	int *started;
+#if _WIN32
+	HANDLE *threads;
+#elif __linux__ || __APPLE__
+	pthread_t *threads;
+#endif
+
+	if (count <= 0)
+		return;
+
+	starts = malloc(count * sizeof(struct thread_start));
+	threads = malloc(count * sizeof(*threads));
+	started = calloc(count, sizeof(int));
+	if (!starts || !threads || !started)
+	{
+		// fall back to running everything on this thread
+		free(starts);
+		free(threads);
+		free(started);
+		for (i = 0; i < count; i++)
+			proc((char *)args + i * argsize);
+		return;
+	}
+
+	for (i = 1; i < count; i++)
+	{
+		starts[i].proc = proc;
+		starts[i].arg = (char *)args + i * argsize;
+#if _WIN32
+		threads[i] = CreateThread(NULL, 0, &thread_entry, &starts[i], 0, NULL);
+		started[i] = threads[i] != NULL;
+#elif __linux__ || __APPLE__
+		started[i] = !pthread_create(&threads[i], NULL, &thread_entry, &starts[i]);
+#endif
+
+		// could not spawn, do the work here instead
+		if (!started[i])
+			proc(starts[i].arg);
+	}
+
+	proc(args);
+
+	for (i = 1; i < count; i++)
+	{
+		if (!started[i])
+			continue;
+#if _WIN32
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+#elif __linux__ || __APPLE__
+		pthread_join(threads[i], NULL);
+#endif
+	}
+
+	free(starts);
+	free(threads);
+	free(started);
+}
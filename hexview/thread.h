@@ -0,0 +1,21 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+typedef void(*thread_fn)(void *arg);
+
+// Returns the number of logical processors avaliable to the process.
+// Always at least 1.
+int cpu_count();
+
+// Run a function on an array of arguments in parallel, one thread per
+// argument. The calling thread runs the first argument itself. Returns
+// once all have finished.
+// Parameters:
+// - proc: The function to run.
+// - args: Array of count arguments, each argsize bytes long. proc is
+//         passed a pointer to its element.
+// - count: The number of elements in args.
+// - argsize: The size of a single element in args.
+void run_parallel(thread_fn proc, void *args, int count, int argsize);
+
+#endif
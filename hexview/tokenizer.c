@@ -278,7 +278,7 @@ builder_append_char(struct string_builder *builder, char append)
 	if (nlen > builder->cap)
 	{
 		ncap = builder->cap * 2;
-		nbuf = realloc(builder->string, nlen);
+		nbuf = realloc(builder->string, ncap);
 		if (!nbuf)
 			return 0;
 		builder->string = nbuf;
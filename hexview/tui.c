@@ -0,0 +1,705 @@
+#include "tui.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minimap.h"
+#include "render.h"
+
+#if _WIN32
+#include <Windows.h>
+
+struct term_state
+{
+	HANDLE hIn, hOut;
+	DWORD dwInMode, dwOutMode;
+};
+
+#elif __linux__ || __APPLE__
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+
+struct term_state
+{
+	struct termios termios;
+	struct sigaction winch;
+};
+#endif
+
+#define MIN_WIDTH 8
+#define MAX_WIDTH 64
+#define MAX_KEYS 64
+#define PANEL_COLUMNS 16          // minimap cells on each line
+#define PANEL_GAP 2               // columns between the bytes and the minimap
+#define MIN_PANEL_WIDTH 16        // narrowest row of bytes shown beside the minimap
+#define REFINE_STEP_SIZE (16 << 20)  // bytes of the minimap refined between polls for keys
+#define INVALID_LINE ((size_t)-1)
+
+#define ENTER_SCREEN "\033[?1049h\033[?25l\033[?7l\033[?1000h\033[?1006h\033[2J"
+#define LEAVE_SCREEN "\033[?1006l\033[?1000l\033[?7h\033[?25h\033[?1049l"
+#define STATUS_COLOR "\033[7m"
+#define RESET_COLOR "\033[m"
+
+enum
+{
+	KeyQuit,
+	KeyUp,
+	KeyDown,
+	KeyPageUp,
+	KeyPageDown,
+	KeyHome,
+	KeyEnd,
+	KeyNextClass,
+	KeyPrevClass,
+	KeyClick
+};
+
+struct key
+{
+	int code;
+	unsigned int x, y;  // where a click was, from 0
+};
+
+// What is on the terminal, used to redraw only what changed
+struct screen
+{
+	unsigned int rows;   // height of the terminal
+	unsigned int cols;   // width of the terminal
+	unsigned int lines;  // rows of bytes, between the header and the status line
+	unsigned int width;  // bytes in each row
+
+	char **text;       // each terminal line as last drawn
+	size_t *len;       // length of each line in text, INVALID_LINE if unknown
+	size_t linecap;    // characters each line in text can hold
+	char *line;        // scratch line being rendered
+
+	char *out;         // escapes and text of the frame being drawn
+	size_t outlen;
+	size_t outcap;
+
+	minimap_t *map;        // minimap of the file, NULL if the terminal is too narrow
+	unsigned int panel;    // column of the minimap
+	char **side;           // minimap part of each line as last drawn
+	size_t *sidelen;       // length of each line in side, INVALID_LINE if unknown
+};
+
+static int term_enter(struct term_state *const saved);
+static void term_leave(const struct term_state *saved);
+static int read_keys(struct key *const keys, int max, int wait);
+
+static int screen_setup(struct screen *scr, file_t *file, unsigned int rows, unsigned int cols);
+static void screen_free(struct screen *scr);
+static void screen_scroll(struct screen *scr, int delta);
+static void screen_move(struct screen *scr, unsigned int from, unsigned int to);
+static void screen_forget(struct screen *scr, unsigned int y);
+static void screen_put(struct screen *scr, unsigned int y, const char *text, size_t len);
+static void screen_put_side(struct screen *scr, unsigned int y, const char *text, size_t len);
+static void draw(struct screen *scr, file_t *file, unsigned int top);
+static unsigned int jump_class(const minimap_t *map, unsigned int top, int forward);
+
+int
+tui_run(file_t *file, unsigned int *const off)
+{
+	struct term_state saved;
+	struct screen scr;
+	struct key keys[MAX_KEYS];
+	unsigned int rows, cols;
+	unsigned int top, prevtop, page, lastrow, maxtop, cell, step;
+	int nkeys, i, quit, refined;
+	int64 delta;
+
+	if (!term_enter(&saved))
+		return 0;
+
+	memset(&scr, 0, sizeof(scr));
+	render_write(ENTER_SCREEN, sizeof(ENTER_SCREEN) - 1);
+
+	top = *off;
+	prevtop = top;
+	quit = 0;
+	while (!quit)
+	{
+		// a resize invalidates everything on screen
+		render_term_size(&rows, &cols);
+		if (rows != scr.rows || cols != scr.cols)
+		{
+			if (!screen_setup(&scr, file, rows, cols))
+				break;
+			render_write("\033[2J", 4);
+			top -= top % scr.width;
+			prevtop = top;
+		}
+
+		page = scr.lines * scr.width;
+		lastrow = (file->size - 1) / scr.width * scr.width;
+		maxtop = lastrow > page - scr.width ? lastrow - (page - scr.width) : 0;
+		if (top > maxtop)
+			top = maxtop;
+
+		// move what is already on screen with the terminal's own scrolling
+		delta = ((int64)top - (int64)prevtop) / (int64)scr.width;
+		if (delta && (delta < 0 ? -delta : delta) < scr.lines)
+			screen_scroll(&scr, (int)delta);
+		prevtop = top;
+
+		draw(&scr, file, top);
+
+		// the neighbouring screens are read in the background
+		file_prefetch(file, top + page, page);
+		file_prefetch(file, top > page ? top - page : 0, top > page ? page : top);
+
+		// refine the minimap a step at a time while no key is waiting
+		refined = !scr.map || scr.map->refined == scr.map->count;
+		if (!refined)
+		{
+			step = REFINE_STEP_SIZE / scr.map->cell_size;
+			minimap_refine(scr.map, file->data, file->size, step ? step : 1);
+		}
+
+		nkeys = read_keys(keys, MAX_KEYS, refined);
+		for (i = 0; i < nkeys && !quit; i++)
+		{
+			switch (keys[i].code)
+			{
+			case KeyQuit:
+				quit = 1;
+				break;
+			case KeyUp:
+				top = top > scr.width ? top - scr.width : 0;
+				break;
+			case KeyDown:
+				top = top + scr.width <= maxtop ? top + scr.width : maxtop;
+				break;
+			case KeyPageUp:
+				top = top > page ? top - page : 0;
+				break;
+			case KeyPageDown:
+				top = top + page <= maxtop ? top + page : maxtop;
+				break;
+			case KeyHome:
+				top = 0;
+				break;
+			case KeyEnd:
+				top = maxtop;
+				break;
+			case KeyNextClass:
+			case KeyPrevClass:
+				if (scr.map)
+					top = jump_class(scr.map, top, keys[i].code == KeyNextClass);
+				break;
+			case KeyClick:
+				// a click on the minimap jumps to its cell
+				if (!scr.map || keys[i].x < scr.panel || keys[i].x >= scr.panel + PANEL_COLUMNS)
+					break;
+				if (keys[i].y < 1 || keys[i].y > scr.lines)
+					break;
+				cell = (keys[i].y - 1) * PANEL_COLUMNS + keys[i].x - scr.panel;
+				if (cell < scr.map->count)
+					top = cell * scr.map->cell_size;
+				break;
+			}
+			top -= top % scr.width;
+			if (top > maxtop)
+				top = maxtop;
+		}
+	}
+
+	render_write(LEAVE_SCREEN, sizeof(LEAVE_SCREEN) - 1);
+	term_leave(&saved);
+	screen_free(&scr);
+
+	*off = top;
+	return 1;
+}
+
+// Size the screen for the terminal, choosing the widest row which fits.
+// The minimap is only shown if rows can stay reasonably wide beside it.
+static int
+screen_setup(struct screen *scr, file_t *file, unsigned int rows, unsigned int cols)
+{
+	unsigned int width, i;
+
+	screen_free(scr);
+
+	if (rows < 3)
+		rows = 3;
+
+	// "0x00000000 " + " xx" per byte + "   " + a character per byte
+	width = cols > 14 + PANEL_GAP + PANEL_COLUMNS ? (cols - 14 - PANEL_GAP - PANEL_COLUMNS) / 4 : 0;
+	if (width >= MIN_PANEL_WIDTH)
+		scr->panel = 1;
+	else
+		width = cols > 14 ? (cols - 14) / 4 : 0;
+
+	width -= width % MIN_WIDTH;
+	if (width < MIN_WIDTH)
+		width = MIN_WIDTH;
+	if (width > MAX_WIDTH)
+		width = MAX_WIDTH;
+
+	scr->rows = rows;
+	scr->cols = cols;
+	scr->lines = rows - 2;
+	scr->width = width;
+
+	scr->linecap = render_peek_size(1, width);
+	if (scr->linecap < (size_t)cols + 32)
+		scr->linecap = (size_t)cols + 32;
+	if (scr->linecap < render_map_size(PANEL_COLUMNS))
+		scr->linecap = render_map_size(PANEL_COLUMNS);
+	scr->outcap = (scr->linecap + 32) * rows * (scr->panel ? 2 : 1) + 64;
+
+	scr->text = calloc(rows, sizeof(char *));
+	scr->len = malloc(rows * sizeof(size_t));
+	scr->line = malloc(scr->linecap);
+	scr->out = malloc(scr->outcap);
+	if (!scr->text || !scr->len || !scr->line || !scr->out)
+	{
+		screen_free(scr);
+		return 0;
+	}
+
+	for (i = 0; i < rows; i++)
+	{
+		scr->len[i] = INVALID_LINE;
+		scr->text[i] = malloc(scr->linecap);
+		if (!scr->text[i])
+		{
+			screen_free(scr);
+			return 0;
+		}
+	}
+
+	// the minimap is optional, the bytes are shown without it if memory is short
+	if (scr->panel)
+	{
+		scr->panel = 14 + 4 * width + PANEL_GAP;
+		scr->map = minimap_create(file->size, scr->lines * PANEL_COLUMNS);
+		scr->side = calloc(rows, sizeof(char *));
+		scr->sidelen = malloc(rows * sizeof(size_t));
+		for (i = 0; scr->map && scr->side && scr->sidelen && i < rows; i++)
+		{
+			scr->sidelen[i] = INVALID_LINE;
+			scr->side[i] = malloc(render_map_size(PANEL_COLUMNS));
+			if (!scr->side[i])
+				break;
+		}
+
+		if (i < rows)
+		{
+			for (i = 0; scr->side && i < rows; i++)
+				free(scr->side[i]);
+			free(scr->side);
+			free(scr->sidelen);
+			minimap_free(scr->map);
+			scr->side = NULL;
+			scr->sidelen = NULL;
+			scr->map = NULL;
+		}
+		else
+			minimap_sample(scr->map, file->data, file->size);
+	}
+
+	return 1;
+}
+
+static void
+screen_free(struct screen *scr)
+{
+	unsigned int i;
+
+	if (scr->text)
+	{
+		for (i = 0; i < scr->rows; i++)
+			free(scr->text[i]);
+	}
+
+	if (scr->side)
+	{
+		for (i = 0; i < scr->rows; i++)
+			free(scr->side[i]);
+	}
+
+	free(scr->side);
+	free(scr->sidelen);
+	minimap_free(scr->map);
+
+	free(scr->text);
+	free(scr->len);
+	free(scr->line);
+	free(scr->out);
+	memset(scr, 0, sizeof(struct screen));
+}
+
+// Scroll the rows of bytes by delta rows, positive moving the content
+// up. The rows scrolled in are left to be drawn.
+static void
+screen_scroll(struct screen *scr, int delta)
+{
+	char cmd[32];
+	unsigned int i, n, from;
+	int len;
+
+	n = delta < 0 ? -delta : delta;
+
+	// restrict scrolling to the rows of bytes, lines 2 to lines + 1
+	len = snprintf(cmd, sizeof(cmd), "\033[2;%ur\033[%u%c\033[r", scr->lines + 1, n, delta > 0 ? 'S' : 'T');
+	render_write(cmd, len);
+
+	// rotate the remembered lines the same way, text buffers are reused
+	if (delta > 0)
+	{
+		for (i = 1; i <= scr->lines; i++)
+		{
+			from = i + n;
+			if (from <= scr->lines)
+				screen_move(scr, from, i);
+			else
+				screen_forget(scr, i);
+		}
+	}
+	else
+	{
+		for (i = scr->lines; i >= 1; i--)
+		{
+			if (i > n)
+				screen_move(scr, i - n, i);
+			else
+				screen_forget(scr, i);
+		}
+	}
+}
+
+// Remember that a line moved, text buffers are swapped rather than copied
+static void
+screen_move(struct screen *scr, unsigned int from, unsigned int to)
+{
+	char *tmp;
+
+	tmp = scr->text[to];
+	scr->text[to] = scr->text[from];
+	scr->text[from] = tmp;
+	scr->len[to] = scr->len[from];
+
+	if (scr->side)
+	{
+		tmp = scr->side[to];
+		scr->side[to] = scr->side[from];
+		scr->side[from] = tmp;
+		scr->sidelen[to] = scr->sidelen[from];
+	}
+}
+
+// Forget what is on a line, so it is drawn again
+static void
+screen_forget(struct screen *scr, unsigned int y)
+{
+	scr->len[y] = INVALID_LINE;
+	if (scr->side)
+		scr->sidelen[y] = INVALID_LINE;
+}
+
+// Queue a line of the frame if it differs from what is on screen
+static void
+screen_put(struct screen *scr, unsigned int y, const char *text, size_t len)
+{
+	int n;
+
+	if (scr->len[y] == len && !memcmp(scr->text[y], text, len))
+		return;
+
+	n = snprintf(scr->out + scr->outlen, scr->outcap - scr->outlen, "\033[%u;1H", y + 1);
+	scr->outlen += n;
+	memcpy(scr->out + scr->outlen, text, len);
+	scr->outlen += len;
+	memcpy(scr->out + scr->outlen, "\033[K", 3);
+	scr->outlen += 3;
+
+	memcpy(scr->text[y], text, len);
+	scr->len[y] = len;
+
+	// the minimap on this line was erased
+	if (scr->side)
+		scr->sidelen[y] = INVALID_LINE;
+}
+
+// Queue the minimap part of a line if it differs from what is on screen
+static void
+screen_put_side(struct screen *scr, unsigned int y, const char *text, size_t len)
+{
+	int n;
+
+	if (scr->sidelen[y] == len && !memcmp(scr->side[y], text, len))
+		return;
+
+	n = snprintf(scr->out + scr->outlen, scr->outcap - scr->outlen, "\033[%u;%uH", y + 1, scr->panel + 1);
+	scr->outlen += n;
+	memcpy(scr->out + scr->outlen, text, len);
+	scr->outlen += len;
+
+	memcpy(scr->side[y], text, len);
+	scr->sidelen[y] = len;
+}
+
+// Build the frame for the given top offset and write only the lines
+// which changed, with a single write
+static void
+draw(struct screen *scr, file_t *file, unsigned int top)
+{
+	unsigned int y, at, percent, cell, mark, mark_end, count;
+	size_t len;
+
+	scr->outlen = 0;
+
+	len = render_peek_header(scr->width, 1, scr->line);
+	screen_put(scr, 0, scr->line, len);
+
+	for (y = 1; y <= scr->lines; y++)
+	{
+		at = top + (y - 1) * scr->width;
+		if (at < file->size && at >= top)
+			len = render_peek_row(file->data, file->size, at, scr->width, 1, scr->line);
+		else
+			len = 0;
+		screen_put(scr, y, scr->line, len);
+	}
+
+	// cells of the minimap covering the screen are marked
+	if (scr->map)
+	{
+		mark = minimap_cell(scr->map, top);
+		at = top + scr->lines * scr->width - 1;
+		mark_end = minimap_cell(scr->map, at > top && at < file->size ? at : file->size - 1) + 1;
+
+		for (y = 1; y <= scr->lines; y++)
+		{
+			cell = (y - 1) * PANEL_COLUMNS;
+			count = cell < scr->map->count ? scr->map->count - cell : 0;
+			if (count > PANEL_COLUMNS)
+				count = PANEL_COLUMNS;
+			len = render_map_row(scr->map->cells + cell, count, mark > cell ? mark - cell : 0, mark_end > cell ? mark_end - cell : 0, scr->line);
+			screen_put_side(scr, y, scr->line, len);
+		}
+	}
+
+	percent = (unsigned int)((uint64)(top + scr->lines * scr->width < file->size ? top + scr->lines * scr->width : file->size) * 100 / file->size);
+	len = snprintf(scr->line, scr->linecap, STATUS_COLOR " 0x%08x / 0x%08x %3u%%  q quit  j/k up/down  space/b page  g/G start/end%s %*s" RESET_COLOR,
+		top, file->size, percent, scr->map ? "  [/] map" : "", scr->cols > 80 ? scr->cols - 80 : 0, "");
+	screen_put(scr, scr->rows - 1, scr->line, len);
+
+	if (scr->outlen)
+		render_write(scr->out, scr->outlen);
+}
+
+// The offset of the next or previous run of minimap cells of the same
+// class, from the cell at top
+static unsigned int
+jump_class(const minimap_t *map, unsigned int top, int forward)
+{
+	unsigned int cell;
+	byte class;
+
+	cell = minimap_cell(map, top);
+	class = map->cells[cell];
+
+	if (forward)
+	{
+		while (cell + 1 < map->count && map->cells[cell] == class)
+			cell++;
+		return map->cells[cell] == class ? top : cell * map->cell_size;
+	}
+
+	// back to the start of this run, then to the start of the one before
+	while (cell > 0 && map->cells[cell - 1] == class)
+		cell--;
+	if (cell > 0)
+	{
+		class = map->cells[--cell];
+		while (cell > 0 && map->cells[cell - 1] == class)
+			cell--;
+	}
+	return cell * map->cell_size;
+}
+
+#if _WIN32
+
+static int
+term_enter(struct term_state *const saved)
+{
+	saved->hIn = GetStdHandle(STD_INPUT_HANDLE);
+	saved->hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+	if (!GetConsoleMode(saved->hIn, &saved->dwInMode) || !GetConsoleMode(saved->hOut, &saved->dwOutMode))
+		return 0;
+
+	SetConsoleMode(saved->hIn, ENABLE_VIRTUAL_TERMINAL_INPUT);
+	SetConsoleMode(saved->hOut, saved->dwOutMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+	return 1;
+}
+
+static void
+term_leave(const struct term_state *saved)
+{
+	SetConsoleMode(saved->hIn, saved->dwInMode);
+	SetConsoleMode(saved->hOut, saved->dwOutMode);
+}
+
+#elif __linux__ || __APPLE__
+
+// Does nothing, it is installed so a resize interrupts the read for
+// keys and the loop polls render_term_size for the new size
+static void
+on_resize(int sig)
+{
+	(void)sig;
+}
+
+static int
+term_enter(struct term_state *const saved)
+{
+	struct termios raw;
+	struct sigaction sa;
+
+	if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &saved->termios))
+		return 0;
+
+	raw = saved->termios;
+	raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+	raw.c_iflag &= ~(IXON | ICRNL);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	// without SA_RESTART a resize interrupts the read for keys
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = &on_resize;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, &saved->winch);
+
+	return 1;
+}
+
+static void
+term_leave(const struct term_state *saved)
+{
+	sigaction(SIGWINCH, &saved->winch, NULL);
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved->termios);
+}
+
+#endif
+
+// Read whatever keys are waiting. If wait is nonzero, at least one
+// unless interrupted by a resize, otherwise none if nothing is waiting.
+// Held keys arrive together and are handled before the next frame is
+// drawn.
+static int
+read_keys(struct key *const keys, int max, int wait)
+{
+	unsigned char buf[MAX_KEYS * 4];
+	unsigned int x, y;
+	int n, i, count;
+#if _WIN32
+	DWORD dwRead;
+
+	if (!wait && WaitForSingleObject(GetStdHandle(STD_INPUT_HANDLE), 0) != WAIT_OBJECT_0)
+		return 0;
+	if (!ReadFile(GetStdHandle(STD_INPUT_HANDLE), buf, sizeof(buf), &dwRead, NULL))
+		return 0;
+	n = (int)dwRead;
+#elif __linux__ || __APPLE__
+	struct pollfd pfd;
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	if (!wait && poll(&pfd, 1, 0) <= 0)
+		return 0;
+	n = (int)read(STDIN_FILENO, buf, sizeof(buf));
+	if (n < 0)
+		return 0;
+#endif
+
+	// end of input ends the session
+	if (n == 0)
+	{
+		keys[0].code = KeyQuit;
+		return 1;
+	}
+
+	count = 0;
+	for (i = 0; i < n && count < max; i++)
+	{
+		// mouse reports, "\033[<button;x;yM" with positions from 1
+		if (buf[i] == 0x1b && i + 2 < n && buf[i + 1] == '[' && buf[i + 2] == '<')
+		{
+			keys[count].code = -1;
+			for (i += 3; i < n && buf[i] != ';'; i++)
+			{
+				if (buf[i] != '0')
+					keys[count].code = -2;
+			}
+			for (x = 0, i++; i < n && buf[i] >= '0' && buf[i] <= '9'; i++)
+				x = x * 10 + buf[i] - '0';
+			for (y = 0, i++; i < n && buf[i] >= '0' && buf[i] <= '9'; i++)
+				y = y * 10 + buf[i] - '0';
+
+			// only presses of the first button, not releases or other buttons
+			if (i < n && buf[i] == 'M' && keys[count].code == -1 && x && y)
+			{
+				keys[count].code = KeyClick;
+				keys[count].x = x - 1;
+				keys[count].y = y - 1;
+				count++;
+			}
+			continue;
+		}
+
+		keys[count].x = 0;
+		keys[count].y = 0;
+		if (buf[i] == 0x1b && i + 2 < n && (buf[i + 1] == '[' || buf[i + 1] == 'O'))
+		{
+			i += 2;
+			switch (buf[i])
+			{
+			case 'A': keys[count++].code = KeyUp; break;
+			case 'B': keys[count++].code = KeyDown; break;
+			case 'H': keys[count++].code = KeyHome; break;
+			case 'F': keys[count++].code = KeyEnd; break;
+			case '1': case '4': case '5': case '6': case '7': case '8':
+				// "\033[5~" and friends
+				if (i + 1 < n && buf[i + 1] == '~')
+				{
+					switch (buf[i])
+					{
+					case '1': case '7': keys[count++].code = KeyHome; break;
+					case '4': case '8': keys[count++].code = KeyEnd; break;
+					case '5': keys[count++].code = KeyPageUp; break;
+					case '6': keys[count++].code = KeyPageDown; break;
+					}
+					i++;
+				}
+				break;
+			}
+			continue;
+		}
+
+		switch (buf[i])
+		{
+		case 'q': case 'Q': case 0x1b: case 0x03:
+			keys[count++].code = KeyQuit;
+			break;
+		case 'k': keys[count++].code = KeyUp; break;
+		case 'j': case '\r': case '\n': keys[count++].code = KeyDown; break;
+		case 'b': keys[count++].code = KeyPageUp; break;
+		case ' ': case 'f': keys[count++].code = KeyPageDown; break;
+		case 'g': keys[count++].code = KeyHome; break;
+		case 'G': keys[count++].code = KeyEnd; break;
+		case ']': keys[count++].code = KeyNextClass; break;
+		case '[': keys[count++].code = KeyPrevClass; break;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,19 @@
+#ifndef TUI_H
+#define TUI_H
+
+#include "file.h"
+
+// Browse a file full screen until the user quits. The terminal is put
+// into raw mode and the alternate screen, and both are restored before
+// returning. Only rows which changed since the last frame are redrawn,
+// and the screens before and after the visible one are prefetched.
+// Parameters:
+// - file: The file to browse.
+// - off: The offset to start at. On return, the offset of the first
+//        byte on screen.
+//
+// Returns:
+// Nonzero on success, or 0 if stdin or stdout is not a terminal.
+int tui_run(file_t *file, unsigned int *const off);
+
+#endif
@@ -8,6 +8,11 @@
 #if _WIN32
 #include <Windows.h>
 #elif __linux__ || __APPLE__
+#include <time.h>
+#endif
+
+#if HAVE_SSE2 && !_MSC_VER
+#include <cpuid.h>
 #endif
 
 struct alist_node
@@ -119,21 +124,90 @@ to_native_endianess(const value_u *in, int max_read, int endianess, outvalues_t
 #endif
 }
 
+int
+cpu_features()
+{
+	static int features = -1;
+	unsigned int regs[4];  // eax, ebx, ecx, edx
+	unsigned int xcr0;
+	int result;
+
+	if (features != -1)
+		return features;
+
+	result = 0;
+#if HAVE_SSE2
+#if _MSC_VER
+	__cpuid((int *)regs, 1);
+#else
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	if (regs[2] & (1 << 9)) result |= CpuSsse3;
+	if (regs[2] & (1 << 19)) result |= CpuSse41;
+	if (regs[2] & (1 << 20)) result |= CpuSse42;
+	if (regs[2] & (1 << 1)) result |= CpuPclmul;
+
+	// AVX state must also be enabled by the OS
+	xcr0 = 0;
+	if (regs[2] & (1 << 27))
+	{
+#if _MSC_VER
+		xcr0 = (unsigned int)_xgetbv(0);
+#else
+		__asm__ ("xgetbv" : "=a"(xcr0) : "c"(0) : "edx");
+#endif
+	}
+
+#if _MSC_VER
+	__cpuidex((int *)regs, 7, 0);
+#else
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	if ((regs[1] & (1 << 5)) && (xcr0 & 6) == 6) result |= CpuAvx2;
+	if (regs[1] & (1 << 29)) result |= CpuSha;
+#endif
+
+	features = result;
+	return features;
+}
+
+double
+time_now()
+{
+#if _WIN32
+	LARGE_INTEGER counter, frequency;
+
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#elif __linux__ || __APPLE__
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
 int
 readline(char *const out, int maxcount)
 {
-	char c;
+	int c;
 	int off;
 
-	for (off = 0; off < maxcount; off++)
+	for (off = 0; off < maxcount - 1; off++)
 	{
 		c = fgetc(stdin);
-		if (c == '\n')
-		{
-			out[off] = 0;
+		if (c == EOF && !off)
+			return -1;
+		if (c == '\n' || c == EOF)
 			break;
-		}
-		out[off] = c;
+		out[off] = (char)c;
+	}
+	out[off] = 0;
+
+	if (off == maxcount - 1)
+	{
+		for (c = fgetc(stdin); c != '\n' && c != EOF; c = fgetc(stdin));
 	}
 
 	return off;
@@ -224,11 +298,24 @@ alist_find(alist_t *alist, akey_t key)
 	return node ? &node->value : NULL;
 }
 
+void
+alist_foreach(alist_t *alist, visit_fn visit, void *user)
+{
+	struct alist_node *node;
+
+	for (node = alist->front; node; node = node->next)
+		visit(node->key, node->value, user);
+}
+
 void
 alist_free(alist_t *alist)
 {
-	if (alist)
+	if (!alist)
+		return;
+
+	if (alist->front)
 		alist_free_node(alist, alist->front);
+	free(alist);
 }
 
 void
@@ -3,6 +3,10 @@
 
 #include "defs.h"
 
+#if _MSC_VER
+#include <intrin.h>
+#endif
+
 typedef void *akey_t;
 typedef void *avalue_t;
 
@@ -14,9 +18,21 @@ typedef void *avalue_t;
 
 typedef struct alist_s alist_t;
 
+// Instruction set extensions reported by cpu_features
+enum
+{
+	CpuSsse3 = 1 << 0,
+	CpuSse41 = 1 << 1,
+	CpuSse42 = 1 << 2,
+	CpuPclmul = 1 << 3,
+	CpuAvx2 = 1 << 4,
+	CpuSha = 1 << 5
+};
+
 typedef int(*compare_fn)(void *first, void *second);
 typedef void *(*copy_fn)(void *val);
 typedef void(*free_fn)(void *val);
+typedef void(*visit_fn)(akey_t key, avalue_t value, void *user);
 
 typedef union value_u value_u;
 union value_u
@@ -78,6 +94,35 @@ uint32 swap_endianess32(uint32 num);
 
 uint64 swap_endianess64(uint64 num);
 
+// Returns the index of the lowest set bit in num. num must be nonzero.
+static inline int
+lowest_bit64(uint64 num)
+{
+#if _MSC_VER
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)num))
+		return index;
+	_BitScanForward(&index, (unsigned long)(num >> 32));
+	return index + 32;
+#else
+	return __builtin_ctzll(num);
+#endif
+}
+
+// Returns the number of set bits in num.
+static inline int
+popcount64(uint64 num)
+{
+#if _MSC_VER
+	num = num - ((num >> 1) & 0x5555555555555555ULL);
+	num = (num & 0x3333333333333333ULL) + ((num >> 2) & 0x3333333333333333ULL);
+	num = (num + (num >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((num * 0x0101010101010101ULL) >> 56);
+#else
+	return __builtin_popcountll(num);
+#endif
+}
+
 // Convert data to the system's native endianess.
 // Parameters:
 // - in: Values to convert.
@@ -89,13 +134,23 @@ uint64 swap_endianess64(uint64 num);
 // Number of bytes written to out.
 int to_native_endianess(const value_u *in, int max_read, int endianess, outvalues_t *const out);
 
-// Read a line from stdin.
+// Returns a bitmask of the instruction set extensions supported by the
+// processor, see CpuSsse3 and friends. Always 0 on non-x86 targets.
+int cpu_features();
+
+// Returns a monotonic timestamp in seconds, for measuring elapsed time.
+double time_now();
+
+// Read a line from stdin. The rest of a line longer than out can hold
+// is read and dropped, so it is not taken for the next line.
 // Parameters:
 // - out: Destination string.
-// - maxcount: Maximum number of characters to read from stdin.
+// - maxcount: Maximum number of characters to store in out, including
+//             the null terminator.
 //
 // Returns:
-// The length of the string stored in out on return.
+// The length of the string stored in out on return, or -1 at the end
+// of the input.
 int readline(char *const out, int maxcount);
 
 // Returns whether two strings are case-insensitively equal.
@@ -142,6 +197,14 @@ void alist_insert(alist_t *alist, akey_t key, avalue_t value);
 // no such pairing exists.
 avalue_t *alist_find(alist_t *alist, akey_t key);
 
+// Calls a function on every pairing in an associative list, most
+// recently inserted first.
+// Parameters:
+// - alist: The list to visit.
+// - visit: The function to call with each key and value.
+// - user: Passed through to visit.
+void alist_foreach(alist_t *alist, visit_fn visit, void *user);
+
 // Frees an alist_t allocated with alist_create.
 // Parameters:
 // - alist: The list to free, can be NULL.